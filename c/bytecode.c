@@ -0,0 +1,757 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "util.h"
+#include "vm.h"
+
+#ifdef I_WIN
+#   include <process.h>
+#   define getpid _getpid
+#else
+#   include <unistd.h>
+#endif
+
+typedef enum {
+    CONSTANT_VALUE,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+} ConstantType;
+
+typedef struct {
+    uint8_t *bytes;
+    size_t count;
+    size_t capacity;
+    bool failed; // Something the format can't hold, the cache isn't written.
+} Writer;
+
+typedef struct {
+    const uint8_t *at;
+    const uint8_t *end;
+    bool failed; // Ran past the end of the file, the cache is ignored.
+    bool readOnly; // A program, which VMs on other threads may be running at the same time.
+} Reader;
+
+static void writeBytes(Writer *writer, const void *bytes, const size_t count) {
+    if (writer->capacity < writer->count + count) {
+        while (writer->capacity < writer->count + count) {
+            writer->capacity = GROW_CAPACITY(writer->capacity);
+        }
+
+        writer->bytes = (uint8_t*)realloc(writer->bytes, writer->capacity);
+        if (writer->bytes == NULL) {
+            exit(69);
+        }
+    }
+
+    memcpy(writer->bytes + writer->count, bytes, count);
+    writer->count += count;
+}
+
+static void writeByte(Writer *writer, const uint8_t byte) {
+    writeBytes(writer, &byte, 1);
+}
+
+static void writeInt(Writer *writer, const int32_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeLong(Writer *writer, const uint64_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeString(Writer *writer, const ObjString *string) {
+    if (string == NULL) {
+        writeInt(writer, -1);
+        return;
+    }
+
+    if (string->str == NULL) {
+        writer->failed = true;
+        return;
+    }
+
+    writeInt(writer, string->len);
+    writeBytes(writer, string->str, string->len);
+}
+
+static const uint8_t *readBytes(Reader *reader, const size_t count) {
+    if (reader->failed || (size_t)(reader->end - reader->at) < count) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const uint8_t *bytes = reader->at;
+    reader->at += count;
+    return bytes;
+}
+
+static uint8_t readByte(Reader *reader) {
+    const uint8_t *bytes = readBytes(reader, 1);
+    return bytes == NULL ? 0 : bytes[0];
+}
+
+static int32_t readInt(Reader *reader) {
+    int32_t value = 0;
+    const uint8_t *bytes = readBytes(reader, sizeof(value));
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+
+    return value;
+}
+
+static uint64_t readLong(Reader *reader) {
+    uint64_t value = 0;
+    const uint8_t *bytes = readBytes(reader, sizeof(value));
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+
+    return value;
+}
+
+// A NULL result is either a NULL string or a failed read, check reader->failed.
+static ObjString *readString(Reader *reader, VM *vm) {
+    const int32_t len = readInt(reader);
+    if (len < 0) {
+        return NULL;
+    }
+
+    const char *str = (const char*)readBytes(reader, len);
+    return str == NULL ? NULL : copyString(vm, str, len);
+}
+
+static uint64_t hashSource(const char *source, const size_t len) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)source[i];
+        hash *= 0x100000001b3u;
+    }
+
+    return hash;
+}
+
+// The compiler resolves natives to slots in globalValues and built in libraries to indexes, so a cache is only good
+// for a VM that has the same ones in the same places.
+static uint64_t environmentHash(const VM *vm) {
+    uint64_t hash = (uint64_t)vm->globalValues.count;
+    for (int i = 0; i < vm->globals.capacity; ++i) {
+        const Entry *entry = &vm->globals.entries[i];
+        if (entry->key != NULL) {
+            // Summed so the order of the table doesn't matter.
+            hash += hashSource(entry->key->str, entry->key->len) ^ ((uint64_t)AS_NUMBER(entry->value) * 0x9e3779b97f4a7c15u);
+        }
+    }
+
+    for (int i = 0; i < vm->libCount; ++i) {
+        hash = hash * 31 + hashSource(vm->libs[i].name, strlen(vm->libs[i].name));
+    }
+
+    return hash;
+}
+
+// The header ends with a checksum of the rest of the image, which is filled in by writeChecksum() once it's written.
+// Returns where the checksum goes.
+static size_t writeHeader(Writer *writer, const VM *vm, const uint64_t sourceHash, const size_t sourceLen) {
+    writeBytes(writer, BYTECODE_MAGIC, 4);
+    writeInt(writer, BYTECODE_VERSION);
+    writeInt(writer, (int32_t)strlen(ILEX_VERSION));
+    writeBytes(writer, ILEX_VERSION, strlen(ILEX_VERSION));
+    writeLong(writer, sourceHash);
+    writeLong(writer, (uint64_t)sourceLen);
+    writeLong(writer, environmentHash(vm));
+    writeByte(writer, vm->optimize);
+
+    const size_t checksumAt = writer->count;
+    writeLong(writer, 0);
+    return checksumAt;
+}
+
+static void writeChecksum(const Writer *writer, const size_t checksumAt) {
+    const size_t start = checksumAt + sizeof(uint64_t);
+    const uint64_t checksum = hashSource((const char*)writer->bytes + start, writer->count - start);
+    memcpy(writer->bytes + checksumAt, &checksum, sizeof(checksum));
+}
+
+static bool readHeader(Reader *reader, const VM *vm, const uint64_t sourceHash, const size_t sourceLen) {
+    const uint8_t *magic = readBytes(reader, 4);
+    if (magic == NULL || memcmp(magic, BYTECODE_MAGIC, 4) != 0 || readInt(reader) != BYTECODE_VERSION) {
+        return false;
+    }
+
+    const int32_t versionLen = readInt(reader);
+    const uint8_t *version = readBytes(reader, versionLen < 0 ? 0 : versionLen);
+    if (version == NULL || versionLen != (int32_t)strlen(ILEX_VERSION) || memcmp(version, ILEX_VERSION, versionLen) != 0) {
+        return false;
+    }
+
+    if (readLong(reader) != sourceHash || readLong(reader) != (uint64_t)sourceLen ||
+        readLong(reader) != environmentHash(vm) || readByte(reader) != vm->optimize) {
+        return false;
+    }
+
+    // A file that was damaged on disk or cut short is compiled again rather than run.
+    const uint64_t checksum = readLong(reader);
+    return !reader->failed && checksum == hashSource((const char*)reader->at, (size_t)(reader->end - reader->at));
+}
+
+// Upvalue descriptors are operands of OP_CLOSURE, so they come along with the code.
+static void writeFunction(Writer *writer, const ObjFunction *function) {
+    writeByte(writer, (uint8_t)function->type);
+    writeByte(writer, (uint8_t)function->accessLevel);
+    writeInt(writer, function->arity);
+    writeInt(writer, function->arityDefault);
+    writeInt(writer, function->upvalueCount);
+    writeInt(writer, function->maxSlots);
+    writeString(writer, function->name);
+
+    const Chunk *chunk = &function->chunk;
+    writeInt(writer, chunk->count);
+    writeBytes(writer, chunk->code, chunk->count);
+    // Lines are written as runs, every byte of an instruction and most instructions in a row share one.
+    for (int i = 0; i < chunk->count;) {
+        int run = 1;
+        while (i + run < chunk->count && chunk->lines[i + run] == chunk->lines[i]) {
+            ++run;
+        }
+
+        writeInt(writer, chunk->lines[i]);
+        writeInt(writer, run);
+        i += run;
+    }
+    writeInt(writer, chunk->cacheCount);
+
+    writeInt(writer, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; ++i) {
+        const Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant)) {
+            writeByte(writer, CONSTANT_STRING);
+            writeString(writer, AS_STRING(constant));
+        } else if (IS_FUNCTION(constant)) {
+            writeByte(writer, CONSTANT_FUNCTION);
+            writeFunction(writer, AS_FUNCTION(constant));
+        } else if (!IS_OBJ(constant)) {
+            writeByte(writer, CONSTANT_VALUE);
+            writeLong(writer, constant);
+        } else {
+            writer->failed = true;
+        }
+    }
+}
+
+static ObjFunction *readFunction(Reader *reader, VM *vm, ObjScript *script) {
+    const uint8_t type = readByte(reader);
+    const uint8_t accessLevel = readByte(reader);
+    ObjFunction *function = newFunction(vm, (FunctionType)type, (AccessLevel)accessLevel, script);
+    push(vm, OBJ_VAL(function));
+
+    function->arity = readInt(reader);
+    function->arityDefault = readInt(reader);
+    function->upvalueCount = readInt(reader);
+    function->maxSlots = readInt(reader);
+    function->name = readString(reader, vm);
+    writeBarrier(vm, (Obj*)function);
+
+    // Nothing below is allocated or looped over before it is known to fit in what is left of the file. Locals and
+    // upvalues are short operands, and every value waiting on the stack was pushed by an instruction.
+    const int32_t count = readInt(reader);
+    const uint8_t *code = readBytes(reader, count < 0 ? 0 : count);
+    reader->failed |= type > TYPE_TOP_LEVEL || accessLevel > ACCESS_PRIVATE || function->arity < 0 ||
+                      function->arityDefault < 0 || function->upvalueCount < 0 ||
+                      function->upvalueCount > UINT16_COUNT || function->maxSlots < 0 ||
+                      function->maxSlots > UINT16_COUNT + count;
+    if (reader->failed) {
+        pop(vm);
+        return NULL;
+    }
+
+    // The code is run in place. A cache file is mapped privately, so quickening an instruction only copies the page it is
+    // on and the rest stays shared with every other process running it. A program is shared by every VM that runs it
+    // and is never written, its code isn't quickened.
+    Chunk *chunk = &function->chunk;
+    int *chunkLines = ALLOCATE(vm, int, count);
+    chunk->code = (uint8_t*)code;
+    chunk->sharedCode = true;
+    chunk->readOnlyCode = reader->readOnly;
+    chunk->lines = chunkLines;
+    chunk->count = count;
+    chunk->capacity = count;
+
+    for (int i = 0; i < count && !reader->failed;) {
+        const int32_t line = readInt(reader);
+        const int32_t run = readInt(reader);
+        if (run <= 0 || run > count - i) {
+            reader->failed = true;
+            break;
+        }
+
+        for (int j = 0; j < run; ++j) {
+            chunkLines[i++] = line;
+        }
+    }
+
+    // Every cache is named by a short operand, every constant takes at least a byte.
+    const int32_t cacheCount = readInt(reader);
+    reader->failed |= cacheCount < 0 || cacheCount > count / 2;
+    for (int i = 0; i < cacheCount && !reader->failed; ++i) {
+        addInlineCache(vm, chunk);
+    }
+
+    const int32_t constantCount = readInt(reader);
+    reader->failed |= constantCount < 0 || constantCount > reader->end - reader->at;
+    for (int i = 0; i < constantCount && !reader->failed; ++i) {
+        Value constant = NULL_VAL;
+        switch (readByte(reader)) {
+            case CONSTANT_VALUE: {
+                constant = readLong(reader);
+                reader->failed |= IS_OBJ(constant);
+            } break;
+            case CONSTANT_STRING: {
+                ObjString *string = readString(reader, vm);
+                reader->failed |= string == NULL;
+                constant = OBJ_VAL(string);
+            } break;
+            case CONSTANT_FUNCTION: {
+                ObjFunction *nested = readFunction(reader, vm, script);
+                reader->failed |= nested == NULL;
+                constant = OBJ_VAL(nested);
+            } break;
+            default: reader->failed = true; break;
+        }
+
+        if (!reader->failed) {
+            addConstant(vm, chunk, constant);
+        }
+    }
+
+    pop(vm);
+    return reader->failed ? NULL : function;
+}
+
+static int shortOperand(const uint8_t *code) {
+    return code[0] << 8 | code[1];
+}
+
+// run() takes the operands of an instruction as they are, so every constant, cache, slot, upvalue and jump in the code
+// is checked before any of it runs. Quickened instructions are never written to an image, nor is OP_BREAK, which the
+// compiler patches into a jump. Functions in the constants are checked too. scriptCount is how many slots the script
+// has once the names in the image are read.
+static bool verifyCode(const VM *vm, const ObjFunction *function, const int scriptCount) {
+    const Chunk *chunk = &function->chunk;
+    const Value *constants = chunk->constants.values;
+    const int constantCount = chunk->constants.count;
+    const int localCount = function->maxSlots + UINT8_COUNT;
+
+#define CONSTANT(at) (shortOperand(code + (at)) < constantCount)
+#define STRING(at) (CONSTANT(at) && IS_STRING(constants[shortOperand(code + (at))]))
+#define CACHE(at) (shortOperand(code + (at)) < chunk->cacheCount)
+#define LOCAL(at) (shortOperand(code + (at)) < localCount)
+#define FORWARD(at) (offset + length + shortOperand(code + (at)))
+#define BACKWARD(at) (offset + length - shortOperand(code + (at)))
+
+    // Jumps have to land on an instruction, so where they start is found first.
+    bool *starts = (bool*)calloc(chunk->count + 1, sizeof(bool));
+    if (starts == NULL) {
+        exit(69);
+    }
+
+    // The last instruction can't let run() carry on past the end.
+    bool valid = chunk->count > 0;
+    uint8_t last = OP_RETURN;
+    for (int offset = 0; valid && offset < chunk->count;) {
+        const uint8_t *code = &chunk->code[offset];
+        int length = 1;
+        switch (code[0]) {
+            case OP_USE_VAR_FROM: length = offset + 1 < chunk->count ? 2 + code[1] * 2 : 2; break;
+            case OP_USE_BUILTIN_VAR: length = offset + 3 < chunk->count ? 4 + code[3] * 2 : 4; break;
+            case OP_CLOSURE: {
+                valid = offset + 2 < chunk->count && CONSTANT(1) && IS_FUNCTION(constants[shortOperand(code + 1)]);
+                length = valid ? instructionLength(chunk, offset) : 1;
+            } break;
+            default: length = instructionLength(chunk, offset); break;
+        }
+
+        starts[offset] = true;
+        valid &= code[0] < OP_ADD_NUM && code[0] != OP_BREAK && length <= chunk->count - offset;
+        last = code[0];
+        offset += length;
+    }
+    valid &= last == OP_RETURN;
+
+    for (int offset = 0; valid && offset < chunk->count;) {
+        const uint8_t *code = &chunk->code[offset];
+        const int length = instructionLength(chunk, offset);
+        int target = -1;
+
+        switch (code[0]) {
+            case OP_CONSTANT: valid = CONSTANT(1); break;
+            case OP_GET_PROPERTY_NO_POP:
+            case OP_GET_PRIVATE_PROPERTY:
+            case OP_GET_PRIVATE_PROPERTY_NO_POP:
+            case OP_GET_SUPER:
+            case OP_SET_PRIVATE_PROPERTY:
+            case OP_SET_CLASS_STATIC_VAR:
+            case OP_INVOKE_SUPER:
+            case OP_INVOKE_THIS:
+            case OP_METHOD:
+            case OP_ASSERT:
+            case OP_PANIC:
+            case OP_ENUM:
+            case OP_ENUM_SET_VALUE:
+            case OP_USE: valid = STRING(1); break;
+            case OP_CLASS:
+            case OP_INHERIT:
+            case OP_USE_BUILTIN: valid = STRING(2); break;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_INVOKE: valid = CACHE(1) && CONSTANT(3); break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_INC_LOCAL:
+            case OP_DEC_LOCAL:
+            case OP_CLOSE_FILE: valid = LOCAL(1); break;
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL: valid = shortOperand(code + 1) < vm->globalValues.count; break;
+            case OP_GET_SCRIPT:
+            case OP_SET_SCRIPT:
+            case OP_DEFINE_SCRIPT: valid = shortOperand(code + 1) < scriptCount; break;
+            case OP_GET_UPVALUE:
+            case OP_SET_UPVALUE: valid = shortOperand(code + 1) < function->upvalueCount; break;
+            case OP_ADD_LOCAL_CONST:
+            case OP_SUB_LOCAL_CONST: valid = LOCAL(1) && CONSTANT(3); break;
+            case OP_LT_LOCALS_JMP:
+            case OP_LTEQ_LOCALS_JMP:
+            case OP_GR_LOCALS_JMP:
+            case OP_GREQ_LOCALS_JMP: valid = LOCAL(1) && LOCAL(3); target = FORWARD(5); break;
+            case OP_LT_LOCAL_CONST_JMP:
+            case OP_LTEQ_LOCAL_CONST_JMP:
+            case OP_GR_LOCAL_CONST_JMP:
+            case OP_GREQ_LOCAL_CONST_JMP: valid = LOCAL(1) && CONSTANT(3); target = FORWARD(5); break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_CMP_JMP:
+            case OP_CMP_JMP_FALL: target = FORWARD(1); break;
+            case OP_JUMP_DO_WHILE:
+            case OP_LOOP: target = BACKWARD(1); break;
+            case OP_USE_VAR_FROM: {
+                for (int i = 0; valid && i < code[1]; ++i) {
+                    valid = STRING(2 + i * 2);
+                }
+            } break;
+            case OP_USE_BUILTIN_VAR: {
+                valid = STRING(1);
+                for (int i = 0; valid && i < code[3]; ++i) {
+                    valid = STRING(4 + i * 2);
+                }
+            } break;
+            case OP_CLOSURE: {
+                // An isLocal byte and an index short for each upvalue.
+                const ObjFunction *nested = AS_FUNCTION(constants[shortOperand(code + 1)]);
+                for (int i = 0; valid && i < nested->upvalueCount; ++i) {
+                    const int index = shortOperand(code + 4 + i * 3);
+                    valid = code[3 + i * 3] ? index < localCount : index < function->upvalueCount;
+                }
+            } break;
+            default: break;
+        }
+
+        valid &= target == -1 || (target >= 0 && target < chunk->count && starts[target]);
+        offset += length;
+    }
+
+#undef CONSTANT
+#undef STRING
+#undef CACHE
+#undef LOCAL
+#undef FORWARD
+#undef BACKWARD
+
+    free(starts);
+
+    for (int i = 0; valid && i < constantCount; ++i) {
+        if (IS_FUNCTION(constants[i])) {
+            valid = verifyCode(vm, AS_FUNCTION(constants[i]), scriptCount);
+        }
+    }
+
+    return valid;
+}
+
+static void writeNames(Writer *writer, ObjString **names, const int count) {
+    writeInt(writer, count);
+    for (int i = 0; i < count; ++i) {
+        writeString(writer, names[i]);
+    }
+}
+
+// Reads past a list of names without making them, to check the file holds all of them.
+static void skipNames(Reader *reader) {
+    const int32_t count = readInt(reader);
+    for (int i = 0; i < count && !reader->failed; ++i) {
+        const int32_t len = readInt(reader);
+        reader->failed |= len < 0;
+        readBytes(reader, len < 0 ? 0 : len);
+    }
+}
+
+// Top level variables get their slots while compiling, so they are given the same ones again in the same order. The
+// consts the script declared go back in vm->consts.
+static void writeScriptNames(Writer *writer, const VM *vm, const ObjScript *script, const Table *oldConsts) {
+    const int count = script->variableValues.count;
+    ObjString **variables = (ObjString**)calloc(count == 0 ? 1 : count, sizeof(ObjString*));
+    ObjString **consts = (ObjString**)malloc(sizeof(ObjString*) * (count == 0 ? 1 : count));
+    if (variables == NULL || consts == NULL) {
+        exit(69);
+    }
+
+    int constCount = 0;
+    for (int i = 0; i < script->variables.capacity; ++i) {
+        const Entry *entry = &script->variables.entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        Value unused;
+        variables[TO_INT(entry->value)] = entry->key;
+        if (tableGet(&vm->consts, entry->key, &unused) && !tableGet(oldConsts, entry->key, &unused)) {
+            consts[constCount++] = entry->key;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        writer->failed |= variables[i] == NULL;
+    }
+
+    if (!writer->failed) {
+        writeNames(writer, variables, count);
+        writeNames(writer, consts, constCount);
+    }
+
+    free(variables);
+    free(consts);
+}
+
+static void readScriptNames(Reader *reader, VM *vm, ObjScript *script) {
+    const int32_t variableCount = readInt(reader);
+    for (int i = 0; i < variableCount; ++i) {
+        ObjString *name = readString(reader, vm);
+        push(vm, OBJ_VAL(name));
+        scriptVariableSlot(vm, script, name);
+        pop(vm);
+    }
+
+    const int32_t constCount = readInt(reader);
+    for (int i = 0; i < constCount; ++i) {
+        ObjString *name = readString(reader, vm);
+        Value unused;
+        // The VM that compiled a program has them already.
+        if (!tableGet(&vm->consts, name, &unused)) {
+            push(vm, OBJ_VAL(name));
+            tableSet(vm, &vm->consts, name, NULL_VAL, ILEX_READ_ONLY);
+            pop(vm);
+        }
+    }
+}
+
+// Checks the whole image before reading the names in it, they are added to the script and vm->consts as they are read.
+static ObjFunction *readImage(VM *vm, ObjScript *script, const uint8_t *bytes, const size_t size,
+                              const uint64_t sourceHash, const size_t sourceLen, const bool readOnly) {
+    Reader reader = {bytes, bytes + size, false, readOnly};
+    if (!readHeader(&reader, vm, sourceHash, sourceLen)) {
+        return NULL;
+    }
+
+    ObjFunction *function = readFunction(&reader, vm, script);
+    if (function == NULL) {
+        return NULL;
+    }
+
+    // Each name read gets a script slot, if it doesn't have one already.
+    Reader names = reader;
+    const int32_t variableCount = readInt(&names);
+    names = reader;
+    skipNames(&names);
+    skipNames(&names);
+    if (names.failed || !verifyCode(vm, function, script->variableValues.count + variableCount)) {
+        return NULL;
+    }
+
+    push(vm, OBJ_VAL(function));
+    readScriptNames(&reader, vm, script);
+    pop(vm);
+    return function;
+}
+
+// Compiles source into script and writes the image of it. The writer is marked failed when the script can't be
+// written, function is NULL when it doesn't compile.
+static ObjFunction *compileImage(VM *vm, ObjScript *script, const char *source, const uint64_t sourceHash,
+                                 const size_t sourceLen, Writer *writer) {
+    // Remember which consts there were so the ones this script declares can be told apart.
+    Table oldConsts;
+    initTable(&oldConsts, NULL);
+    tableAddAll(vm, &vm->consts, &oldConsts);
+
+    ObjFunction *function = compile(vm, script, source);
+    if (function != NULL) {
+        const size_t checksumAt = writeHeader(writer, vm, sourceHash, sourceLen);
+        writeFunction(writer, function);
+        writeScriptNames(writer, vm, script, &oldConsts);
+        writeChecksum(writer, checksumAt);
+    }
+
+    freeTable(vm, &oldConsts);
+    return function;
+}
+
+#ifndef ILEX_NO_BYTECODE_CACHE
+
+// A cache file that was loaded. Its code is run in place, so it stays mapped as long as the VM lives.
+struct CacheFile {
+    MappedFile file;
+    CacheFile *next;
+};
+
+// Written next to the cache and renamed over it, so another process never reads half a file and the ones that have the
+// old cache mapped keep running it. Every process and thread writes a file of its own.
+static void writeCacheFile(const char *path, const Writer *writer) {
+    char tmpPath[I_MAX_PATH + 64];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.%p~", path, (long)getpid(), (const void*)writer);
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return;
+    }
+
+    bool written = fwrite(writer->bytes, 1, writer->count, file) == writer->count;
+    written &= fclose(file) == 0;
+#ifdef I_WIN
+    remove(path);
+#endif
+    if (!written || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+    }
+}
+
+static ObjFunction *loadCache(VM *vm, ObjScript *script, const char *cachePath, const uint64_t sourceHash,
+                              const size_t sourceLen) {
+    MappedFile file;
+    if (!mapFile(cachePath, &file, false)) {
+        return NULL;
+    }
+
+    ObjFunction *function = readImage(vm, script, (const uint8_t*)file.bytes, file.size, sourceHash, sourceLen,
+                                      false);
+    if (function == NULL) {
+        unmapFile(&file);
+        return NULL;
+    }
+
+    CacheFile *cacheFile = (CacheFile*)malloc(sizeof(CacheFile));
+    if (cacheFile == NULL) {
+        exit(69);
+    }
+
+    cacheFile->file = file;
+    cacheFile->next = vm->cacheFiles;
+    vm->cacheFiles = cacheFile;
+    return function;
+}
+
+#endif
+
+ObjFunction *compileCached(VM *vm, ObjScript *script, const char *path, const char *source) {
+#ifndef ILEX_NO_BYTECODE_CACHE
+    const size_t pathLen = strlen(path);
+    if (pathLen < 5 || pathLen + 1 >= I_MAX_PATH || strcmp(path + pathLen - 5, ".ilex") != 0) {
+        return compile(vm, script, source);
+    }
+
+    char cachePath[I_MAX_PATH];
+    snprintf(cachePath, sizeof(cachePath), "%sc", path);
+
+    const size_t sourceLen = strlen(source);
+    const uint64_t sourceHash = hashSource(source, sourceLen);
+    ObjFunction *function = loadCache(vm, script, cachePath, sourceHash, sourceLen);
+    if (function != NULL) {
+        return function;
+    }
+
+    Writer writer = {NULL, 0, 0, false};
+    function = compileImage(vm, script, source, sourceHash, sourceLen, &writer);
+    if (function != NULL && !writer.failed) {
+        writeCacheFile(cachePath, &writer);
+    }
+
+    free(writer.bytes);
+    return function;
+#else
+    (void)path;
+    return compile(vm, script, source);
+#endif
+}
+
+void freeCacheFiles(VM *vm) {
+#ifndef ILEX_NO_BYTECODE_CACHE
+    CacheFile *cacheFile = vm->cacheFiles;
+    while (cacheFile != NULL) {
+        CacheFile *next = cacheFile->next;
+        unmapFile(&cacheFile->file);
+        free(cacheFile);
+        cacheFile = next;
+    }
+
+    vm->cacheFiles = NULL;
+#else
+    (void)vm;
+#endif
+}
+
+IlexProgram *newProgram(VM *vm, ObjScript *script, const char *source) {
+    const size_t sourceLen = strlen(source);
+    const uint64_t sourceHash = hashSource(source, sourceLen);
+    Writer writer = {NULL, 0, 0, false};
+    if (compileImage(vm, script, source, sourceHash, sourceLen, &writer) == NULL || writer.failed) {
+        free(writer.bytes);
+        return NULL;
+    }
+
+    IlexProgram *program = (IlexProgram*)malloc(sizeof(IlexProgram));
+    const size_t nameLen = (size_t)script->name->len;
+    char *name = (char*)malloc(nameLen + 1);
+    if (program == NULL || name == NULL) {
+        exit(69);
+    }
+
+    memcpy(name, script->name->str, nameLen + 1);
+    program->name = name;
+    program->bytes = writer.bytes;
+    program->size = writer.count;
+    program->sourceHash = sourceHash;
+    program->sourceLen = sourceLen;
+    return program;
+}
+
+ObjFunction *loadProgram(VM *vm, ObjScript *script, const IlexProgram *program) {
+    return readImage(vm, script, program->bytes, program->size, program->sourceHash, program->sourceLen, true);
+}
+
+void freeProgram(IlexProgram *program) {
+    if (program == NULL) {
+        return;
+    }
+
+    free(program->name);
+    free(program->bytes);
+    free(program);
+}
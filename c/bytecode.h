@@ -0,0 +1,36 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_BYTECODE_H__
+#define __C_BYTECODE_H__
+
+#include "ilex.h"
+#include "object.h"
+
+// Compiled scripts are cached next to their source, foo.ilex gets foo.ilexc. A cache is only used when it was written
+// by the same version for the same source, the same natives and libraries and the same -O. Define
+// ILEX_NO_BYTECODE_CACHE to always compile.
+#define BYTECODE_MAGIC "ILXC"
+// Bump whenever an instruction, what the compiler records about a function or the layout of a cache file changes.
+#define BYTECODE_VERSION 6
+
+// The image of a compiled script, in the format of a cache file. It is never written after it was made, so VMs on any
+// number of threads can run it at once.
+struct IlexProgram {
+    char *name;
+    uint8_t *bytes;
+    size_t size;
+    uint64_t sourceHash;
+    size_t sourceLen;
+};
+
+// Loads the script at path from its cache, or compiles source and writes the cache for next time.
+ObjFunction *compileCached(VM *vm, ObjScript *script, const char *path, const char *source);
+void freeCacheFiles(VM *vm);
+// NULL when source doesn't compile.
+IlexProgram *newProgram(VM *vm, ObjScript *script, const char *source);
+// NULL when the program was compiled by a VM with other natives, libraries or -O.
+ObjFunction *loadProgram(VM *vm, ObjScript *script, const IlexProgram *program);
+
+#endif //__C_BYTECODE_H__
@@ -8,19 +8,27 @@
 #include "memory.h"
 #include "vm.h"
 
-void initChunk(Chunk *chunk) {
+void initChunk(Chunk *chunk, Obj *owner) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
-    initValueArray(&chunk->constants);
+    chunk->sharedCode = false;
+    chunk->readOnlyCode = false;
+    initValueArray(&chunk->constants, owner);
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches = NULL;
 }
 
 void freeChunk(VM *vm, Chunk *chunk) {
-    FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+    if (!chunk->sharedCode) {
+        FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+    }
     FREE_ARRAY(vm, int, chunk->lines, chunk->capacity);
     freeValueArray(vm, &chunk->constants);
-    initChunk(chunk);
+    FREE_ARRAY(vm, InlineCache, chunk->caches, chunk->cacheCapacity);
+    initChunk(chunk, chunk->constants.owner);
 }
 
 void writeChunk(VM *vm, Chunk *chunk, const uint8_t byte, const int line) {
@@ -43,3 +51,109 @@ int addConstant(VM *vm, Chunk *chunk, const Value value) {
 
     return chunk->constants.count - 1;
 }
+
+int addInlineCache(VM *vm, Chunk *chunk) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        const int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(vm, InlineCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+
+    InlineCache *cache = &chunk->caches[chunk->cacheCount];
+    cache->shape = NULL;
+    cache->slot = -1;
+    cache->method = NULL_VAL;
+
+    return chunk->cacheCount++;
+}
+
+int instructionLength(const Chunk *chunk, const int offset) {
+    const uint8_t *code = &chunk->code[offset];
+
+    switch (code[0]) {
+        case OP_CALL:
+        case OP_MULTI_CASE:
+        case OP_NEW_ARRAY:
+        case OP_NEW_MAP:
+        case OP_NEW_SET:
+            return 2;
+
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_GET_PROPERTY_NO_POP:
+        case OP_GET_PRIVATE_PROPERTY:
+        case OP_GET_PRIVATE_PROPERTY_NO_POP:
+        case OP_GET_SUPER:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_SET_PRIVATE_PROPERTY:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_DO_WHILE:
+        case OP_LOOP:
+        case OP_METHOD:
+        case OP_ASSERT:
+        case OP_PANIC:
+        case OP_CMP_JMP:
+        case OP_CMP_JMP_FALL:
+        case OP_ENUM:
+        case OP_ENUM_SET_VALUE:
+        case OP_USE:
+        case OP_BREAK:
+        case OP_CLOSE_FILE:
+        case OP_GET_SCRIPT:
+        case OP_SET_SCRIPT:
+        case OP_DEFINE_SCRIPT:
+        case OP_DEFINE_DEFAULT:
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+            return 3;
+
+        case OP_SET_CLASS_STATIC_VAR:
+        case OP_INVOKE_SUPER:
+        case OP_INVOKE_THIS:
+        case OP_CLASS:
+        case OP_INHERIT:
+        case OP_USE_BUILTIN:
+            return 4;
+
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUB_LOCAL_CONST:
+            return 5;
+
+        case OP_INVOKE:
+            return 6;
+
+        case OP_LT_LOCALS_JMP:
+        case OP_LTEQ_LOCALS_JMP:
+        case OP_GR_LOCALS_JMP:
+        case OP_GREQ_LOCALS_JMP:
+        case OP_LT_LOCAL_CONST_JMP:
+        case OP_LTEQ_LOCAL_CONST_JMP:
+        case OP_GR_LOCAL_CONST_JMP:
+        case OP_GREQ_LOCAL_CONST_JMP:
+            return 7;
+
+        // A short name for each variable.
+        case OP_USE_VAR_FROM:
+            return 2 + code[1] * 2;
+        case OP_USE_BUILTIN_VAR:
+            return 4 + code[3] * 2;
+
+        // An isLocal byte and an index short for each upvalue.
+        case OP_CLOSURE: {
+            const ObjFunction *function = AS_FUNCTION(chunk->constants.values[code[1] << 8 | code[2]]);
+            return 3 + function->upvalueCount * 3;
+        }
+
+        default:
+            return 1;
+    }
+}
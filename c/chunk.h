@@ -99,11 +99,37 @@ typedef enum {
     OP_NEW_MAP,
     OP_NEW_SET,
     OP_DEFINE_DEFAULT,
+    OP_YIELD,
+    OP_RESUME,
+
+    // Superinstructions. The compiler emits these in place of the sequences next to them.
+    OP_INC_LOCAL,            // GET_LOCAL, INC, SET_LOCAL
+    OP_DEC_LOCAL,            // GET_LOCAL, DEC, SET_LOCAL
+    OP_ADD_LOCAL_CONST,      // GET_LOCAL, CONSTANT, ADD
+    OP_SUB_LOCAL_CONST,      // GET_LOCAL, CONSTANT, SUB
+    OP_LT_LOCALS_JMP,        // GET_LOCAL, GET_LOCAL, LT, JUMP_IF_FALSE, POP
+    OP_LTEQ_LOCALS_JMP,      // GET_LOCAL, GET_LOCAL, LTEQ, JUMP_IF_FALSE, POP
+    OP_GR_LOCALS_JMP,        // GET_LOCAL, GET_LOCAL, GR, JUMP_IF_FALSE, POP
+    OP_GREQ_LOCALS_JMP,      // GET_LOCAL, GET_LOCAL, GREQ, JUMP_IF_FALSE, POP
+    OP_LT_LOCAL_CONST_JMP,   // GET_LOCAL, CONSTANT, LT, JUMP_IF_FALSE, POP
+    OP_LTEQ_LOCAL_CONST_JMP, // GET_LOCAL, CONSTANT, LTEQ, JUMP_IF_FALSE, POP
+    OP_GR_LOCAL_CONST_JMP,   // GET_LOCAL, CONSTANT, GR, JUMP_IF_FALSE, POP
+    OP_GREQ_LOCAL_CONST_JMP, // GET_LOCAL, CONSTANT, GREQ, JUMP_IF_FALSE, POP
+
+    // Quickened instructions. The compiler never emits these, run() rewrites the generic instruction into one of them
+    // once it has seen the operands it is made for, and back when its guard fails.
+    OP_ADD_NUM,     // ADD of two numbers
+    OP_EQ_NUM,      // EQ of two numbers
+    OP_NOTEQ_NUM,   // NOTEQ of two numbers
+    OP_INDEX_ARRAY, // INDEX of an array by a number in bounds
 } OpCode;
 
-void initChunk(Chunk *chunk);
+void initChunk(Chunk *chunk, Obj *owner);
 void freeChunk(VM *vm, Chunk *chunk);
 void writeChunk(VM *vm, Chunk *chunk, uint8_t byte, int line);
 int addConstant(VM *vm, Chunk *chunk, Value value);
+int addInlineCache(VM *vm, Chunk *chunk);
+// Size of the instruction at offset, with its operands.
+int instructionLength(const Chunk *chunk, int offset);
 
 #endif //C_CHUNK_H
@@ -2,6 +2,8 @@
 // Created by Skyler on 3/12/22.
 //
 
+#include <limits.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,6 +13,7 @@
 #include "ilex.h"
 #include "compiler.h"
 #include "memory.h"
+#include "optimizer.h"
 #include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -94,7 +97,7 @@ static void errorAtCurrent(Parser *parser, const char *message) {
 }
 
 static void firstAdvance(const Compiler *compiler) {
-    compiler->parser->next = nextToken();
+    compiler->parser->next = nextToken(&compiler->parser->lexer);
 
     if (compiler->parser->next.type == TK_ERROR) {
         errorAtCurrent(compiler->parser, compiler->parser->current.start);
@@ -106,7 +109,7 @@ static void advance(Parser *parser) {
 
     for (;;) {
         parser->current = parser->next;
-        parser->next = nextToken();
+        parser->next = nextToken(&parser->lexer);
         if (parser->current.type != TK_ERROR) {
             break;
         }
@@ -205,10 +208,89 @@ static uint16_t makeConstant(const Compiler *compiler, const Value value) {
     return (uint16_t)constant;
 }
 
+static uint16_t makeInlineCache(const Compiler *compiler) {
+    const int cache = addInlineCache(compiler->parser->vm, currentChunk(compiler));
+    if (cache > UINT16_MAX) {
+        error(compiler->parser, "Too many property accesses in one chunk.");
+        return 0;
+    }
+
+    return (uint16_t)cache;
+}
+
+// OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE have the index of their inline cache in front of the name.
+static void emitPropertyOp(const Compiler *compiler, const uint8_t op, const uint16_t name) {
+    emitByteShort(compiler, op, makeInlineCache(compiler));
+    emitShort(compiler, name);
+}
+
 static void emitConstant(const Compiler *compiler, const Value value) {
     emitByteShort(compiler, OP_CONSTANT, makeConstant(compiler, value));
 }
 
+// Emits an arithmetic op. 'GET_LOCAL, CONSTANT, ADD/SUB' is folded into a single instruction. leftStart is where the
+// code for the left operand begins, so it is known to be the start of an instruction.
+static void emitArithmetic(const Compiler *compiler, const int leftStart, const uint8_t op) {
+    Chunk *chunk = currentChunk(compiler);
+
+    if ((op == OP_ADD || op == OP_SUB) && chunk->count - leftStart == 6 &&
+        chunk->code[leftStart] == OP_GET_LOCAL && chunk->code[leftStart + 3] == OP_CONSTANT) {
+        chunk->code[leftStart] = op == OP_ADD ? OP_ADD_LOCAL_CONST : OP_SUB_LOCAL_CONST;
+        chunk->code[leftStart + 3] = chunk->code[leftStart + 4];
+        chunk->code[leftStart + 4] = chunk->code[leftStart + 5];
+        chunk->count = leftStart + 5;
+        return;
+    }
+
+    emitByte(compiler, op);
+}
+
+// Emits the jump taken when an if/while/for condition is false, and the pop of the condition when it isn't. A condition
+// that is a single comparison of a local against another local or a constant becomes one compare and branch
+// instruction. That only leaves the condition on the stack when it jumps, so there is nothing to pop after it.
+static int emitConditionJump(const Compiler *compiler, const int condStart) {
+    Chunk *chunk = currentChunk(compiler);
+
+    if (chunk->count - condStart == 7 && chunk->code[condStart] == OP_GET_LOCAL) {
+        uint8_t *code = &chunk->code[condStart];
+        int fused = -1;
+
+        if (code[3] == OP_GET_LOCAL) {
+            switch (code[6]) {
+                case OP_LT:   fused = OP_LT_LOCALS_JMP; break;
+                case OP_LTEQ: fused = OP_LTEQ_LOCALS_JMP; break;
+                case OP_GR:   fused = OP_GR_LOCALS_JMP; break;
+                case OP_GREQ: fused = OP_GREQ_LOCALS_JMP; break;
+                default: break;
+            }
+        } else if (code[3] == OP_CONSTANT) {
+            switch (code[6]) {
+                case OP_LT:   fused = OP_LT_LOCAL_CONST_JMP; break;
+                case OP_LTEQ: fused = OP_LTEQ_LOCAL_CONST_JMP; break;
+                case OP_GR:   fused = OP_GR_LOCAL_CONST_JMP; break;
+                case OP_GREQ: fused = OP_GREQ_LOCAL_CONST_JMP; break;
+                default: break;
+            }
+        }
+
+        if (fused != -1) {
+            code[0] = (uint8_t)fused;
+            code[3] = code[4];
+            code[4] = code[5];
+            chunk->count = condStart + 5;
+            emitByte(compiler, 0xff);
+            emitByte(compiler, 0xff);
+
+            return chunk->count - 2;
+        }
+    }
+
+    const int jump = emitJump(compiler, OP_JUMP_IF_FALSE);
+    emitByte(compiler, OP_POP); // Condition.
+
+    return jump;
+}
+
 static void patchJump(const Compiler *compiler, const int offset) {
     const int jump = currentChunk(compiler)->count - offset - 2;
 
@@ -220,13 +302,165 @@ static void patchJump(const Compiler *compiler, const int offset) {
     currentChunk(compiler)->code[offset + 1] = jump & 0xff;
 }
 
+// Drops the code emitted from start on, used for branches that can never run. They are still compiled for their errors.
+static void discardCode(const Compiler *compiler, const int start) {
+    currentChunk(compiler)->count = start;
+}
+
+// If the code from start to end is a single instruction pushing a literal, stores the literal in value. start has to be
+// the start of an instruction.
+static bool literalAt(const Compiler *compiler, const int start, const int end, Value *value) {
+    const Chunk *chunk = currentChunk(compiler);
+
+    if (end - start == 1) {
+        switch (chunk->code[start]) {
+            case OP_NULL:  *value = NULL_VAL; return true;
+            case OP_TRUE:  *value = TRUE_VAL; return true;
+            case OP_FALSE: *value = FALSE_VAL; return true;
+            default: return false;
+        }
+    }
+
+    if (end - start == 3 && chunk->code[start] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[start + 1] << 8 | chunk->code[start + 2]];
+        return IS_NUMBER(*value) || IS_STRING(*value);
+    }
+
+    return false;
+}
+
+// Takes back the constant of a literal that is folded away, if it is the last one added.
+static void dropLiteral(const Compiler *compiler, const int start) {
+    Chunk *chunk = currentChunk(compiler);
+    if (chunk->code[start] != OP_CONSTANT) {
+        return;
+    }
+
+    const int constant = chunk->code[start + 1] << 8 | chunk->code[start + 2];
+    if (constant == chunk->constants.count - 1) {
+        chunk->constants.count--;
+    }
+}
+
+static void emitLiteral(const Compiler *compiler, const Value value) {
+    if (IS_NULL(value)) {
+        emitByte(compiler, OP_NULL);
+    } else if (IS_BOOL(value)) {
+        emitByte(compiler, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(compiler, value);
+    }
+}
+
+static bool fitsInt(const double number) {
+    return number >= INT_MIN && number <= INT_MAX;
+}
+
+// Replaces 'literal, literal, op' from leftStart on with the result, computed the same way the VM would. Anything that
+// would be a runtime error is left for the VM to report.
+static bool foldBinary(const Compiler *compiler, const int leftStart, const int rightStart, const uint8_t op) {
+    Value a, b;
+    if (!literalAt(compiler, leftStart, rightStart, &a) ||
+        !literalAt(compiler, rightStart, currentChunk(compiler)->count, &b)) {
+        return false;
+    }
+
+    Value result;
+    if (op == OP_EQ || op == OP_NOTEQ) {
+        result = BOOL_VAL(valuesEqual(a, b) == (op == OP_EQ));
+    } else if (op == OP_NULL_COALESCE) {
+        result = IS_NULL(a) ? b : a;
+    } else if (op == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+        const ObjString *left = AS_STRING(a);
+        const ObjString *right = AS_STRING(b);
+        const int len = left->len + right->len;
+        char *str = ALLOCATE(compiler->parser->vm, char, len + 1);
+        memcpy(str, left->str, left->len);
+        memcpy(str + left->len, right->str, right->len);
+        str[len] = '\0';
+        result = OBJ_VAL(takeString(compiler->parser->vm, str, len));
+    } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        const double x = AS_NUMBER(a);
+        const double y = AS_NUMBER(b);
+        const bool ints = fitsInt(x) && fitsInt(y);
+
+        switch (op) {
+            case OP_GR:      result = BOOL_VAL(x > y); break;
+            case OP_GREQ:    result = BOOL_VAL(x >= y); break;
+            case OP_LT:      result = BOOL_VAL(x < y); break;
+            case OP_LTEQ:    result = BOOL_VAL(x <= y); break;
+            case OP_ADD:     result = NUMBER_VAL(x + y); break;
+            case OP_SUB:     result = NUMBER_VAL(x - y); break;
+            case OP_MUL:     result = NUMBER_VAL(x * y); break;
+            case OP_DIV:     result = NUMBER_VAL(x / y); break;
+            case OP_POW:     result = NUMBER_VAL(powf(x, y)); break;
+            case OP_MOD:     result = NUMBER_VAL(fmod(x, y)); break;
+            case OP_BIT_AND: if (!ints) return false; result = NUMBER_VAL((int)x & (int)y); break;
+            case OP_BIT_OR:  if (!ints) return false; result = NUMBER_VAL((int)x | (int)y); break;
+            case OP_BIT_XOR: if (!ints) return false; result = NUMBER_VAL((int)x ^ (int)y); break;
+            case OP_BIT_LS: {
+                if (!ints || x < 0 || y < 0 || y > 30 || (int)x > INT_MAX >> (int)y) {
+                    return false;
+                }
+                result = NUMBER_VAL((int)x << (int)y);
+            } break;
+            case OP_BIT_RS: {
+                if (!ints || y < 0 || y > 31) {
+                    return false;
+                }
+                result = NUMBER_VAL((int)x >> (int)y);
+            } break;
+            default: return false;
+        }
+    } else {
+        return false;
+    }
+
+    dropLiteral(compiler, rightStart);
+    dropLiteral(compiler, leftStart);
+    discardCode(compiler, leftStart);
+    emitLiteral(compiler, result);
+    return true;
+}
+
+static bool foldUnary(const Compiler *compiler, const int operandStart, const uint8_t op) {
+    Value value;
+    if (!literalAt(compiler, operandStart, currentChunk(compiler)->count, &value)) {
+        return false;
+    }
+
+    Value result;
+    switch (op) {
+        case OP_NOT: result = BOOL_VAL(isFalsy(value)); break;
+        case OP_NEG: {
+            if (!IS_NUMBER(value)) {
+                return false;
+            }
+            result = NUMBER_VAL(-AS_NUMBER(value));
+        } break;
+        case OP_BIT_NOT: {
+            if (!IS_NUMBER(value) || !fitsInt(AS_NUMBER(value))) {
+                return false;
+            }
+            result = NUMBER_VAL(~TO_INT(value));
+        } break;
+        default: return false;
+    }
+
+    dropLiteral(compiler, operandStart);
+    discardCode(compiler, operandStart);
+    emitLiteral(compiler, result);
+    return true;
+}
+
 static void initCompiler(Parser *parser, Compiler *compiler, Compiler *parent, const FunctionType type, const AccessLevel level) {
     compiler->parser = parser;
-    initTable(&compiler->stringConsts);
+    initTable(&compiler->stringConsts, NULL);
     compiler->enclosing = parent;
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
+    compiler->temporaries = 0;
     compiler->scopeDepth = 0;
     compiler->function = newFunction(parser->vm, type, level, parser->script);
     compiler->currentLibName = 0;
@@ -237,6 +471,7 @@ static void initCompiler(Parser *parser, Compiler *compiler, Compiler *parent, c
     compiler->upvalues = NULL;
     compiler->isWithBlock = false;
     compiler->withVarName = NULL;
+    compiler->operandStart = 0;
 
     compiler->locals   = (Local*)  malloc(sizeof(Local)   * LOCAL_COUNT);
     compiler->upvalues = (Upvalue*)malloc(sizeof(Upvalue) * LOCAL_COUNT);
@@ -255,10 +490,13 @@ static void initCompiler(Parser *parser, Compiler *compiler, Compiler *parent, c
     } else {
         compiler->function->name = NULL;
     }
+    writeBarrier(parser->vm, (Obj*)compiler->function);
 
     Local *local = &compiler->locals[compiler->localCount++];
     local->depth = compiler->scopeDepth;
     local->isCaptured = false;
+    local->isConst = false;
+    local->hasLiteral = false;
     if (type == TYPE_METHOD || type == TYPE_CONSTRUCTOR) {
         local->name.start = "this";
         local->name.len = 4;
@@ -342,6 +580,16 @@ static int resolveUpvalue(const Compiler *compiler, Token *name) {
     return -1;
 }
 
+// call() makes room for the locals and for every value an expression leaves waiting on the stack while it compiles
+// the next one, anything an instruction pushes for itself fits in the UINT8_COUNT slots it adds to that.
+static void reserveSlots(Compiler *compiler, const int temporaries) {
+    compiler->temporaries += temporaries;
+    const int slots = compiler->localCount + compiler->temporaries;
+    if (slots > compiler->function->maxSlots) {
+        compiler->function->maxSlots = slots;
+    }
+}
+
 static void addLocal(Compiler *compiler, const Token name) {
     if (compiler->localCount == LOCAL_COUNT) {
         error(compiler->parser, "To many local variables in function.");
@@ -349,10 +597,12 @@ static void addLocal(Compiler *compiler, const Token name) {
     }
 
     Local *local = &compiler->locals[compiler->localCount++];
+    reserveSlots(compiler, 0);
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
     local->isConst = false;
+    local->hasLiteral = false;
 }
 
 static void declareVariable(Compiler *compiler) {
@@ -386,34 +636,58 @@ static uint16_t parseVariable(Compiler *compiler, const char *errorMessage) {
     return identifierConstant(compiler, &compiler->parser->previous);
 }
 
+// Resolve a top level variable to its slot in the script being compiled.
+static uint16_t scriptVariable(const Compiler *compiler, ObjString *name) {
+    const int slot = scriptVariableSlot(compiler->parser->vm, compiler->parser->script, name);
+    if (slot > UINT16_MAX) {
+        error(compiler->parser, "Too many top level variables in one script.");
+        return 0;
+    }
+
+    return (uint16_t)slot;
+}
+
 static void defineVariable(const Compiler *compiler, const uint16_t global, const bool isConst) {
     if (compiler->scopeDepth == 0) {
+        ObjString *name = AS_STRING(currentChunk(compiler)->constants.values[global]);
         if (isConst) {
-            tableSet(compiler->parser->vm,
-                     &compiler->parser->vm->consts,
-                     AS_STRING(currentChunk(compiler)->constants.values[global]),
-                     NULL_VAL,
-                     ILEX_READ_ONLY);
+            tableSet(compiler->parser->vm, &compiler->parser->vm->consts, name, NULL_VAL, ILEX_READ_ONLY);
+        } else {
+            tableDelete(&compiler->parser->constLiterals, name);
         }
 
-        emitByteShort(compiler, OP_DEFINE_SCRIPT, global);
+        emitByteShort(compiler, OP_DEFINE_SCRIPT, scriptVariable(compiler, name));
     } else {
         compiler->locals[compiler->localCount - 1].depth = compiler->scopeDepth;
         compiler->locals[compiler->localCount - 1].isConst = isConst;
     }
 }
 
+// Called after defineVariable() for a const initialised with a literal, so reads of it push the literal instead of
+// loading the variable.
+static void constLiteral(const Compiler *compiler, const uint16_t global, const Value value) {
+    if (compiler->scopeDepth == 0) {
+        ObjString *name = AS_STRING(currentChunk(compiler)->constants.values[global]);
+        tableSet(compiler->parser->vm, &compiler->parser->constLiterals, name, value, false);
+    } else {
+        compiler->locals[compiler->localCount - 1].hasLiteral = true;
+        compiler->locals[compiler->localCount - 1].literal = value;
+    }
+}
+
 static uint8_t argumentList(Compiler *compiler) {
     uint8_t argCount = 0;
     if (!check(compiler, TK_RPAREN)) {
         do {
             expression(compiler);
+            reserveSlots(compiler, 1);
             if (argCount > 255) {
                 error(compiler->parser, "Can't have more than 255 arguments.");
             }
             argCount++;
         } while (match(compiler, TK_COMMA));
     }
+    compiler->temporaries -= argCount;
 
     eat(compiler->parser, TK_RPAREN, "Expect ')' after arguments.");
     return argCount;
@@ -423,6 +697,10 @@ static ObjFunction *endCompiler(Compiler *compiler) {
     emitReturn(compiler);
     ObjFunction *function = compiler->function;
 
+    if (compiler->parser->vm->optimize && !compiler->parser->hadError) {
+        optimizeChunk(currentChunk(compiler));
+    }
+
 #ifdef DEBUG_PRINT_CODE
     if (!compiler->parser->hadError) {
         disassembleChunk(currentChunk(compiler), function->name != NULL ? function->name->str : function->script->name->str);
@@ -578,12 +856,13 @@ static void string(Compiler *compiler, bool canAssign) {
 
 static void invokeMethod(const Compiler* compiler, const int argc, const char* name, const int length) {
     const uint16_t slot = makeConstant(compiler, OBJ_VAL(copyString(compiler->parser->vm, name, length)));
-    emitByteShort(compiler, OP_INVOKE, slot);
+    emitPropertyOp(compiler, OP_INVOKE, slot);
     emitByte(compiler, argc);
 }
 
 static void interpol(Compiler *compiler, const bool canAssign) {
     int count = 0;
+    reserveSlots(compiler, 1); // The string so far.
     do {
         bool concatenate = false;
         bool isString = false;
@@ -604,6 +883,7 @@ static void interpol(Compiler *compiler, const bool canAssign) {
         }
         count++;
     } while (match(compiler, TK_INTERPOLATION));
+    compiler->temporaries--;
 
     eat(compiler->parser, TK_STRING, "Expect end of string interpolation.");
     if (compiler->parser->previous.len > 2) {
@@ -621,11 +901,13 @@ static void array(Compiler *compiler, bool canAssign) {
         }
 
         expression(compiler);
+        reserveSlots(compiler, 1);
         if (++count > UINT16_MAX) {
             error(compiler->parser, "Can't have more than 65535 items in an array initializer.");
         }
     } while (match(compiler, TK_COMMA));
 
+    compiler->temporaries -= count;
     emitBytes(compiler, OP_NEW_ARRAY, count);
     eat(compiler->parser, TK_RBRACKET, "Expect ']' after array elements.");
 }
@@ -654,9 +936,11 @@ static void map(Compiler *compiler, bool canAssign) {
         }
         eat(compiler->parser, TK_COLON, "Expect ':'.");
         expression(compiler);
+        reserveSlots(compiler, 2);
         ++count;
     } while (match(compiler, TK_COMMA));
 
+    compiler->temporaries -= count * 2;
     emitBytes(compiler, OP_NEW_MAP, count);
     eat(compiler->parser, TK_RBRACE, "Expect closing '}'.");
 }
@@ -669,9 +953,11 @@ static void set(Compiler *compiler, bool canAssign) {
         }
 
         expression(compiler);
+        reserveSlots(compiler, 1);
         ++count;
     } while (match(compiler, TK_COMMA));
 
+    compiler->temporaries -= count;
     emitBytes(compiler, OP_NEW_SET, count);
     eat(compiler->parser, TK_RBRACE, "Expect closing '}'.");
 }
@@ -688,7 +974,9 @@ static void hash(Compiler *compiler, const bool canAssign) {
 static void index_(Compiler *compiler, Token prev, const bool canAssign) {
     if (match(compiler, TK_COLON)) {
         emitByte(compiler, OP_EMPTY);
+        reserveSlots(compiler, 1);
         expression(compiler);
+        compiler->temporaries--;
         emitByte(compiler, OP_SLICE);
         eat(compiler->parser, TK_RBRACKET, "Expect closing ']'.");
 
@@ -696,6 +984,8 @@ static void index_(Compiler *compiler, Token prev, const bool canAssign) {
     }
 
     expression(compiler);
+    // The index waits under the end of a slice or the value assigned.
+    reserveSlots(compiler, 1);
 
     if (match(compiler, TK_COLON)) {
         if (check(compiler, TK_RBRACKET)) {
@@ -703,6 +993,7 @@ static void index_(Compiler *compiler, Token prev, const bool canAssign) {
         } else {
             expression(compiler);
         }
+        compiler->temporaries--;
         emitByte(compiler, OP_SLICE);
         eat(compiler->parser, TK_RBRACKET, "Expect closing ']'.");
 
@@ -751,9 +1042,10 @@ static void index_(Compiler *compiler, Token prev, const bool canAssign) {
     } else {
         emitByte(compiler, OP_INDEX);
     }
+    compiler->temporaries--;
 }
 
-static void checkIfConst(const Compiler *compiler, const uint8_t setOp, const int arg) {
+static void checkIfConst(const Compiler *compiler, const uint8_t setOp, const int arg, ObjString *name) {
     if (setOp == OP_SET_LOCAL) {
         if (compiler->locals[arg].isConst) {
             // TODO(Skyler): Find a better way to do this.
@@ -763,15 +1055,8 @@ static void checkIfConst(const Compiler *compiler, const uint8_t setOp, const in
             error(compiler->parser, "Cannot assign to const variable '%s'.", name);
             free(name);
         }
-    } else if (setOp == OP_SET_GLOBAL) {
-        Value _;
-        ObjString *name = AS_STRING(currentChunk(compiler)->constants.values[arg]);
-        if (tableGet(&compiler->parser->vm->consts, name, &_)) {
-            error(compiler->parser, "Cannot assign to const variable '%s'.", name->str);
-        }
-    } else if (setOp == OP_SET_SCRIPT) {
+    } else if (setOp == OP_SET_GLOBAL || setOp == OP_SET_SCRIPT) {
         Value _;
-        ObjString *name = AS_STRING(currentChunk(compiler)->constants.values[arg]);
         if (tableGet(&compiler->parser->vm->consts, name, &_)) {
             error(compiler->parser, "Cannot assign to const variable '%s'.", name->str);
         }
@@ -780,6 +1065,7 @@ static void checkIfConst(const Compiler *compiler, const uint8_t setOp, const in
 
 static void namedVariable(Compiler *compiler, Token name, bool canAssign) {
     uint8_t getOp, setOp;
+    ObjString *str = NULL;
     int arg = resolveLocal(compiler, &name, false);
 
     if (arg != -1) {
@@ -789,29 +1075,33 @@ static void namedVariable(Compiler *compiler, Token name, bool canAssign) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = (int)identifierConstant(compiler, &name);
-        ObjString *str = copyString(compiler->parser->vm, name.start, name.len);
-        Value value;
-        if (tableGet(&compiler->parser->vm->globals, str, &value)) {
+        str = copyString(compiler->parser->vm, name.start, name.len);
+        Value slot;
+        if (tableGet(&compiler->parser->vm->globals, str, &slot)) {
             getOp = OP_GET_GLOBAL;
+            arg = TO_INT(slot);
             canAssign = false;
         } else {
             getOp = OP_GET_SCRIPT;
+            arg = scriptVariable(compiler, str);
         }
 
         setOp = OP_SET_SCRIPT;
     }
 
 #define EMIT_OP_EQ(token) do { \
-                              checkIfConst(compiler, setOp, arg); \
+                              checkIfConst(compiler, setOp, arg, str); \
+                              const int leftStart = currentChunk(compiler)->count; \
                               namedVariable(compiler, name, false); \
+                              reserveSlots(compiler, 1); \
                               expression(compiler); \
-                              emitByte(compiler, token); \
+                              compiler->temporaries--; \
+                              emitArithmetic(compiler, leftStart, token); \
                               emitByteShort(compiler, setOp, (uint16_t)arg); \
                           } while (false) \
 
     if (canAssign && match(compiler, TK_ASSIGN)) {
-        checkIfConst(compiler, setOp, arg);
+        checkIfConst(compiler, setOp, arg, str);
         expression(compiler);
         emitByteShort(compiler, setOp, (uint16_t)arg);
     }  else if (canAssign && match(compiler, TK_PLUSEQ)) {
@@ -835,17 +1125,32 @@ static void namedVariable(Compiler *compiler, Token name, bool canAssign) {
     } else if (canAssign && match(compiler, TK_NULL_COALESCE_EQ)) {
         EMIT_OP_EQ(OP_NULL_COALESCE);
     } else if (canAssign && match(compiler, TK_INC)) {
-        checkIfConst(compiler, setOp, arg);
-        namedVariable(compiler, name, false);
-        emitByte(compiler, OP_INC);
-        emitByteShort(compiler, setOp, (uint16_t)arg);
+        checkIfConst(compiler, setOp, arg, str);
+        if (setOp == OP_SET_LOCAL) {
+            emitByteShort(compiler, OP_INC_LOCAL, (uint16_t)arg);
+        } else {
+            namedVariable(compiler, name, false);
+            emitByte(compiler, OP_INC);
+            emitByteShort(compiler, setOp, (uint16_t)arg);
+        }
     } else if (canAssign && match(compiler, TK_DEC)) {
-        checkIfConst(compiler, setOp, arg);
-        namedVariable(compiler, name, false);
-        emitByte(compiler, OP_DEC);
-        emitByteShort(compiler, setOp, (uint16_t)arg);
+        checkIfConst(compiler, setOp, arg, str);
+        if (setOp == OP_SET_LOCAL) {
+            emitByteShort(compiler, OP_DEC_LOCAL, (uint16_t)arg);
+        } else {
+            namedVariable(compiler, name, false);
+            emitByte(compiler, OP_DEC);
+            emitByteShort(compiler, setOp, (uint16_t)arg);
+        }
     } else {
-        emitByteShort(compiler, getOp, (uint16_t)arg);
+        Value literal;
+        if (getOp == OP_GET_LOCAL && compiler->locals[arg].hasLiteral) {
+            emitLiteral(compiler, compiler->locals[arg].literal);
+        } else if (getOp == OP_GET_SCRIPT && tableGet(&compiler->parser->constLiterals, str, &literal)) {
+            emitLiteral(compiler, literal);
+        } else {
+            emitByteShort(compiler, getOp, (uint16_t)arg);
+        }
     }
 
 #undef EMIT_OP_EQ
@@ -876,7 +1181,9 @@ static void super_(Compiler *compiler, bool canAssign) {
 
     namedVariable(compiler, syntheticToken("this"), false);
     if (match(compiler, TK_LPAREN)) {
+        reserveSlots(compiler, 1);
         const uint8_t argc = argumentList(compiler);
+        compiler->temporaries--;
         namedVariable(compiler, syntheticToken("super"), false);
         emitByteShort(compiler, OP_INVOKE_SUPER, name);
         emitByte(compiler, argc);
@@ -911,36 +1218,45 @@ static void static_(Compiler *compiler, bool canAssign) {
 }
 
 static void binary(Compiler *compiler, Token prev, bool canAssign) {
+    const int leftStart = compiler->operandStart;
     const IlexTokenType operatorType = compiler->parser->previous.type;
     const IlexTokenType secondOp = compiler->parser->current.type;
     const ParseRule *rule = getRule(operatorType);
+    const int rightStart = currentChunk(compiler)->count;
     parsePrecedence(compiler, (Precedence)(rule->precedence + 1));
 
+    uint8_t op;
     switch (operatorType) {
-        case TK_NOTEQ:         emitByte(compiler, OP_NOTEQ); break;
-        case TK_IS: {
-            if (secondOp == TK_NOT) {
-                emitByte(compiler, OP_NOTEQ); break;
-            }
-        }
-        case TK_EQ:            emitByte(compiler, OP_EQ); break;
-        case TK_GR:            emitByte(compiler, OP_GR); break;
-        case TK_GREQ:          emitByte(compiler, OP_GREQ); break;
-        case TK_LT:            emitByte(compiler, OP_LT); break;
-        case TK_LTEQ:          emitByte(compiler, OP_LTEQ); break;
-        case TK_PLUS:          emitByte(compiler, OP_ADD); break;
-        case TK_MINUS:         emitByte(compiler, OP_SUB); break;
-        case TK_MUL:           emitByte(compiler, OP_MUL); break;
-        case TK_DIV:           emitByte(compiler, OP_DIV); break;
-        case TK_POW:           emitByte(compiler, OP_POW); break;
-        case TK_MOD:           emitByte(compiler, OP_MOD); break;
-        case TK_BIT_AND:       emitByte(compiler, OP_BIT_AND); break;
-        case TK_BIT_OR:        emitByte(compiler, OP_BIT_OR); break;
-        case TK_BIT_XOR:       emitByte(compiler, OP_BIT_XOR); break;
-        case TK_BIT_LS:        emitByte(compiler, OP_BIT_LS); break;
-        case TK_BIT_RS:        emitByte(compiler, OP_BIT_RS); break;
-        case TK_NULL_COALESCE: emitByte(compiler, OP_NULL_COALESCE); break;
-        default: break; // Unreachable.
+        case TK_NOTEQ:         op = OP_NOTEQ; break;
+        case TK_IS:            op = secondOp == TK_NOT ? OP_NOTEQ : OP_EQ; break;
+        case TK_EQ:            op = OP_EQ; break;
+        case TK_GR:            op = OP_GR; break;
+        case TK_GREQ:          op = OP_GREQ; break;
+        case TK_LT:            op = OP_LT; break;
+        case TK_LTEQ:          op = OP_LTEQ; break;
+        case TK_PLUS:          op = OP_ADD; break;
+        case TK_MINUS:         op = OP_SUB; break;
+        case TK_MUL:           op = OP_MUL; break;
+        case TK_DIV:           op = OP_DIV; break;
+        case TK_POW:           op = OP_POW; break;
+        case TK_MOD:           op = OP_MOD; break;
+        case TK_BIT_AND:       op = OP_BIT_AND; break;
+        case TK_BIT_OR:        op = OP_BIT_OR; break;
+        case TK_BIT_XOR:       op = OP_BIT_XOR; break;
+        case TK_BIT_LS:        op = OP_BIT_LS; break;
+        case TK_BIT_RS:        op = OP_BIT_RS; break;
+        case TK_NULL_COALESCE: op = OP_NULL_COALESCE; break;
+        default: return; // Unreachable.
+    }
+
+    if (foldBinary(compiler, leftStart, rightStart, op)) {
+        return;
+    }
+
+    if (op == OP_ADD || op == OP_SUB) {
+        emitArithmetic(compiler, leftStart, op);
+    } else {
+        emitByte(compiler, op);
     }
 }
 
@@ -987,7 +1303,7 @@ static void dot(Compiler *compiler, const Token prev, const bool canAssign) {
         if (compiler->class != NULL && (prev.type == TK_THIS || identifiersEqual(&prev, &compiler->class->name))) {
             emitByteShort(compiler, OP_INVOKE_THIS, name);
         } else {
-            emitByteShort(compiler, OP_INVOKE, name);
+            emitPropertyOp(compiler, OP_INVOKE, name);
         }
         emitByte(compiler, argc);
         return;
@@ -995,14 +1311,18 @@ static void dot(Compiler *compiler, const Token prev, const bool canAssign) {
 
 #define EMIT_OP_EQ(token) do { \
                               emitByteShort(compiler, OP_GET_PROPERTY_NO_POP, name); \
+                              reserveSlots(compiler, 1); \
                               expression(compiler); \
+                              compiler->temporaries--; \
                               emitByte(compiler, token); \
-                              emitByteShort(compiler, OP_SET_PROPERTY, name); \
+                              emitPropertyOp(compiler, OP_SET_PROPERTY, name); \
                           } while (false) \
 
 #define EMIT_OP_EQ_PRIV(token) do { \
                               emitByteShort(compiler, OP_GET_PRIVATE_PROPERTY_NO_POP, name); \
+                              reserveSlots(compiler, 1); \
                               expression(compiler); \
+                              compiler->temporaries--; \
                               emitByte(compiler, token); \
                               emitByteShort(compiler, OP_SET_PRIVATE_PROPERTY, name); \
                           } while (false) \
@@ -1046,7 +1366,7 @@ static void dot(Compiler *compiler, const Token prev, const bool canAssign) {
     } else {
         if (canAssign && match(compiler, TK_ASSIGN)) {
             expression(compiler);
-            emitByteShort(compiler, OP_SET_PROPERTY, name);
+            emitPropertyOp(compiler, OP_SET_PROPERTY, name);
         } else if (canAssign && match(compiler, TK_PLUSEQ)) {
             EMIT_OP_EQ(OP_ADD);
         } else if (canAssign && match(compiler, TK_MINUSEQ)) {
@@ -1070,13 +1390,13 @@ static void dot(Compiler *compiler, const Token prev, const bool canAssign) {
         } else if (canAssign && match(compiler, TK_INC)) {
             emitByteShort(compiler, OP_GET_PROPERTY_NO_POP, name);
             emitByte(compiler, OP_INC);
-            emitByteShort(compiler, OP_SET_PROPERTY, name);
+            emitPropertyOp(compiler, OP_SET_PROPERTY, name);
         } else if (canAssign && match(compiler, TK_DEC)) {
             emitByteShort(compiler, OP_GET_PROPERTY_NO_POP, name);
             emitByte(compiler, OP_DEC);
-            emitByteShort(compiler, OP_SET_PROPERTY, name);
+            emitPropertyOp(compiler, OP_SET_PROPERTY, name);
         } else {
-            emitByteShort(compiler, OP_GET_PROPERTY, name);
+            emitPropertyOp(compiler, OP_GET_PROPERTY, name);
         }
     }
 
@@ -1090,10 +1410,10 @@ static void scope(Compiler *compiler, Token prev, bool canAssign) {
 
     if (match(compiler, TK_LPAREN)) {
         const int argc = argumentList(compiler);
-        emitByteShort(compiler, OP_INVOKE, name);
+        emitPropertyOp(compiler, OP_INVOKE, name);
         emitByte(compiler, argc);
     } else {
-        emitByteShort(compiler, OP_GET_PROPERTY, name);
+        emitPropertyOp(compiler, OP_GET_PROPERTY, name);
     }
 }
 
@@ -1107,15 +1427,21 @@ static void literal(Compiler *compiler, bool canAssign) {
 }
 
 static void unary(Compiler *compiler, bool canAssign) {
-    const IlexTokenType op = compiler->parser->previous.type;
+    const IlexTokenType operatorType = compiler->parser->previous.type;
+    const int operandStart = currentChunk(compiler)->count;
 
     parsePrecedence(compiler, PREC_UNARY);
 
-    switch (op) {
-        case TK_NOT:     emitByte(compiler, OP_NOT);     break;
-        case TK_BIT_NOT: emitByte(compiler, OP_BIT_NOT); break;
-        case TK_MINUS:   emitByte(compiler, OP_NEG);     break;
-        default: break;
+    uint8_t op;
+    switch (operatorType) {
+        case TK_NOT:     op = OP_NOT;     break;
+        case TK_BIT_NOT: op = OP_BIT_NOT; break;
+        case TK_MINUS:   op = OP_NEG;     break;
+        default: return;
+    }
+
+    if (!foldUnary(compiler, operandStart, op)) {
+        emitByte(compiler, op);
     }
 }
 
@@ -1183,6 +1509,48 @@ static void typeof_(Compiler *compiler, bool canAssign) {
     emitByte(compiler, OP_TYPEOF);
 }
 
+// yield hands a value to whatever resumed the running fiber and evaluates to the value it gets resumed with. A bare
+// yield hands back null.
+static void yield_(Compiler *compiler, bool canAssign) {
+    if (match(compiler, TK_LPAREN)) {
+        if (check(compiler, TK_RPAREN)) {
+            emitByte(compiler, OP_NULL);
+        } else {
+            expression(compiler);
+        }
+        eat(compiler->parser, TK_RPAREN, "Expect ')' after value.");
+    } else if (check(compiler, TK_SEMICOLON) || check(compiler, TK_RPAREN) || check(compiler, TK_RBRACE) ||
+               check(compiler, TK_RBRACKET) || check(compiler, TK_COMMA)) {
+        emitByte(compiler, OP_NULL);
+    } else {
+        expression(compiler);
+    }
+
+    emitByte(compiler, OP_YIELD);
+}
+
+// resume(fiber, value) runs the fiber until it yields or returns and evaluates to what it yielded or returned. The
+// value is what the yield it is suspended at evaluates to, or the argument of its function if it hasn't started yet.
+static void resume_(Compiler *compiler, bool canAssign) {
+    if (!match(compiler, TK_LPAREN)) {
+        parsePrecedence(compiler, PREC_UNARY);
+        emitBytes(compiler, OP_NULL, OP_RESUME);
+        return;
+    }
+
+    expression(compiler);
+    if (match(compiler, TK_COMMA)) {
+        reserveSlots(compiler, 1);
+        expression(compiler);
+        compiler->temporaries--;
+    } else {
+        emitByte(compiler, OP_NULL);
+    }
+    eat(compiler->parser, TK_RPAREN, "Expect ')' after value.");
+
+    emitByte(compiler, OP_RESUME);
+}
+
 //                              prefix, infix, precedence
 ParseRule rules[] = {
         [TK_LPAREN]           = {grouping, call,    PREC_CALL},
@@ -1239,6 +1607,7 @@ ParseRule rules[] = {
         [TK_IF]               = {NULL,     NULL,    PREC_NONE},
         [TK_NULL]             = {literal,  NULL,    PREC_NONE},
         [TK_OR]               = {NULL,     or_,     PREC_OR},
+        [TK_RESUME]           = {resume_,  NULL,    PREC_NONE},
         [TK_RETURN]           = {NULL,     NULL,    PREC_NONE},
         [TK_SUPER]            = {super_,   NULL,    PREC_NONE},
         [TK_THIS]             = {this_,    NULL,    PREC_NONE},
@@ -1258,6 +1627,7 @@ ParseRule rules[] = {
         [TK_DEFAULT]          = {NULL,     NULL,    PREC_NONE},
         [TK_ASSERT]           = {NULL,     NULL,    PREC_NONE},
         [TK_TYPEOF]           = {typeof_,  NULL,    PREC_NONE},
+        [TK_YIELD]            = {yield_,   NULL,    PREC_NONE},
         [TK_PANIC]            = {NULL,     NULL,    PREC_NONE},
         [TK_INC]              = {NULL,     inc,     PREC_TERM},
         [TK_DEC]              = {NULL,     dec,     PREC_TERM},
@@ -1276,6 +1646,7 @@ static void parsePrecedence(Compiler *compiler, const Precedence precedence) {
     Parser *parser = compiler->parser;
     advance(parser);
 
+    const int start = currentChunk(compiler)->count;
     const ParsePrefixFn prefixRule = getRule(parser->previous.type)->prefix;
     if (prefixRule == NULL) {
         error(parser, "Expect expression.");
@@ -1299,7 +1670,10 @@ static void parsePrecedence(Compiler *compiler, const Precedence precedence) {
             infixRule = orr;
         }
 
+        compiler->operandStart = start;
+        reserveSlots(compiler, 1); // The left operand.
         infixRule(compiler, prev, canAssign);
+        compiler->temporaries--;
     }
 
     if (canAssign && match(compiler, TK_ASSIGN)) {
@@ -1511,7 +1885,7 @@ static void parseClassBody(Compiler *compiler) {
                 } else {
                     emitByte(compiler, OP_NULL);
                 }
-                emitByteShort(compiler, OP_SET_PROPERTY, name);
+                emitPropertyOp(compiler, OP_SET_PROPERTY, name);
 
                 match(compiler, TK_SEMICOLON);
             }
@@ -1554,7 +1928,7 @@ static void initClassCompiler(Compiler *compiler, ClassCompiler *classCompiler,
     classCompiler->enclosing = compiler->class;
     classCompiler->staticMethod = false;
     classCompiler->abstractClass = isAbstract;
-    initTable(&classCompiler->privateVariables);
+    initTable(&classCompiler->privateVariables, NULL);
     compiler->class = classCompiler;
 }
 
@@ -1656,13 +2030,19 @@ static void varDeclaration(Compiler *compiler, const bool isConst) {
         const uint16_t global = parseVariable(compiler, "Expect variable name.");
 
         // TODO: Error message for const when '=' is not present.
+        const int valueStart = currentChunk(compiler)->count;
         if (match(compiler, TK_ASSIGN) || isConst) {
             expression(compiler);
         } else {
             emitByte(compiler, OP_NULL);
         }
 
+        Value literal;
+        const bool hasLiteral = isConst && literalAt(compiler, valueStart, currentChunk(compiler)->count, &literal);
         defineVariable(compiler, global, isConst);
+        if (hasLiteral) {
+            constLiteral(compiler, global, literal);
+        }
     } while (match(compiler, TK_COMMA));
 
     match(compiler, TK_SEMICOLON);
@@ -1696,8 +2076,15 @@ static void varDeclaration2(Compiler *compiler, const bool isConst) {
     } else {
         eat(compiler->parser, TK_CONST_DECL, "Expect ::= after variable name.");
     }
+    const int valueStart = currentChunk(compiler)->count;
     expression(compiler);
+
+    Value literal;
+    const bool hasLiteral = isConst && literalAt(compiler, valueStart, currentChunk(compiler)->count, &literal);
     defineVariable(compiler, global, isConst);
+    if (hasLiteral) {
+        constLiteral(compiler, global, literal);
+    }
 
     match(compiler, TK_SEMICOLON);
 }
@@ -1739,82 +2126,6 @@ static void expressionStatement(Compiler *compiler) {
     emitByte(compiler, OP_POP);
 }
 
-static int getArgCount(const uint8_t *code, const ValueArray constants, const int ip) {
-    switch (code[ip]) {
-        case OP_NULL:
-        case OP_TRUE:
-        case OP_FALSE:
-        case OP_POP:
-        case OP_EQ:
-        case OP_GR:
-        case OP_LT:
-        case OP_ADD:
-        case OP_SUB:
-        case OP_MUL:
-        case OP_DIV:
-        case OP_POW:
-        case OP_MOD:
-        case OP_NOT:
-        case OP_NEG:
-        case OP_CLOSE_UPVALUE:
-        case OP_RETURN:
-        case OP_BREAK:
-        case OP_OPEN_FILE:
-        case OP_CHECK_ABSTRACT:
-            return 0;
-
-        case OP_CONSTANT:
-        case OP_GET_LOCAL:
-        case OP_SET_LOCAL:
-        case OP_GET_GLOBAL:
-        case OP_GET_UPVALUE:
-        case OP_SET_UPVALUE:
-        case OP_GET_PROPERTY:
-        case OP_GET_PROPERTY_NO_POP:
-        case OP_SET_PROPERTY:
-        case OP_GET_SUPER:
-        case OP_CALL:
-        case OP_METHOD:
-        case OP_USE:
-        case OP_MULTI_CASE:
-        case OP_GET_SCRIPT:
-        case OP_SET_SCRIPT:
-        case OP_DEFINE_SCRIPT:
-        case OP_NEW_MAP:
-            return 1;
-
-        case OP_JUMP:
-        case OP_CMP_JMP:
-        case OP_JUMP_IF_FALSE:
-        case OP_LOOP:
-        case OP_INVOKE:
-        case OP_INVOKE_THIS:
-        case OP_INVOKE_SUPER:
-        case OP_CLASS:
-        case OP_INHERIT:
-        case OP_USE_BUILTIN:
-            return 2;
-
-        case OP_USE_BUILTIN_VAR: {
-            const int argCount = code[ip + 2];
-
-            return 2 + argCount;
-        }
-
-        case OP_CLOSURE: {
-            const int constant = code[ip + 1];
-            const ObjFunction* loadedFn = AS_FUNCTION(constants.values[constant]);
-
-            // There is one byte for the constant, then two for each upvalue.
-            return 1 + (loadedFn->upvalueCount * 2);
-        }
-
-        default: return 0;
-    }
-
-    return 0;
-}
-
 static void endLoop(Compiler *compiler, const bool isDo) {
     if (!isDo && compiler->loop->end != -1) {
         patchJump(compiler, compiler->loop->end);
@@ -1834,7 +2145,7 @@ static void endLoop(Compiler *compiler, const bool isDo) {
             patchJump(compiler, i + 1);
             i += 3;
         } else {
-            i += 1 + getArgCount(compiler->function->chunk.code, compiler->function->chunk.constants, i);
+            i += instructionLength(&compiler->function->chunk, i);
         }
     }
 
@@ -1875,12 +2186,12 @@ static void forStatement(Compiler *compiler) {
     compiler->loop->end = -1; // Exit condition.
 
     if (!match(compiler, TK_SEMICOLON)) {
+        const int condStart = currentChunk(compiler)->count;
         expression(compiler);
         eat(compiler->parser, TK_SEMICOLON, "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        compiler->loop->end = emitJump(compiler, OP_JUMP_IF_FALSE);
-        emitByte(compiler, OP_POP); // Condition.
+        compiler->loop->end = emitConditionJump(compiler, condStart);
     }
 
     if (!match(compiler, TK_RPAREN)) {
@@ -1982,6 +2293,7 @@ static void matchStatement(Compiler *compiler) {
     }
 
     beginScope(compiler);
+    reserveSlots(compiler, 1); // The value matched, the cases are compared with it.
 
     eat(compiler->parser, TK_LBRACE, "Expect '{' after 'match' statement.");
     eat(compiler->parser, TK_WHEN, "Expect at least one 'when' block.");
@@ -1993,8 +2305,10 @@ static void matchStatement(Compiler *compiler) {
             int multipleCases = 0;
             do {
                 multipleCases++;
+                reserveSlots(compiler, 1);
                 expression(compiler);
             } while (match(compiler, TK_COMMA));
+            compiler->temporaries -= multipleCases;
             emitBytes(compiler, OP_MULTI_CASE, multipleCases);
         }
         if (!check(compiler, TK_COLON) && !check(compiler, TK_ARROW)) {
@@ -2064,6 +2378,7 @@ static void matchStatement(Compiler *compiler) {
     }
 
     eat(compiler->parser, TK_RBRACE, "Expect '}' after 'when' blocks.");
+    compiler->temporaries--;
     endScope(compiler);
 
     for (int i = 0; i < caseCount; i++) {
@@ -2073,6 +2388,23 @@ static void matchStatement(Compiler *compiler) {
     }
 }
 
+static void ifStatement(Compiler *compiler);
+
+static void elseBranch(Compiler *compiler) {
+    if (match(compiler, TK_ELIF)) {
+        ifStatement(compiler);
+    } else if (match(compiler, TK_ELSE)) {
+        if (match(compiler, TK_IF)) {
+            ifStatement(compiler);
+        } else {
+            eat(compiler->parser, TK_LBRACE, "Expect '{' after 'else'.");
+            beginScope(compiler);
+            block(compiler);
+            endScope(compiler);
+        }
+    }
+}
+
 static void ifStatement(Compiler *compiler) {
     bool expectClosingParen = false;
 
@@ -2081,14 +2413,36 @@ static void ifStatement(Compiler *compiler) {
         expectClosingParen = true;
     }
 
+    const int condStart = currentChunk(compiler)->count;
     expression(compiler);
 
     if (expectClosingParen) {
         eat(compiler->parser, TK_RPAREN, "Expect ')' after condition.");
     }
 
-    const int thenJump = emitJump(compiler, OP_JUMP_IF_FALSE);
-    emitByte(compiler, OP_POP);
+    // A literal condition picks the branch at compile time, the other one is dropped.
+    Value condition;
+    if (literalAt(compiler, condStart, currentChunk(compiler)->count, &condition)) {
+        discardCode(compiler, condStart);
+        const bool taken = !isFalsy(condition);
+
+        eat(compiler->parser, TK_LBRACE, "Expect '{' after if statement.");
+        beginScope(compiler);
+        block(compiler);
+        endScope(compiler);
+        if (!taken) {
+            discardCode(compiler, condStart);
+        }
+
+        const int elseStart = currentChunk(compiler)->count;
+        elseBranch(compiler);
+        if (taken) {
+            discardCode(compiler, elseStart);
+        }
+        return;
+    }
+
+    const int thenJump = emitConditionJump(compiler, condStart);
 
     eat(compiler->parser, TK_LBRACE, "Expect '{' after if statement.");
     beginScope(compiler);
@@ -2099,18 +2453,7 @@ static void ifStatement(Compiler *compiler) {
     patchJump(compiler, thenJump);
     emitByte(compiler, OP_POP);
 
-    if (match(compiler, TK_ELIF)) {
-        ifStatement(compiler);
-    } else if (match(compiler, TK_ELSE)) {
-        if (match(compiler, TK_IF)) {
-            ifStatement(compiler);
-        } else {
-            eat(compiler->parser, TK_LBRACE, "Expect '{' after 'else'.");
-            beginScope(compiler);
-            block(compiler);
-            endScope(compiler);
-        }
-    }
+    elseBranch(compiler);
     patchJump(compiler, elseJump);
 }
 
@@ -2128,14 +2471,22 @@ static void whileStatement(Compiler *compiler) {
         expectClosingParen = true;
     }
 
+    const int condStart = currentChunk(compiler)->count;
     expression(compiler);
 
     if (expectClosingParen) {
         eat(compiler->parser, TK_RPAREN, "Expect ')' after condition.");
     }
 
-    compiler->loop->end = emitJump(compiler, OP_JUMP_IF_FALSE);
-    emitByte(compiler, OP_POP);
+    // A literal condition needs no test, and a false one no loop at all.
+    Value condition;
+    const bool literal = literalAt(compiler, condStart, currentChunk(compiler)->count, &condition);
+    if (literal) {
+        discardCode(compiler, condStart);
+        compiler->loop->end = -1;
+    } else {
+        compiler->loop->end = emitConditionJump(compiler, condStart);
+    }
     compiler->loop->body = compiler->function->chunk.count;
 
     eat(compiler->parser, TK_LBRACE, "Expect '{' after while loop.");
@@ -2145,6 +2496,10 @@ static void whileStatement(Compiler *compiler) {
 
     emitLoop(compiler, compiler->loop->start);
     endLoop(compiler, false);
+
+    if (literal && isFalsy(condition)) {
+        discardCode(compiler, loop.start);
+    }
 }
 
 static void doWhileStatement(Compiler *compiler) {
@@ -2433,6 +2788,7 @@ static void withStatement(Compiler *compiler) {
 
     const int fileIdx = compiler->localCount;
     Local *local = &compiler->locals[compiler->localCount++];
+    reserveSlots(compiler, 0);
     local->depth = compiler->scopeDepth;
     local->name = compiler->withVarName == NULL ? syntheticToken("file") : syntheticToken(compiler->withVarName);
     local->isCaptured = false;
@@ -2555,8 +2911,9 @@ ObjFunction *compile(VM *vm, ObjScript *script,  const char *source) {
     parser.hadError = false;
     parser.panicMode = false;
     parser.script = script;
+    initTable(&parser.constLiterals, NULL);
 
-    initLexer(source);
+    initLexer(&parser.lexer, source);
     Compiler compiler;
     initCompiler(&parser, &compiler, NULL, TYPE_TOP_LEVEL, ACCESS_PUBLIC);
     firstAdvance(&compiler);
@@ -2567,11 +2924,15 @@ ObjFunction *compile(VM *vm, ObjScript *script,  const char *source) {
     }
 
     ObjFunction *function = endCompiler(&compiler);
+    freeTable(vm, &parser.constLiterals);
     return parser.hadError ? NULL : function;
 }
 
 void markCompilerRoots(VM *vm) {
     const Compiler *compiler = vm->compiler;
+    if (compiler != NULL) {
+        markTable(vm, &compiler->parser->constLiterals);
+    }
 
     while (compiler != NULL) {
         const ClassCompiler *classCompiler = vm->compiler->class;
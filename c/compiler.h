@@ -10,12 +10,14 @@
 
 typedef struct {
     VM *vm;
+    Lexer lexer;
     Token current;
     Token previous;
     Token next;
     bool hadError;
     bool panicMode;
     ObjScript *script;
+    Table constLiterals; // Top level consts initialised with a literal, their reads push the literal.
 } Parser;
 
 typedef struct {
@@ -23,6 +25,8 @@ typedef struct {
     int depth;
     bool isConst;
     bool isCaptured;
+    bool hasLiteral; // A const initialised with a literal, its reads push the literal.
+    Value literal;
 } Local;
 
 typedef struct {
@@ -57,6 +61,7 @@ typedef struct Compiler {
 
     Local *locals; //TODO(Skyler): Grow this.
     int localCount;
+    int temporaries; // Values waiting on the stack for the expression being compiled, see reserveSlots().
     Upvalue *upvalues; //TODO(Skyler): Grow this.
     int scopeDepth;
     uint16_t currentLibName;
@@ -64,6 +69,7 @@ typedef struct Compiler {
     Loop *loop;
     bool isWithBlock;
     char *withVarName;
+    int operandStart; // Where the left operand of the infix rule being compiled starts.
 } Compiler;
 
 ObjFunction *compile(VM *vm, ObjScript *script, const char *source);
@@ -39,6 +39,31 @@ static int invokeInstruction(const char *name, const Chunk *chunk, int offset) {
     return offset + 4;
 }
 
+static int cachedInstruction(const char *name, const Chunk *chunk, int offset) {
+    uint16_t cache = (uint16_t)(chunk->code[offset + 1] << 8);
+    cache |= chunk->code[offset + 2];
+    uint16_t constant = (uint16_t)(chunk->code[offset + 3] << 8);
+    constant |= chunk->code[offset + 4];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' (cache %d)\n", cache);
+
+    return offset + 5;
+}
+
+static int cachedInvokeInstruction(const char *name, const Chunk *chunk, int offset) {
+    uint16_t cache = (uint16_t)(chunk->code[offset + 1] << 8);
+    cache |= chunk->code[offset + 2];
+    uint16_t constant = (uint16_t)(chunk->code[offset + 3] << 8);
+    constant |= chunk->code[offset + 4];
+    uint8_t argCount = chunk->code[offset + 5];
+    printf("%-16s (%d args) %4d '", name, argCount, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' (cache %d)\n", cache);
+
+    return offset + 6;
+}
+
 static int simpleInstruction(const char *name, int offset) {
     printf("%s\n", name);
     return offset + 1;
@@ -64,6 +89,41 @@ static int jumpInstruction(const char *name, int sign, const Chunk *chunk, int o
     return offset + 3;
 }
 
+static int localConstantInstruction(const char *name, const Chunk *chunk, int offset) {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot |= chunk->code[offset + 2];
+    uint16_t constant = (uint16_t)(chunk->code[offset + 3] << 8);
+    constant |= chunk->code[offset + 4];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 5;
+}
+
+static int localsJumpInstruction(const char *name, const Chunk *chunk, int offset) {
+    uint16_t a = (uint16_t)(chunk->code[offset + 1] << 8);
+    a |= chunk->code[offset + 2];
+    uint16_t b = (uint16_t)(chunk->code[offset + 3] << 8);
+    b |= chunk->code[offset + 4];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 5] << 8);
+    jump |= chunk->code[offset + 6];
+    printf("%-16s %4d %4d %4d -> %d\n", name, a, b, offset, offset + 7 + jump);
+    return offset + 7;
+}
+
+static int localConstantJumpInstruction(const char *name, const Chunk *chunk, int offset) {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot |= chunk->code[offset + 2];
+    uint16_t constant = (uint16_t)(chunk->code[offset + 3] << 8);
+    constant |= chunk->code[offset + 4];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 5] << 8);
+    jump |= chunk->code[offset + 6];
+    printf("%-16s %4d '", name, slot);
+    printValue(chunk->constants.values[constant]);
+    printf("' %4d -> %d\n", offset, offset + 7 + jump);
+    return offset + 7;
+}
+
 static int useBuiltinInstruction(const char* name, const Chunk* chunk, int offset) {
     uint16_t lib = (uint16_t)(chunk->code[offset + 2] << 8);
     lib |= chunk->code[offset + 3];
@@ -119,21 +179,21 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         case OP_FALSE: return simpleInstruction("OP_FALSE", offset);
         case OP_POP: return simpleInstruction("OP_POP", offset);
         case OP_GET_LOCAL: return shortInstruction("OP_GET_LOCAL", chunk, offset);
-        case OP_GET_GLOBAL: return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+        case OP_GET_GLOBAL: return shortInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE: return shortInstruction("OP_GET_UPVALUE", chunk, offset);
-        case OP_GET_PROPERTY: return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+        case OP_GET_PROPERTY: return cachedInstruction("OP_GET_PROPERTY", chunk, offset);
         case OP_GET_PROPERTY_NO_POP: return constantInstruction("OP_GET_PROPERTY_NO_POP", chunk, offset);
         case OP_GET_PRIVATE_PROPERTY: return constantInstruction("OP_GET_PRIVATE_PROPERTY", chunk, offset);
         case OP_GET_PRIVATE_PROPERTY_NO_POP: return constantInstruction("OP_GET_PRIVATE_PROPERTY_NO_POP", chunk, offset);
         case OP_GET_SUPER: return constantInstruction("OP_GET_SUPER", chunk, offset);
-        case OP_GET_SCRIPT: return constantInstruction("OP_GET_SCRIPT", chunk, offset);
-        case OP_DEFINE_GLOBAL: return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-        case OP_DEFINE_SCRIPT: return constantInstruction("OP_DEFINE_SCRIPT", chunk, offset);
+        case OP_GET_SCRIPT: return shortInstruction("OP_GET_SCRIPT", chunk, offset);
+        case OP_DEFINE_GLOBAL: return shortInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_DEFINE_SCRIPT: return shortInstruction("OP_DEFINE_SCRIPT", chunk, offset);
         case OP_SET_LOCAL: return shortInstruction("OP_SET_LOCAL", chunk, offset);
-        case OP_SET_GLOBAL: return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL: return shortInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_SET_UPVALUE: return shortInstruction("OP_SET_UPVALUE", chunk, offset);
-        case OP_SET_PROPERTY: return constantInstruction("OP_SET_PROPERTY", chunk, offset);
-        case OP_SET_SCRIPT: return constantInstruction("OP_SET_SCRIPT", chunk, offset);
+        case OP_SET_PROPERTY: return cachedInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_SET_SCRIPT: return shortInstruction("OP_SET_SCRIPT", chunk, offset);
         case OP_SET_PRIVATE_PROPERTY: return constantInstruction("OP_SET_PRIVATE_PROPERTY", chunk, offset);
         case OP_SET_CLASS_STATIC_VAR: return constantInstruction("OP_SET_CLASS_STATIC_VAR", chunk, offset);
         case OP_EQ: return simpleInstruction("OP_EQ", offset);
@@ -159,7 +219,7 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         case OP_JUMP_DO_WHILE: return jumpInstruction("OP_JUMP_DO_WHILE", -1, chunk, offset);
         case OP_LOOP: return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL: return byteInstruction("OP_CALL", chunk, offset);
-        case OP_INVOKE: return invokeInstruction("OP_INVOKE", chunk, offset);
+        case OP_INVOKE: return cachedInvokeInstruction("OP_INVOKE", chunk, offset);
         case OP_INVOKE_SUPER: return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
         case OP_INVOKE_THIS: return invokeInstruction("OP_INVOKE_THIS", chunk, offset);
         case OP_CLOSURE: {
@@ -205,9 +265,27 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         case OP_OPEN_FILE: return constantInstruction("OP_OPEN_FILE", chunk, offset);
         case OP_CLOSE_FILE: return constantInstruction("OP_CLOSE_FILE", chunk, offset);
         case OP_DEFINE_DEFAULT: return constantInstruction("OP_DEFINE_DEFAULT", chunk, offset);
+        case OP_YIELD: return simpleInstruction("OP_YIELD", offset);
+        case OP_RESUME: return simpleInstruction("OP_RESUME", offset);
         case OP_ENUM: return constantInstruction("OP_ENUM", chunk, offset);
         case OP_ENUM_SET_VALUE: return constantInstruction("OP_ENUM_SET_VALUE", chunk, offset);
         case OP_OR: return simpleInstruction("OP_OR", offset);
+        case OP_INC_LOCAL: return shortInstruction("OP_INC_LOCAL", chunk, offset);
+        case OP_DEC_LOCAL: return shortInstruction("OP_DEC_LOCAL", chunk, offset);
+        case OP_ADD_LOCAL_CONST: return localConstantInstruction("OP_ADD_LOCAL_CONST", chunk, offset);
+        case OP_SUB_LOCAL_CONST: return localConstantInstruction("OP_SUB_LOCAL_CONST", chunk, offset);
+        case OP_LT_LOCALS_JMP: return localsJumpInstruction("OP_LT_LOCALS_JMP", chunk, offset);
+        case OP_LTEQ_LOCALS_JMP: return localsJumpInstruction("OP_LTEQ_LOCALS_JMP", chunk, offset);
+        case OP_GR_LOCALS_JMP: return localsJumpInstruction("OP_GR_LOCALS_JMP", chunk, offset);
+        case OP_GREQ_LOCALS_JMP: return localsJumpInstruction("OP_GREQ_LOCALS_JMP", chunk, offset);
+        case OP_LT_LOCAL_CONST_JMP: return localConstantJumpInstruction("OP_LT_LOCAL_CONST_JMP", chunk, offset);
+        case OP_LTEQ_LOCAL_CONST_JMP: return localConstantJumpInstruction("OP_LTEQ_LOCAL_CONST_JMP", chunk, offset);
+        case OP_GR_LOCAL_CONST_JMP: return localConstantJumpInstruction("OP_GR_LOCAL_CONST_JMP", chunk, offset);
+        case OP_GREQ_LOCAL_CONST_JMP: return localConstantJumpInstruction("OP_GREQ_LOCAL_CONST_JMP", chunk, offset);
+        case OP_ADD_NUM: return simpleInstruction("OP_ADD_NUM", offset);
+        case OP_EQ_NUM: return simpleInstruction("OP_EQ_NUM", offset);
+        case OP_NOTEQ_NUM: return simpleInstruction("OP_NOTEQ_NUM", offset);
+        case OP_INDEX_ARRAY: return simpleInstruction("OP_INDEX_ARRAY", offset);
         default:
             printf("??? Unknown opcode %d\n", instruction);
             return offset + 1;
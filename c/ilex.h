@@ -100,15 +100,22 @@ typedef void (*ErrorCallback)(const char *msg);
 #define TAG_FALSE 2 // 10.
 #define TAG_TRUE  3 // 11.
 #define TAG_ERR   4 // 10.
+#define TAG_UNDEFINED 5 // 101.
+// Whole numbers that fit in 32 bits keep the integer in the low half, see numToValue().
+#define TAG_INT   ((uint64_t)0x0001000000000000)
 
 #define IS_BOOL(value)      (((value) | 1u) == TRUE_VAL)
 #define IS_NULL(value)      ((value) == NULL_VAL)
-#define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
+#define IS_INT(value)       (((value) & (SIGN_BIT | QNAN | TAG_INT)) == (QNAN | TAG_INT))
+#define IS_NUMBER(value)    (((value) & (QNAN | TAG_INT)) != QNAN) // Pointers are below TAG_INT, see OBJ_VAL.
 #define IS_ERR(value)       ((value) == ERROR_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
 #define IS_OBJ(value)       (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
 #define AS_BOOL(value)      ((value) == TRUE_VAL)
 #define AS_NUMBER(value)    valueToNum(value)
+#define AS_INT(value)       ((int32_t)(uint32_t)(value))
+#define TO_INT(value)       valueToInt(value) // Any number, truncated like a cast from a double.
 #define AS_OBJ(value)       ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
 
 
@@ -117,8 +124,10 @@ typedef void (*ErrorCallback)(const char *msg);
 #define TRUE_VAL        ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NULL_VAL        ((Value)(uint64_t)(QNAN | TAG_NULL))
 #define ERROR_VAL       ((Value)(uint64_t)(QNAN | TAG_ERR))
+#define UNDEFINED_VAL   ((Value)(uint64_t)(QNAN | TAG_UNDEFINED)) // A variable slot that has not been defined yet.
 #define NUMBER_VAL(num) numToValue(num)
-#define ZERO_VAL        numToValue(0)
+#define INT_VAL(i)      ((Value)(QNAN | TAG_INT | (uint32_t)(int32_t)(i)))
+#define ZERO_VAL        INT_VAL(0)
 #define OBJ_VAL(obj)    (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
 #define OBJ_TYPE(value)        (AS_OBJ(value)->type)
@@ -138,6 +147,7 @@ typedef void (*ErrorCallback)(const char *msg);
 #define IS_MAP(value)          isObjType(value, OBJ_MAP)
 #define IS_SET(value)          isObjType(value, OBJ_SET)
 #define IS_ABSTRACT(value)     isObjType(value, OBJ_ABSTRACT)
+#define IS_FIBER(value)        isObjType(value, OBJ_FIBER)
 #define IS_WINDOW(value)       isObjType(value, OBJ_WINDOW)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
@@ -155,6 +165,7 @@ typedef void (*ErrorCallback)(const char *msg);
 #define AS_MAP(value)          ((ObjMap*)AS_OBJ(value))
 #define AS_SET(value)          ((ObjSet*)AS_OBJ(value))
 #define AS_ABSTRACT(value)     ((ObjAbstract*)AS_OBJ(value))
+#define AS_FIBER(value)        ((ObjFiber*)AS_OBJ(value))
 #define AS_WINDOW(value)       ((ObjWindow*)AS_OBJ(value))
 
 typedef union {
@@ -164,14 +175,32 @@ typedef union {
 } IlexDouble;
 
 static inline double valueToNum(const Value value) {
+    if (IS_INT(value)) {
+        return AS_INT(value);
+    }
+
     IlexDouble data;
     data.bits64 = value;
     return data.num;
 }
 
-static inline Value numToValue(double num) {
+static inline int valueToInt(const Value value) {
+    return IS_INT(value) ? AS_INT(value) : (int)valueToNum(value);
+}
+
+// Every number has exactly one Value, so numbers are still equal and hash the same when their bits are. Whole numbers
+// that fit in 32 bits are integers, everything else, -0 included, is a double.
+static inline Value numToValue(const double num) {
     IlexDouble data;
     data.num = num;
+    // At most 2^31 either way, which rules out NaN too, so the cast is defined.
+    if ((data.bits64 & ~SIGN_BIT) <= 0x41E0000000000000u) {
+        const int64_t whole = (int64_t)num;
+        if (whole == num && whole <= INT32_MAX && data.bits64 != SIGN_BIT) {
+            return INT_VAL(whole);
+        }
+    }
+
     return data.bits64;
 }
 
@@ -191,6 +220,7 @@ typedef enum {
     OBJ_MAP,
     OBJ_SET,
     OBJ_ABSTRACT,
+    OBJ_FIBER,
 
     OBJ_WINDOW,
 } ObjType;
@@ -216,34 +246,54 @@ typedef enum {
     TYPE_TOP_LEVEL,
 } FunctionType;
 
+typedef struct Obj Obj;
+
 typedef struct {
     int capacity;
     int count;
     Value *values;
+    Obj *owner; // Object the array belongs to, for the write barrier. NULL when it isn't part of an object.
 } ValueArray;
 
+// Remembers what the last lookup at a property access or invoke site found, so the next lookup on an instance with the
+// same shape can skip the hash tables.
+typedef struct {
+    struct Shape *shape; // Shape of the instance the cache was filled from, NULL while the cache is empty.
+    int slot;            // Slot of the field, -1 when the name is a method.
+    Value method;
+} InlineCache;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t *code;
     int *lines;
+    bool sharedCode; // code points into a cache file the VM keeps mapped or a program, see bytecode.c.
+    bool readOnlyCode; // code belongs to a program other VMs run too, run() doesn't quicken it.
     ValueArray constants;
+    int cacheCount;
+    int cacheCapacity;
+    InlineCache *caches;
 } Chunk;
 
-typedef struct Obj Obj;
-
 struct Obj {
     ObjType type;
     bool isMarked;
-    Obj *next;
+    bool isOld;        // Survived a collection, only traced by full collections.
+    bool isRemembered; // In the remembered set, see writeBarrier().
+    bool isFree;       // An empty block in an arena, see allocateObjectBlock().
 };
 
-typedef struct {
+typedef struct ObjString ObjString;
+
+struct ObjString {
     Obj obj;
     int len;
-    char *str;
     uint32_t hash;
-} ObjString;
+    bool isHashed; // Long strings are hashed on demand, see stringHash().
+    char *str;     // Points at chars for short strings, NULL while a long string is a rope, see flattenString().
+    char chars[];  // The characters of a short string, a long one has room for the halves of a rope here.
+};
 
 typedef struct {
     ObjString *key;
@@ -256,6 +306,7 @@ typedef struct {
     int count;
     int capacity;
     Entry *entries;
+    Obj *owner; // Object the table belongs to, for the write barrier. NULL when it isn't part of an object.
 } Table;
 
 typedef struct {
@@ -263,19 +314,26 @@ typedef struct {
     ObjString *name;
     ObjString *path;
     Table values;
+    Table variables; // Top level variable name -> slot in variableValues, resolved by the compiler.
+    ValueArray variableValues;
     bool used;
 } ObjScript;
 
+typedef struct JitCode JitCode;
+
 typedef struct {
     Obj obj;
     int arity;
     int arityDefault;
     int upvalueCount;
+    int maxSlots; // Most locals the function has at once, call() makes room for them.
     Chunk chunk;
     ObjString *name;
     FunctionType type;
     AccessLevel accessLevel;
     ObjScript *script;
+    int hotness;  // Calls and loop iterations counted towards compiling it, see jit.c.
+    JitCode *jit; // NULL until it is compiled.
 } ObjFunction;
 
 typedef struct {
@@ -309,13 +367,30 @@ typedef struct ObjClass {
     Table fields;
     Table privateFields;
     ClassType type;
+    struct Shape **shapes; // Every shape handed out to instances of this class, they live as long as the class.
+    int shapeCount;
+    int shapeCapacity;
+    struct Shape *rootShape; // Shape new instances start with, NULL until the next instance after the fields change.
 } ObjClass;
 
+// The field layout shared by instances. Maps field names to slots in the instance's fields array.
+typedef struct Shape {
+    ObjClass *objClass;
+    Table fields;        // Public field names to slots.
+    Table privateFields; // Private field names to slots.
+    Table transitions;   // Private field name to the index in objClass->shapes of this shape with that field added.
+    int slotCount;
+    Value *defaults;     // Slot values new instances start with, only on root shapes.
+    bool dictionary;     // Belongs to a single instance and is changed in place.
+} Shape;
+
 typedef struct {
     Obj obj;
     ObjClass *objClass;
-    Table fields;
-    Table privateFields;
+    Shape *shape;
+    int fieldCapacity;
+    bool ownsShape; // Has its own dictionary shape, freeing doesn't look at the shape since the class might be gone.
+    Value *fields;
 } ObjInstance;
 
 typedef struct {
@@ -386,6 +461,9 @@ struct ObjAbstract {
     AbstractFreeFn feeFn;
 };
 
+// Defined in vm.h, next to the call frames it holds.
+typedef struct ObjFiber ObjFiber;
+
 typedef struct {
     Obj obj;
     struct tm time;
@@ -400,15 +478,34 @@ typedef struct {
 extern "C" {
 #endif
 
+// A VM and everything allocated by it belong to the thread using it. Different VMs share no state, so a host can run
+// one on each of its threads. Only the things a process has one of are shared: the working directory, environment
+// variables, the standard streams, and the window, which has to be used from the main thread.
 VM *initVM(const char *path, int argc, char **argv);
 void freeVM(VM *vm);
 void runFile(VM *vm, const char *path);
 
+// A script compiled once and run by any number of VMs on any threads. Every VM gets its own objects and the code of
+// the program is shared. A VM can only run a program compiled by a VM with the same natives and libraries, and the
+// program has to be freed after every VM that ran it.
+typedef struct IlexProgram IlexProgram;
+
+IlexProgram *compileProgram(VM *vm, const char *scriptName, const char *source);
+InterpretResult runProgram(VM *vm, const IlexProgram *program);
+void freeProgram(IlexProgram *program);
+
 void runtimeError(VM *vm, const char *format, ...);
 
 void setRuntimeErrorCallback(VM *vm, ErrorCallback runtimeCallback);
 void setAssertErrorCallback(VM *vm, ErrorCallback assertCallback);
 void setPanicErrorCallback(VM *vm, ErrorCallback panicCallback);
+void setFrameLimit(VM *vm, int frameLimit);
+// Scripts compiled from now on go through the bytecode optimizer, like -O.
+void setOptimize(VM *vm, bool optimize);
+// Functions are compiled to machine code after threshold calls and loop iterations, like -J. 0 turns it off. Only
+// x86-64 has a JIT, see jit.h.
+#define ILEX_JIT_THRESHOLD 1000 // For -J without a threshold.
+void setJitThreshold(VM *vm, int threshold);
 
 ObjScript *newScript(VM *vm, ObjString *name);
 ObjString *copyString(VM *vm, const char *str, int len);
@@ -0,0 +1,707 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#include "jit.h"
+
+#ifdef ILEX_JIT
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+// A template JIT. Every instruction it knows is translated on its own into machine code that works on the same stack,
+// locals and constants as run(). Nothing is kept in registers from one instruction to the next, so the machine code can
+// be started at any instruction and can hand control back to run() before any instruction. It does so at instructions
+// it doesn't know and at ones whose operands aren't what it was translated for, like an ADD of two strings. run() then
+// runs the instruction itself, errors included, and comes back in after the next call, return or loop.
+//
+// rbx holds the frame's slots, r12 the stack top, r13 the constants, r14 where the stack top is stored on the way out
+// and rbp the QNAN mask. The way out returns the offset of the instruction run() carries on with.
+//
+// Numbers follow numToValue(): two integers are worked on as integers while the result fits, anything else as doubles,
+// and every result is stored the way numToValue() would store it.
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RSI 6
+#define R12 12
+#define R13 13
+#define R14 14
+
+#define CC_O  0x0
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_A  0x7
+#define CC_S  0x8
+#define CC_P  0xA
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+#define ALWAYS -1
+
+// The upper half of every integer Value.
+#define INT_HIGH ((uint32_t)(INT_VAL(0) >> 32))
+
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_DIV 0x5E
+
+typedef size_t (*JitFn)(Value *slots, Value *sp, const Value *constants, const uint8_t *entry, Value **spOut);
+
+typedef struct {
+    int at;     // Where the rel32 goes.
+    int target; // Offset of the instruction it jumps to.
+    bool exit;  // To the way out at the instruction instead of its code.
+} Patch;
+
+typedef struct {
+    uint8_t *code;
+    int count;
+    int capacity;
+    Patch *patches;
+    int patchCount;
+    int patchCapacity;
+} Assembler;
+
+static void emitByte(Assembler *as, const uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        as->capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+        as->code = (uint8_t*)realloc(as->code, as->capacity);
+        if (as->code == NULL) {
+            exit(69);
+        }
+    }
+
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler *as, const uint8_t *bytes, const int count) {
+    for (int i = 0; i < count; ++i) {
+        emitByte(as, bytes[i]);
+    }
+}
+
+#define EMIT(as, ...) emitBytes(as, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emitInt(Assembler *as, const uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        emitByte(as, (uint8_t)(value >> i * 8));
+    }
+}
+
+static void emitLong(Assembler *as, const uint64_t value) {
+    emitInt(as, (uint32_t)value);
+    emitInt(as, (uint32_t)(value >> 32));
+}
+
+static void addPatch(Assembler *as, const int target, const bool toExit) {
+    if (as->patchCapacity < as->patchCount + 1) {
+        as->patchCapacity = as->patchCapacity < 64 ? 64 : as->patchCapacity * 2;
+        as->patches = (Patch*)realloc(as->patches, sizeof(Patch) * as->patchCapacity);
+        if (as->patches == NULL) {
+            exit(69);
+        }
+    }
+
+    as->patches[as->patchCount++] = (Patch){as->count, target, toExit};
+    emitInt(as, 0);
+}
+
+// op reg, [base + disp] with 64 bit operands.
+static void emitMemory(Assembler *as, const uint8_t op, const int reg, const int base, const int32_t disp) {
+    emitByte(as, 0x48 | (reg & 8) >> 1 | (base & 8) >> 3);
+    emitByte(as, op);
+    emitByte(as, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP) {
+        emitByte(as, 0x24);
+    }
+    emitInt(as, (uint32_t)disp);
+}
+
+static void load(Assembler *as, const int reg, const int base, const int32_t disp) {
+    emitMemory(as, 0x8B, reg, base, disp);
+}
+
+static void store(Assembler *as, const int base, const int32_t disp, const int reg) {
+    emitMemory(as, 0x89, reg, base, disp);
+}
+
+// Only for rax to rdi.
+static void loadImmediate(Assembler *as, const int reg, const uint64_t value) {
+    EMIT(as, 0x48, 0xB8 + reg);
+    emitLong(as, value);
+}
+
+static void pushValue(Assembler *as, const int reg) {
+    store(as, R12, 0, reg);
+    EMIT(as, 0x49, 0x83, 0xC4, 0x08); // add r12, 8
+}
+
+static void dropValue(Assembler *as) {
+    EMIT(as, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+}
+
+static void jump(Assembler *as, const int target) {
+    emitByte(as, 0xE9);
+    addPatch(as, target, false);
+}
+
+static void branch(Assembler *as, const uint8_t condition, const int target, const bool toExit) {
+    EMIT(as, 0x0F, 0x80 | condition);
+    addPatch(as, target, toExit);
+}
+
+// cmp rax, value. Uses rcx.
+static void compareTo(Assembler *as, const uint64_t value) {
+    loadImmediate(as, RCX, value);
+    EMIT(as, 0x48, 0x39, 0xC8);
+}
+
+// A jump forward within the code of one instruction, land() points it at where the code is now.
+static int jumpForward(Assembler *as, const int condition) {
+    if (condition == ALWAYS) {
+        emitByte(as, 0xE9);
+    } else {
+        EMIT(as, 0x0F, 0x80 | condition);
+    }
+
+    emitInt(as, 0);
+    return as->count - 4;
+}
+
+static void land(Assembler *as, const int at) {
+    const uint32_t rel = (uint32_t)(as->count - (at + 4));
+    for (int i = 0; i < 4; ++i) {
+        as->code[at + i] = (uint8_t)(rel >> i * 8);
+    }
+}
+
+// Jumps unless rax and rdx both hold integers. Uses rcx and rsi.
+static int unlessInts(Assembler *as) {
+    EMIT(as, 0x48, 0x89, 0xC1);       // mov rcx, rax
+    EMIT(as, 0x48, 0xC1, 0xE9, 0x20); // shr rcx, 32
+    EMIT(as, 0x48, 0x89, 0xD6);       // mov rsi, rdx
+    EMIT(as, 0x48, 0xC1, 0xEE, 0x20); // shr rsi, 32
+    EMIT(as, 0x81, 0xF1);             // xor ecx, INT_HIGH
+    emitInt(as, INT_HIGH);
+    EMIT(as, 0x81, 0xF6);             // xor esi, INT_HIGH
+    emitInt(as, INT_HIGH);
+    EMIT(as, 0x09, 0xF1);             // or ecx, esi
+    return jumpForward(as, CC_NE);
+}
+
+// rax = the integer in ecx.
+static void boxInt(Assembler *as) {
+    EMIT(as, 0x89, 0xC8); // mov eax, ecx
+    loadImmediate(as, RDX, INT_VAL(0));
+    EMIT(as, 0x48, 0x09, 0xD0); // or rax, rdx
+}
+
+// rax = the double in xmm0, as an integer when it is a whole number that fits. Uses rcx, rdx and xmm1.
+static void boxDouble(Assembler *as) {
+    EMIT(as, 0xF2, 0x0F, 0x2C, 0xC8);       // cvttsd2si ecx, xmm0
+    EMIT(as, 0xF2, 0x0F, 0x2A, 0xC9);       // cvtsi2sd xmm1, ecx
+    EMIT(as, 0x66, 0x48, 0x0F, 0x7E, 0xC0); // movq rax, xmm0
+    EMIT(as, 0x66, 0x0F, 0x2E, 0xC1);       // ucomisd xmm0, xmm1
+    const int unordered = jumpForward(as, CC_P);
+    const int fraction = jumpForward(as, CC_NE);
+    EMIT(as, 0x85, 0xC9);                   // test ecx, ecx
+    const int nonZero = jumpForward(as, CC_NE);
+    EMIT(as, 0x48, 0x85, 0xC0);             // test rax, rax
+    const int negativeZero = jumpForward(as, CC_S);
+    land(as, nonZero);
+    boxInt(as);
+    land(as, unordered);
+    land(as, fraction);
+    land(as, negativeZero);
+}
+
+// xmm = the number in reg, which is rax or rdx. Leaves for run() at the instruction unless it holds one. Uses rcx.
+static void toDouble(Assembler *as, const int reg, const int xmm, const int offset) {
+    EMIT(as, 0x48, 0x89, 0xC0 | reg << 3 | RCX); // mov rcx, reg
+    EMIT(as, 0x48, 0x21, 0xE9);                  // and rcx, rbp
+    EMIT(as, 0x48, 0x39, 0xE9);                  // cmp rcx, rbp
+    const int isDouble = jumpForward(as, CC_NE);
+    EMIT(as, 0x48, 0x89, 0xC0 | reg << 3 | RCX); // mov rcx, reg
+    EMIT(as, 0x48, 0xC1, 0xE9, 0x20);            // shr rcx, 32
+    EMIT(as, 0x81, 0xF9);                        // cmp ecx, INT_HIGH
+    emitInt(as, INT_HIGH);
+    branch(as, CC_NE, offset, true);
+    EMIT(as, 0xF2, 0x0F, 0x2A, 0xC0 | xmm << 3 | reg); // cvtsi2sd xmm, reg32
+    const int done = jumpForward(as, ALWAYS);
+    land(as, isDouble);
+    EMIT(as, 0x66, 0x48, 0x0F, 0x6E, 0xC0 | xmm << 3 | reg); // movq xmm, reg
+    land(as, done);
+}
+
+// Leaves for run() at the instruction unless reg holds a number. Uses rcx.
+static void guardNumber(Assembler *as, const int reg, const int offset) {
+    EMIT(as, 0x48, 0x89, 0xC0 | reg << 3 | RCX); // mov rcx, reg
+    EMIT(as, 0x48, 0x21, 0xE9);                  // and rcx, rbp
+    EMIT(as, 0x48, 0x39, 0xE9);                  // cmp rcx, rbp
+    const int isDouble = jumpForward(as, CC_NE);
+    EMIT(as, 0x48, 0x89, 0xC0 | reg << 3 | RCX); // mov rcx, reg
+    EMIT(as, 0x48, 0xC1, 0xE9, 0x20);            // shr rcx, 32
+    EMIT(as, 0x81, 0xF9);                        // cmp ecx, INT_HIGH
+    emitInt(as, INT_HIGH);
+    branch(as, CC_NE, offset, true);
+    land(as, isDouble);
+}
+
+// rax = a op b for the numbers in rax and rdx, op being OP_ADD, OP_SUB, OP_MUL or OP_DIV.
+static void arithmetic(Assembler *as, const uint8_t op, const int offset) {
+    int toDoubles[3];
+    int count = 0;
+    int done = 0;
+    if (op != OP_DIV) {
+        toDoubles[count++] = unlessInts(as);
+        EMIT(as, 0x89, 0xC1);                 // mov ecx, eax
+        if (op == OP_ADD) {
+            EMIT(as, 0x01, 0xD1);             // add ecx, edx
+        } else if (op == OP_SUB) {
+            EMIT(as, 0x29, 0xD1);             // sub ecx, edx
+        } else {
+            EMIT(as, 0x0F, 0xAF, 0xCA);       // imul ecx, edx
+        }
+        toDoubles[count++] = jumpForward(as, CC_O);
+        if (op == OP_MUL) {
+            // 0 times a negative number is -0.
+            EMIT(as, 0x85, 0xC9);             // test ecx, ecx
+            const int nonZero = jumpForward(as, CC_NE);
+            EMIT(as, 0x89, 0xC6);             // mov esi, eax
+            EMIT(as, 0x09, 0xD6);             // or esi, edx
+            toDoubles[count++] = jumpForward(as, CC_S);
+            land(as, nonZero);
+        }
+        boxInt(as);
+        done = jumpForward(as, ALWAYS);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        land(as, toDoubles[i]);
+    }
+    toDouble(as, RAX, 0, offset);
+    toDouble(as, RDX, 1, offset);
+    const uint8_t sse = op == OP_ADD ? SSE_ADD : op == OP_SUB ? SSE_SUB : op == OP_MUL ? SSE_MUL : SSE_DIV;
+    EMIT(as, 0xF2, 0x0F, sse, 0xC1); // op xmm0, xmm1
+    boxDouble(as);
+    if (op != OP_DIV) {
+        land(as, done);
+    }
+}
+
+// al = whether the comparison of the numbers in rax and rdx holds. NaN never does, like in C.
+static void compare(Assembler *as, const uint8_t op, const int offset) {
+    uint8_t condition;
+    uint8_t doubleCondition = CC_A;
+    bool swap = false;
+    switch (op) {
+        case OP_GR:
+        case OP_GR_LOCALS_JMP:
+        case OP_GR_LOCAL_CONST_JMP:
+            condition = CC_G;
+            break;
+        case OP_GREQ:
+        case OP_GREQ_LOCALS_JMP:
+        case OP_GREQ_LOCAL_CONST_JMP:
+            condition = CC_GE;
+            doubleCondition = CC_AE;
+            break;
+        case OP_LT:
+        case OP_LT_LOCALS_JMP:
+        case OP_LT_LOCAL_CONST_JMP:
+            condition = CC_L;
+            swap = true;
+            break;
+        default:
+            condition = CC_LE;
+            doubleCondition = CC_AE;
+            swap = true;
+            break;
+    }
+
+    const int notInts = unlessInts(as);
+    EMIT(as, 0x39, 0xD0);                     // cmp eax, edx
+    EMIT(as, 0x0F, 0x90 | condition, 0xC0);   // setcc al
+    const int done = jumpForward(as, ALWAYS);
+    land(as, notInts);
+    toDouble(as, RAX, 0, offset);
+    toDouble(as, RDX, 1, offset);
+    if (swap) {
+        EMIT(as, 0x66, 0x0F, 0x2E, 0xC8);     // ucomisd xmm1, xmm0
+    } else {
+        EMIT(as, 0x66, 0x0F, 0x2E, 0xC1);     // ucomisd xmm0, xmm1
+    }
+    EMIT(as, 0x0F, 0x90 | doubleCondition, 0xC0);
+    land(as, done);
+}
+
+// rax = the bool in al.
+static void boxBool(Assembler *as) {
+    EMIT(as, 0x0F, 0xB6, 0xC0); // movzx eax, al
+    loadImmediate(as, RCX, FALSE_VAL);
+    EMIT(as, 0x48, 0x01, 0xC8); // add rax, rcx
+}
+
+// rax = a, rdx = b from the top of the stack.
+static void operands(Assembler *as) {
+    load(as, RAX, R12, -16);
+    load(as, RDX, R12, -8);
+}
+
+static bool translate(VM *vm, const ObjFunction *function, Assembler *as, const int offset) {
+    const uint8_t *code = &function->chunk.code[offset];
+    const uint8_t op = code[0];
+    const int length = instructionLength(&function->chunk, offset);
+    const int first = length >= 3 ? code[1] << 8 | code[2] : 0;
+    const int second = length >= 5 ? code[3] << 8 | code[4] : 0;
+
+    switch (op) {
+        case OP_CONSTANT:
+            load(as, RAX, R13, first * 8);
+            pushValue(as, RAX);
+            return true;
+        case OP_NULL:
+        case OP_TRUE:
+        case OP_FALSE:
+            loadImmediate(as, RAX, op == OP_NULL ? NULL_VAL : BOOL_VAL(op == OP_TRUE));
+            pushValue(as, RAX);
+            return true;
+        case OP_POP:
+            dropValue(as);
+            return true;
+        case OP_GET_LOCAL:
+            load(as, RAX, RBX, first * 8);
+            pushValue(as, RAX);
+            return true;
+        case OP_SET_LOCAL:
+            load(as, RAX, R12, -8);
+            store(as, RBX, first * 8, RAX);
+            return true;
+        case OP_GET_GLOBAL:
+            // The array can grow, it is looked up every time.
+            loadImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->globalValues.values);
+            load(as, RAX, RAX, 0);
+            load(as, RAX, RAX, first * 8);
+            pushValue(as, RAX);
+            return true;
+        case OP_GET_SCRIPT:
+            if (function->script == NULL) {
+                return false;
+            }
+
+            loadImmediate(as, RAX, (uint64_t)(uintptr_t)&function->script->variableValues.values);
+            load(as, RAX, RAX, 0);
+            load(as, RAX, RAX, first * 8);
+            compareTo(as, UNDEFINED_VAL);
+            branch(as, CC_E, offset, true);
+            pushValue(as, RAX);
+            return true;
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            operands(as);
+            arithmetic(as, op == OP_ADD_NUM ? OP_ADD : op, offset);
+            store(as, R12, -16, RAX);
+            dropValue(as);
+            return true;
+        case OP_GR:
+        case OP_GREQ:
+        case OP_LT:
+        case OP_LTEQ:
+            operands(as);
+            compare(as, op, offset);
+            boxBool(as);
+            store(as, R12, -16, RAX);
+            dropValue(as);
+            return true;
+        case OP_EQ:
+        case OP_EQ_NUM:
+        case OP_NOTEQ:
+        case OP_NOTEQ_NUM:
+            // Numbers are equal when their bits are, like in valuesEqual().
+            operands(as);
+            guardNumber(as, RAX, offset);
+            guardNumber(as, RDX, offset);
+            EMIT(as, 0x48, 0x39, 0xD0);                                              // cmp rax, rdx
+            EMIT(as, 0x0F, 0x90 | (op == OP_EQ || op == OP_EQ_NUM ? CC_E : CC_NE), 0xC0); // setcc al
+            boxBool(as);
+            store(as, R12, -16, RAX);
+            dropValue(as);
+            return true;
+        case OP_INC:
+        case OP_DEC:
+            load(as, RAX, R12, -8);
+            loadImmediate(as, RDX, INT_VAL(1));
+            arithmetic(as, op == OP_INC ? OP_ADD : OP_SUB, offset);
+            store(as, R12, -8, RAX);
+            return true;
+        case OP_NEG:
+            load(as, RAX, R12, -8);
+            toDouble(as, RAX, 0, offset);
+            EMIT(as, 0x66, 0x48, 0x0F, 0x7E, 0xC0); // movq rax, xmm0
+            loadImmediate(as, RCX, SIGN_BIT);
+            EMIT(as, 0x48, 0x31, 0xC8);             // xor rax, rcx
+            EMIT(as, 0x66, 0x48, 0x0F, 0x6E, 0xC0); // movq xmm0, rax
+            boxDouble(as);
+            store(as, R12, -8, RAX);
+            return true;
+        case OP_NOT:
+            // Only bools, run() has the rest of isFalsy().
+            load(as, RAX, R12, -8);
+            EMIT(as, 0x48, 0x89, 0xC1);       // mov rcx, rax
+            EMIT(as, 0x48, 0x83, 0xC9, 0x01); // or rcx, 1
+            loadImmediate(as, RDX, TRUE_VAL);
+            EMIT(as, 0x48, 0x39, 0xD1);       // cmp rcx, rdx
+            branch(as, CC_NE, offset, true);
+            EMIT(as, 0x48, 0x83, 0xF0, 0x01); // xor rax, 1
+            store(as, R12, -8, RAX);
+            return true;
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+            load(as, RAX, RBX, first * 8);
+            loadImmediate(as, RDX, INT_VAL(1));
+            arithmetic(as, op == OP_INC_LOCAL ? OP_ADD : OP_SUB, offset);
+            store(as, RBX, first * 8, RAX);
+            pushValue(as, RAX);
+            return true;
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUB_LOCAL_CONST:
+            load(as, RAX, RBX, first * 8);
+            load(as, RDX, R13, second * 8);
+            arithmetic(as, op == OP_ADD_LOCAL_CONST ? OP_ADD : OP_SUB, offset);
+            pushValue(as, RAX);
+            return true;
+        case OP_JUMP:
+            jump(as, offset + length + first);
+            return true;
+        case OP_LOOP:
+            jump(as, offset + length - first);
+            return true;
+        case OP_JUMP_IF_FALSE:
+            // Only bools and null, run() has the rest of isFalsy(). None of them pop the condition.
+            load(as, RAX, R12, -8);
+            compareTo(as, FALSE_VAL);
+            branch(as, CC_E, offset + length + first, false);
+            compareTo(as, NULL_VAL);
+            branch(as, CC_E, offset + length + first, false);
+            compareTo(as, TRUE_VAL);
+            branch(as, CC_NE, offset, true);
+            return true;
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_DO_WHILE:
+            load(as, RAX, R12, -8);
+            compareTo(as, TRUE_VAL);
+            branch(as, CC_E, op == OP_JUMP_IF_TRUE ? offset + length + first : offset + length - first, false);
+            compareTo(as, FALSE_VAL);
+            branch(as, CC_E, offset + length, false);
+            compareTo(as, NULL_VAL);
+            branch(as, CC_NE, offset, true);
+            return true;
+        case OP_LT_LOCALS_JMP:
+        case OP_LTEQ_LOCALS_JMP:
+        case OP_GR_LOCALS_JMP:
+        case OP_GREQ_LOCALS_JMP:
+        case OP_LT_LOCAL_CONST_JMP:
+        case OP_LTEQ_LOCAL_CONST_JMP:
+        case OP_GR_LOCAL_CONST_JMP:
+        case OP_GREQ_LOCAL_CONST_JMP: {
+            const bool locals = op <= OP_GREQ_LOCALS_JMP;
+            load(as, RAX, RBX, first * 8);
+            load(as, RDX, locals ? RBX : R13, second * 8);
+            compare(as, op, offset);
+            EMIT(as, 0x84, 0xC0); // test al, al
+            branch(as, CC_NE, offset + length, false);
+            // False is left for the pop at the target.
+            loadImmediate(as, RAX, FALSE_VAL);
+            pushValue(as, RAX);
+            jump(as, offset + length + (code[5] << 8 | code[6]));
+            return true;
+        }
+        case OP_INDEX:
+        case OP_INDEX_ARRAY:
+            // Only arrays by an integer in bounds, run() has everything else.
+            if (sizeof(ObjType) != sizeof(uint32_t)) {
+                return false;
+            }
+
+            load(as, RAX, R12, -16);
+            load(as, RDX, R12, -8);
+            EMIT(as, 0x48, 0x89, 0xD1);       // mov rcx, rdx
+            EMIT(as, 0x48, 0xC1, 0xE9, 0x20); // shr rcx, 32
+            EMIT(as, 0x81, 0xF9);             // cmp ecx, INT_HIGH
+            emitInt(as, INT_HIGH);
+            branch(as, CC_NE, offset, true);
+            loadImmediate(as, RSI, SIGN_BIT | QNAN);
+            EMIT(as, 0x48, 0x89, 0xC1); // mov rcx, rax
+            EMIT(as, 0x48, 0x21, 0xF1); // and rcx, rsi
+            EMIT(as, 0x48, 0x39, 0xF1); // cmp rcx, rsi
+            branch(as, CC_NE, offset, true);
+            EMIT(as, 0x48, 0xF7, 0xD6); // not rsi
+            EMIT(as, 0x48, 0x21, 0xF0); // and rax, rsi
+            EMIT(as, 0x81, 0xB8);       // cmp dword [rax + type], OBJ_ARRAY
+            emitInt(as, offsetof(Obj, type));
+            emitInt(as, OBJ_ARRAY);
+            branch(as, CC_NE, offset, true);
+            EMIT(as, 0x89, 0xD1);                   // mov ecx, edx
+            EMIT(as, 0x8B, 0x90);                   // mov edx, [rax + count]
+            emitInt(as, offsetof(ObjArray, data) + offsetof(ValueArray, count));
+            EMIT(as, 0x85, 0xC9);                   // test ecx, ecx
+            EMIT(as, 0x79, 0x02);                   // jns over the add
+            EMIT(as, 0x01, 0xD1);                   // add ecx, edx
+            EMIT(as, 0x39, 0xD1);                   // cmp ecx, edx
+            branch(as, CC_AE, offset, true);
+            load(as, RAX, RAX, offsetof(ObjArray, data) + offsetof(ValueArray, values));
+            EMIT(as, 0x48, 0x63, 0xC9);             // movsxd rcx, ecx
+            EMIT(as, 0x48, 0x8B, 0x04, 0xC8);       // mov rax, [rax + rcx * 8]
+            store(as, R12, -16, RAX);
+            dropValue(as);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns offset in eax through the way out.
+static void exitAt(Assembler *as, const int offset, const int out) {
+    emitByte(as, 0xB8);
+    emitInt(as, (uint32_t)offset);
+    emitByte(as, 0xE9);
+    emitInt(as, (uint32_t)(out - (as->count + 4)));
+}
+
+void compileJit(VM *vm, ObjFunction *function) {
+    const Chunk *chunk = &function->chunk;
+    Assembler as = {NULL, 0, 0, NULL, 0, 0};
+    int *labels = (int*)malloc(sizeof(int) * chunk->count);
+    int *exits = (int*)malloc(sizeof(int) * chunk->count);
+    uint32_t *entries = (uint32_t*)calloc(chunk->count, sizeof(uint32_t));
+    if (labels == NULL || exits == NULL || entries == NULL) {
+        exit(69);
+    }
+
+    // push rbp, rbx, r12, r13, r14. rbx = slots, r12 = sp, r13 = constants, r14 = spOut, rbp = QNAN, jmp entry.
+    EMIT(&as, 0x55, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56);
+    EMIT(&as, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5, 0x4D, 0x89, 0xC6);
+    EMIT(&as, 0x48, 0xBD);
+    emitLong(&as, QNAN);
+    EMIT(&as, 0xFF, 0xE1);
+
+    // The way out: store sp, pop r14, r13, r12, rbx, rbp and return.
+    const int out = as.count;
+    store(&as, R14, 0, R12);
+    EMIT(&as, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        labels[offset] = as.count;
+        exits[offset] = -1;
+        if (translate(vm, function, &as, offset)) {
+            entries[offset] = (uint32_t)labels[offset];
+        } else {
+            exitAt(&as, offset, out);
+        }
+    }
+
+    for (int i = 0; i < as.patchCount; ++i) {
+        const Patch *patch = &as.patches[i];
+        int destination = labels[patch->target];
+        if (patch->exit) {
+            if (exits[patch->target] == -1) {
+                exits[patch->target] = as.count;
+                exitAt(&as, patch->target, out);
+            }
+            destination = exits[patch->target];
+        }
+
+        const uint32_t rel = (uint32_t)(destination - (patch->at + 4));
+        for (int j = 0; j < 4; ++j) {
+            as.code[patch->at + j] = (uint8_t)(rel >> j * 8);
+        }
+    }
+
+    free(labels);
+    free(exits);
+    free(as.patches);
+
+    uint8_t *code = (uint8_t*)mmap(NULL, as.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (code == MAP_FAILED) {
+        free(as.code);
+        free(entries);
+        return;
+    }
+
+    memcpy(code, as.code, as.count);
+    free(as.code);
+    if (mprotect(code, as.count, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, as.count);
+        free(entries);
+        return;
+    }
+
+    JitCode *jit = (JitCode*)malloc(sizeof(JitCode));
+    if (jit == NULL) {
+        exit(69);
+    }
+
+    jit->code = code;
+    jit->size = as.count;
+    jit->bytecode = chunk->code;
+    jit->entries = entries;
+    function->jit = jit;
+}
+
+void freeJit(ObjFunction *function) {
+    JitCode *jit = function->jit;
+    if (jit == NULL) {
+        return;
+    }
+
+    munmap(jit->code, jit->size);
+    free(jit->entries);
+    free(jit);
+    function->jit = NULL;
+}
+
+uint8_t *runJit(const JitCode *jit, uint8_t *ip, Value *slots, const Value *constants, Value **sp) {
+    const uint32_t entry = jit->entries[ip - jit->bytecode];
+    if (entry == 0) {
+        return ip;
+    }
+
+    const JitFn fn = (JitFn)(void*)jit->code;
+    return jit->bytecode + fn(slots, *sp, constants, jit->code + entry, sp);
+}
+
+#else
+
+void compileJit(VM *vm, ObjFunction *function) {
+    (void)vm;
+    (void)function;
+}
+
+void freeJit(ObjFunction *function) {
+    (void)function;
+}
+
+uint8_t *runJit(const JitCode *jit, uint8_t *ip, Value *slots, const Value *constants, Value **sp) {
+    (void)jit;
+    (void)slots;
+    (void)constants;
+    (void)sp;
+    return ip;
+}
+
+#endif
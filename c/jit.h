@@ -0,0 +1,31 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_JIT_H__
+#define __C_JIT_H__
+
+#include "ilex.h"
+
+// Hot functions are compiled to x86-64 machine code when the VM is started with -J, see jit.c. Define ILEX_NO_JIT to
+// leave it out, it is also left out on other machines and when tracing execution.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && !defined(ILEX_NO_JIT) && \
+    !defined(DEBUG_TRACE_EXECUTION) && !defined(DEBUG_MODE)
+#   define ILEX_JIT
+#endif
+
+struct JitCode {
+    uint8_t *code;
+    size_t size;
+    uint8_t *bytecode; // The chunk's code, offsets into it are what the machine code and run() agree on.
+    uint32_t *entries; // Where each instruction starts in code, 0 for instructions left to run().
+};
+
+// Compiles the function, every instruction the JIT can't translate gives control back to run().
+void compileJit(VM *vm, ObjFunction *function);
+void freeJit(ObjFunction *function);
+// Runs the function's machine code from ip for as long as it can. Returns where run() carries on, which is ip itself
+// when there is no machine code for it.
+uint8_t *runJit(const JitCode *jit, uint8_t *ip, Value *slots, const Value *constants, Value **sp);
+
+#endif //__C_JIT_H__
@@ -8,26 +8,14 @@
 #include "ilex.h"
 #include "lexer.h"
 
-typedef struct {
-    const char *start;
-    const char *current;
-    char previous;
-    int line;
-    bool interpolation;
-    int interpolationDepth;
-    char stringChar;
-} Lexer;
-
-Lexer lexer;
-
-void initLexer(const char *source) {
-    lexer.start = source;
-    lexer.current = source;
-    lexer.previous = '\0';
-    lexer.line = 1;
-    lexer.interpolation = false;
-    lexer.interpolationDepth = 0;
-    lexer.stringChar = '\0';
+void initLexer(Lexer *lexer, const char *source) {
+    lexer->start = source;
+    lexer->current = source;
+    lexer->previous = '\0';
+    lexer->line = 1;
+    lexer->interpolation = false;
+    lexer->interpolationDepth = 0;
+    lexer->stringChar = '\0';
 }
 
 static bool isAlpha(const char c) {
@@ -50,91 +38,91 @@ static bool isAlphaNumeric(const char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (c >= '0' && c <= '9');
 }
 
-static bool atEnd() {
-    return *lexer.current == '\0';
+static bool atEnd(Lexer *lexer) {
+    return *lexer->current == '\0';
 }
 
-static Token makeToken(const IlexTokenType type) {
+static Token makeToken(Lexer *lexer, const IlexTokenType type) {
     Token token;
     token.type = type;
-    token.start = lexer.start;
-    token.len = (int)(lexer.current - lexer.start);
-    token.line = lexer.line;
+    token.start = lexer->start;
+    token.len = (int)(lexer->current - lexer->start);
+    token.line = lexer->line;
 
     return token;
 }
 
-static Token errorToken(const char* message) {
+static Token errorToken(Lexer *lexer, const char* message) {
     Token token;
     token.type = TK_ERROR;
     token.start = message;
     token.len = (int)strlen(message);
-    token.line = lexer.line;
+    token.line = lexer->line;
 
     return token;
 }
 
-static char advance() {
-    lexer.previous = *lexer.current;
-    lexer.current++;
-    return lexer.current[-1];
+static char advance(Lexer *lexer) {
+    lexer->previous = *lexer->current;
+    lexer->current++;
+    return lexer->current[-1];
 }
 
-static char peek() {
-    return *lexer.current;
+static char peek(Lexer *lexer) {
+    return *lexer->current;
 }
 
-static char peekNext() {
-    if (atEnd()) {
+static char peekNext(Lexer *lexer) {
+    if (atEnd(lexer)) {
         return '\0';
     }
 
-    return lexer.current[1];
+    return lexer->current[1];
 }
 
-static char peekn(const int n) {
-    if (atEnd()) {
+static char peekn(Lexer *lexer, const int n) {
+    if (atEnd(lexer)) {
         return '\0';
     }
 
-    return lexer.current[n];
+    return lexer->current[n];
 }
 
-static void skipWhitespace() {
+static void skipWhitespace(Lexer *lexer) {
     for (;;) {
-        const char c = peek();
+        const char c = peek(lexer);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                advance(lexer);
                 break;
             case '\n':
-                ++lexer.line;
-                advance();
+                ++lexer->line;
+                advance(lexer);
                 break;
             case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' && !atEnd()) {
-                        advance();
+                if (peekNext(lexer) == '/') {
+                    while (peek(lexer) != '\n' && !atEnd(lexer)) {
+                        advance(lexer);
                     }
-                } else if (peekNext() == '-' || peekNext() == '*') {
+                } else if (peekNext(lexer) == '-' || peekNext(lexer) == '*') {
                     int level = 0;
-                    advance();
-                    while (!atEnd() && (level >= 1 || !((peek() == '-' || peek() == '*') && peekNext() == '/'))) {
-                        if (peek() == '\n') {
-                            lexer.line++;
-                        } else if (peek() == '/' && (peekNext() == '-' || peekNext() == '*')) {
+                    advance(lexer);
+                    while (!atEnd(lexer) && (level >= 1 || !((peek(lexer) == '-' || peek(lexer) == '*') && peekNext(lexer) == '/'))) {
+                        if (peek(lexer) == '\n') {
+                            lexer->line++;
+                        } else if (peek(lexer) == '/' && (peekNext(lexer) == '-' || peekNext(lexer) == '*')) {
                             ++level;
-                        } else if ((peek() == '-' || peek() == '*') && peekNext() == '/') {
+                        } else if ((peek(lexer) == '-' || peek(lexer) == '*') && peekNext(lexer) == '/') {
                             --level;
                         }
 
-                        advance();
+                        advance(lexer);
                     }
 
-                    advance(); // - or *
-                    advance();// /
+                    advance(lexer); // - or *
+                    advance(lexer);// /
                 } else {
                     return;
                 }
@@ -145,61 +133,61 @@ static void skipWhitespace() {
     }
 }
 
-static IlexTokenType checkKeyword(const int start, const int len, const char *rest, const IlexTokenType type) {
-    if (lexer.current - lexer.start == start + len && memcmp(lexer.start + start, rest, len) == 0) {
+static IlexTokenType checkKeyword(Lexer *lexer, const int start, const int len, const char *rest, const IlexTokenType type) {
+    if (lexer->current - lexer->start == start + len && memcmp(lexer->start + start, rest, len) == 0) {
         return type;
     }
 
     return TK_IDENT;
 }
 
-static IlexTokenType checkKeyword2(const int start, const int len, const char *rest, const IlexTokenType type, const int start2, const int len2, const char *rest2, const IlexTokenType type2) {
-    IlexTokenType tokenType = checkKeyword(start, len, rest, type);
+static IlexTokenType checkKeyword2(Lexer *lexer, const int start, const int len, const char *rest, const IlexTokenType type, const int start2, const int len2, const char *rest2, const IlexTokenType type2) {
+    IlexTokenType tokenType = checkKeyword(lexer, start, len, rest, type);
     if (tokenType == TK_IDENT) {
-        tokenType = checkKeyword(start2, len2, rest2, type2);
+        tokenType = checkKeyword(lexer, start2, len2, rest2, type2);
     }
 
     return tokenType;
 }
 
-static bool match(const char expected) {
-    if (atEnd()) {
+static bool match(Lexer *lexer, const char expected) {
+    if (atEnd(lexer)) {
         return false;
     }
 
-    if (*lexer.current != expected) {
+    if (*lexer->current != expected) {
         return false;
     }
-    lexer.current++;
+    lexer->current++;
 
     return true;
 }
 
-static IlexTokenType identType() {
-    switch (lexer.start[0]) {
+static IlexTokenType identType(Lexer *lexer) {
+    switch (lexer->start[0]) {
         case 'a': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'b': return checkKeyword(2, 6, "stract", TK_ABSTRACT);
-                    case 'n': return checkKeyword(2, 1, "d", TK_AND);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'b': return checkKeyword(lexer, 2, 6, "stract", TK_ABSTRACT);
+                    case 'n': return checkKeyword(lexer, 2, 1, "d", TK_AND);
                     case 's':
-                        if (lexer.start[2] == 's') {
-                            return checkKeyword(2, 4, "sert", TK_ASSERT);
+                        if (lexer->start[2] == 's') {
+                            return checkKeyword(lexer, 2, 4, "sert", TK_ASSERT);
                         }
-                        return checkKeyword(2, 0, "", TK_AS);
+                        return checkKeyword(lexer, 2, 0, "", TK_AS);
                     default: break;
                 }
             }
         } break;
-        case 'b': return checkKeyword(1, 4, "reak", TK_BREAK);
+        case 'b': return checkKeyword(lexer, 1, 4, "reak", TK_BREAK);
         case 'c': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'l': return checkKeyword(2, 3, "ass", TK_CLASS);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'l': return checkKeyword(lexer, 2, 3, "ass", TK_CLASS);
                     case 'o': {
-                        const IlexTokenType tk = checkKeyword(2, 3, "nst", TK_CONST);
+                        const IlexTokenType tk = checkKeyword(lexer, 2, 3, "nst", TK_CONST);
                         if (tk == TK_IDENT) {
-                            return checkKeyword(2, 6, "ntinue", TK_CONTINUE);
+                            return checkKeyword(lexer, 2, 6, "ntinue", TK_CONTINUE);
                         }
                         return tk;
                     }
@@ -208,392 +196,401 @@ static IlexTokenType identType() {
             }
         } break;
         case 'd': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'e': return checkKeyword(2, 5, "fault", TK_DEFAULT);
-                    case 'o': return checkKeyword(2, 0, "", TK_DO);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'e': return checkKeyword(lexer, 2, 5, "fault", TK_DEFAULT);
+                    case 'o': return checkKeyword(lexer, 2, 0, "", TK_DO);
                     default: break;
                 }
             }
         } break;
         case 'e': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
                     case 'l':
-                        if (lexer.current - lexer.start > 2) {
-                            switch (lexer.start[2]) {
-                                case 'i': return checkKeyword(3, 1, "f", TK_ELIF);
-                                case 's': return checkKeyword(3, 1, "e", TK_ELSE);
+                        if (lexer->current - lexer->start > 2) {
+                            switch (lexer->start[2]) {
+                                case 'i': return checkKeyword(lexer, 3, 1, "f", TK_ELIF);
+                                case 's': return checkKeyword(lexer, 3, 1, "e", TK_ELSE);
                                 default: break;
                             }
                         }
-                    case 'n': return checkKeyword(2, 2, "um", TK_ENUM);
+                    case 'n': return checkKeyword(lexer, 2, 2, "um", TK_ENUM);
                     default: break;
                 }
             }
         } break;
         case 'f': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TK_FALSE);
-                    case 'n': return checkKeyword(2, 0, "", TK_FN);
-                    case 'o': return checkKeyword(2, 1, "r", TK_FOR);
-                    case 'r': return checkKeyword(2, 2, "om", TK_FROM);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'a': return checkKeyword(lexer, 2, 3, "lse", TK_FALSE);
+                    case 'n': return checkKeyword(lexer, 2, 0, "", TK_FN);
+                    case 'o': return checkKeyword(lexer, 2, 1, "r", TK_FOR);
+                    case 'r': return checkKeyword(lexer, 2, 2, "om", TK_FROM);
                     default: break;
                 }
             }
         } break;
         case 'i': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'f': return checkKeyword(2, 0, "", TK_IF);
-                    case 'n': return checkKeyword2(2, 0, "", TK_IN, 2, 6, "herits", TK_INHERITS);
-                    case 's': return checkKeyword(2, 0, "", TK_IS);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'f': return checkKeyword(lexer, 2, 0, "", TK_IF);
+                    case 'n': return checkKeyword2(lexer, 2, 0, "", TK_IN, 2, 6, "herits", TK_INHERITS);
+                    case 's': return checkKeyword(lexer, 2, 0, "", TK_IS);
                     default: break;
                 }
             }
         } break;
-        case 'm': return checkKeyword(1, 4, "atch", TK_MATCH);
+        case 'm': return checkKeyword(lexer, 1, 4, "atch", TK_MATCH);
         case 'n': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'a': return checkKeyword(2, 7, "mespace", TK_NAMESPACE);
-                    case 'o': return checkKeyword(2, 1, "t", TK_NOT);
-                    case 'u': return checkKeyword(2, 2, "ll", TK_NULL);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'a': return checkKeyword(lexer, 2, 7, "mespace", TK_NAMESPACE);
+                    case 'o': return checkKeyword(lexer, 2, 1, "t", TK_NOT);
+                    case 'u': return checkKeyword(lexer, 2, 2, "ll", TK_NULL);
                     default: break;
                 }
             }
         } break;
-        case 'o': return checkKeyword(1, 1, "r", TK_OR);
+        case 'o': return checkKeyword(lexer, 1, 1, "r", TK_OR);
         case 'p': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
                     case 'a': {
-                        const int tk = checkKeyword(2, 3, "nic", TK_PANIC);
-                        if (tk == TK_PANIC && match('!')) {
+                        const int tk = checkKeyword(lexer, 2, 3, "nic", TK_PANIC);
+                        if (tk == TK_PANIC && match(lexer, '!')) {
                             return tk;
                         }
                         return TK_IDENT;
                     }
-                    case 'r': return checkKeyword(2, 5, "ivate", TK_PRIVATE);
-                    case 'u': return checkKeyword(2, 4, "blic", TK_PUBLIC);
+                    case 'r': return checkKeyword(lexer, 2, 5, "ivate", TK_PRIVATE);
+                    case 'u': return checkKeyword(lexer, 2, 4, "blic", TK_PUBLIC);
+                    default: break;
+                }
+            }
+        } break;
+        case 'r': {
+            if (lexer->current - lexer->start > 2 && lexer->start[1] == 'e') {
+                switch (lexer->start[2]) {
+                    case 's': return checkKeyword(lexer, 3, 3, "ume", TK_RESUME);
+                    case 't': return checkKeyword(lexer, 3, 3, "urn", TK_RETURN);
                     default: break;
                 }
             }
         } break;
-        case 'r': return checkKeyword(1, 5, "eturn", TK_RETURN);
         case 's': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'u': return checkKeyword(2, 3, "per", TK_SUPER);
-                    case 'w': return checkKeyword(2, 4, "itch", TK_SWITCH);
-                    case 't': return checkKeyword(2, 4, "atic", TK_STATIC);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'u': return checkKeyword(lexer, 2, 3, "per", TK_SUPER);
+                    case 'w': return checkKeyword(lexer, 2, 4, "itch", TK_SWITCH);
+                    case 't': return checkKeyword(lexer, 2, 4, "atic", TK_STATIC);
                     default: break;
                 }
             }
         } break;
         case 't': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TK_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TK_TRUE);
-                    case 'y': return checkKeyword(2, 4, "peof", TK_TYPEOF);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'h': return checkKeyword(lexer, 2, 2, "is", TK_THIS);
+                    case 'r': return checkKeyword(lexer, 2, 2, "ue", TK_TRUE);
+                    case 'y': return checkKeyword(lexer, 2, 4, "peof", TK_TYPEOF);
                     default: break;
                 }
             }
         } break;
         case 'u': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 's': return checkKeyword(2, 1, "e", TK_USE);
-                    case 'n': return checkKeyword(2, 3, "til", TK_UNTIL);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 's': return checkKeyword(lexer, 2, 1, "e", TK_USE);
+                    case 'n': return checkKeyword(lexer, 2, 3, "til", TK_UNTIL);
                     default: break;
                 }
             }
         } break;
-        case 'v': return checkKeyword(1, 2, "ar", TK_VAR);
+        case 'v': return checkKeyword(lexer, 1, 2, "ar", TK_VAR);
         case 'w': {
-            if (lexer.current - lexer.start > 1) {
-                switch (lexer.start[1]) {
-                    case 'h': return checkKeyword2(2, 2, "en", TK_WHEN, 2, 3, "ile", TK_WHILE);
-                    case 'i': return checkKeyword(2, 6, "thFile", TK_WITH_FILE);
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'h': return checkKeyword2(lexer, 2, 2, "en", TK_WHEN, 2, 3, "ile", TK_WHILE);
+                    case 'i': return checkKeyword(lexer, 2, 6, "thFile", TK_WITH_FILE);
                     default: break;
                 }
             }
         } break;
+        case 'y': return checkKeyword(lexer, 1, 4, "ield", TK_YIELD);
         default: break;
     }
     
     return TK_IDENT;
 }
 
-static Token string(const char strChar) {
-    lexer.stringChar = strChar;
+static Token string(Lexer *lexer, const char strChar) {
+    lexer->stringChar = strChar;
     bool overwrite = false;
     bool skipInterpolation = false;
-    while ((peek() != strChar || overwrite) && !atEnd()) {
+    while ((peek(lexer) != strChar || overwrite) && !atEnd(lexer)) {
         overwrite = false;
         
-        if (peek() == '\\' && peekNext() == strChar) {
+        if (peek(lexer) == '\\' && peekNext(lexer) == strChar) {
             overwrite = true;
-        } else if (peek() == '\\' && peekNext() == '{') {
+        } else if (peek(lexer) == '\\' && peekNext(lexer) == '{') {
             skipInterpolation = true;
-        } else if (peek() == '\n') {
-            lexer.line++;
-        } else if (!skipInterpolation && peek() == '{') {
-            if (lexer.interpolationDepth >= MAX_INTERPOLATION_DEPTH) {
-                return errorToken("Interpolation may only nest 2 levels deep");
+        } else if (peek(lexer) == '\n') {
+            lexer->line++;
+        } else if (!skipInterpolation && peek(lexer) == '{') {
+            if (lexer->interpolationDepth >= MAX_INTERPOLATION_DEPTH) {
+                return errorToken(lexer, "Interpolation may only nest 2 levels deep");
             }
 
-            ++lexer.interpolationDepth;
+            ++lexer->interpolationDepth;
 
-            advance();
-            const Token token = makeToken(TK_INTERPOLATION);
+            advance(lexer);
+            const Token token = makeToken(lexer, TK_INTERPOLATION);
 
             return token;
         }
 
-        advance();
+        advance(lexer);
     }
 
-    if (atEnd()) {
-        return errorToken("Unterminated string.");
+    if (atEnd(lexer)) {
+        return errorToken(lexer, "Unterminated string.");
     }
 
-    advance();
-    return makeToken(TK_STRING);
+    advance(lexer);
+    return makeToken(lexer, TK_STRING);
 }
 
-static Token ident() {
-    while (isAlphaNumeric(peek())) {
-        advance();
+static Token ident(Lexer *lexer) {
+    while (isAlphaNumeric(peek(lexer))) {
+        advance(lexer);
     }
 
-    return makeToken(identType());
+    return makeToken(lexer, identType(lexer));
 }
 
-static Token exponent() {
-    advance();
+static Token exponent(Lexer *lexer) {
+    advance(lexer);
     
-    while (peek() == '_') {
-        advance();
+    while (peek(lexer) == '_') {
+        advance(lexer);
     }
     
-    if (peek() == '-' || peek() == '+') {
-        advance();
+    if (peek(lexer) == '-' || peek(lexer) == '+') {
+        advance(lexer);
     }
     
-    if (!isDigit(peek()) && peek() != '_') {
-        return errorToken("Invalid exponent literal.");
+    if (!isDigit(peek(lexer)) && peek(lexer) != '_') {
+        return errorToken(lexer, "Invalid exponent literal.");
     }
     
-    while (isDigit(peek()) || peek() == '_') {
-        advance();
+    while (isDigit(peek(lexer)) || peek(lexer) == '_') {
+        advance(lexer);
     }
     
-    return makeToken(TK_NUMBER);
+    return makeToken(lexer, TK_NUMBER);
 }
 
-static Token number() {
-    while (isDigit(peek()) || peek() == '_') {
-        advance();
+static Token number(Lexer *lexer) {
+    while (isDigit(peek(lexer)) || peek(lexer) == '_') {
+        advance(lexer);
     }
     
-    if (peek() == 'e' || peek() == 'E') {
-        return exponent();
+    if (peek(lexer) == 'e' || peek(lexer) == 'E') {
+        return exponent(lexer);
     }
 
-    if (peek() == '.' && isDigit(peekNext())) {
-        advance();
+    if (peek(lexer) == '.' && isDigit(peekNext(lexer))) {
+        advance(lexer);
 
-        while (isDigit(peek()) || peek() == '_') {
-            advance();
+        while (isDigit(peek(lexer)) || peek(lexer) == '_') {
+            advance(lexer);
         }
     
-        if (peek() == 'e' || peek() == 'E') {
-            return exponent();
+        if (peek(lexer) == 'e' || peek(lexer) == 'E') {
+            return exponent(lexer);
         }
     }
 
-    return makeToken(TK_NUMBER);
+    return makeToken(lexer, TK_NUMBER);
 }
 
-static Token octalNumber() {
-    while (peek() == '_') {
-        advance();
+static Token octalNumber(Lexer *lexer) {
+    while (peek(lexer) == '_') {
+        advance(lexer);
     }
     
-    if (peek() == '0') {
-        advance();
+    if (peek(lexer) == '0') {
+        advance(lexer);
     }
     
-    if (peek() == 'o' || peek() == 'O' || peek() == 'q' || peek() == 'Q') {
-        advance();
-        if (!isOctDigit(peek())) {
-            return errorToken("Invalid octal literal.");
+    if (peek(lexer) == 'o' || peek(lexer) == 'O' || peek(lexer) == 'q' || peek(lexer) == 'Q') {
+        advance(lexer);
+        if (!isOctDigit(peek(lexer))) {
+            return errorToken(lexer, "Invalid octal literal.");
         }
         
-        while (isOctDigit(peek())) {
-            advance();
+        while (isOctDigit(peek(lexer))) {
+            advance(lexer);
         }
         
-        return makeToken(TK_NUMBER);
+        return makeToken(lexer, TK_NUMBER);
     }
 
-    return number();
+    return number(lexer);
 }
 
-static Token hexNumber() {
-    while (peek() == '_') {
-        advance();
+static Token hexNumber(Lexer *lexer) {
+    while (peek(lexer) == '_') {
+        advance(lexer);
     }
     
-    if (peek() == '0') {
-        advance();
+    if (peek(lexer) == '0') {
+        advance(lexer);
     }
     
-    if (peek() == 'x' || peek() == 'X') {
-        advance();
-        if (!isHexDigit(peek())) {
-            return errorToken("Invalid hex literal.");
+    if (peek(lexer) == 'x' || peek(lexer) == 'X') {
+        advance(lexer);
+        if (!isHexDigit(peek(lexer))) {
+            return errorToken(lexer, "Invalid hex literal.");
         }
         
-        while (isHexDigit(peek())) {
-            advance();
+        while (isHexDigit(peek(lexer))) {
+            advance(lexer);
         }
         
-        return makeToken(TK_NUMBER);
+        return makeToken(lexer, TK_NUMBER);
     }
 
-    return octalNumber();
+    return octalNumber(lexer);
 }
 
-Token nextToken() {
-    skipWhitespace();
-    lexer.start = lexer.current;
+Token nextToken(Lexer *lexer) {
+    skipWhitespace(lexer);
+    lexer->start = lexer->current;
 
-    if (atEnd()) {
-        return makeToken(TK_EOF);
+    if (atEnd(lexer)) {
+        return makeToken(lexer, TK_EOF);
     }
 
-    const char c = advance();
+    const char c = advance(lexer);
     if (isAlpha(c)) {
-        return ident();
+        return ident(lexer);
     }
 
     if (isDigit(c)) {
-        return hexNumber();
+        return hexNumber(lexer);
     }
 
     switch (c) {
-        case '$': return ident();
-        case '(': return makeToken(TK_LPAREN);
-        case ')': return makeToken(TK_RPAREN);
-        case '{': return makeToken(TK_LBRACE);
+        case '$': return ident(lexer);
+        case '(': return makeToken(lexer, TK_LPAREN);
+        case ')': return makeToken(lexer, TK_RPAREN);
+        case '{': return makeToken(lexer, TK_LBRACE);
         case '}': {
-            if (lexer.interpolationDepth > 0) {
-                --lexer.interpolationDepth;
-                return string(lexer.stringChar);
+            if (lexer->interpolationDepth > 0) {
+                --lexer->interpolationDepth;
+                return string(lexer, lexer->stringChar);
             }
-            return makeToken(TK_RBRACE);
+            return makeToken(lexer, TK_RBRACE);
         }
-        case '[': return makeToken(TK_LBRACKET);
-        case ']': return makeToken(TK_RBRACKET);
-        case ';': return makeToken(TK_SEMICOLON);
-        case ',': return makeToken(TK_COMMA);
-        case '.': return makeToken(TK_DOT);
-        case '#': return makeToken(TK_HASH);
+        case '[': return makeToken(lexer, TK_LBRACKET);
+        case ']': return makeToken(lexer, TK_RBRACKET);
+        case ';': return makeToken(lexer, TK_SEMICOLON);
+        case ',': return makeToken(lexer, TK_COMMA);
+        case '.': return makeToken(lexer, TK_DOT);
+        case '#': return makeToken(lexer, TK_HASH);
         case '-': {
-            if (match('-')) {
-                return makeToken(TK_DEC);
-            } else if (match('=')) {
-                return makeToken(TK_MINUSEQ);
-            } else if (match('>')) {
-                return makeToken(TK_ARROW);
+            if (match(lexer, '-')) {
+                return makeToken(lexer, TK_DEC);
+            } else if (match(lexer, '=')) {
+                return makeToken(lexer, TK_MINUSEQ);
+            } else if (match(lexer, '>')) {
+                return makeToken(lexer, TK_ARROW);
             } else {
-                return makeToken(TK_MINUS);
+                return makeToken(lexer, TK_MINUS);
             }
         }
         case '+': {
-            if (match('+')) {
-                return makeToken(TK_INC);
-            } else if (match('=')) {
-                return makeToken(TK_PLUSEQ);
+            if (match(lexer, '+')) {
+                return makeToken(lexer, TK_INC);
+            } else if (match(lexer, '=')) {
+                return makeToken(lexer, TK_PLUSEQ);
             } else {
-                return makeToken(TK_PLUS);
+                return makeToken(lexer, TK_PLUS);
             }
         }
-        case '/': return makeToken(match('=') ? TK_DIVEQ : TK_DIV);
+        case '/': return makeToken(lexer, match(lexer, '=') ? TK_DIVEQ : TK_DIV);
         case '*': {
-            if (match('=')) {
-                return makeToken(TK_MULEQ);
-            } else if (match('*')) {
-                return makeToken(match('=') ? TK_POWEQ : TK_POW);
+            if (match(lexer, '=')) {
+                return makeToken(lexer, TK_MULEQ);
+            } else if (match(lexer, '*')) {
+                return makeToken(lexer, match(lexer, '=') ? TK_POWEQ : TK_POW);
             } else {
-                return makeToken(TK_MUL);
+                return makeToken(lexer, TK_MUL);
             }
         }
-        case '%': return makeToken(match('=') ? TK_MODEQ : TK_MOD);
-        case '!': return makeToken(match('=') ? TK_NOTEQ : TK_NOT);
-        case '=': return makeToken(match('=') ? TK_EQ    : TK_ASSIGN);
+        case '%': return makeToken(lexer, match(lexer, '=') ? TK_MODEQ : TK_MOD);
+        case '!': return makeToken(lexer, match(lexer, '=') ? TK_NOTEQ : TK_NOT);
+        case '=': return makeToken(lexer, match(lexer, '=') ? TK_EQ    : TK_ASSIGN);
         case '<': {
-            if (match('<')) {
-                return makeToken(TK_BIT_LS);
+            if (match(lexer, '<')) {
+                return makeToken(lexer, TK_BIT_LS);
             } else {
-                return makeToken(match('=') ? TK_LTEQ : TK_LT);
+                return makeToken(lexer, match(lexer, '=') ? TK_LTEQ : TK_LT);
             }
         }
         case '>': {
-            if (match('>')) {
-                return makeToken(TK_BIT_RS);
+            if (match(lexer, '>')) {
+                return makeToken(lexer, TK_BIT_RS);
             } else {
-                return makeToken(match('=') ? TK_GREQ : TK_GR);
+                return makeToken(lexer, match(lexer, '=') ? TK_GREQ : TK_GR);
             }
         }
         case ':': {
-            if (match('=')) {
-                return makeToken(TK_VAR_DECL);
-            } else if (match(':')) {
-                return makeToken(match('=') ? TK_CONST_DECL : TK_SCOPE);
+            if (match(lexer, '=')) {
+                return makeToken(lexer, TK_VAR_DECL);
+            } else if (match(lexer, ':')) {
+                return makeToken(lexer, match(lexer, '=') ? TK_CONST_DECL : TK_SCOPE);
             } else {
-                return makeToken(TK_COLON);
+                return makeToken(lexer, TK_COLON);
             }
         }
         case '?': {
-            if (match('.')) {
-                return makeToken(TK_OPT);
-            } else if (match('?')) {
-                return makeToken(match('=') ? TK_NULL_COALESCE_EQ : TK_NULL_COALESCE);
+            if (match(lexer, '.')) {
+                return makeToken(lexer, TK_OPT);
+            } else if (match(lexer, '?')) {
+                return makeToken(lexer, match(lexer, '=') ? TK_NULL_COALESCE_EQ : TK_NULL_COALESCE);
             } else {
-                return makeToken(TK_TER);
+                return makeToken(lexer, TK_TER);
             }
         }
         case '&': {
-            if (match('&')) {
-                return makeToken(TK_AND);
-            } else if (match('=')) {
-                return makeToken(TK_BIT_ANDEQ);
+            if (match(lexer, '&')) {
+                return makeToken(lexer, TK_AND);
+            } else if (match(lexer, '=')) {
+                return makeToken(lexer, TK_BIT_ANDEQ);
             } else {
-                return makeToken(TK_BIT_AND);
+                return makeToken(lexer, TK_BIT_AND);
             }
         }
         case '|': {
-            if (match('|')) {
-                return makeToken(TK_OR);
-            } else if (match('=')) {
-                return makeToken(TK_BIT_OREQ);
+            if (match(lexer, '|')) {
+                return makeToken(lexer, TK_OR);
+            } else if (match(lexer, '=')) {
+                return makeToken(lexer, TK_BIT_OREQ);
             } else {
-                return makeToken(TK_BIT_OR);
+                return makeToken(lexer, TK_BIT_OR);
             }
         }
         case '^': {
-            return makeToken(match('=') ? TK_BIT_XOREQ : TK_BIT_XOR);
+            return makeToken(lexer, match(lexer, '=') ? TK_BIT_XOREQ : TK_BIT_XOR);
         }
-        case '~': return makeToken(TK_BIT_NOT);
-        case '"': return string('"');
-        case '\'': return string('\'');
+        case '~': return makeToken(lexer, TK_BIT_NOT);
+        case '"': return string(lexer, '"');
+        case '\'': return string(lexer, '\'');
         default: break;
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(lexer, "Unexpected character.");
 }
@@ -5,6 +5,8 @@
 #ifndef __C_LEXER_H__
 #define __C_LEXER_H__
 
+#include <stdbool.h>
+
 #define MAX_INTERPOLATION_DEPTH 2
 
 typedef enum {
@@ -102,6 +104,7 @@ typedef enum {
     TK_PANIC,
     TK_PRIVATE,
     TK_PUBLIC,
+    TK_RESUME,
     TK_RETURN,
     TK_SUPER,
     TK_SWITCH,
@@ -115,6 +118,7 @@ typedef enum {
     TK_WHEN,
     TK_WHILE,
     TK_WITH_FILE,
+    TK_YIELD,
 
     // No character representation.
     TK_TO_STR,
@@ -130,7 +134,18 @@ typedef struct {
     int line;
 } Token;
 
-void initLexer(const char *source);
-Token nextToken();
+// Each compile has its own, so scripts can be compiled on several threads at once.
+typedef struct {
+    const char *start;
+    const char *current;
+    char previous;
+    int line;
+    bool interpolation;
+    int interpolationDepth;
+    char stringChar;
+} Lexer;
+
+void initLexer(Lexer *lexer, const char *source);
+Token nextToken(Lexer *lexer);
 
 #endif //__C_LEXER_H__
@@ -0,0 +1,893 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifdef __linux__
+#   define _GNU_SOURCE // For accept4().
+#endif
+
+#include "lib_async.h"
+
+#include "../memory.h"
+#include "../vm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <netdb.h>
+#   include <netinet/in.h>
+#   include <stdio.h>
+#   include <sys/epoll.h>
+#   include <sys/socket.h>
+#   include <time.h>
+#   include <unistd.h>
+#endif
+
+// Tasks are fibers that async.run() takes turns running. A task waits for something by yielding one of the handles the
+// functions here return, and gets resumed with the handle's result once it is ready. Timers are kept in a heap, files
+// and sockets are non-blocking and watched with epoll. Anything else a task yields just lets the other tasks go first.
+
+#ifdef __linux__
+
+#define READ_SIZE_DEFAULT (64 * 1024)
+#define EVENTS_MAX 64
+
+typedef enum {
+    AWAIT_SLEEP,
+    AWAIT_READ,
+    AWAIT_WRITE,
+    AWAIT_ACCEPT,
+    AWAIT_CONNECT,
+} AwaitKind;
+
+// What a handle waits for, the data of its abstract object. The stream or string it works on is kept alive in the
+// handle's values.
+typedef struct {
+    AwaitKind kind;
+    int fd;
+    bool ownsFd;    // A connection in progress belongs to its handle until it connects.
+    bool ready;     // epoll said the descriptor is ready.
+    bool awaited;
+    double deadline; // In milliseconds, see now().
+    int size;
+    ObjString *data;
+    int written;
+} Await;
+
+typedef struct {
+    int fd;
+    bool waiting; // epoll can only watch a descriptor once.
+} Stream;
+
+typedef struct {
+    ObjFiber *fiber;
+    Value value;
+} Ready;
+
+typedef struct {
+    double deadline;
+    uint64_t order; // Timers that are due at the same time fire in the order they were set.
+    ObjFiber *fiber;
+} Timer;
+
+typedef struct Waiter {
+    ObjFiber *fiber;
+    ObjAbstract *handle;
+    struct Waiter *prev;
+    struct Waiter *next;
+} Waiter;
+
+struct EventLoop {
+    int epoll;
+    bool running;
+    int readyHead; // The ready queue is a ring, readyCapacity is always a power of two.
+    int readyCount;
+    int readyCapacity;
+    Ready *ready;
+    int timerCount;
+    int timerCapacity;
+    uint64_t timerOrder;
+    Timer *timers;
+    int waiterCount;
+    Waiter *waiters;
+};
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec * 1000.0 + (double)time.tv_nsec / 1000000.0;
+}
+
+static EventLoop *getLoop(VM *vm) {
+    if (vm->eventLoop != NULL) {
+        return vm->eventLoop;
+    }
+
+    EventLoop *loop = (EventLoop*)calloc(1, sizeof(EventLoop));
+    if (loop == NULL) {
+        exit(69);
+    }
+
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll < 0) {
+        exit(69);
+    }
+
+    vm->eventLoop = loop;
+    return loop;
+}
+
+static void pushReady(EventLoop *loop, ObjFiber *fiber, const Value value) {
+    if (loop->readyCount == loop->readyCapacity) {
+        const int capacity = GROW_CAPACITY(loop->readyCapacity);
+        Ready *ready = (Ready*)malloc(sizeof(Ready) * capacity);
+        if (ready == NULL) {
+            exit(69);
+        }
+
+        for (int i = 0; i < loop->readyCount; ++i) {
+            ready[i] = loop->ready[(loop->readyHead + i) & (loop->readyCapacity - 1)];
+        }
+        free(loop->ready);
+        loop->ready = ready;
+        loop->readyHead = 0;
+        loop->readyCapacity = capacity;
+    }
+
+    Ready *task = &loop->ready[(loop->readyHead + loop->readyCount) & (loop->readyCapacity - 1)];
+    task->fiber = fiber;
+    task->value = value;
+    ++loop->readyCount;
+}
+
+static Ready popReady(EventLoop *loop) {
+    const Ready task = loop->ready[loop->readyHead];
+    loop->readyHead = (loop->readyHead + 1) & (loop->readyCapacity - 1);
+    --loop->readyCount;
+    return task;
+}
+
+static bool timerBefore(const Timer *a, const Timer *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->order < b->order);
+}
+
+static void pushTimer(EventLoop *loop, ObjFiber *fiber, const double deadline) {
+    if (loop->timerCount == loop->timerCapacity) {
+        loop->timerCapacity = GROW_CAPACITY(loop->timerCapacity);
+        loop->timers = (Timer*)realloc(loop->timers, sizeof(Timer) * loop->timerCapacity);
+        if (loop->timers == NULL) {
+            exit(69);
+        }
+    }
+
+    Timer timer = {deadline, loop->timerOrder++, fiber};
+    int i = loop->timerCount++;
+    while (i > 0 && timerBefore(&timer, &loop->timers[(i - 1) / 2])) {
+        loop->timers[i] = loop->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    loop->timers[i] = timer;
+}
+
+static ObjFiber *popTimer(EventLoop *loop) {
+    ObjFiber *fiber = loop->timers[0].fiber;
+    const Timer last = loop->timers[--loop->timerCount];
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= loop->timerCount) {
+            break;
+        }
+        if (child + 1 < loop->timerCount && timerBefore(&loop->timers[child + 1], &loop->timers[child])) {
+            ++child;
+        }
+        if (!timerBefore(&loop->timers[child], &last)) {
+            break;
+        }
+        loop->timers[i] = loop->timers[child];
+        i = child;
+    }
+    loop->timers[i] = last;
+
+    return fiber;
+}
+
+static void freeAwait(VM *vm, ObjAbstract *abstract) {
+    Await *await = (Await*)abstract->data;
+    if (await->ownsFd && await->fd >= 0) {
+        close(await->fd);
+    }
+    free(await);
+}
+
+static void freeStream(VM *vm, ObjAbstract *abstract) {
+    Stream *stream = (Stream*)abstract->data;
+    if (stream->fd >= 0) {
+        close(stream->fd);
+    }
+    free(stream);
+}
+
+static bool isHandle(const Value value) {
+    return IS_ABSTRACT(value) && AS_ABSTRACT(value)->feeFn == freeAwait;
+}
+
+static void keepValue(VM *vm, ObjAbstract *abstract, const char *name, const Value value) {
+    ObjString *key = copyString(vm, name, (int)strlen(name));
+    push(vm, OBJ_VAL(key));
+    tableSet(vm, &abstract->values, key, value, ILEX_READ_ONLY);
+    pop(vm);
+}
+
+static ObjAbstract *newHandle(VM *vm, const AwaitKind kind, const int fd) {
+    Await *await = (Await*)calloc(1, sizeof(Await));
+    if (await == NULL) {
+        exit(69);
+    }
+
+    await->kind = kind;
+    await->fd = fd;
+    ObjAbstract *handle = newAbstract(vm, freeAwait);
+    handle->data = await;
+    return handle;
+}
+
+static Stream *getStream(const Value value) {
+    return (Stream*)AS_ABSTRACT(value)->data;
+}
+
+static Value streamRead(VM *vm, int argc, const Value *args);
+static Value streamWrite(VM *vm, int argc, const Value *args);
+static Value streamClose(VM *vm, int argc, const Value *args);
+static Value serverAccept(VM *vm, int argc, const Value *args);
+static Value serverPort(VM *vm, int argc, const Value *args);
+
+static ObjAbstract *newStream(VM *vm, const int fd, const bool server) {
+    Stream *stream = (Stream*)calloc(1, sizeof(Stream));
+    if (stream == NULL) {
+        exit(69);
+    }
+
+    stream->fd = fd;
+    ObjAbstract *abstract = newAbstract(vm, freeStream);
+    abstract->data = stream;
+    push(vm, OBJ_VAL(abstract));
+    if (server) {
+        defineNative(vm, "accept", serverAccept, &abstract->values);
+        defineNative(vm, "port", serverPort, &abstract->values);
+    } else {
+        defineNative(vm, "read", streamRead, &abstract->values);
+        defineNative(vm, "write", streamWrite, &abstract->values);
+    }
+    defineNative(vm, "close", streamClose, &abstract->values);
+    pop(vm);
+
+    return abstract;
+}
+
+// Tries what the handle waits for without blocking. False if it has to wait, otherwise result is what the task gets.
+static bool tryAwait(VM *vm, const ObjAbstract *handle, Value *result) {
+    Await *await = (Await*)handle->data;
+    *result = NULL_VAL;
+    if (await->fd < 0) {
+        return true;
+    }
+
+    switch (await->kind) {
+        case AWAIT_READ: {
+            char *buffer = (char*)malloc(await->size);
+            if (buffer == NULL) {
+                exit(69);
+            }
+
+            const ssize_t count = read(await->fd, buffer, await->size);
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                free(buffer);
+                return false;
+            }
+
+            // null at the end and on errors.
+            if (count > 0) {
+                *result = OBJ_VAL(copyString(vm, buffer, (int)count));
+            }
+            free(buffer);
+        } break;
+        case AWAIT_WRITE: {
+            while (await->written < await->data->len) {
+                const ssize_t count = write(await->fd, await->data->str + await->written, await->data->len - await->written);
+                if (count < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return false;
+                    }
+                    return true;
+                }
+                await->written += (int)count;
+            }
+            *result = NUMBER_VAL(await->written);
+        } break;
+        case AWAIT_ACCEPT: {
+            const int fd = accept4(await->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return errno != EAGAIN && errno != EWOULDBLOCK;
+            }
+            *result = OBJ_VAL(newStream(vm, fd, false));
+        } break;
+        case AWAIT_CONNECT: {
+            if (!await->ready) {
+                return false;
+            }
+
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(await->fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+                await->ownsFd = false;
+                *result = OBJ_VAL(newStream(vm, await->fd, false));
+            }
+        } break;
+        default: break;
+    }
+
+    return true;
+}
+
+static void unwatch(VM *vm, EventLoop *loop, Waiter *waiter) {
+    const Await *await = (Await*)waiter->handle->data;
+    epoll_ctl(loop->epoll, EPOLL_CTL_DEL, await->fd, NULL);
+    Value stream;
+    if (tableGet(&waiter->handle->values, copyString(vm, "$stream", 7), &stream)) {
+        getStream(stream)->waiting = false;
+    }
+
+    if (waiter->prev != NULL) {
+        waiter->prev->next = waiter->next;
+    } else {
+        loop->waiters = waiter->next;
+    }
+    if (waiter->next != NULL) {
+        waiter->next->prev = waiter->prev;
+    }
+    --loop->waiterCount;
+    free(waiter);
+}
+
+// Parks fiber until handle is ready, or queues it right away if it already is.
+static bool awaitHandle(VM *vm, EventLoop *loop, ObjFiber *fiber, ObjAbstract *handle) {
+    Await *await = (Await*)handle->data;
+    if (await->awaited) {
+        runtimeError(vm, "A handle can only be awaited once.");
+        return false;
+    }
+    await->awaited = true;
+
+    if (await->kind == AWAIT_SLEEP) {
+        pushTimer(loop, fiber, await->deadline);
+        return true;
+    }
+
+    Value result;
+    if (tryAwait(vm, handle, &result)) {
+        pushReady(loop, fiber, result);
+        return true;
+    }
+
+    Value streamValue;
+    Stream *stream = NULL;
+    if (tableGet(&handle->values, copyString(vm, "$stream", 7), &streamValue)) {
+        stream = getStream(streamValue);
+        if (stream->waiting) {
+            runtimeError(vm, "Another task is already waiting on this stream.");
+            return false;
+        }
+    }
+
+    Waiter *waiter = (Waiter*)malloc(sizeof(Waiter));
+    if (waiter == NULL) {
+        exit(69);
+    }
+
+    waiter->fiber = fiber;
+    waiter->handle = handle;
+    struct epoll_event event;
+    event.events = await->kind == AWAIT_WRITE || await->kind == AWAIT_CONNECT ? EPOLLOUT : EPOLLIN;
+    event.data.ptr = waiter;
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, await->fd, &event) != 0) {
+        free(waiter);
+        runtimeError(vm, "Unable to wait on descriptor %d.", await->fd);
+        return false;
+    }
+
+    if (stream != NULL) {
+        stream->waiting = true;
+    }
+    waiter->prev = NULL;
+    waiter->next = loop->waiters;
+    if (loop->waiters != NULL) {
+        loop->waiters->prev = waiter;
+    }
+    loop->waiters = waiter;
+    ++loop->waiterCount;
+
+    return true;
+}
+
+// Waits for the next timer or descriptor, no longer than timeout milliseconds, and queues the tasks they woke up.
+static void pollLoop(VM *vm, EventLoop *loop, const int timeout) {
+    struct epoll_event events[EVENTS_MAX];
+    const int count = epoll_wait(loop->epoll, events, EVENTS_MAX, timeout);
+    for (int i = 0; i < count; ++i) {
+        Waiter *waiter = (Waiter*)events[i].data.ptr;
+        ((Await*)waiter->handle->data)->ready = true;
+
+        Value result;
+        if (tryAwait(vm, waiter->handle, &result)) {
+            push(vm, result);
+            pushReady(loop, waiter->fiber, result);
+            unwatch(vm, loop, waiter);
+            pop(vm);
+        }
+    }
+
+    const double time = now();
+    while (loop->timerCount > 0 && loop->timers[0].deadline <= time) {
+        pushReady(loop, popTimer(loop), NULL_VAL);
+    }
+}
+
+static int nextTimeout(const EventLoop *loop) {
+    if (loop->readyCount > 0) {
+        return 0;
+    }
+
+    if (loop->timerCount == 0) {
+        return -1;
+    }
+
+    const double wait = loop->timers[0].deadline - now();
+    return wait <= 0 ? 0 : (int)wait + 1;
+}
+
+static Value asyncRun(VM *vm, int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function run() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    EventLoop *loop = getLoop(vm);
+    if (loop->running) {
+        runtimeError(vm, "The event loop is already running.");
+        return ERROR_VAL;
+    }
+
+    loop->running = true;
+    while (loop->readyCount > 0 || loop->timerCount > 0 || loop->waiterCount > 0) {
+        while (loop->readyCount > 0) {
+            const Ready task = popReady(loop);
+
+            push(vm, OBJ_VAL(task.fiber));
+            push(vm, task.value);
+            const Value result = resumeFiber(vm, task.fiber, task.value);
+            if (IS_ERR(result)) {
+                loop->running = false;
+                return ERROR_VAL;
+            }
+
+            push(vm, result);
+            if (task.fiber->state != FIBER_DONE) {
+                if (isHandle(result)) {
+                    if (!awaitHandle(vm, loop, task.fiber, AS_ABSTRACT(result))) {
+                        loop->running = false;
+                        return ERROR_VAL;
+                    }
+                } else {
+                    pushReady(loop, task.fiber, NULL_VAL);
+                }
+            }
+            pop(vm);
+            pop(vm);
+            pop(vm);
+
+            // Timers and descriptors get a look in between tasks, so a task that keeps yielding can't starve them.
+            if (loop->timerCount > 0 || loop->waiterCount > 0) {
+                pollLoop(vm, loop, 0);
+            }
+        }
+
+        if (loop->timerCount > 0 || loop->waiterCount > 0) {
+            pollLoop(vm, loop, nextTimeout(loop));
+        }
+    }
+    loop->running = false;
+
+    return NULL_VAL;
+}
+
+static Value asyncSpawn(VM *vm, int argc, const Value *args) {
+    if (argc != 1) {
+        runtimeError(vm, "Function spawn() expected 1 argument but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    ObjFiber *fiber;
+    if (IS_FIBER(args[0])) {
+        fiber = AS_FIBER(args[0]);
+    } else if (IS_CLOSURE(args[0]) && AS_CLOSURE(args[0])->function->arity == 0 &&
+               AS_CLOSURE(args[0])->function->arityDefault == 0) {
+        fiber = newFiber(vm, AS_CLOSURE(args[0]));
+    } else {
+        char *type = valueType(args[0]);
+        runtimeError(vm, "Function spawn() expected a fiber or a function without arguments but got '%s'.", type);
+        free(type);
+        return ERROR_VAL;
+    }
+
+    if (fiber->state != FIBER_NEW && fiber->state != FIBER_SUSPENDED) {
+        runtimeError(vm, "Function spawn() can't run a fiber that is running or has finished.");
+        return ERROR_VAL;
+    }
+
+    push(vm, OBJ_VAL(fiber));
+    pushReady(getLoop(vm), fiber, NULL_VAL);
+    pop(vm);
+
+    return OBJ_VAL(fiber);
+}
+
+static Value asyncSleep(VM *vm, int argc, const Value *args) {
+    if (argc != 1) {
+        runtimeError(vm, "Function sleep() expected 1 argument but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_NUMBER(args[0])) {
+        char *type = valueType(args[0]);
+        runtimeError(vm, "Function sleep() expected type 'number' but got '%s'.", type);
+        free(type);
+        return ERROR_VAL;
+    }
+
+    ObjAbstract *handle = newHandle(vm, AWAIT_SLEEP, -1);
+    ((Await*)handle->data)->deadline = now() + AS_NUMBER(args[0]);
+    return OBJ_VAL(handle);
+}
+
+static Value asyncConnect(VM *vm, int argc, const Value *args) {
+    if (argc != 2) {
+        runtimeError(vm, "Function connect() expected 2 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_STRING(args[0]) || !IS_NUMBER(args[1])) {
+        runtimeError(vm, "Function connect() expected a host and a port.");
+        return ERROR_VAL;
+    }
+
+    // Looking up the host still blocks.
+    char port[16];
+    snprintf(port, sizeof(port), "%d", (int)AS_NUMBER(args[1]));
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = NULL;
+
+    int fd = -1;
+    bool connected = false;
+    if (getaddrinfo(AS_CSTRING(args[0]), port, &hints, &addresses) == 0) {
+        for (const struct addrinfo *address = addresses; address != NULL; address = address->ai_next) {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+
+            if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+                connected = true;
+                break;
+            }
+            if (errno == EINPROGRESS) {
+                break;
+            }
+
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(addresses);
+    }
+
+    // A handle without a descriptor gives null, like a connection that fails later on.
+    ObjAbstract *handle = newHandle(vm, AWAIT_CONNECT, fd);
+    Await *await = (Await*)handle->data;
+    await->ownsFd = true;
+    await->ready = connected;
+    return OBJ_VAL(handle);
+}
+
+static Value asyncListen(VM *vm, int argc, const Value *args) {
+    if (argc != 1 && argc != 2) {
+        runtimeError(vm, "Function listen() expected 1 or 2 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_NUMBER(args[0]) || (argc == 2 && !IS_STRING(args[1]))) {
+        runtimeError(vm, "Function listen() expected a port and optionally a host.");
+        return ERROR_VAL;
+    }
+
+    char port[16];
+    snprintf(port, sizeof(port), "%d", (int)AS_NUMBER(args[0]));
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *addresses = NULL;
+
+    int fd = -1;
+    if (getaddrinfo(argc == 2 ? AS_CSTRING(args[1]) : NULL, port, &hints, &addresses) == 0) {
+        for (const struct addrinfo *address = addresses; address != NULL; address = address->ai_next) {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+
+            const int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+                break;
+            }
+
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(addresses);
+    }
+
+    if (fd < 0) {
+        runtimeError(vm, "Unable to listen on port %s.", port);
+        return ERROR_VAL;
+    }
+
+    return OBJ_VAL(newStream(vm, fd, true));
+}
+
+static Value asyncOpen(VM *vm, int argc, const Value *args) {
+    if (argc != 1 && argc != 2) {
+        runtimeError(vm, "Function open() expected 1 or 2 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_STRING(args[0]) || (argc == 2 && !IS_STRING(args[1]))) {
+        runtimeError(vm, "Function open() expected a path and optionally a mode.");
+        return ERROR_VAL;
+    }
+
+    int flags = O_RDONLY;
+    if (argc == 2) {
+        const char *mode = AS_CSTRING(args[1]);
+        if (strcmp(mode, "w") == 0) {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        } else if (strcmp(mode, "a") == 0) {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        } else if (strcmp(mode, "r") != 0) {
+            runtimeError(vm, "Function open() expected mode 'r', 'w' or 'a' but got '%s'.", mode);
+            return ERROR_VAL;
+        }
+    }
+
+    // Regular files are always ready, pipes and terminals go through epoll like sockets.
+    const int fd = open(AS_CSTRING(args[0]), flags | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL_VAL;
+    }
+
+    return OBJ_VAL(newStream(vm, fd, false));
+}
+
+static bool checkOpen(VM *vm, const Stream *stream) {
+    if (stream->fd < 0) {
+        runtimeError(vm, "Stream is closed.");
+        return false;
+    }
+
+    return true;
+}
+
+static Value streamRead(VM *vm, int argc, const Value *args) {
+    if (argc > 1) {
+        runtimeError(vm, "Function read() expected 0 or 1 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (argc == 1 && (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 1)) {
+        runtimeError(vm, "Function read() expected a positive number of bytes.");
+        return ERROR_VAL;
+    }
+
+    const Stream *stream = getStream(args[0]);
+    if (!checkOpen(vm, stream)) {
+        return ERROR_VAL;
+    }
+
+    ObjAbstract *handle = newHandle(vm, AWAIT_READ, stream->fd);
+    ((Await*)handle->data)->size = argc == 1 ? (int)AS_NUMBER(args[1]) : READ_SIZE_DEFAULT;
+    push(vm, OBJ_VAL(handle));
+    keepValue(vm, handle, "$stream", args[0]);
+    pop(vm);
+
+    return OBJ_VAL(handle);
+}
+
+static Value streamWrite(VM *vm, int argc, const Value *args) {
+    if (argc != 1) {
+        runtimeError(vm, "Function write() expected 1 argument but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_STRING(args[1])) {
+        char *type = valueType(args[1]);
+        runtimeError(vm, "Function write() expected type 'string' but got '%s'.", type);
+        free(type);
+        return ERROR_VAL;
+    }
+
+    const Stream *stream = getStream(args[0]);
+    if (!checkOpen(vm, stream)) {
+        return ERROR_VAL;
+    }
+
+    ObjAbstract *handle = newHandle(vm, AWAIT_WRITE, stream->fd);
+    ((Await*)handle->data)->data = AS_STRING(args[1]);
+    push(vm, OBJ_VAL(handle));
+    keepValue(vm, handle, "$stream", args[0]);
+    keepValue(vm, handle, "$data", args[1]);
+    pop(vm);
+
+    return OBJ_VAL(handle);
+}
+
+static Value serverAccept(VM *vm, int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function accept() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    const Stream *stream = getStream(args[0]);
+    if (!checkOpen(vm, stream)) {
+        return ERROR_VAL;
+    }
+
+    ObjAbstract *handle = newHandle(vm, AWAIT_ACCEPT, stream->fd);
+    push(vm, OBJ_VAL(handle));
+    keepValue(vm, handle, "$stream", args[0]);
+    pop(vm);
+
+    return OBJ_VAL(handle);
+}
+
+static Value serverPort(VM *vm, int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function port() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    const Stream *stream = getStream(args[0]);
+    if (!checkOpen(vm, stream)) {
+        return ERROR_VAL;
+    }
+
+    struct sockaddr_in address;
+    socklen_t len = sizeof(address);
+    if (getsockname(stream->fd, (struct sockaddr*)&address, &len) != 0) {
+        return NULL_VAL;
+    }
+
+    return NUMBER_VAL(ntohs(address.sin_port));
+}
+
+static Value streamClose(VM *vm, int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function close() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    Stream *stream = getStream(args[0]);
+    if (stream->waiting) {
+        runtimeError(vm, "Can't close a stream a task is waiting on.");
+        return ERROR_VAL;
+    }
+
+    if (stream->fd >= 0) {
+        close(stream->fd);
+        stream->fd = -1;
+    }
+
+    return NULL_VAL;
+}
+
+void markEventLoop(VM *vm) {
+    const EventLoop *loop = vm->eventLoop;
+    if (loop == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < loop->readyCount; ++i) {
+        const Ready *task = &loop->ready[(loop->readyHead + i) & (loop->readyCapacity - 1)];
+        markObject(vm, (Obj*)task->fiber);
+        markValue(vm, task->value);
+    }
+    for (int i = 0; i < loop->timerCount; ++i) {
+        markObject(vm, (Obj*)loop->timers[i].fiber);
+    }
+    for (const Waiter *waiter = loop->waiters; waiter != NULL; waiter = waiter->next) {
+        markObject(vm, (Obj*)waiter->fiber);
+        markObject(vm, (Obj*)waiter->handle);
+    }
+}
+
+void freeEventLoop(VM *vm) {
+    EventLoop *loop = vm->eventLoop;
+    if (loop == NULL) {
+        return;
+    }
+
+    Waiter *waiter = loop->waiters;
+    while (waiter != NULL) {
+        Waiter *next = waiter->next;
+        free(waiter);
+        waiter = next;
+    }
+    close(loop->epoll);
+    free(loop->ready);
+    free(loop->timers);
+    free(loop);
+    vm->eventLoop = NULL;
+}
+
+#else
+
+static Value asyncUnsupported(VM *vm, int argc, const Value *args) {
+    runtimeError(vm, "The async library needs epoll, which this platform doesn't have.");
+    return ERROR_VAL;
+}
+
+void markEventLoop(VM *vm) {
+}
+
+void freeEventLoop(VM *vm) {
+}
+
+#endif
+
+Value useAsyncLib(VM *vm) {
+    ObjString *name = copyString(vm, "async", 5);
+    push(vm, OBJ_VAL(name));
+    ObjScript *lib = newScript(vm, name);
+    push(vm, OBJ_VAL(lib));
+
+    if (lib->used) {
+        return OBJ_VAL(lib);
+    }
+
+#ifdef __linux__
+    defineNative(vm, "run", asyncRun, &lib->values);
+    defineNative(vm, "spawn", asyncSpawn, &lib->values);
+    defineNative(vm, "sleep", asyncSleep, &lib->values);
+    defineNative(vm, "connect", asyncConnect, &lib->values);
+    defineNative(vm, "listen", asyncListen, &lib->values);
+    defineNative(vm, "open", asyncOpen, &lib->values);
+#else
+    defineNative(vm, "run", asyncUnsupported, &lib->values);
+    defineNative(vm, "spawn", asyncUnsupported, &lib->values);
+    defineNative(vm, "sleep", asyncUnsupported, &lib->values);
+    defineNative(vm, "connect", asyncUnsupported, &lib->values);
+    defineNative(vm, "listen", asyncUnsupported, &lib->values);
+    defineNative(vm, "open", asyncUnsupported, &lib->values);
+#endif
+
+    pop(vm);
+    pop(vm);
+
+    lib->used = true;
+    return OBJ_VAL(lib);
+}
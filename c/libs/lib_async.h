@@ -0,0 +1,15 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_LIB_ASYNC_H__
+#define __C_LIB_ASYNC_H__
+
+#include "../value.h"
+
+Value useAsyncLib(VM *vm);
+
+void markEventLoop(VM *vm);
+void freeEventLoop(VM *vm);
+
+#endif //__C_LIB_ASYNC_H__
@@ -18,7 +18,7 @@ BuiltInLibs makeLib(VM *vm, const char *name, const BuiltInLib lib) {
 }
 
 void initBuiltInLibs(VM *vm) {
-    static const int LIB_COUNT = 14;
+    static const int LIB_COUNT = 16;
     vm->libCapacity = LIB_COUNT;
     vm->libCapacity = GROW_CAPACITY(vm->libCapacity);
 
@@ -38,6 +38,8 @@ void initBuiltInLibs(VM *vm) {
     vm->libs[11] = makeLib(vm, "toml",   &useTomlLib);
     vm->libs[12] = makeLib(vm, "base64", &useBase64Lib);
     vm->libs[13] = makeLib(vm, "fmt",    &useFmtLib);
+    vm->libs[14] = makeLib(vm, "thread", &useThreadLib);
+    vm->libs[15] = makeLib(vm, "async",  &useAsyncLib);
 }
 
 Value useBuiltInLib(VM *vm, const int idx) {
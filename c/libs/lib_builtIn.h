@@ -22,6 +22,8 @@
 #include "lib_toml.h"
 #include "lib_base64.h"
 #include "lib_fmt.h"
+#include "lib_thread.h"
+#include "lib_async.h"
 
 BuiltInLibs makeLib(VM *vm, const char *name, BuiltInLib lib);
 void initBuiltInLibs(VM *vm);
@@ -3,6 +3,7 @@
 //
 
 #include "lib_fmt.h"
+#include "lib_random.h"
 
 #include <stdlib.h>
 
@@ -15,7 +16,7 @@ static Value fmtPrintColors(VM *vm, const int argc, const Value *args) {
     printf("\033[0m"); // Reset before printing colors.
 
     if (argc == 0) {
-        const int r = rand() % 2;
+        const int r = nextRandom(vm) % 2;
         if (r == 0) {
             for (int i = 0; i < 256; ++i) {
                 printf("\033[38;5;%dmThe quick brown fox jumped over the lazy dog. %d\n", i, i);
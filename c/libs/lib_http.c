@@ -9,6 +9,10 @@
 #include <stdlib.h>
 #include <curl/curl.h>
 
+#ifndef I_WIN
+#   include <pthread.h>
+#endif
+
 #define HTTP_METHOD_GET     "GET"
 #define HTTP_METHOD_HEAD    "HEAD"
 #define HTTP_METHOD_POST    "POST"
@@ -224,6 +228,31 @@ static const char *httpStatusCodeToMessage(const int status) {
     }
 }
 
+// curl_global_init() isn't safe to call while another thread is using curl, so it is called once for the whole
+// process and never cleaned up.
+#ifdef I_WIN
+static INIT_ONCE curlOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK initCurlOnce(PINIT_ONCE once, PVOID param, PVOID *context) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    return TRUE;
+}
+
+static void initCurl() {
+    InitOnceExecuteOnce(&curlOnce, initCurlOnce, NULL, NULL);
+}
+#else
+static pthread_once_t curlOnce = PTHREAD_ONCE_INIT;
+
+static void initCurlOnce() {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+static void initCurl() {
+    pthread_once(&curlOnce, initCurlOnce);
+}
+#endif
+
 static void createResponse(VM *vm, Response *response) {
     response->vm = vm;
     response->headers = newMap(vm);
@@ -259,8 +288,9 @@ static size_t writeHeaders(const char *ptr, const size_t size, const size_t nite
     if (nitems != 2) {
         const ObjString *str = copyString(response->vm, ptr, (int)((nitems - 2) * size));
 
-        const char *key = strtok(str->str, ": ");
-        const char *value = strtok(NULL, ": ");
+        char *ptr;
+        const char *key = strtok_r(str->str, ": ", &ptr);
+        const char *value = strtok_r(NULL, ": ", &ptr);
 
         const Value keyValue = OBJ_VAL(copyString(response->vm, key, strlen(key)));
         const Value valueValue = OBJ_VAL(copyString(response->vm, value, strlen(value)));
@@ -345,7 +375,6 @@ static ObjMap *makeResponse(VM *vm, CURL *curl, Response response, const bool cl
 
     if (cleanup) {
         curl_easy_cleanup(curl);
-        curl_global_cleanup();
     }
 
     return responseMap;
@@ -454,7 +483,7 @@ static Value httpGet(VM *vm, const int argc, const Value *args) {
         timeout = AS_NUMBER(args[3]);
     }
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    initCurl();
     CURL *curl = curl_easy_init();
 
     if (curl) {
@@ -486,7 +515,6 @@ static Value httpGet(VM *vm, const int argc, const Value *args) {
 
         if (curlResponse != CURLE_OK) {
             curl_easy_cleanup(curl);
-            curl_global_cleanup();
             pop(vm);
 
             // char *errorString = (char *) curl_easy_strerror(curlResponse);
@@ -497,7 +525,6 @@ static Value httpGet(VM *vm, const int argc, const Value *args) {
     }
 
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     pop(vm);
 
     // char *errorString = (char *) curl_easy_strerror(CURLE_FAILED_INIT);
@@ -557,7 +584,7 @@ static Value httpPost(VM *vm, const int argc, const Value *args) {
         timeout = (int)AS_NUMBER(args[3]);
     }
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    initCurl();
     CURL *curl = curl_easy_init();
 
     if (curl) {
@@ -603,7 +630,6 @@ static Value httpPost(VM *vm, const int argc, const Value *args) {
         if (curlResponse != CURLE_OK) {
             /* always cleanup */
             curl_easy_cleanup(curl);
-            curl_global_cleanup();
             pop(vm);
 
             // char *errorString = (char *) curl_easy_strerror(curlResponse);
@@ -614,7 +640,6 @@ static Value httpPost(VM *vm, const int argc, const Value *args) {
     }
 
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     pop(vm);
 
     // char *errorString = (char *) curl_easy_strerror(CURLE_FAILED_INIT);
@@ -674,7 +699,7 @@ static Value httpPut(VM *vm, const int argc, const Value *args) {
         timeout = (int)AS_NUMBER(args[3]);
     }
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    initCurl();
     CURL *curl = curl_easy_init();
 
     if (curl) {
@@ -721,7 +746,6 @@ static Value httpPut(VM *vm, const int argc, const Value *args) {
         if (curlResponse != CURLE_OK) {
             /* always cleanup */
             curl_easy_cleanup(curl);
-            curl_global_cleanup();
             pop(vm);
 
             // char *errorString = (char *) curl_easy_strerror(curlResponse);
@@ -732,7 +756,6 @@ static Value httpPut(VM *vm, const int argc, const Value *args) {
     }
 
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     pop(vm);
 
     // char *errorString = (char *) curl_easy_strerror(CURLE_FAILED_INIT);
@@ -778,7 +801,7 @@ static Value httpHead(VM *vm, const int argc, const Value *args) {
         timeout = AS_NUMBER(args[3]);
     }
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    initCurl();
     CURL *curl = curl_easy_init();
 
     if (curl) {
@@ -808,7 +831,6 @@ static Value httpHead(VM *vm, const int argc, const Value *args) {
 
         if (curlResponse != CURLE_OK) {
             curl_easy_cleanup(curl);
-            curl_global_cleanup();
             pop(vm);
 
             // char *errorString = (char *) curl_easy_strerror(curlResponse);
@@ -819,7 +841,6 @@ static Value httpHead(VM *vm, const int argc, const Value *args) {
     }
 
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     pop(vm);
 
     // char *errorString = (char *) curl_easy_strerror(CURLE_FAILED_INIT);
@@ -865,7 +886,7 @@ static Value httpOptions(VM *vm, const int argc, const Value *args) {
         timeout = AS_NUMBER(args[3]);
     }
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    initCurl();
     CURL *curl = curl_easy_init();
 
     if (curl) {
@@ -898,7 +919,6 @@ static Value httpOptions(VM *vm, const int argc, const Value *args) {
 
         if (curlResponse != CURLE_OK) {
             curl_easy_cleanup(curl);
-            curl_global_cleanup();
             pop(vm);
 
             // char *errorString = (char *) curl_easy_strerror(curlResponse);
@@ -909,7 +929,6 @@ static Value httpOptions(VM *vm, const int argc, const Value *args) {
     }
 
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     pop(vm);
 
     // char *errorString = (char *) curl_easy_strerror(CURLE_FAILED_INIT);
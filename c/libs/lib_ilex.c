@@ -118,6 +118,15 @@ static Value ilexGcRuns(VM *vm, const int argc, const Value *args) {
     return NUMBER_VAL((double)vm->gcRuns);
 }
 
+static Value ilexYoungGcRuns(VM *vm, const int argc, const Value *args) {
+    return NUMBER_VAL((double)vm->youngGcRuns);
+}
+
+// Longest time, in seconds, the program was stopped by a single collection or collection step.
+static Value ilexGcMaxPause(VM *vm, const int argc, const Value *args) {
+    return NUMBER_VAL(vm->gcMaxPause);
+}
+
 static Value ilexCollectGarbage(VM *vm, const int argc, const Value *args) {
     collectGarbage(vm);
     return ZERO_VAL;
@@ -166,6 +175,8 @@ Value useIlexLib(VM *vm) {
     defineNative(vm, "getMemUsage", ilexGetMemUsed, &lib->values);
     defineNative(vm, "nextGC", ilexNextGcAt, &lib->values);
     defineNative(vm, "gcRuns", ilexGcRuns, &lib->values);
+    defineNative(vm, "youngGcRuns", ilexYoungGcRuns, &lib->values);
+    defineNative(vm, "gcMaxPause", ilexGcMaxPause, &lib->values);
 
     defineNative(vm, "collectGarbage", ilexCollectGarbage, &lib->values);
 
@@ -87,12 +87,12 @@ static Value nativeToBool(VM *vm, const int argc, const Value *args) {
 }
 
 void defineNatives(VM *vm) {
-    defineNative(vm, "println", println, &vm->globals);
-    defineNative(vm, "debugln", println, &vm->globals); // Same as println but more searchable.
-    defineNative(vm, "newLine", newLine, &vm->globals);
-    defineNative(vm, "print", print, &vm->globals);
-    defineNative(vm, "debug", print, &vm->globals); // Same as print but more searchable.
-    defineNative(vm, "printErr", stdErr, &vm->globals);
-    defineNative(vm, "toString", nativeToString, &vm->globals);
-    defineNative(vm, "toBool", nativeToBool, &vm->globals);
+    registerGlobalFunction(vm, "println", println);
+    registerGlobalFunction(vm, "debugln", println); // Same as println but more searchable.
+    registerGlobalFunction(vm, "newLine", newLine);
+    registerGlobalFunction(vm, "print", print);
+    registerGlobalFunction(vm, "debug", print); // Same as print but more searchable.
+    registerGlobalFunction(vm, "printErr", stdErr);
+    registerGlobalFunction(vm, "toString", nativeToString);
+    registerGlobalFunction(vm, "toBool", nativeToBool);
 }
\ No newline at end of file
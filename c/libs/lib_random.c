@@ -37,12 +37,26 @@
                             } \
                         } while (false)
 
-unsigned int randomLibSeed;
+// Every VM has its own generator, nextRandom(vm) would share one between the threads of a host. Numbers are between 0 and
+// RAND_MAX like the ones nextRandom(vm) gave.
+void seedRandom(VM *vm, const unsigned int seed) {
+    vm->randomSeed = seed;
+    vm->randomState = seed;
+}
+
+// splitmix64.
+int nextRandom(VM *vm) {
+    uint64_t z = (vm->randomState += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    z ^= z >> 31;
+    return (int)(z % ((uint64_t)RAND_MAX + 1));
+}
 
 static Value randomSeed(VM *vm, int argc, const Value *args) {
     argCheckNum("seed");
 
-    srand((unsigned  int)AS_NUMBER(args[0]));
+    seedRandom(vm, (unsigned int)AS_NUMBER(args[0]));
 
     return ZERO_VAL;
 }
@@ -50,22 +64,22 @@ static Value randomSeed(VM *vm, int argc, const Value *args) {
 static Value randomRandomSeed(VM *vm, int argc, const Value *args) {
     argCheckNum("randomSeed");
 
-    srand((unsigned  int)rand() % RAND_MAX);
+    seedRandom(vm, (unsigned int)nextRandom(vm));
 
     return ZERO_VAL;
 }
 
 static Value randomGetSeed(VM *vm, const int argc, const Value *args) {
-    return NUMBER_VAL(randomLibSeed);
+    return NUMBER_VAL(vm->randomSeed);
 }
 
 static Value randomRand(VM *vm, const int argc, const Value *args) {
-    return NUMBER_VAL((double)rand() / RAND_MAX);
+    return NUMBER_VAL((double)nextRandom(vm) / RAND_MAX);
 }
 
 static Value randomRandom(VM *vm, const int argc, const Value *args) {
     if (argc == 0) {
-        return NUMBER_VAL((double)rand());
+        return NUMBER_VAL((double)nextRandom(vm));
     }
 
     if (!IS_NUMBER(args[0])) {
@@ -75,18 +89,18 @@ static Value randomRandom(VM *vm, const int argc, const Value *args) {
         return ERROR_VAL;
     }
 
-    return AS_NUMBER((double)rand() / (double)(RAND_MAX / AS_NUMBER(args[0])));
+    return AS_NUMBER((double)nextRandom(vm) / (double)(RAND_MAX / AS_NUMBER(args[0])));
 }
 
 static Value randomRandomRange(VM *vm, int argc, const Value *args) {
     argCheckNum2("randomRange");
 
-    return AS_NUMBER((double)rand() / (double)(RAND_MAX / AS_NUMBER(args[0]) - AS_NUMBER(args[1])));
+    return AS_NUMBER((double)nextRandom(vm) / (double)(RAND_MAX / AS_NUMBER(args[0]) - AS_NUMBER(args[1])));
 }
 
 static Value randomRandomI(VM *vm, int argc, const Value *args) {
     if (argc == 0) {
-        return NUMBER_VAL(rand());
+        return NUMBER_VAL(nextRandom(vm));
     }
 
     if (!IS_NUMBER(args[0])) {
@@ -96,13 +110,13 @@ static Value randomRandomI(VM *vm, int argc, const Value *args) {
         return ERROR_VAL;
     }
 
-    return AS_NUMBER(rand() % (unsigned int)AS_NUMBER(args[0]));
+    return AS_NUMBER(nextRandom(vm) % (unsigned int)AS_NUMBER(args[0]));
 }
 
 static Value randomRandomRangeI(VM *vm, int argc, const Value *args) {
     argCheckNum2("intRange");
 
-    return AS_NUMBER(rand() % (unsigned int)( AS_NUMBER(args[0]) - AS_NUMBER(args[1])));
+    return AS_NUMBER(nextRandom(vm) % (unsigned int)( AS_NUMBER(args[0]) - AS_NUMBER(args[1])));
 }
 
 static Value randomChoose(VM *vm, const int argc, const Value *args) {
@@ -121,13 +135,13 @@ static Value randomChoose(VM *vm, const int argc, const Value *args) {
             return array->data.values[0];
         }
         
-        return array->data.values[rand() % len];
+        return array->data.values[nextRandom(vm) % len];
     }
     if (argc == 1) {
         return args[0];
     }
     
-    return args[rand() % argc];
+    return args[nextRandom(vm) % argc];
 }
 
 Value useRandomLib(VM *vm) {
@@ -140,8 +154,7 @@ Value useRandomLib(VM *vm) {
         return OBJ_VAL(lib);
     }
 
-    randomLibSeed = time(NULL);
-    srand(randomLibSeed);
+    seedRandom(vm, (unsigned int)time(NULL) ^ (unsigned int)((uintptr_t)vm >> 4));
 
     defineNative(vm, "seed", randomSeed, &lib->values);
     defineNative(vm, "randomSeed", randomRandomSeed, &lib->values);
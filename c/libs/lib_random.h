@@ -7,6 +7,8 @@
 
 #include "../value.h"
 
+void seedRandom(VM *vm, unsigned int seed);
+int nextRandom(VM *vm);
 Value useRandomLib(VM *vm);
 
 #endif //__C_LIB_RANDOM_H__
@@ -0,0 +1,442 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#include "lib_thread.h"
+
+#include "../memory.h"
+#include "../util.h"
+#include "../vm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef I_WIN
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
+
+// Every thread runs a script in a VM of its own. Values only cross between VMs packed, see packValue(), so the VMs
+// share nothing. A future is the handle the spawning VM gets, it sends to and receives from the thread and joins it.
+
+#ifndef I_WIN
+
+typedef struct Message {
+    Packed *value;
+    struct Message *next;
+} Message;
+
+typedef struct {
+    Message *head;
+    Message *tail;
+    bool closed; // Nothing more will be sent.
+} Queue;
+
+// Shared by the future and the thread, whichever lets go of it last frees it.
+struct Worker {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    char *path;
+    Packed *args;
+    Queue inbox;  // From the future to the thread.
+    Queue outbox; // From the thread to the future.
+    Packed *result;
+    bool done;
+    bool failed;
+    bool joined;
+    bool optimize; // The thread compiles and runs its script like the VM that spawned it.
+    int jitThreshold;
+    int refs;
+};
+
+static void pushMessage(Queue *queue, Packed *value) {
+    Message *message = (Message*)malloc(sizeof(Message));
+    if (message == NULL) {
+        exit(69);
+    }
+
+    message->value = value;
+    message->next = NULL;
+    if (queue->tail == NULL) {
+        queue->head = message;
+    } else {
+        queue->tail->next = message;
+    }
+    queue->tail = message;
+}
+
+static Packed *popMessage(Queue *queue) {
+    Message *message = queue->head;
+    if (message == NULL) {
+        return NULL;
+    }
+
+    queue->head = message->next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+
+    Packed *value = message->value;
+    free(message);
+    return value;
+}
+
+static void freeQueue(Queue *queue) {
+    while (queue->head != NULL) {
+        freePacked(popMessage(queue));
+    }
+}
+
+// Called with the lock held, it is released either way.
+static void releaseWorker(Worker *worker) {
+    const bool last = --worker->refs == 0;
+    pthread_mutex_unlock(&worker->lock);
+    if (!last) {
+        return;
+    }
+
+    freeQueue(&worker->inbox);
+    freeQueue(&worker->outbox);
+    freePacked(worker->args);
+    freePacked(worker->result);
+    pthread_cond_destroy(&worker->wake);
+    pthread_mutex_destroy(&worker->lock);
+    free(worker->path);
+    free(worker);
+}
+
+static void *runWorker(void *data) {
+    Worker *worker = (Worker*)data;
+    VM *vm = initVM(worker->path, 0, NULL);
+    vm->worker = worker;
+    vm->optimize = worker->optimize;
+    vm->jitThreshold = worker->jitThreshold;
+
+    InterpretResult result = INTERPRET_RUNTIME_ERROR;
+    MappedFile source;
+    if (mapFile(worker->path, &source, true)) {
+        result = interpret(vm, worker->path, source.bytes);
+        unmapFile(&source);
+    } else {
+        fprintf(stderr, "Could not open file '%s'.\n", worker->path);
+    }
+    freeVM(vm);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->done = true;
+    worker->failed = result != INTERPRET_GOOD;
+    worker->outbox.closed = true;
+    pthread_cond_broadcast(&worker->wake);
+    releaseWorker(worker);
+    return NULL;
+}
+
+static void freeFuture(VM *vm, ObjAbstract *abstract) {
+    Worker *worker = (Worker*)abstract->data;
+    if (worker == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    if (!worker->joined) {
+        pthread_detach(worker->thread);
+        worker->joined = true;
+    }
+    worker->inbox.closed = true;
+    pthread_cond_broadcast(&worker->wake);
+    releaseWorker(worker);
+}
+
+// The optional second argument of send() and result() says whether arrays are transferred instead of copied.
+static Packed *packArgument(VM *vm, const char *name, const int argc, const Value *args) {
+    if (argc != 1 && argc != 2) {
+        runtimeError(vm, "Function %s() expected 1 or 2 arguments but got '%d'.", name, argc);
+        return NULL;
+    }
+
+    if (argc == 2 && !IS_BOOL(args[1])) {
+        char *type = valueType(args[1]);
+        runtimeError(vm, "Function %s() expected type 'bool' for the second argument but got '%s'.", name, type);
+        free(type);
+        return NULL;
+    }
+
+    Packed *packed = packValue(vm, args[0], argc == 2 && AS_BOOL(args[1]));
+    if (packed == NULL) {
+        char *type = valueType(args[0]);
+        runtimeError(vm, "Function %s() can't send '%s' to another thread.", name, type);
+        free(type);
+    }
+
+    return packed;
+}
+
+// Waits for a message in queue, NULL once the queue is closed and empty.
+static Packed *receiveMessage(Worker *worker, Queue *queue) {
+    pthread_mutex_lock(&worker->lock);
+    while (queue->head == NULL && !queue->closed) {
+        pthread_cond_wait(&worker->wake, &worker->lock);
+    }
+
+    Packed *value = popMessage(queue);
+    pthread_mutex_unlock(&worker->lock);
+    return value;
+}
+
+static void sendMessage(Worker *worker, Queue *queue, Packed *value) {
+    pthread_mutex_lock(&worker->lock);
+    if (queue->closed) {
+        freePacked(value);
+    } else {
+        pushMessage(queue, value);
+        pthread_cond_broadcast(&worker->wake);
+    }
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static Value futureSend(VM *vm, const int argc, const Value *args) {
+    Packed *value = packArgument(vm, "send", argc, args + 1);
+    if (value == NULL) {
+        return ERROR_VAL;
+    }
+
+    Worker *worker = (Worker*)AS_ABSTRACT(args[0])->data;
+    sendMessage(worker, &worker->inbox, value);
+    return ZERO_VAL;
+}
+
+static Value futureReceive(VM *vm, const int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function receive() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    Worker *worker = (Worker*)AS_ABSTRACT(args[0])->data;
+    Packed *value = receiveMessage(worker, &worker->outbox);
+    return value == NULL ? NULL_VAL : unpackValue(vm, value);
+}
+
+static Value futureDone(VM *vm, const int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function done() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    Worker *worker = (Worker*)AS_ABSTRACT(args[0])->data;
+    pthread_mutex_lock(&worker->lock);
+    const bool done = worker->done;
+    pthread_mutex_unlock(&worker->lock);
+    return BOOL_VAL(done);
+}
+
+static Value futureJoin(VM *vm, const int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function join() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    ObjAbstract *future = AS_ABSTRACT(args[0]);
+    Worker *worker = (Worker*)future->data;
+    pthread_mutex_lock(&worker->lock);
+    const bool joined = worker->joined;
+    worker->joined = true;
+    pthread_mutex_unlock(&worker->lock);
+
+    // Joined once, the result is kept with the future for the next time.
+    if (joined) {
+        Value result = NULL_VAL;
+        tableGet(&future->values, copyString(vm, "$result", 7), &result);
+        return result;
+    }
+
+    pthread_join(worker->thread, NULL);
+    if (worker->failed) {
+        runtimeError(vm, "Thread '%s' stopped with an error.", worker->path);
+        return ERROR_VAL;
+    }
+
+    Packed *packed = worker->result;
+    worker->result = NULL;
+    const Value result = packed == NULL ? NULL_VAL : unpackValue(vm, packed);
+    push(vm, result);
+    ObjString *resultName = copyString(vm, "$result", 7);
+    push(vm, OBJ_VAL(resultName));
+    tableSet(vm, &future->values, resultName, result, ILEX_READ_ONLY);
+    pop(vm);
+    pop(vm);
+    return result;
+}
+
+static Value threadSpawn(VM *vm, const int argc, const Value *args) {
+    if (argc == 0) {
+        runtimeError(vm, "Function spawn() expected at least 1 argument but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_STRING(args[0])) {
+        char *type = valueType(args[0]);
+        runtimeError(vm, "Function spawn() expected type 'string' but got '%s'.", type);
+        free(type);
+        return ERROR_VAL;
+    }
+
+    // Relative to the script that spawns it, like use.
+    char path[I_MAX_PATH];
+    const CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    if (!resolvePath(frame->closure->function->script->path->str, AS_CSTRING(args[0]), path)) {
+        runtimeError(vm, "Could not open file '%s'.", AS_CSTRING(args[0]));
+        return ERROR_VAL;
+    }
+
+    ObjArray *threadArgs = newArray(vm);
+    push(vm, OBJ_VAL(threadArgs));
+    for (int i = 1; i < argc; ++i) {
+        writeValueArray(vm, &threadArgs->data, args[i]);
+    }
+    Packed *packedArgs = packValue(vm, OBJ_VAL(threadArgs), false);
+    pop(vm);
+    if (packedArgs == NULL) {
+        runtimeError(vm, "Function spawn() can only send numbers, booleans, null, strings, arrays, maps and sets to a thread.");
+        return ERROR_VAL;
+    }
+
+    Worker *worker = (Worker*)calloc(1, sizeof(Worker));
+    if (worker == NULL) {
+        exit(69);
+    }
+
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    worker->path = newCString(path);
+    worker->args = packedArgs;
+    worker->optimize = vm->optimize;
+    worker->jitThreshold = vm->jitThreshold;
+    worker->refs = 2;
+
+    ObjAbstract *future = newAbstract(vm, freeFuture);
+    push(vm, OBJ_VAL(future));
+    defineNative(vm, "send", futureSend, &future->values);
+    defineNative(vm, "receive", futureReceive, &future->values);
+    defineNative(vm, "done", futureDone, &future->values);
+    defineNative(vm, "join", futureJoin, &future->values);
+
+    if (pthread_create(&worker->thread, NULL, runWorker, worker) != 0) {
+        worker->refs = 1;
+        pthread_mutex_lock(&worker->lock);
+        releaseWorker(worker);
+        pop(vm);
+        runtimeError(vm, "Unable to start a thread for '%s'.", path);
+        return ERROR_VAL;
+    }
+
+    future->data = worker;
+    pop(vm);
+    return OBJ_VAL(future);
+}
+
+static Worker *currentWorker(VM *vm, const char *name) {
+    if (vm->worker == NULL) {
+        runtimeError(vm, "Function %s() can only be used by a script running in a thread.", name);
+    }
+
+    return vm->worker;
+}
+
+static Value threadSend(VM *vm, const int argc, const Value *args) {
+    Worker *worker = currentWorker(vm, "send");
+    Packed *value = worker == NULL ? NULL : packArgument(vm, "send", argc, args);
+    if (value == NULL) {
+        return ERROR_VAL;
+    }
+
+    sendMessage(worker, &worker->outbox, value);
+    return ZERO_VAL;
+}
+
+static Value threadReceive(VM *vm, const int argc, const Value *args) {
+    Worker *worker = currentWorker(vm, "receive");
+    if (worker == NULL) {
+        return ERROR_VAL;
+    }
+
+    if (argc != 0) {
+        runtimeError(vm, "Function receive() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    Packed *value = receiveMessage(worker, &worker->inbox);
+    return value == NULL ? NULL_VAL : unpackValue(vm, value);
+}
+
+static Value threadResult(VM *vm, const int argc, const Value *args) {
+    Worker *worker = currentWorker(vm, "result");
+    Packed *value = worker == NULL ? NULL : packArgument(vm, "result", argc, args);
+    if (value == NULL) {
+        return ERROR_VAL;
+    }
+
+    // Nothing else looks at the result until the thread is done.
+    freePacked(worker->result);
+    worker->result = value;
+    return ZERO_VAL;
+}
+
+#else
+
+static Value threadSpawn(VM *vm, const int argc, const Value *args) {
+    runtimeError(vm, "Threads aren't supported on Windows yet.");
+    return ERROR_VAL;
+}
+
+#endif
+
+static Value threadCores(VM *vm, const int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function cores() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+#ifdef I_WIN
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return NUMBER_VAL(info.dwNumberOfProcessors);
+#else
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return NUMBER_VAL(cores < 1 ? 1 : cores);
+#endif
+}
+
+Value useThreadLib(VM *vm) {
+    ObjString *name = copyString(vm, "thread", 6);
+    push(vm, OBJ_VAL(name));
+    ObjScript *lib = newScript(vm, name);
+    push(vm, OBJ_VAL(lib));
+
+    if (lib->used) {
+        return OBJ_VAL(lib);
+    }
+
+    defineNative(vm, "spawn", threadSpawn, &lib->values);
+    defineNative(vm, "cores", threadCores, &lib->values);
+#ifndef I_WIN
+    defineNative(vm, "send", threadSend, &lib->values);
+    defineNative(vm, "receive", threadReceive, &lib->values);
+    defineNative(vm, "result", threadResult, &lib->values);
+
+    // What the thread was spawned with, or an empty array outside of one.
+    Worker *worker = vm->worker;
+    if (worker != NULL && worker->args != NULL) {
+        Packed *packed = worker->args;
+        worker->args = NULL;
+        defineNativeValue(vm, "args", unpackValue(vm, packed), &lib->values);
+    } else {
+        defineNativeValue(vm, "args", OBJ_VAL(newArray(vm)), &lib->values);
+    }
+#endif
+
+    pop(vm);
+    pop(vm);
+
+    lib->used = true;
+    return OBJ_VAL(lib);
+}
@@ -0,0 +1,12 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_LIB_THREAD_H__
+#define __C_LIB_THREAD_H__
+
+#include "../value.h"
+
+Value useThreadLib(VM *vm);
+
+#endif //__C_LIB_THREAD_H__
@@ -143,16 +143,20 @@ static void setArrayValueFromToml(VM *vm, ObjArray *array, const toml_array_t *a
         const toml_table_t *table = toml_table_at(arr, i);
         if (table != NULL) {
             ObjMap *map = newMap(vm);
+            push(vm, OBJ_VAL(map));
             setMapValuesFromToml(vm, map, table);
             appendMap(vm, array, map);
+            pop(vm);
             continue;
         }
 
         const toml_array_t *subArr = toml_array_at(arr, i);
         if (subArr != NULL) {
             ObjArray *subArray = newArray(vm);
+            push(vm, OBJ_VAL(subArray));
             setArrayValueFromToml(vm, subArray, subArr);
             appendArray(vm, array, subArray);
+            pop(vm);
             continue;
         }
 
@@ -165,11 +169,10 @@ static void setMapArray(VM *vm, ObjMap *map, const toml_array_t *arr, const char
     push(vm, valueKey);
 
     ObjArray *array = newArray(vm);
-    setArrayValueFromToml(vm, array, arr);
-
     const Value value = OBJ_VAL(array);
     push(vm, value);
 
+    setArrayValueFromToml(vm, array, arr);
     mapSet(vm, map, valueKey, value);
     pop(vm);
     pop(vm);
@@ -209,8 +212,10 @@ void setMapValuesFromToml(VM *vm, ObjMap *map, const toml_table_t *conf) {
         const toml_table_t *table = toml_table_in(conf, key);
         if (table != NULL) {
             ObjMap *subMap = newMap(vm);
+            push(vm, OBJ_VAL(subMap));
             setMapValuesFromToml(vm, subMap, table);
             setMapMap(vm, map, subMap, key);
+            pop(vm);
             continue;
         }
 
@@ -249,7 +254,9 @@ static Value tomlParseFile(VM *vm, const int argc, const Value *args) {
     }
 
     ObjMap *map = newMap(vm);
+    push(vm, OBJ_VAL(map));
     setMapValuesFromToml(vm, map, conf);
+    pop(vm);
 
     return OBJ_VAL(map);
 }
@@ -276,7 +283,9 @@ static Value tomlParseString(VM *vm, const int argc, const Value *args) {
     }
 
     ObjMap *map = newMap(vm);
+    push(vm, OBJ_VAL(map));
     setMapValuesFromToml(vm, map, conf);
+    pop(vm);
 
     return OBJ_VAL(map);
 }
@@ -17,10 +17,29 @@ void printHelp() {
     printf("info    -i ------ Print build info\n");
     printf("help    -h ------ Print help text\n");
     printf("\n");
-    printf("Usage: ilex [path]\n");
+    printf("Usage: ilex [-O] [-J[threshold]] [path]\n");
+    printf("\n");
+    printf("-O ------------- Optimize the bytecode of scripts as they are compiled\n");
+    printf("-J[threshold] -- Compile functions to machine code after threshold calls and loop iterations, %d by\n",
+           ILEX_JIT_THRESHOLD);
+    printf("                 default. -J0 turns it off\n");
 }
 
 int main(int argc, char **argv) {
+    bool optimize = false;
+    int jitThreshold = 0;
+    while (argc >= 2 && (strcmp("-O", argv[1]) == 0 || strncmp("-J", argv[1], 2) == 0)) {
+        if (argv[1][1] == 'O') {
+            optimize = true;
+        } else {
+            jitThreshold = argv[1][2] == '\0' ? ILEX_JIT_THRESHOLD : atoi(argv[1] + 2);
+        }
+
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc >= 2) {
         if (strcmp("-v", argv[1]) == 0 || strcmp("version", argv[1]) == 0) {
             printf("%s\n", ILEX_VERSION);
@@ -36,6 +55,8 @@ int main(int argc, char **argv) {
         }
         
         VM *vm = initVM(argv[1], argc, argv);
+        setOptimize(vm, optimize);
+        setJitThreshold(vm, jitThreshold);
         runFile(vm, argv[1]);
         freeVM(vm);
     } else {
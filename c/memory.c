@@ -3,10 +3,19 @@
 //
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef ILEX_BACKGROUND_SWEEP
+#   include <pthread.h>
+#endif
 
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
+#include "shape.h"
 #include "vm.h"
+#include "libs/lib_async.h"
 
 #ifdef DEBUG_LOG_GC
 #include <stdio.h>
@@ -15,15 +24,30 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
-void *reallocate(VM *vm, void *pointer, size_t oldSize, size_t newSize) {
-    vm->bytesAllocated += newSize - oldSize;
-    if (newSize > oldSize) {
+static void collectIfNeeded(VM *vm) {
 #ifdef DEBUG_STRESS_GC
+    collectGarbage(vm);
+#endif
+#ifdef ILEX_NO_INCREMENTAL_GC
+    if (vm->bytesAllocated > vm->nextGC) {
         collectGarbage(vm);
+    }
+#else
+    if (vm->gcPhase != GC_IDLE || vm->bytesAllocated > vm->nextGC) {
+        collectGarbageStep(vm);
+    }
 #endif
-        if (vm->bytesAllocated > vm->nextGC) {
-            collectGarbage(vm);
-        }
+#ifndef ILEX_NO_GENERATIONAL_GC
+    else if (vm->bytesAllocated > vm->nextYoungGC) {
+        collectYoungGarbage(vm);
+    }
+#endif
+}
+
+void *reallocate(VM *vm, void *pointer, size_t oldSize, size_t newSize) {
+    vm->bytesAllocated += newSize - oldSize;
+    if (newSize > oldSize) {
+        collectIfNeeded(vm);
     }
 
     if (newSize == 0) {
@@ -39,12 +63,302 @@ void *reallocate(VM *vm, void *pointer, size_t oldSize, size_t newSize) {
     return mem;
 }
 
+// A buffer from reallocate() can be handed to another VM, it stops counting for the one it came from and starts counting
+// for the one that takes it. Nothing pooled can move, the pools belong to the VM.
+void releaseBuffer(VM *vm, const size_t size) {
+    vm->bytesAllocated -= size;
+}
+
+void adoptBuffer(VM *vm, const size_t size) {
+    vm->bytesAllocated += size;
+}
+
+#define POOL_CLASS(size) (((size) - 1) / POOL_GRANULE)
+#define IS_POOLED(size) ((size) != 0 && (size) <= POOL_MAX_SIZE)
+
+// Slabs start with the link to the next one, padded to a granule so every block stays aligned.
+static void *allocateFromSlab(VM *vm, const size_t size) {
+    if (vm->slabNext == NULL || (size_t)(vm->slabEnd - vm->slabNext) < size) {
+        char *slab = (char*)malloc(POOL_SLAB_SIZE);
+        if (slab == NULL) {
+            exit(69);
+        }
+
+        *(void**)slab = vm->slabs;
+        vm->slabs = slab;
+        vm->slabNext = slab + POOL_GRANULE;
+        vm->slabEnd = slab + POOL_SLAB_SIZE;
+    }
+
+    void *mem = vm->slabNext;
+    vm->slabNext += size;
+    return mem;
+}
+
+// Same contract as reallocate(), but sizes up to POOL_MAX_SIZE are served from the pools. A block only changes when
+// the size moves to another class.
+void *reallocatePooled(VM *vm, void *pointer, size_t oldSize, size_t newSize) {
+#ifdef ILEX_NO_POOL
+    return reallocate(vm, pointer, oldSize, newSize);
+#else
+    const bool wasPooled = IS_POOLED(oldSize);
+    const bool isPooled = IS_POOLED(newSize);
+    if (!wasPooled && !isPooled) {
+        return reallocate(vm, pointer, oldSize, newSize);
+    }
+
+    if (wasPooled && isPooled && POOL_CLASS(oldSize) == POOL_CLASS(newSize)) {
+        vm->bytesAllocated += newSize - oldSize;
+        return pointer;
+    }
+
+    void *mem = NULL;
+    if (isPooled) {
+        vm->bytesAllocated += newSize;
+        collectIfNeeded(vm);
+
+        const int sizeClass = POOL_CLASS(newSize);
+        mem = vm->pools[sizeClass];
+        if (mem != NULL) {
+            vm->pools[sizeClass] = *(void**)mem;
+        } else {
+            mem = allocateFromSlab(vm, (sizeClass + 1) * POOL_GRANULE);
+        }
+    } else if (newSize != 0) {
+        mem = reallocate(vm, NULL, 0, newSize);
+    }
+
+    if (pointer == NULL) {
+        return mem;
+    }
+
+    if (mem != NULL) {
+        memcpy(mem, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+
+    if (wasPooled) {
+        vm->bytesAllocated -= oldSize;
+        const int sizeClass = POOL_CLASS(oldSize);
+        *(void**)pointer = vm->pools[sizeClass];
+        vm->pools[sizeClass] = pointer;
+    } else {
+        reallocate(vm, pointer, oldSize, 0);
+    }
+
+    return mem;
+#endif
+}
+
+// Objects live in arenas that are split into blocks of one size class. A full collection sweeps them an arena at a
+// time, either from collectGarbageStep() or when an allocation runs out of free blocks of its class.
+struct Arena {
+    Arena *next;
+    int blockSize;
+    int blockCount;
+};
+
+#define ARENA_HEADER_SIZE ((sizeof(Arena) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)
+#define ARENA_BLOCK(arena, i) ((Obj*)((char*)(arena) + ARENA_HEADER_SIZE + (size_t)(i) * (arena)->blockSize))
+
+// Free blocks are linked through the word after the object header.
+typedef struct {
+    Obj obj;
+    Obj *next;
+} FreeBlock;
+
+static void pushFreeBlock(VM *vm, const int sizeClass, Obj *obj) {
+    obj->isFree = true;
+    ((FreeBlock*)obj)->next = vm->freeBlocks[sizeClass];
+    vm->freeBlocks[sizeClass] = obj;
+}
+
+static void newArena(VM *vm, const int sizeClass) {
+    Arena *arena = (Arena*)malloc(ARENA_SIZE);
+    if (arena == NULL) {
+        exit(69);
+    }
+
+    arena->next = vm->arenas[sizeClass];
+    arena->blockSize = (sizeClass + 1) * POOL_GRANULE;
+    arena->blockCount = (int)((ARENA_SIZE - ARENA_HEADER_SIZE) / arena->blockSize);
+    vm->arenas[sizeClass] = arena;
+
+    for (int i = arena->blockCount - 1; i >= 0; --i) {
+        pushFreeBlock(vm, sizeClass, ARENA_BLOCK(arena, i));
+    }
+}
+
+static void trackYoungObject(VM *vm, Obj *obj) {
+    if (vm->youngCapacity < vm->youngCount + 1) {
+        vm->youngCapacity = GROW_CAPACITY(vm->youngCapacity);
+        vm->youngObjects = (Obj**)realloc(vm->youngObjects, sizeof(Obj*) * vm->youngCapacity);
+        if (vm->youngObjects == NULL) {
+            exit(69);
+        }
+    }
+
+    vm->youngObjects[vm->youngCount++] = obj;
+}
+
+#ifdef ILEX_BACKGROUND_SWEEP
+// The pools belong to the VM and aren't locked, so the sweeper threads only get buffers that came from malloc. The
+// collector hands them over in batches and the threads take whole batches, so the lock is held for a swap.
+struct Sweeper {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t threads[ILEX_SWEEP_THREADS];
+    void **buffers;
+    int count;
+    int capacity;
+    bool stopping;
+};
+
+static void *runSweeper(void *arg) {
+    Sweeper *sweeper = (Sweeper*)arg;
+
+    pthread_mutex_lock(&sweeper->lock);
+    for (;;) {
+        while (sweeper->count == 0 && !sweeper->stopping) {
+            pthread_cond_wait(&sweeper->wake, &sweeper->lock);
+        }
+
+        if (sweeper->count == 0) {
+            break;
+        }
+
+        void **buffers = sweeper->buffers;
+        const int count = sweeper->count;
+        sweeper->buffers = NULL;
+        sweeper->count = 0;
+        sweeper->capacity = 0;
+        pthread_mutex_unlock(&sweeper->lock);
+
+        for (int i = 0; i < count; ++i) {
+            free(buffers[i]);
+        }
+        free(buffers);
+
+        pthread_mutex_lock(&sweeper->lock);
+    }
+    pthread_mutex_unlock(&sweeper->lock);
+
+    return NULL;
+}
+
+static Sweeper *startSweeper() {
+    Sweeper *sweeper = (Sweeper*)malloc(sizeof(Sweeper));
+    if (sweeper == NULL) {
+        exit(69);
+    }
+
+    pthread_mutex_init(&sweeper->lock, NULL);
+    pthread_cond_init(&sweeper->wake, NULL);
+    sweeper->buffers = NULL;
+    sweeper->count = 0;
+    sweeper->capacity = 0;
+    sweeper->stopping = false;
+    for (int i = 0; i < ILEX_SWEEP_THREADS; ++i) {
+        pthread_create(&sweeper->threads[i], NULL, runSweeper, sweeper);
+    }
+
+    return sweeper;
+}
+
+// Hands the buffers collected since the last call to the sweeper threads.
+static void flushDeadBuffers(VM *vm) {
+    if (vm->deadCount == 0) {
+        return;
+    }
+
+    if (vm->sweeper == NULL) {
+        vm->sweeper = startSweeper();
+    }
+
+    Sweeper *sweeper = vm->sweeper;
+    pthread_mutex_lock(&sweeper->lock);
+    if (sweeper->count == 0) {
+        void **buffers = sweeper->buffers;
+        const int capacity = sweeper->capacity;
+        sweeper->buffers = vm->deadBuffers;
+        sweeper->capacity = vm->deadCapacity;
+        vm->deadBuffers = buffers;
+        vm->deadCapacity = capacity;
+    } else {
+        if (sweeper->capacity < sweeper->count + vm->deadCount) {
+            sweeper->capacity = sweeper->count + vm->deadCount;
+            sweeper->buffers = (void**)realloc(sweeper->buffers, sizeof(void*) * sweeper->capacity);
+            if (sweeper->buffers == NULL) {
+                exit(69);
+            }
+        }
+        memcpy(sweeper->buffers + sweeper->count, vm->deadBuffers, sizeof(void*) * vm->deadCount);
+    }
+    sweeper->count += vm->deadCount;
+    vm->deadCount = 0;
+    pthread_cond_signal(&sweeper->wake);
+    pthread_mutex_unlock(&sweeper->lock);
+}
+
+static void stopSweeper(VM *vm) {
+    flushDeadBuffers(vm);
+    free(vm->deadBuffers);
+    vm->deadBuffers = NULL;
+    vm->deadCapacity = 0;
+
+    Sweeper *sweeper = vm->sweeper;
+    if (sweeper == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&sweeper->lock);
+    sweeper->stopping = true;
+    pthread_cond_broadcast(&sweeper->wake);
+    pthread_mutex_unlock(&sweeper->lock);
+
+    for (int i = 0; i < ILEX_SWEEP_THREADS; ++i) {
+        pthread_join(sweeper->threads[i], NULL);
+    }
+
+    free(sweeper->buffers);
+    pthread_cond_destroy(&sweeper->wake);
+    pthread_mutex_destroy(&sweeper->lock);
+    free(sweeper);
+    vm->sweeper = NULL;
+}
+#else
+static void flushDeadBuffers(VM *vm) {
+    (void)vm;
+}
+#endif
+
+// Frees a malloc'd buffer that belonged to a dead string, array or map.
+static void freeDeadBuffer(VM *vm, void *pointer, const size_t size) {
+#ifdef ILEX_BACKGROUND_SWEEP
+    if (pointer == NULL) {
+        return;
+    }
+
+    vm->bytesAllocated -= size;
+    if (vm->deadCapacity < vm->deadCount + 1) {
+        vm->deadCapacity = GROW_CAPACITY(vm->deadCapacity);
+        vm->deadBuffers = (void**)realloc(vm->deadBuffers, sizeof(void*) * vm->deadCapacity);
+        if (vm->deadBuffers == NULL) {
+            exit(69);
+        }
+    }
+    vm->deadBuffers[vm->deadCount++] = pointer;
+#else
+    reallocate(vm, pointer, size, 0);
+#endif
+}
+
 void markObject(VM *vm, Obj *obj) {
     if (obj == NULL) {
         return;
     }
 
-    if (obj->isMarked) {
+    // Old objects are only traced by a full collection, a minor one finds their references through the remembered set.
+    if (obj->isMarked || (obj->isOld && vm->collectingYoung)) {
         return;
     }
 
@@ -80,13 +394,16 @@ static void markArray(VM *vm, const ValueArray *array) {
     }
 }
 
-static void blackenObject(VM *vm, Obj *obj) {
+// Marks what obj refers to. Returns about how many slots that looked at. Tables count capacity + 1 like maps and sets,
+// an empty one has a capacity of -1.
+static int blackenObject(VM *vm, Obj *obj) {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)obj);
     printValue(OBJ_VAL(obj));
     printf("\n");
 #endif
 
+    int work = 1;
     switch (obj->type) {
         case OBJ_BOUND_METHOD: {
             const ObjBoundMethod *bound = (ObjBoundMethod*)obj;
@@ -102,8 +419,12 @@ static void blackenObject(VM *vm, Obj *obj) {
             markTable(vm, &objClass->staticConsts);
             markTable(vm, &objClass->fields);
             markTable(vm, &objClass->privateFields);
+            for (int i = 0; i < objClass->shapeCount; i++) {
+                markShape(vm, objClass->shapes[i]);
+            }
             markObject(vm, (Obj*)objClass->name);
             markObject(vm, (Obj*)objClass->superClass);
+            work += objClass->methods.capacity + 1 + objClass->fields.capacity + 1 + objClass->shapeCount;
         } break;
         case OBJ_CLOSURE: {
             const ObjClosure *closure = (ObjClosure*)obj;
@@ -111,55 +432,206 @@ static void blackenObject(VM *vm, Obj *obj) {
             for (int i = 0; i < closure->upvalueCount; ++i) {
                 markObject(vm, (Obj*)closure->upvalues[i]);
             }
+            work += closure->upvalueCount;
         } break;
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction*)obj;
             markObject(vm, (Obj*)function->name);
             markArray(vm, &function->chunk.constants);
+            for (int i = 0; i < function->chunk.cacheCount; i++) {
+                // Keeps the shape alive through its class, so a new shape can't reuse its address.
+                const InlineCache *cache = &function->chunk.caches[i];
+                if (cache->shape != NULL) {
+                    markObject(vm, (Obj*)cache->shape->objClass);
+                }
+                markValue(vm, cache->method);
+            }
+            work += function->chunk.constants.count + function->chunk.cacheCount;
         } break;
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance*)obj;
             markObject(vm, (Obj*)instance->objClass);
-            markTable(vm, &instance->fields);
-            markTable(vm, &instance->privateFields);
+            if (instance->shape->dictionary) {
+                markShape(vm, instance->shape);
+            }
+            for (int i = 0; i < instance->shape->slotCount; i++) {
+                markValue(vm, instance->fields[i]);
+            }
+            work += instance->shape->slotCount;
         } break;
         case OBJ_UPVALUE: {
             markValue(vm, ((ObjUpvalue*)obj)->closed);
         } break;
         case OBJ_NATIVE:
-        case OBJ_STRING:
             break;
+        case OBJ_STRING: {
+            ObjString *string = (ObjString*)obj;
+            if (string->str == NULL) {
+                markObject(vm, (Obj*)ROPE_HALVES(string)[0]);
+                markObject(vm, (Obj*)ROPE_HALVES(string)[1]);
+            }
+        } break;
         case OBJ_ENUM: {
             ObjEnum *objEnum = (ObjEnum*)obj;
             markObject(vm, (Obj*)objEnum->name);
             markTable(vm, &objEnum->values);
+            work += objEnum->values.capacity + 1;
         } break;
         case OBJ_ARRAY: {
             ObjArray *array = (ObjArray*)obj;
             markArray(vm, &array->data);
+            work += array->data.count;
         } break;
         case OBJ_MAP: {
             ObjMap *map = (ObjMap*)obj;
             markMap(vm, map);
+            work += map->capacity + 1;
         } break;
         case OBJ_SET: {
             ObjSet *set = (ObjSet*)obj;
             markSet(vm, set);
+            work += set->capacity + 1;
         } break;
         case OBJ_SCRIPT: {
             ObjScript *script = (ObjScript*)obj;
             markObject(vm, (Obj*)script->name);
             markObject(vm, (Obj*)script->path);
             markTable(vm, &script->values);
+            markTable(vm, &script->variables);
+            markArray(vm, &script->variableValues);
+            work += script->values.capacity + 1 + script->variables.capacity + 1 + script->variableValues.count;
         } break;
         case OBJ_FILE:
             break;
         case OBJ_ABSTRACT: {
             ObjAbstract *abstract = (ObjAbstract*)obj;
             markTable(vm, &abstract->values);
+            work += abstract->values.capacity + 1;
+        } break;
+        case OBJ_FIBER: {
+            // The running fiber's stack and frames are the VM's, markRoots() gets those.
+            ObjFiber *fiber = (ObjFiber*)obj;
+            markObject(vm, (Obj*)fiber->closure);
+            markObject(vm, (Obj*)fiber->caller);
+            for (const Value *slot = fiber->stack; slot < fiber->stackTop; slot++) {
+                markValue(vm, *slot);
+            }
+            for (int i = 0; i < fiber->frameCount; ++i) {
+                markObject(vm, (Obj*)fiber->frames[i].closure);
+            }
+            for (ObjUpvalue *upvalue = fiber->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+                markObject(vm, (Obj*)upvalue);
+            }
+            work += (int)(fiber->stackTop - fiber->stack) + fiber->frameCount;
         } break;
         default: break;
     }
+
+    return work;
+}
+
+// Marks the slots of vm->sliced below vm->sliceNext from the top down until about work of them have been looked at.
+// Returns how many were. Values only move down in an array without a write barrier, so going down never skips one.
+// Maps and sets call writeValueBarrier() for every item they move.
+static int traceSlice(VM *vm, const int work) {
+    Obj *obj = vm->sliced;
+    int next = vm->sliceNext;
+    int end = next - work > 0 ? next - work : 0;
+
+    switch (obj->type) {
+        case OBJ_ARRAY: {
+            const ValueArray *data = &((ObjArray*)obj)->data;
+            next = next < data->count ? next : data->count;
+            for (int i = next - 1; i >= end; --i) {
+                markValue(vm, data->values[i]);
+            }
+        } break;
+        case OBJ_MAP: {
+            const ObjMap *map = (ObjMap*)obj;
+            next = next < map->capacity + 1 ? next : map->capacity + 1;
+            for (int i = next - 1; i >= end; --i) {
+                markValue(vm, map->items[i].key);
+                markValue(vm, map->items[i].value);
+            }
+        } break;
+        case OBJ_SET: {
+            const ObjSet *set = (ObjSet*)obj;
+            next = next < set->capacity + 1 ? next : set->capacity + 1;
+            for (int i = next - 1; i >= end; --i) {
+                markValue(vm, set->items[i].value);
+            }
+        } break;
+        default: break;
+    }
+
+    end = end < next ? end : next;
+    vm->sliceNext = end;
+    if (end == 0) {
+        vm->sliced = NULL;
+    }
+
+    return next - end + 1;
+}
+
+// Slots of the objects that are traced a step at a time, 0 for the rest.
+static int sliceCount(const Obj *obj) {
+    switch (obj->type) {
+        case OBJ_ARRAY: return ((ObjArray*)obj)->data.count;
+        case OBJ_MAP: return ((ObjMap*)obj)->capacity + 1;
+        case OBJ_SET: return ((ObjSet*)obj)->capacity + 1;
+        default: return 0;
+    }
+}
+
+// obj is old or marked and is about to be changed in bulk. An incremental collection that has marked it marks what it
+// holds right away, the changes that call this cost as much as that anyway. Otherwise it is remembered for the next
+// minor collection, which traces it again.
+void rememberObject(VM *vm, Obj *obj) {
+    if (vm->gcPhase == GC_MARKING) {
+        if (obj->isMarked) {
+            blackenObject(vm, obj);
+        }
+        return;
+    }
+
+    // Marking is over, whatever is stored now was marked or is new, and every survivor is old after the sweep.
+    if (vm->gcPhase == GC_CLEARING) {
+        return;
+    }
+
+    if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+        vm->rememberedCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+        vm->remembered = (Obj**)realloc(vm->remembered, sizeof(Obj*) * vm->rememberedCapacity);
+
+        if (vm->remembered == NULL) {
+            exit(69);
+        }
+    }
+
+    obj->isRemembered = true;
+    vm->remembered[vm->rememberedCount++] = obj;
+}
+
+// value was stored into obj, which is old or marked. Only a young value needs remembering, the next minor collection
+// marks it like a root. Slots are never looked at again, so the cost doesn't grow with obj.
+void rememberValue(VM *vm, const Obj *obj, Obj *value) {
+    if (vm->gcPhase == GC_MARKING) {
+        if (obj->isMarked) {
+            markObject(vm, value);
+        }
+        return;
+    }
+
+    if (!value->isOld && !value->isRemembered) {
+        rememberObject(vm, value);
+    }
+}
+
+#define FREE_OBJ(vm, type, pointer) freeObjectBlock(vm, (Obj*)(pointer), sizeof(type))
+
+static void freeObjectBlock(VM *vm, Obj *obj, const size_t size) {
+    vm->bytesAllocated -= size;
+    pushFreeBlock(vm, POOL_CLASS(size), obj);
 }
 
 static void freeObject(VM *vm, Obj *obj) {
@@ -169,7 +641,7 @@ static void freeObject(VM *vm, Obj *obj) {
 
     switch (obj->type) {
         case OBJ_BOUND_METHOD: {
-            FREE(vm, ObjBoundMethod, obj);
+            FREE_OBJ(vm, ObjBoundMethod, obj);
         } break;
         case OBJ_CLASS: {
             ObjClass *objClass = (ObjClass*)obj;
@@ -180,72 +652,91 @@ static void freeObject(VM *vm, Obj *obj) {
             freeTable(vm, &objClass->staticConsts);
             freeTable(vm, &objClass->fields);
             freeTable(vm, &objClass->privateFields);
-            FREE(vm, ObjClass, obj);
+            for (int i = 0; i < objClass->shapeCount; i++) {
+                freeShape(vm, objClass->shapes[i]);
+            }
+            FREE_ARRAY(vm, Shape*, objClass->shapes, objClass->shapeCapacity);
+            FREE_OBJ(vm, ObjClass, obj);
         } break;
         case OBJ_CLOSURE: {
             ObjClosure *closure = (ObjClosure*)obj;
-            FREE_ARRAY(vm, ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(vm, ObjClosure, obj);
+            FREE_POOLED_ARRAY(vm, ObjUpvalue*, closure->upvalues, closure->upvalueCount);
+            FREE_OBJ(vm, ObjClosure, obj);
         } break;
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction*)obj;
+            freeJit(function);
             freeChunk(vm, &function->chunk);
-            FREE(vm, ObjFunction, obj);
+            FREE_OBJ(vm, ObjFunction, obj);
         } break;
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance*)obj;
-            freeTable(vm, &instance->fields);
-            FREE(vm, ObjInstance, obj);
+            if (instance->ownsShape) {
+                freeShape(vm, instance->shape);
+            }
+            FREE_POOLED_ARRAY(vm, Value, instance->fields, instance->fieldCapacity);
+            FREE_OBJ(vm, ObjInstance, obj);
         } break;
         case OBJ_NATIVE: {
-            FREE(vm, ObjNative, obj);
+            FREE_OBJ(vm, ObjNative, obj);
         } break;
         case OBJ_STRING: {
             ObjString *string = (ObjString*)obj;
-            FREE_ARRAY(vm, char, string->str, string->len + 1);
-            FREE(vm, ObjString, obj);
+            // Short strings keep their characters inline, a rope only has characters once it's flattened.
+            if (string->len >= LONG_STRING_LENGTH && string->str != NULL) {
+                freeDeadBuffer(vm, string->str, string->len + 1);
+            }
+
+            freeObjectBlock(vm, obj, stringSize(string->len));
         } break;
         case OBJ_UPVALUE: {
-            FREE(vm, ObjUpvalue, obj);
+            FREE_OBJ(vm, ObjUpvalue, obj);
         } break;
         case OBJ_ENUM: {
             ObjEnum *objEnum = (ObjEnum*)obj;
             freeTable(vm, &objEnum->values);
-            FREE(vm, ObjEnum, obj);
+            FREE_OBJ(vm, ObjEnum, obj);
         } break;
         case OBJ_ARRAY: {
             ObjArray *array = (ObjArray*)obj;
-            freeValueArray(vm, &array->data);
-            FREE(vm, ObjArray, obj);
+            freeDeadBuffer(vm, array->data.values, sizeof(Value) * array->data.capacity);
+            FREE_OBJ(vm, ObjArray, obj);
         } break;
         case OBJ_MAP: {
             ObjMap *map = (ObjMap*)obj;
-            FREE_ARRAY(vm, MapItem, map->items, map->capacity + 1);
-            FREE(vm, ObjMap, obj);
+            freeDeadBuffer(vm, map->items, sizeof(MapItem) * (map->capacity + 1));
+            FREE_OBJ(vm, ObjMap, obj);
         } break;
         case OBJ_SET: {
             ObjSet *set = (ObjSet*)obj;
             FREE_ARRAY(vm, SetItem, set->items, set->capacity + 1);
-            FREE(vm, ObjSet, obj);
+            FREE_OBJ(vm, ObjSet, obj);
         } break;
         case OBJ_SCRIPT: {
             ObjScript *script = (ObjScript*)obj;
             freeTable(vm, &script->values);
-            FREE(vm, ObjScript, obj);
+            freeTable(vm, &script->variables);
+            freeValueArray(vm, &script->variableValues);
+            FREE_OBJ(vm, ObjScript, obj);
         } break;
         case OBJ_FILE: {
-            FREE(vm, ObjFile, obj);
+            FREE_OBJ(vm, ObjFile, obj);
         } break;
         case OBJ_ABSTRACT: {
             ObjAbstract *abstract = (ObjAbstract*)obj;
             abstract->feeFn(vm, abstract);
             freeTable(vm, &abstract->values);
-            FREE(vm, ObjAbstract, obj);
+            FREE_OBJ(vm, ObjAbstract, obj);
+        } break;
+        case OBJ_FIBER: {
+            freeFiberBuffers(vm, (ObjFiber*)obj);
+            FREE_OBJ(vm, ObjFiber, obj);
         } break;
     }
 }
 
-static void markRoots(VM *vm) {
+// Returns about how many slots that looked at, the stack, the frames and the globals are most of them.
+static int markRoots(VM *vm) {
     for (const Value *slot = vm->stack; slot < vm->stackTop; slot++) {
         markValue(vm, *slot);
     }
@@ -257,19 +748,27 @@ static void markRoots(VM *vm) {
     for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
         markObject(vm, (Obj*)upvalue);
     }
+    markObject(vm, (Obj*)vm->fiber);
+    markEventLoop(vm);
 
     markTable(vm, &vm->scripts);
     markTable(vm, &vm->globals);
+    markArray(vm, &vm->globalValues);
     markTable(vm, &vm->consts);
     markTable(vm, &vm->numberFunctions);
     markTable(vm, &vm->stringFunctions);
     markTable(vm, &vm->arrayFunctions);
+    markTable(vm, &vm->fileFunctions);
     markTable(vm, &vm->mapFunctions);
     markTable(vm, &vm->setFunctions);
     markTable(vm, &vm->enumFunctions);
+    markTable(vm, &vm->fiberFunctions);
     markCompilerRoots(vm);
     markObject(vm, (Obj*)vm->initString);
+    markObject(vm, (Obj*)vm->toStringString);
     markObject(vm, (Obj*)vm->scriptName);
+
+    return (int)(vm->stackTop - vm->stack) + vm->frameCount + vm->globals.capacity + 1 + vm->globalValues.count;
 }
 
 static void traceRefs(VM *vm) {
@@ -279,57 +778,318 @@ static void traceRefs(VM *vm) {
     }
 }
 
-static void sweep(VM *vm) {
-    Obj *prev = NULL;
-    Obj *obj = vm->objects;
-    while (obj != NULL) {
+// Frees the unmarked objects of an arena and makes the marked ones old. Returns the number of blocks looked at.
+static int sweepArena(VM *vm, const int sizeClass) {
+    Arena *arena = vm->unswept[sizeClass];
+    vm->unswept[sizeClass] = arena->next;
+
+    for (int i = 0; i < arena->blockCount; ++i) {
+        Obj *obj = ARENA_BLOCK(arena, i);
+        if (obj->isFree) {
+            pushFreeBlock(vm, sizeClass, obj);
+        } else if (obj->isMarked) {
+            obj->isMarked = false;
+            obj->isOld = true;
+        } else {
+            freeObject(vm, obj);
+        }
+    }
+
+    return arena->blockCount;
+}
+
+// Sweeps arenas until about work blocks have been looked at. Returns true once every arena is swept. Arenas created
+// during the sweep go in front of the unswept ones, so they aren't looked at.
+static bool sweep(VM *vm, int work) {
+    for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+        while (vm->unswept[i] != NULL) {
+            if (work <= 0) {
+                return false;
+            }
+
+            work -= sweepArena(vm, i);
+        }
+    }
+
+    return true;
+}
+
+void *allocateObjectBlock(VM *vm, const size_t size) {
+    vm->bytesAllocated += size;
+    collectIfNeeded(vm);
+
+    // Lazy sweeping, the free blocks of a class are only known once its arenas are swept.
+    const int sizeClass = POOL_CLASS(size);
+    while (vm->freeBlocks[sizeClass] == NULL && vm->unswept[sizeClass] != NULL) {
+        sweepArena(vm, sizeClass);
+    }
+
+    if (vm->freeBlocks[sizeClass] == NULL) {
+        newArena(vm, sizeClass);
+    }
+
+    Obj *obj = vm->freeBlocks[sizeClass];
+    vm->freeBlocks[sizeClass] = ((FreeBlock*)obj)->next;
+    obj->isFree = false;
+    trackYoungObject(vm, obj);
+    return obj;
+}
+
+// Frees the young objects that weren't reached and promotes the rest, they stay where they are in their arenas. Dead
+// short strings are taken out of the string table one by one, the rest of it isn't looked at.
+static void sweepYoung(VM *vm) {
+    for (int i = 0; i < vm->youngCount; ++i) {
+        Obj *obj = vm->youngObjects[i];
         if (obj->isMarked) {
             obj->isMarked = false;
-            prev = obj;
-            obj = obj->next;
+            obj->isOld = true;
         } else {
-            Obj *unreached = obj;
-            obj = obj->next;
-            if (prev != NULL) {
-                prev->next = obj;
+            if (obj->type == OBJ_STRING && ((ObjString*)obj)->len < LONG_STRING_LENGTH) {
+                tableDelete(&vm->strings, (ObjString*)obj);
+            }
+            freeObject(vm, obj);
+        }
+    }
+
+    vm->youngCount = 0;
+}
+
+// Every survivor is old after a collection, so nothing needs to be remembered anymore.
+static void forgetRemembered(VM *vm) {
+    for (int i = 0; i < vm->rememberedCount; ++i) {
+        vm->remembered[i]->isRemembered = false;
+    }
+
+    vm->rememberedCount = 0;
+}
+
+static void recordPause(VM *vm, const clock_t start) {
+    const double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (pause > vm->gcMaxPause) {
+        vm->gcMaxPause = pause;
+    }
+}
+
+static void beginCollection(VM *vm) {
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+#endif
+
+    ++vm->gcRuns;
+    // The whole heap is traced, and the barriers mark what is stored into a marked object from here on.
+    forgetRemembered(vm);
+    vm->gcPhase = GC_MARKING;
+    markRoots(vm);
+}
+
+// Traces gray objects until about work slots have been looked at. Returns true once marking is done. Big arrays, maps
+// and sets are traced a slice at a time. Stores into marked objects are caught by the write barriers, but the roots
+// aren't, so they are marked again whenever nothing is gray. A step that does that looks at the stack, the frames and
+// the globals on top of its work, which bounds its pause. Nothing runs between a rescan and the next one in the same
+// step, so the second one finds nothing and marking is over.
+static bool mark(VM *vm, int work) {
+    for (;;) {
+        while (work > 0) {
+            if (vm->sliced != NULL) {
+                work -= traceSlice(vm, work);
+            } else if (vm->grayCount > 0) {
+                Obj *obj = vm->grayStack[--vm->grayCount];
+                const int count = sliceCount(obj);
+                if (count > GC_STEP_WORK) {
+                    vm->sliced = obj;
+                    vm->sliceNext = count;
+                } else {
+                    work -= blackenObject(vm, obj);
+                }
             } else {
-                vm->objects = obj;
+                break;
             }
+        }
+
+        if (work <= 0) {
+            return false;
+        }
 
-            freeObject(vm, unreached);
+        work -= markRoots(vm);
+        if (vm->grayCount == 0) {
+            return true;
         }
     }
 }
 
+// Unmarked strings are about to be freed, so they are taken out of the string table a slice at a time. Marking is
+// over, objects allocated from here on are born marked and an interned string that is looked up is marked again.
+static void startClearing(VM *vm) {
+    vm->gcPhase = GC_CLEARING;
+    vm->clearNext = 0;
+    vm->clearCapacity = vm->strings.capacity;
+}
+
+// Returns true once the whole table has been cleared. A table that grew meanwhile was rehashed, so it is gone over again.
+static bool clearStrings(VM *vm, const int work) {
+    if (vm->clearCapacity != vm->strings.capacity) {
+        vm->clearNext = 0;
+        vm->clearCapacity = vm->strings.capacity;
+    }
+
+    vm->clearNext = tableRemoveWhite(&vm->strings, vm->clearNext, work);
+    return vm->clearNext >= vm->clearCapacity;
+}
+
+static void startSweeping(VM *vm) {
+    // The young objects are in the arenas too, so the sweep gets them. Free blocks are found again as it goes.
+    vm->youngCount = 0;
+    for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+        vm->freeBlocks[i] = NULL;
+        vm->unswept[i] = vm->arenas[i];
+    }
+    vm->gcPhase = GC_SWEEPING;
+}
+
+static void finishCollection(VM *vm) {
+    vm->gcPhase = GC_IDLE;
+    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    vm->nextYoungGC = vm->bytesAllocated + GC_NURSERY_SIZE;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   %zu bytes allocated, next at %zu\n", vm->bytesAllocated, vm->nextGC);
+#endif
+}
+
+static void completeCollection(VM *vm) {
+    if (vm->gcPhase == GC_MARKING) {
+        mark(vm, INT32_MAX);
+        startClearing(vm);
+    }
+
+    if (vm->gcPhase == GC_CLEARING) {
+        clearStrings(vm, INT32_MAX);
+        startSweeping(vm);
+    }
+
+    sweep(vm, INT32_MAX);
+    finishCollection(vm);
+}
+
+// Runs a whole collection without stopping. A collection that is already in progress is finished first, so everything
+// that was unreachable when this was called gets freed.
 void collectGarbage(VM *vm) {
+    const clock_t start = clock();
+
+    if (vm->gcPhase != GC_IDLE) {
+        completeCollection(vm);
+    }
+    beginCollection(vm);
+    completeCollection(vm);
+
+    flushDeadBuffers(vm);
+    recordPause(vm, start);
+}
+
+// Does GC_STEP_WORK worth of a full collection, starting one if none is in progress. Minor collections are held off
+// until it is done, the young objects are collected along with the old ones.
+void collectGarbageStep(VM *vm) {
+    const clock_t start = clock();
+
+    if (vm->gcPhase == GC_IDLE) {
+        beginCollection(vm);
+    }
+
+    switch (vm->gcPhase) {
+        case GC_MARKING: {
+            if (mark(vm, GC_STEP_WORK)) {
+                startClearing(vm);
+            }
+        } break;
+        case GC_CLEARING: {
+            if (clearStrings(vm, GC_STEP_WORK)) {
+                startSweeping(vm);
+            }
+        } break;
+        default: {
+            if (sweep(vm, GC_STEP_WORK)) {
+                finishCollection(vm);
+            }
+        } break;
+    }
+
+    flushDeadBuffers(vm);
+    recordPause(vm, start);
+}
+
+// Only traces and sweeps the objects allocated since the last collection. Old objects are assumed to be alive, the
+// ones that might point to young objects are in the remembered set.
+void collectYoungGarbage(VM *vm) {
 #ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
+    printf("-- minor gc begin\n");
     size_t before = vm->bytesAllocated;
 #endif
 
-    ++vm->gcRuns;
+    const clock_t start = clock();
+
+    ++vm->youngGcRuns;
+    vm->collectingYoung = true;
     markRoots(vm);
+    // Old objects changed in bulk are traced again, young values stored into old objects are marked like roots.
+    for (int i = 0; i < vm->rememberedCount; ++i) {
+        Obj *obj = vm->remembered[i];
+        if (obj->isOld) {
+            blackenObject(vm, obj);
+        } else {
+            markObject(vm, obj);
+        }
+    }
     traceRefs(vm);
-    tableRemoveWhite(&vm->strings);
-    sweep(vm);
+    vm->collectingYoung = false;
 
-    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    forgetRemembered(vm);
+    sweepYoung(vm);
+
+    vm->nextYoungGC = vm->bytesAllocated + GC_NURSERY_SIZE;
+    flushDeadBuffers(vm);
+    recordPause(vm, start);
 
 #ifdef DEBUG_LOG_GC
-    printf("-- gc end\n");
+    printf("-- minor gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
            before - vm->bytesAllocated, before, vm->bytesAllocated,
-           vm->nextGC);
+           vm->nextYoungGC);
 #endif
 }
 
 void freeObjects(VM *vm) {
-    Obj *object = vm->objects;
-    while (object != NULL) {
-        Obj *next = object->next;
-        freeObject(vm, object);
-        object = next;
+    for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+        Arena *arena = vm->arenas[i];
+        while (arena != NULL) {
+            for (int j = 0; j < arena->blockCount; ++j) {
+                Obj *obj = ARENA_BLOCK(arena, j);
+                if (!obj->isFree) {
+                    freeObject(vm, obj);
+                }
+            }
+
+            Arena *next = arena->next;
+            free(arena);
+            arena = next;
+        }
+
+        vm->arenas[i] = NULL;
+        vm->unswept[i] = NULL;
+        vm->freeBlocks[i] = NULL;
+    }
+
+#ifdef ILEX_BACKGROUND_SWEEP
+    stopSweeper(vm);
+#endif
+
+    while (vm->slabs != NULL) {
+        void *next = *(void**)vm->slabs;
+        free(vm->slabs);
+        vm->slabs = next;
     }
 
+    free(vm->youngObjects);
     free(vm->grayStack);
+    free(vm->remembered);
 }
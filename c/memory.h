@@ -22,10 +22,76 @@
 
 #define FREE_ARRAY(vm, type, pointer, oldCount) reallocate(vm, pointer, sizeof(type) * (oldCount), 0)
 
+// Small buffers are carved out of per VM slabs and recycled through a free list for each size class. Whatever is pooled
+// has to be freed and resized with the pooled macros, using the size it was allocated with. Define ILEX_NO_POOL to send
+// them straight to reallocate(), which is handy with memory checkers. Objects use the same size classes but live in
+// arenas, see allocateObjectBlock().
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_SLAB_SIZE (64 * 1024)
+
+#define ALLOCATE_POOLED(vm, type, count) (type*)reallocatePooled(vm, NULL, 0, sizeof(type) * (count))
+
+#define FREE_POOLED(vm, type, pointer) reallocatePooled(vm, pointer, sizeof(type), 0)
+
+#define GROW_POOLED_ARRAY(vm, type, pointer, oldCount, newCount) (type*)reallocatePooled(vm, pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
+
+#define FREE_POOLED_ARRAY(vm, type, pointer, oldCount) reallocatePooled(vm, pointer, sizeof(type) * (oldCount), 0)
+
+// Bytes in an object arena. Every object has to fit in POOL_MAX_SIZE.
+#ifndef ARENA_SIZE
+#   define ARENA_SIZE (16 * 1024)
+#endif
+
+// Define ILEX_BACKGROUND_SWEEP to have ILEX_SWEEP_THREADS threads free the buffers of dead strings, arrays and maps
+// instead of the collector.
+#ifndef ILEX_SWEEP_THREADS
+#   define ILEX_SWEEP_THREADS 1
+#endif
+
+// Bytes that can be allocated between minor collections. Define ILEX_NO_GENERATIONAL_GC to only do full collections.
+#ifndef GC_NURSERY_SIZE
+#   define GC_NURSERY_SIZE (512 * 1024)
+#endif
+
+// Slots traced, string table entries cleared or blocks swept by each allocation while a full collection is in progress.
+// Arrays, maps and sets with more slots than this are traced a step at a time. Define ILEX_NO_INCREMENTAL_GC to do
+// full collections in one go.
+#ifndef GC_STEP_WORK
+#   define GC_STEP_WORK 256
+#endif
+
 void *reallocate(VM *vm, void *pointer, size_t oldSize, size_t newSize);
+void *reallocatePooled(VM *vm, void *pointer, size_t oldSize, size_t newSize);
+void *allocateObjectBlock(VM *vm, size_t size);
+void releaseBuffer(VM *vm, size_t size);
+void adoptBuffer(VM *vm, size_t size);
 void markObject(VM *vm, Obj *obj);
 void markValue(VM *vm, Value value);
+void rememberObject(VM *vm, Obj *obj);
+void rememberValue(VM *vm, const Obj *obj, Obj *value);
 void collectGarbage(VM *vm);
+void collectGarbageStep(VM *vm);
+void collectYoungGarbage(VM *vm);
 void freeObjects(VM *vm);
 
+// Minor collections don't trace old objects, so a young object stored into an old one has to be remembered until the
+// next collection. An incremental collection that has already marked the object it is stored into marks it right away.
+// Call this after the store, before anything else allocates.
+static inline void writeValueBarrier(VM *vm, const Obj *obj, const Value value) {
+    if (obj != NULL && IS_OBJ(value) &&
+        ((obj->isOld && !AS_OBJ(value)->isOld && !AS_OBJ(value)->isRemembered) || obj->isMarked)) {
+        rememberValue(vm, obj, AS_OBJ(value));
+    }
+}
+
+// For changes that add or move many values at once. The object is traced again, as a whole, by the next minor
+// collection, or right away by an incremental collection that has already marked it.
+static inline void writeBarrier(VM *vm, Obj *obj) {
+    if (obj != NULL && (obj->isOld || obj->isMarked) && !obj->isRemembered) {
+        rememberObject(vm, obj);
+    }
+}
+
 #endif //C_MEMORY_H
@@ -8,6 +8,7 @@
 
 #include "memory.h"
 #include "object.h"
+#include "shape.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -15,11 +16,12 @@
 #define ALLOCATE_OBJ(vm, type, objectType) (type*)allocateObject(vm, sizeof(type), objectType)
 
 static Obj* allocateObject(VM *vm, size_t size, ObjType type) {
-    Obj *object = (Obj*)reallocate(vm, NULL, 0, size);
+    Obj *object = (Obj*)allocateObjectBlock(vm, size);
     object->type = type;
-    object->isMarked = false;
-    object->next = vm->objects;
-    vm->objects = object;
+    // Once marking is over the sweep frees whatever isn't marked.
+    object->isMarked = vm->gcPhase == GC_CLEARING;
+    object->isOld = false;
+    object->isRemembered = false;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -40,19 +42,23 @@ ObjClass *newClass(VM *vm, ObjString *name, ObjClass *superClass, ClassType type
     objClass->name = name;
     objClass->superClass = superClass;
     objClass->type = type;
-    initTable(&objClass->methods);
-    initTable(&objClass->privateMethods);
-    initTable(&objClass->abstractMethods);
-    initTable(&objClass->staticVars);
-    initTable(&objClass->staticConsts);
-    initTable(&objClass->fields);
-    initTable(&objClass->privateFields);
+    initTable(&objClass->methods, (Obj*)objClass);
+    initTable(&objClass->privateMethods, (Obj*)objClass);
+    initTable(&objClass->abstractMethods, (Obj*)objClass);
+    initTable(&objClass->staticVars, (Obj*)objClass);
+    initTable(&objClass->staticConsts, (Obj*)objClass);
+    initTable(&objClass->fields, (Obj*)objClass);
+    initTable(&objClass->privateFields, (Obj*)objClass);
+    objClass->shapes = NULL;
+    objClass->shapeCount = 0;
+    objClass->shapeCapacity = 0;
+    objClass->rootShape = NULL;
 
     return objClass;
 }
 
 ObjClosure *newClosure(VM *vm, ObjFunction *function) {
-    ObjUpvalue **upvalues = ALLOCATE(vm, ObjUpvalue*, function->upvalueCount);
+    ObjUpvalue **upvalues = ALLOCATE_POOLED(vm, ObjUpvalue*, function->upvalueCount);
     for (int i = 0; i < function->upvalueCount; ++i) {
         upvalues[i] = NULL;
     }
@@ -70,31 +76,29 @@ ObjFunction *newFunction(VM *vm, FunctionType type, AccessLevel level, ObjScript
     function->arity = 0;
     function->arityDefault = 0;
     function->upvalueCount = 0;
+    function->maxSlots = 0;
     function->name = NULL;
     function->type = type;
     function->accessLevel = level;
     function->script = script;
-    initChunk(&function->chunk);
+    function->hotness = 0;
+    function->jit = NULL;
+    initChunk(&function->chunk, (Obj*)function);
 
     return function;
 }
 
 ObjInstance *newInstance(VM *vm, ObjClass *objClass) {
+    Shape *shape = classRootShape(vm, objClass);
+    Value *fields = ALLOCATE_POOLED(vm, Value, shape->slotCount);
+    memcpy(fields, shape->defaults, sizeof(Value) * shape->slotCount);
+
     ObjInstance *instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
     instance->objClass = objClass;
-    initTable(&instance->fields);
-    initTable(&instance->privateFields);
-
-    push(vm, OBJ_VAL(instance));
-    ObjString *classStr = copyString(vm, "_class", 6);
-    push(vm, OBJ_VAL(classStr));
-    tableSet(vm, &instance->fields, classStr, OBJ_VAL(objClass), ILEX_READ_ONLY);
-    
-    tableAddAll(vm, &objClass->fields, &instance->fields);
-    tableAddAll(vm, &objClass->privateFields, &instance->privateFields);
-    
-    pop(vm);
-    pop(vm);
+    instance->shape = shape;
+    instance->fieldCapacity = shape->slotCount;
+    instance->ownsShape = false;
+    instance->fields = fields;
 
     return instance;
 }
@@ -106,7 +110,9 @@ ObjScript *newScript(VM *vm, ObjString* name) {
     }
 
     ObjScript *script = ALLOCATE_OBJ(vm, ObjScript, OBJ_SCRIPT);
-    initTable(&script->values);
+    initTable(&script->values, (Obj*)script);
+    initTable(&script->variables, (Obj*)script);
+    initValueArray(&script->variableValues, (Obj*)script);
     script->name = name;
     script->path = NULL;
     script->used = false;
@@ -124,6 +130,62 @@ ObjScript *newScript(VM *vm, ObjString* name) {
     return script;
 }
 
+// Top level variables are resolved to a slot in variableValues by the compiler. A slot is created the first time a name
+// is seen, so it can be used before the statement that defines it runs, and holds UNDEFINED_VAL until then.
+int scriptVariableSlot(VM *vm, ObjScript *script, ObjString *name) {
+    Value slot;
+    if (tableGet(&script->variables, name, &slot)) {
+        return TO_INT(slot);
+    }
+
+    Value value = UNDEFINED_VAL;
+    tableGet(&script->values, name, &value);
+
+    push(vm, OBJ_VAL(name));
+    writeValueArray(vm, &script->variableValues, value);
+    tableSet(vm, &script->variables, name, NUMBER_VAL(script->variableValues.count - 1), ILEX_READ_WRITE);
+    pop(vm);
+
+    return script->variableValues.count - 1;
+}
+
+ObjString *scriptVariableName(const ObjScript *script, const int slot) {
+    for (int i = 0; i < script->variables.capacity; ++i) {
+        const Entry *entry = &script->variables.entries[i];
+        if (entry->key != NULL && TO_INT(entry->value) == slot) {
+            return entry->key;
+        }
+    }
+
+    return NULL;
+}
+
+bool scriptGet(const ObjScript *script, ObjString *name, Value *value) {
+    Value slot;
+    if (tableGet(&script->variables, name, &slot)) {
+        const Value variable = script->variableValues.values[TO_INT(slot)];
+        if (!IS_UNDEFINED(variable)) {
+            *value = variable;
+            return true;
+        }
+    }
+
+    return tableGet(&script->values, name, value);
+}
+
+// Names the compiler has not given a slot go in values so that slots are only ever created while compiling, which keeps
+// variableValues from moving under a running script.
+void scriptSet(VM *vm, ObjScript *script, ObjString *name, const Value value) {
+    Value slot;
+    if (tableGet(&script->variables, name, &slot)) {
+        script->variableValues.values[TO_INT(slot)] = value;
+        writeValueBarrier(vm, (Obj*)script, value);
+        return;
+    }
+
+    tableSet(vm, &script->values, name, value, ILEX_READ_WRITE);
+}
+
 ObjNative *newNative(VM *vm, NativeFn function) {
     ObjNative* native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
     native->function = function;
@@ -131,11 +193,23 @@ ObjNative *newNative(VM *vm, NativeFn function) {
     return native;
 }
 
-static ObjString *allocateString(VM *vm, char *str, int len, uint32_t hash) {
-    ObjString *string = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
+// Short strings get their characters copied in by the caller, long ones are given a buffer.
+static ObjString *allocateString(VM *vm, const int len) {
+    ObjString *string = (ObjString*)allocateObject(vm, stringSize(len), OBJ_STRING);
     string->len = len;
-    string->str = str;
+    string->hash = 0;
+    string->isHashed = false;
+    string->str = len < LONG_STRING_LENGTH ? string->chars : NULL;
+
+    return string;
+}
+
+static ObjString *allocateInternedString(VM *vm, const char *str, const int len, const uint32_t hash) {
+    ObjString *string = allocateString(vm, len);
+    memcpy(string->chars, str, len);
+    string->chars[len] = '\0';
     string->hash = hash;
+    string->isHashed = true;
 
     push(vm, OBJ_VAL(string));
     tableSet(vm, &vm->strings, string, NULL_VAL, ILEX_READ_WRITE);
@@ -144,14 +218,44 @@ static ObjString *allocateString(VM *vm, char *str, int len, uint32_t hash) {
     return string;
 }
 
-static uint32_t hashString(const char *key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
+// Hashes a word at a time, the tail is read as one zero padded word. The final mix spreads the upper bits into the
+// lower ones, which is what the tables index with.
+uint32_t hashString(const char *key, const int length) {
+    uint64_t hash = 0x9e3779b97f4a7c15u ^ (uint64_t)length;
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, key + i, 8);
+        hash = (((hash << 5) | (hash >> 59)) ^ word) * 0x517cc1b727220a95u;
+    }
+
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, key + i, length - i);
+        hash = (((hash << 5) | (hash >> 59)) ^ word) * 0x517cc1b727220a95u;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdu;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+
+// Short strings are interned, so they are only equal to themselves. Long ones are compared by their characters.
+bool stringsEqual(const ObjString *a, const ObjString *b) {
+    if (a == b) {
+        return true;
+    }
+
+    if (a->len != b->len || a->len < LONG_STRING_LENGTH) {
+        return false;
+    }
+
+    if (a->isHashed && b->isHashed && a->hash != b->hash) {
+        return false;
     }
 
-    return hash;
+    return memcmp(a->str, b->str, a->len) == 0;
 }
 
 char *newCString(const char *str) {
@@ -172,27 +276,95 @@ char *newCStringLen(const char *str, int len) {
     return ret;
 }
 
+// The string table only holds strings weakly. One that is looked up while the dead ones are being taken out of it is
+// reachable again, so it is marked before the sweep gets to it.
+static ObjString *findInterned(VM *vm, const char *str, const int len, const uint32_t hash) {
+    ObjString *string = tableFindString(&vm->strings, str, len, hash);
+    if (string != NULL && vm->gcPhase == GC_CLEARING) {
+        string->obj.isMarked = true;
+    }
+
+    return string;
+}
+
 ObjString *takeString(VM *vm, char *str, const int len) {
+    if (len >= LONG_STRING_LENGTH) {
+        ObjString *string = allocateString(vm, len);
+        string->str = str;
+        return string;
+    }
+
     const uint32_t hash = hashString(str, len);
-    ObjString *interned = tableFindString(&vm->strings, str, len, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(vm, char, str, len + 1);
-        return interned;
+    ObjString *string = findInterned(vm, str, len, hash);
+    if (string == NULL) {
+        string = allocateInternedString(vm, str, len, hash);
     }
-    return allocateString(vm, str, len, hash);
+
+    FREE_ARRAY(vm, char, str, len + 1);
+    return string;
 }
 
 ObjString *copyString(VM *vm, const char *str, const int len) {
+    if (len >= LONG_STRING_LENGTH) {
+        char *heapStr = ALLOCATE(vm, char, len + 1);
+        memcpy(heapStr, str, len);
+        heapStr[len] = '\0';
+        return takeString(vm, heapStr, len);
+    }
+
     const uint32_t hash = hashString(str, len);
-    ObjString *interned = tableFindString(&vm->strings, str, len, hash);
+    ObjString *interned = findInterned(vm, str, len, hash);
     if (interned != NULL) {
         return interned;
     }
-    char *heapStr = ALLOCATE(vm, char, len + 1);
-    memcpy(heapStr, str, len);
-    heapStr[len] = '\0';
 
-    return allocateString(vm, heapStr, len, hash);
+    return allocateInternedString(vm, str, len, hash);
+}
+
+ObjString *newRope(VM *vm, ObjString *left, ObjString *right) {
+    ObjString *rope = allocateString(vm, left->len + right->len);
+    ROPE_HALVES(rope)[0] = left;
+    ROPE_HALVES(rope)[1] = right;
+
+    return rope;
+}
+
+// Fills dest from the end, ropes built in a loop lean left so the stack stays small.
+static void writeRopeChars(const ObjString *rope, char *dest) {
+    int count = 0;
+    int capacity = 8;
+    const ObjString **stack = (const ObjString**)malloc(sizeof(ObjString*) * capacity);
+    stack[count++] = rope;
+
+    char *end = dest + rope->len;
+    while (count > 0) {
+        const ObjString *string = stack[--count];
+        if (string->str != NULL) {
+            end -= string->len;
+            memcpy(end, string->str, string->len);
+            continue;
+        }
+
+        if (count + 2 > capacity) {
+            capacity = GROW_CAPACITY(capacity);
+            stack = (const ObjString**)realloc(stack, sizeof(ObjString*) * capacity);
+        }
+        stack[count++] = ROPE_HALVES(string)[0];
+        stack[count++] = ROPE_HALVES(string)[1];
+    }
+
+    free(stack);
+    dest[rope->len] = '\0';
+}
+
+// Turns a rope into a flat string in place, it's long so it isn't interned.
+void flattenString(VM *vm, ObjString *rope) {
+    char *str = ALLOCATE(vm, char, rope->len + 1);
+    writeRopeChars(rope, str);
+
+    rope->str = str;
+    ROPE_HALVES(rope)[0] = NULL;
+    ROPE_HALVES(rope)[1] = NULL;
 }
 
 ObjUpvalue *newUpvalue(VM *vm, Value *slot) {
@@ -207,14 +379,14 @@ ObjUpvalue *newUpvalue(VM *vm, Value *slot) {
 ObjEnum *newEnum(VM *vm, ObjString *name) {
     ObjEnum *enumObj = ALLOCATE_OBJ(vm, ObjEnum, OBJ_ENUM);
     enumObj->name = name;
-    initTable(&enumObj->values);
+    initTable(&enumObj->values, (Obj*)enumObj);
 
     return enumObj;
 }
 
 ObjArray *newArray(VM *vm) {
     ObjArray *array = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
-    initValueArray(&array->data);
+    initValueArray(&array->data, (Obj*)array);
     return array;
 }
 
@@ -244,11 +416,81 @@ ObjAbstract *newAbstract(VM *vm, AbstractFreeFn freeFn) {
     ObjAbstract *abstract = ALLOCATE_OBJ(vm, ObjAbstract, OBJ_ABSTRACT);
     abstract->data = NULL;
     abstract->feeFn = freeFn;
-    initTable(&abstract->values);
+    initTable(&abstract->values, (Obj*)abstract);
     
     return abstract;
 }
 
+// A fiber starts out with a single frame calling closure and just enough stack for it, both grow like the VM's do. A
+// NULL closure makes the main fiber, which borrows the VM's.
+ObjFiber *newFiber(VM *vm, ObjClosure *closure) {
+    ObjFiber *fiber = ALLOCATE_OBJ(vm, ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->closure = closure;
+    fiber->caller = NULL;
+    fiber->resumedByNative = false;
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+    fiber->retiredCount = 0;
+    fiber->retiredStacks = NULL;
+    fiber->openUpvalues = NULL;
+    if (closure == NULL) {
+        fiber->state = FIBER_RUNNING;
+        return fiber;
+    }
+
+    // Room for the closure, its argument and everything its frame pushes, see pushFrame().
+    fiber->frameCapacity = FIBER_FRAMES_INITIAL;
+    fiber->stackCapacity = closure->function->maxSlots + UINT8_COUNT + 2;
+    fiber->frames = (CallFrame*)malloc(sizeof(CallFrame) * fiber->frameCapacity);
+    fiber->stack = (Value*)malloc(sizeof(Value) * fiber->stackCapacity);
+    if (fiber->frames == NULL || fiber->stack == NULL) {
+        exit(69);
+    }
+    adoptBuffer(vm, fiberBufferSize(fiber));
+
+    fiber->stack[0] = OBJ_VAL(closure);
+    fiber->stackTop = fiber->stack + 1;
+    CallFrame *frame = &fiber->frames[fiber->frameCount++];
+    frame->closure = closure;
+    frame->ip = closure->function->chunk.code;
+    frame->slots = fiber->stack;
+
+    return fiber;
+}
+
+// The stack and frames of a fiber count towards the heap, growing them while it runs counts too, see growStack().
+size_t fiberBufferSize(const ObjFiber *fiber) {
+    return sizeof(Value) * fiber->stackCapacity + sizeof(CallFrame) * fiber->frameCapacity;
+}
+
+// Frees the stack and frames a fiber holds. The main fiber's were the VM's to begin with, they never counted.
+void freeFiberBuffers(VM *vm, ObjFiber *fiber) {
+    if (fiber->closure != NULL) {
+        releaseBuffer(vm, fiberBufferSize(fiber));
+    }
+    for (int i = 0; i < fiber->retiredCount; ++i) {
+        free(fiber->retiredStacks[i]);
+    }
+    free(fiber->retiredStacks);
+    free(fiber->stack);
+    free(fiber->frames);
+
+    fiber->retiredCount = 0;
+    fiber->retiredStacks = NULL;
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    fiber->openUpvalues = NULL;
+}
+
 static void printFunction(const ObjFunction *function) {
     if (function->name == NULL) {
         printf("<script>");
@@ -286,6 +528,7 @@ static char *instanceToString(ObjInstance *instance) {
             break;                                                      \
         }                                                               \
                                                                         \
+        value = instance->fields[TO_INT(value)];                \
         int keyLen = (int) strlen(key);                                 \
         char *valStr = valueToString(value);                            \
         int valLen = (int) strlen(valStr);                              \
@@ -306,7 +549,7 @@ static char *instanceToString(ObjInstance *instance) {
     bool done = false;
     Value value;
     while (!done) {
-        printVars(&instance->fields);
+        printVars(&instance->shape->fields);
     }
     
     snprintf(ret + written, 3, "| ");
@@ -315,7 +558,7 @@ static char *instanceToString(ObjInstance *instance) {
     done = false;
     
     while (!done) {
-        printVars(&instance->privateFields);
+        printVars(&instance->shape->privateFields);
     }
 
 #undef printVars
@@ -636,11 +879,14 @@ bool mapSet(VM *vm, ObjMap *map, const Value key, const Value value) {
                 break;
             }
             
+            // Displaced items move up, past where an incremental collection tracing the map may have got to.
             if (item.psl > bucket->psl) {
                 isNewKey = true;
                 const MapItem tmp = item;
                 item = *bucket;
                 *bucket = tmp;
+                writeValueBarrier(vm, (Obj*)map, tmp.key);
+                writeValueBarrier(vm, (Obj*)map, tmp.value);
             }
         }
         
@@ -652,6 +898,8 @@ bool mapSet(VM *vm, ObjMap *map, const Value key, const Value value) {
     if (isNewKey) {
         ++map->count;
     }
+    writeValueBarrier(vm, (Obj*)map, item.key);
+    writeValueBarrier(vm, (Obj*)map, item.value);
     
     return isNewKey;
 }
@@ -750,6 +998,9 @@ bool mapDelete(VM *vm, ObjMap *map, Value key) {
         
         --nextItem->psl;
         *item = *nextItem;
+        // The first item wraps around to the top.
+        writeValueBarrier(vm, (Obj*)map, item->key);
+        writeValueBarrier(vm, (Obj*)map, item->value);
         item = nextItem;
     }
     
@@ -763,7 +1014,9 @@ bool mapDelete(VM *vm, ObjMap *map, Value key) {
 
 void mapClear(VM *vm, ObjMap *map) {
     FREE_ARRAY(vm, MapItem, map->items, map->capacity + 1);
-    *map = *newMap(vm);
+    map->count = 0;
+    map->capacity = -1;
+    map->items = NULL;
 }
 
 void markMap(VM *vm, const ObjMap *map) {
@@ -776,7 +1029,7 @@ void markMap(VM *vm, const ObjMap *map) {
 
 ValueArray mapKeys(VM *vm, const ObjMap *map) {
     ValueArray keys;
-    initValueArray(&keys);
+    initValueArray(&keys, NULL);
 
     for (int i = 0; i < map->capacity + 1; ++i) {
         if (IS_ERR(map->items[i].key)) {
@@ -791,7 +1044,7 @@ ValueArray mapKeys(VM *vm, const ObjMap *map) {
 
 ValueArray mapValues(VM *vm, const ObjMap *map) {
     ValueArray values;
-    initValueArray(&values);
+    initValueArray(&values, NULL);
 
     for (int i = 0; i < map->capacity + 1; ++i) {
         if (IS_ERR(map->items[i].key)) {
@@ -844,6 +1097,7 @@ static void adjustSetCapacity(VM *vm, ObjSet *set, int capacity) {
         
         SetItem *dst = setFindItem(items, capacity, item->value);
         dst->value = item->value;
+        writeValueBarrier(vm, (Obj*)set, item->value);
         ++set->count;
     }
     
@@ -866,6 +1120,7 @@ bool setAdd(VM *vm, ObjSet *set, Value value) {
     if (isNewValue) {
         ++set->count;
     }
+    writeValueBarrier(vm, (Obj*)set, value);
     
     return isNewValue;
 }
@@ -907,6 +1162,20 @@ void markSet(VM *vm, const ObjSet *set) {
     }
 }
 
+// Deep copies copy the arrays and maps in what they copy, everything else is shared.
+static Value copyNested(VM *vm, const Value value) {
+    if (IS_ARRAY(value)) {
+        return OBJ_VAL(copyArray(vm, AS_ARRAY(value), false));
+    }
+
+    if (IS_MAP(value)) {
+        return OBJ_VAL(copyMap(vm, AS_MAP(value), false));
+    }
+
+    // TODO: Instance
+    return value;
+}
+
 ObjArray *copyArray(VM *vm, const ObjArray *array, const bool isShallow) {
     ObjArray *ret = newArray(vm);
     push(vm, OBJ_VAL(ret));
@@ -915,12 +1184,7 @@ ObjArray *copyArray(VM *vm, const ObjArray *array, const bool isShallow) {
         Value val = array->data.values[i];
         
         if (!isShallow) {
-            if (IS_ARRAY(val)) {
-                val = OBJ_VAL(copyArray(vm, AS_ARRAY(val), false));
-            } else if (IS_MAP(val)) {
-                val = OBJ_VAL(copyMap(vm, AS_MAP(val), false));
-            }
-            // TODO: Instance
+            val = copyNested(vm, val);
         }
     
         push(vm, val);
@@ -936,7 +1200,7 @@ ObjMap *copyMap(VM *vm, const ObjMap *map, const bool isShallow) {
     ObjMap *ret = newMap(vm);
     push(vm, OBJ_VAL(ret));
     
-    for (int i = 0; i < ret->capacity; ++i) {
+    for (int i = 0; i <= map->capacity; ++i) {
         if (IS_ERR(map->items[i].key)) {
             continue;
         }
@@ -944,12 +1208,7 @@ ObjMap *copyMap(VM *vm, const ObjMap *map, const bool isShallow) {
         Value val = map->items[i].value;
         
         if (!isShallow) {
-            if (IS_ARRAY(val)) {
-                val = OBJ_VAL(copyArray(vm, AS_ARRAY(val), false));
-            } else if (IS_MAP(val)) {
-                val = OBJ_VAL(copyMap(vm, AS_MAP(val), false));
-            }
-            // TODO: Instance
+            val = copyNested(vm, val);
         }
         
         push(vm, val);
@@ -961,6 +1220,255 @@ ObjMap *copyMap(VM *vm, const ObjMap *map, const bool isShallow) {
     return ret;
 }
 
+// Packed values are made with malloc, a VM that unpacks them either adopts their buffers or frees them.
+struct Packed {
+    ObjType type; // Only used when value is an object.
+    Value value;  // Anything but an object is packed as it is.
+    int count;
+    char *chars;   // The characters of a string, count long.
+    Value *values; // The buffer of a transferred array of count values that aren't objects, capacity long.
+    int capacity;
+    Packed *items; // The values of an array or set, or the keys and values of a map one after the other.
+};
+
+// Deeper than this is probably an array or map that holds itself.
+#define PACK_DEPTH_MAX 256
+
+static Packed *allocatePacked(const int count) {
+    Packed *packed = (Packed*)calloc(count == 0 ? 1 : count, sizeof(Packed));
+    if (packed == NULL) {
+        exit(69);
+    }
+
+    return packed;
+}
+
+static void freePackedItems(Packed *packed, const int count) {
+    for (int i = 0; i < count; ++i) {
+        Packed *item = &packed[i];
+        if (!IS_OBJ(item->value)) {
+            continue;
+        }
+
+        free(item->chars);
+        free(item->values);
+        if (item->items != NULL) {
+            freePackedItems(item->items, item->type == OBJ_MAP ? item->count * 2 : item->count);
+            free(item->items);
+        }
+    }
+}
+
+// Checked before anything is packed, so a transfer that can't be done doesn't empty any arrays.
+static bool isPackable(const Value value, const int depth) {
+    if (!IS_OBJ(value)) {
+        return true;
+    }
+
+    if (depth > PACK_DEPTH_MAX) {
+        return false;
+    }
+
+    switch (OBJ_TYPE(value)) {
+        case OBJ_STRING: return true;
+        case OBJ_ARRAY: {
+            const ObjArray *array = AS_ARRAY(value);
+            for (int i = 0; i < array->data.count; ++i) {
+                if (!isPackable(array->data.values[i], depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case OBJ_MAP: {
+            const ObjMap *map = AS_MAP(value);
+            for (int i = 0; i <= map->capacity; ++i) {
+                const MapItem *item = &map->items[i];
+                if (!IS_ERR(item->key) && (!isPackable(item->key, depth + 1) || !isPackable(item->value, depth + 1))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case OBJ_SET: {
+            const ObjSet *set = AS_SET(value);
+            for (int i = 0; i <= set->capacity; ++i) {
+                const SetItem *item = &set->items[i];
+                if (!IS_ERR(item->value) && !item->deleted && !isPackable(item->value, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default: return false;
+    }
+}
+
+static void packInto(VM *vm, Value value, bool transfer, Packed *packed);
+
+static void packArray(VM *vm, ObjArray *array, const bool transfer, Packed *packed) {
+    packed->count = array->data.count;
+    if (transfer) {
+        bool onlyValues = true;
+        for (int i = 0; i < array->data.count && onlyValues; ++i) {
+            onlyValues = !IS_OBJ(array->data.values[i]);
+        }
+
+        if (onlyValues) {
+            packed->values = array->data.values;
+            packed->capacity = array->data.capacity;
+            releaseBuffer(vm, sizeof(Value) * array->data.capacity);
+            initValueArray(&array->data, (Obj*)array);
+            return;
+        }
+    }
+
+    packed->items = allocatePacked(array->data.count);
+    for (int i = 0; i < array->data.count; ++i) {
+        packInto(vm, array->data.values[i], transfer, &packed->items[i]);
+    }
+
+    if (transfer) {
+        freeValueArray(vm, &array->data);
+    }
+}
+
+static void packInto(VM *vm, const Value value, const bool transfer, Packed *packed) {
+    packed->value = value;
+    if (!IS_OBJ(value)) {
+        return;
+    }
+
+    packed->type = OBJ_TYPE(value);
+    switch (packed->type) {
+        case OBJ_STRING: {
+            ObjString *string = AS_STRING(value);
+            if (string->str == NULL) {
+                flattenString(vm, string);
+            }
+
+            packed->count = string->len;
+            packed->chars = newCStringLen(string->str, string->len);
+        } break;
+        case OBJ_ARRAY: packArray(vm, AS_ARRAY(value), transfer, packed); break;
+        case OBJ_MAP: {
+            const ObjMap *map = AS_MAP(value);
+            packed->items = allocatePacked(map->count * 2);
+            for (int i = 0; i <= map->capacity && packed->count < map->count; ++i) {
+                const MapItem *item = &map->items[i];
+                if (!IS_ERR(item->key)) {
+                    packInto(vm, item->key, false, &packed->items[packed->count * 2]);
+                    packInto(vm, item->value, transfer, &packed->items[packed->count * 2 + 1]);
+                    ++packed->count;
+                }
+            }
+        } break;
+        case OBJ_SET: {
+            const ObjSet *set = AS_SET(value);
+            packed->items = allocatePacked(set->count);
+            for (int i = 0; i <= set->capacity && packed->count < set->count; ++i) {
+                const SetItem *item = &set->items[i];
+                if (!IS_ERR(item->value) && !item->deleted) {
+                    packInto(vm, item->value, false, &packed->items[packed->count++]);
+                }
+            }
+        } break;
+        default: break;
+    }
+}
+
+Packed *packValue(VM *vm, const Value value, const bool transfer) {
+    if (!isPackable(value, 0)) {
+        return NULL;
+    }
+
+    Packed *packed = allocatePacked(1);
+    packInto(vm, value, transfer, packed);
+    return packed;
+}
+
+static Value unpackItem(VM *vm, Packed *packed) {
+    if (!IS_OBJ(packed->value)) {
+        return packed->value;
+    }
+
+    switch (packed->type) {
+        case OBJ_STRING: {
+            if (packed->count < LONG_STRING_LENGTH) {
+                return OBJ_VAL(copyString(vm, packed->chars, packed->count));
+            }
+
+            // The characters are used as they are, so the packed string no longer owns them.
+            adoptBuffer(vm, packed->count + 1);
+            char *chars = packed->chars;
+            packed->chars = NULL;
+            return OBJ_VAL(takeString(vm, chars, packed->count));
+        }
+        case OBJ_ARRAY: {
+            ObjArray *array = newArray(vm);
+            if (packed->values != NULL) {
+                adoptBuffer(vm, sizeof(Value) * packed->capacity);
+                array->data.values = packed->values;
+                array->data.capacity = packed->capacity;
+                array->data.count = packed->count;
+                packed->values = NULL;
+                return OBJ_VAL(array);
+            }
+
+            push(vm, OBJ_VAL(array));
+            for (int i = 0; i < packed->count; ++i) {
+                const Value item = unpackItem(vm, &packed->items[i]);
+                push(vm, item);
+                writeValueArray(vm, &array->data, item);
+                pop(vm);
+            }
+            pop(vm);
+            return OBJ_VAL(array);
+        }
+        case OBJ_MAP: {
+            ObjMap *map = newMap(vm);
+            push(vm, OBJ_VAL(map));
+            for (int i = 0; i < packed->count; ++i) {
+                const Value key = unpackItem(vm, &packed->items[i * 2]);
+                push(vm, key);
+                const Value item = unpackItem(vm, &packed->items[i * 2 + 1]);
+                push(vm, item);
+                mapSet(vm, map, key, item);
+                pop(vm);
+                pop(vm);
+            }
+            pop(vm);
+            return OBJ_VAL(map);
+        }
+        case OBJ_SET: {
+            ObjSet *set = newSet(vm);
+            push(vm, OBJ_VAL(set));
+            for (int i = 0; i < packed->count; ++i) {
+                const Value item = unpackItem(vm, &packed->items[i]);
+                push(vm, item);
+                setAdd(vm, set, item);
+                pop(vm);
+            }
+            pop(vm);
+            return OBJ_VAL(set);
+        }
+        default: return NULL_VAL;
+    }
+}
+
+Value unpackValue(VM *vm, Packed *packed) {
+    const Value value = unpackItem(vm, packed);
+    freePacked(packed);
+    return value;
+}
+
+void freePacked(Packed *packed) {
+    if (packed != NULL) {
+        freePackedItems(packed, 1);
+        free(packed);
+    }
+}
+
 char *objectType(Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_BOUND_METHOD: return newCString("boundMethod");
@@ -981,6 +1489,7 @@ char *objectType(Value value) {
         case OBJ_MAP: return newCString("map");
         case OBJ_SET: return newCString("set");
         case OBJ_ABSTRACT: return newCString("abstract");
+        case OBJ_FIBER: return newCString("fiber");
     }
 
     return newCString("unknown type");
@@ -995,7 +1504,16 @@ char *objectToString(const Value value) {
         case OBJ_INSTANCE: return instanceToString(AS_INSTANCE(value));
         case OBJ_SCRIPT: return scriptToString(AS_SCRIPT(value));
         case OBJ_NATIVE: return newCString("<native fn>");
-        case OBJ_STRING: return newCString(AS_STRING(value)->str);
+        case OBJ_STRING: {
+            const ObjString *string = AS_STRING(value);
+            if (string->str == NULL) {
+                char *str = (char*)malloc(sizeof(char) * (string->len + 1));
+                writeRopeChars(string, str);
+                return str;
+            }
+
+            return newCString(string->str);
+        }
         case OBJ_UPVALUE: return newCString("Should never happen.");
         case OBJ_ENUM: return enumToString(AS_ENUM(value));
         case OBJ_ARRAY: return arrayToString(AS_ARRAY(value));
@@ -1003,6 +1521,7 @@ char *objectToString(const Value value) {
         case OBJ_MAP: return mapToString(AS_MAP(value));
         case OBJ_SET: return setToString(AS_SET(value));
         case OBJ_ABSTRACT: return newCString("<abstract obj>"); // TODO: String.
+        case OBJ_FIBER: return newCString("<fiber>");
     }
     
     return newCString("unknown object");
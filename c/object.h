@@ -10,6 +10,14 @@
 #include "table.h"
 #include "value.h"
 
+// Strings at least this long aren't interned and are only hashed when something needs the hash, like a map. Two long
+// strings are equal if their characters are. Concatenations this long make a rope, see flattenString(). Anything
+// shorter keeps its characters inline, so the whole string has to fit in POOL_MAX_SIZE.
+#define LONG_STRING_LENGTH 224
+
+#define IS_ROPE(value) (IS_STRING(value) && AS_STRING(value)->str == NULL)
+#define ROPE_HALVES(string) ((ObjString**)(string)->chars)
+
 ObjBoundMethod *newBoundMethod(VM *vm, Value receiver, ObjClosure *method);
 ObjClass *newClass(VM *vm, ObjString *name, ObjClass *superclass, ClassType type);
 ObjClosure *newClosure(VM *vm, ObjFunction *function);
@@ -19,6 +27,10 @@ ObjNative *newNative(VM *vm, NativeFn function);
 char *newCString(const char *str);
 char *newCStringLen(const char *str, int len);
 ObjString *takeString(VM *vm, char *str, int len);
+ObjString *newRope(VM *vm, ObjString *left, ObjString *right);
+void flattenString(VM *vm, ObjString *rope);
+uint32_t hashString(const char *key, int length);
+bool stringsEqual(const ObjString *a, const ObjString *b);
 ObjUpvalue *newUpvalue(VM *vm, Value *slot);
 ObjEnum *newEnum(VM *vm, ObjString *name);
 ObjArray *newArray(VM *vm);
@@ -26,6 +38,13 @@ ObjFile *newFile(VM *vm);
 ObjMap *newMap(VM *vm);
 ObjSet *newSet(VM *vm);
 ObjAbstract *newAbstract(VM *vm, AbstractFreeFn freeFn);
+ObjFiber *newFiber(VM *vm, ObjClosure *closure);
+size_t fiberBufferSize(const ObjFiber *fiber);
+void freeFiberBuffers(VM *vm, ObjFiber *fiber);
+int scriptVariableSlot(VM *vm, ObjScript *script, ObjString *name);
+ObjString *scriptVariableName(const ObjScript *script, int slot);
+bool scriptGet(const ObjScript *script, ObjString *name, Value *value);
+void scriptSet(VM *vm, ObjScript *script, ObjString *name, Value value);
 char *objectType(Value value);
 char *objectToString(Value value);
 char *arrayToString(const ObjArray *array);
@@ -47,4 +66,33 @@ void markSet(VM *vm, const ObjSet *set);
 ObjArray *copyArray(VM *vm, const ObjArray *array, bool isShallow);
 ObjMap *copyMap(VM *vm, const ObjMap *map, bool isShallow);
 
+// A value on its way from one VM to another, it belongs to neither of them. Numbers, booleans, null, strings, arrays,
+// maps and sets can be packed, see packValue().
+typedef struct Packed Packed;
+
+// NULL when value holds something that can't leave its VM. Transferring empties the arrays in value and moves their
+// buffers instead of copying them.
+Packed *packValue(VM *vm, Value value, bool transfer);
+// Makes the value in vm and frees packed.
+Value unpackValue(VM *vm, Packed *packed);
+void freePacked(Packed *packed);
+
+// Bytes in the object of a string of the given length, the characters of a long string are in a buffer of their own.
+static inline size_t stringSize(const int len) {
+    if (len < LONG_STRING_LENGTH) {
+        return sizeof(ObjString) + len + 1;
+    }
+
+    return sizeof(ObjString) + sizeof(ObjString*) * 2;
+}
+
+static inline uint32_t stringHash(ObjString *string) {
+    if (!string->isHashed) {
+        string->hash = hashString(string->str, string->len);
+        string->isHashed = true;
+    }
+
+    return string->hash;
+}
+
 #endif //__C_OBJECT_H__
@@ -0,0 +1,531 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimizer.h"
+#include "object.h"
+
+// The code of a function is decoded into a list of instructions whose jumps point at instructions instead of offsets.
+// The passes mark instructions dead or point jumps elsewhere, and at the end the code is encoded again with the jump
+// offsets worked out anew. A jump to a dead instruction lands on the next live one. Lines stay with the bytes of the
+// instructions that are kept. Code the decoder doesn't understand is left as it is.
+
+#define ROUNDS_MAX 16
+
+typedef struct {
+    uint8_t op;
+    int offset; // In the code as the compiler wrote it.
+    int length;
+    int target; // The instruction a jump lands on, -1 for anything else.
+    bool dead;
+} Instruction;
+
+typedef struct {
+    Chunk *chunk;
+    Instruction *code;
+    int count;     // code[count] stands for the end of the code.
+    int *incoming; // Live jumps landing on each instruction.
+    int slotCount;
+    bool *captured; // Local slots closures capture, stores to them are never dead.
+    bool hasMatch;
+} Optimizer;
+
+typedef enum {
+    JUMP_NONE,
+    JUMP_FORWARD,
+    JUMP_BACKWARD,
+} JumpKind;
+
+static bool isCompareJump(const uint8_t op) {
+    switch (op) {
+        case OP_LT_LOCALS_JMP:
+        case OP_LTEQ_LOCALS_JMP:
+        case OP_GR_LOCALS_JMP:
+        case OP_GREQ_LOCALS_JMP:
+        case OP_LT_LOCAL_CONST_JMP:
+        case OP_LTEQ_LOCAL_CONST_JMP:
+        case OP_GR_LOCAL_CONST_JMP:
+        case OP_GREQ_LOCAL_CONST_JMP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Every jump keeps its offset in its last two bytes, counted from the end of the instruction.
+static JumpKind jumpKind(const uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_CMP_JMP:
+        case OP_CMP_JMP_FALL:
+            return JUMP_FORWARD;
+        case OP_LOOP:
+        case OP_JUMP_DO_WHILE:
+            return JUMP_BACKWARD;
+        default:
+            return isCompareJump(op) ? JUMP_FORWARD : JUMP_NONE;
+    }
+}
+
+// Jumps that leave a false value on the stack when they are taken.
+static bool jumpsOnFalse(const uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || isCompareJump(op);
+}
+
+static uint16_t operand(const Optimizer *optimizer, const int i) {
+    const uint8_t *code = &optimizer->chunk->code[optimizer->code[i].offset];
+    return (uint16_t)(code[1] << 8 | code[2]);
+}
+
+static int nextLive(const Optimizer *optimizer, int i) {
+    while (i < optimizer->count && optimizer->code[i].dead) {
+        i++;
+    }
+
+    return i;
+}
+
+static int landing(const Optimizer *optimizer, const int i) {
+    return nextLive(optimizer, optimizer->code[i].target);
+}
+
+static uint8_t opAt(const Optimizer *optimizer, const int i) {
+    return i < optimizer->count ? optimizer->code[i].op : OP_RETURN;
+}
+
+static void countIncoming(const Optimizer *optimizer) {
+    memset(optimizer->incoming, 0, sizeof(int) * (optimizer->count + 1));
+    for (int i = 0; i < optimizer->count; ++i) {
+        if (!optimizer->code[i].dead && optimizer->code[i].target != -1) {
+            optimizer->incoming[landing(optimizer, i)]++;
+        }
+    }
+}
+
+static bool decode(Optimizer *optimizer) {
+    const Chunk *chunk = optimizer->chunk;
+    int *indexes = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    optimizer->code = (Instruction*)malloc(sizeof(Instruction) * (chunk->count + 1));
+    optimizer->incoming = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    if (indexes == NULL || optimizer->code == NULL || optimizer->incoming == NULL) {
+        exit(69);
+    }
+
+    for (int i = 0; i <= chunk->count; ++i) {
+        indexes[i] = -1;
+    }
+
+    bool valid = true;
+    int offset = 0;
+    while (offset < chunk->count) {
+        const uint8_t op = chunk->code[offset];
+        const int length = instructionLength(chunk, offset);
+        // Breaks are turned into jumps at the end of their loop, one that is left over means the code is broken.
+        if (op == OP_BREAK || offset + length > chunk->count) {
+            valid = false;
+            break;
+        }
+
+        if (op == OP_SET_LOCAL) {
+            const int slot = chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+            if (slot >= optimizer->slotCount) {
+                optimizer->slotCount = slot + 1;
+            }
+        }
+        if (op == OP_CMP_JMP || op == OP_CMP_JMP_FALL || op == OP_MULTI_CASE) {
+            optimizer->hasMatch = true;
+        }
+
+        indexes[offset] = optimizer->count;
+        optimizer->code[optimizer->count++] = (Instruction){op, offset, length, -1, false};
+        offset += length;
+    }
+    indexes[chunk->count] = optimizer->count;
+
+    for (int i = 0; valid && i < optimizer->count; ++i) {
+        Instruction *instruction = &optimizer->code[i];
+        const JumpKind kind = jumpKind(instruction->op);
+        if (kind == JUMP_NONE) {
+            continue;
+        }
+
+        const int end = instruction->offset + instruction->length;
+        const int jump = chunk->code[end - 2] << 8 | chunk->code[end - 1];
+        const int target = kind == JUMP_FORWARD ? end + jump : end - jump;
+        if (target < 0 || target > chunk->count || indexes[target] == -1) {
+            valid = false;
+            break;
+        }
+        instruction->target = indexes[target];
+    }
+    free(indexes);
+
+    optimizer->captured = (bool*)calloc(optimizer->slotCount + 1, sizeof(bool));
+    if (optimizer->captured == NULL) {
+        exit(69);
+    }
+
+    for (int i = 0; valid && i < optimizer->count; ++i) {
+        if (optimizer->code[i].op != OP_CLOSURE) {
+            continue;
+        }
+
+        const uint8_t *code = &chunk->code[optimizer->code[i].offset];
+        const ObjFunction *function = AS_FUNCTION(chunk->constants.values[code[1] << 8 | code[2]]);
+        for (int j = 0; j < function->upvalueCount; ++j) {
+            const uint8_t *upvalue = &code[3 + j * 3];
+            const int slot = upvalue[1] << 8 | upvalue[2];
+            if (upvalue[0] && slot < optimizer->slotCount) {
+                optimizer->captured[slot] = true;
+            }
+        }
+    }
+
+    return valid;
+}
+
+// A jump landing on an unconditional jump goes straight to where that one goes. A conditional jump landing on another
+// one that tests the same value knows which way that one goes. Only JUMP and LOOP can change direction, they swap.
+static bool threadJumps(const Optimizer *optimizer) {
+    bool changed = false;
+
+    for (int i = 0; i < optimizer->count; ++i) {
+        const Instruction *instruction = &optimizer->code[i];
+        if (instruction->dead || instruction->target == -1) {
+            continue;
+        }
+
+        const uint8_t op = instruction->op;
+        const bool conditional = op == OP_JUMP_IF_TRUE || jumpsOnFalse(op);
+        const int start = landing(optimizer, i);
+        int target = start;
+        for (int steps = 0; steps < optimizer->count && target < optimizer->count; ++steps) {
+            const uint8_t next = optimizer->code[target].op;
+            int to;
+            if (next == OP_JUMP || next == OP_LOOP) {
+                to = landing(optimizer, target);
+            } else if (conditional && (next == OP_JUMP_IF_FALSE || next == OP_JUMP_IF_TRUE)) {
+                const bool same = (next == OP_JUMP_IF_FALSE) == jumpsOnFalse(op);
+                to = same ? landing(optimizer, target) : nextLive(optimizer, target + 1);
+            } else {
+                break;
+            }
+
+            if (to == target || (op != OP_JUMP && op != OP_LOOP && (to > i) != (jumpKind(op) == JUMP_FORWARD))) {
+                break;
+            }
+            target = to;
+        }
+
+        if (target != start) {
+            optimizer->code[i].target = target;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Jumps to the next instruction that leave the stack as it is, and code nothing jumps to after a jump or return.
+static bool removeDeadCode(const Optimizer *optimizer) {
+    bool changed = false;
+    countIncoming(optimizer);
+
+    bool reachable = true;
+    for (int i = 0; i < optimizer->count; ++i) {
+        Instruction *instruction = &optimizer->code[i];
+        if (instruction->dead) {
+            continue;
+        }
+
+        if (!reachable && optimizer->incoming[i] == 0) {
+            instruction->dead = true;
+            changed = true;
+            continue;
+        }
+
+        const uint8_t op = instruction->op;
+        if ((op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE) &&
+            landing(optimizer, i) == nextLive(optimizer, i + 1)) {
+            instruction->dead = true;
+            changed = true;
+            continue;
+        }
+
+        reachable = op != OP_JUMP && op != OP_LOOP && op != OP_RETURN;
+    }
+
+    return changed;
+}
+
+// 'NOT, JUMP_IF_FALSE' becomes 'JUMP_IF_TRUE' when both ways pop the condition straight away, the same for
+// 'NOT, JUMP_IF_TRUE'.
+static bool invertConditions(const Optimizer *optimizer) {
+    bool changed = false;
+    countIncoming(optimizer);
+
+    for (int i = 0; i < optimizer->count; ++i) {
+        if (optimizer->code[i].dead || optimizer->code[i].op != OP_NOT) {
+            continue;
+        }
+
+        const int jump = nextLive(optimizer, i + 1);
+        const uint8_t op = opAt(optimizer, jump);
+        if ((op != OP_JUMP_IF_FALSE && op != OP_JUMP_IF_TRUE) || optimizer->incoming[jump] != 0 ||
+            opAt(optimizer, nextLive(optimizer, jump + 1)) != OP_POP || opAt(optimizer, landing(optimizer, jump)) != OP_POP) {
+            continue;
+        }
+
+        optimizer->code[i].dead = true;
+        optimizer->code[jump].op = op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+        changed = true;
+    }
+
+    return changed;
+}
+
+// A value pushed only to be popped again.
+static bool removePushPop(const Optimizer *optimizer) {
+    bool changed = false;
+    countIncoming(optimizer);
+
+    for (int i = 0; i < optimizer->count; ++i) {
+        if (optimizer->code[i].dead) {
+            continue;
+        }
+
+        switch (optimizer->code[i].op) {
+            case OP_CONSTANT:
+            case OP_NULL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_LOCAL:
+            case OP_GET_UPVALUE: {
+                const int pop = nextLive(optimizer, i + 1);
+                if (opAt(optimizer, pop) == OP_POP && pop < optimizer->count && optimizer->incoming[pop] == 0) {
+                    optimizer->code[i].dead = true;
+                    optimizer->code[pop].dead = true;
+                    changed = true;
+                }
+            } break;
+            default: break;
+        }
+    }
+
+    return changed;
+}
+
+// Instructions that don't read any local except through their operand, and always carry on with the next one.
+static bool keepsLocals(const uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NULL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUB_LOCAL_CONST:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_GLOBAL:
+        case OP_GET_SCRIPT:
+        case OP_SET_SCRIPT:
+        case OP_EQ:
+        case OP_NOTEQ:
+        case OP_GR:
+        case OP_GREQ:
+        case OP_LT:
+        case OP_LTEQ:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_POW:
+        case OP_MOD:
+        case OP_INC:
+        case OP_DEC:
+        case OP_NOT:
+        case OP_NEG:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_BIT_NOT:
+        case OP_BIT_LS:
+        case OP_BIT_RS:
+        case OP_CALL:
+        case OP_INVOKE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_INDEX:
+        case OP_NEW_ARRAY:
+        case OP_NEW_MAP:
+        case OP_NEW_SET:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool readsLocal(const Optimizer *optimizer, const int i, const int slot) {
+    switch (optimizer->code[i].op) {
+        case OP_GET_LOCAL:
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUB_LOCAL_CONST:
+            return operand(optimizer, i) == slot;
+        default:
+            return false;
+    }
+}
+
+// A SET_LOCAL is dead when the same block stores to the local again, or returns, before anything reads it. Captured
+// locals are left alone since closures read them behind the function's back, and so is code with match statements,
+// which keep the value they match on in a local they read off the stack.
+static bool removeDeadStores(const Optimizer *optimizer) {
+    if (optimizer->hasMatch) {
+        return false;
+    }
+
+    bool changed = false;
+    countIncoming(optimizer);
+
+    for (int i = 0; i < optimizer->count; ++i) {
+        if (optimizer->code[i].dead || optimizer->code[i].op != OP_SET_LOCAL) {
+            continue;
+        }
+
+        const int slot = operand(optimizer, i);
+        if (optimizer->captured[slot]) {
+            continue;
+        }
+
+        for (int j = nextLive(optimizer, i + 1); j < optimizer->count; j = nextLive(optimizer, j + 1)) {
+            const uint8_t op = optimizer->code[j].op;
+            if (optimizer->incoming[j] != 0 || readsLocal(optimizer, j, slot)) {
+                break;
+            }
+
+            if (op == OP_RETURN || (op == OP_SET_LOCAL && operand(optimizer, j) == slot)) {
+                optimizer->code[i].dead = true;
+                changed = true;
+                break;
+            }
+
+            if (!keepsLocals(op)) {
+                break;
+            }
+        }
+    }
+
+    return changed;
+}
+
+static bool encode(const Optimizer *optimizer) {
+    Chunk *chunk = optimizer->chunk;
+    int *offsets = (int*)malloc(sizeof(int) * (optimizer->count + 1));
+    if (offsets == NULL) {
+        exit(69);
+    }
+
+    int size = 0;
+    for (int i = 0; i < optimizer->count; ++i) {
+        offsets[i] = size;
+        if (!optimizer->code[i].dead) {
+            size += optimizer->code[i].length;
+        }
+    }
+    offsets[optimizer->count] = size;
+
+    uint8_t *code = (uint8_t*)malloc(size + 1);
+    int *lines = (int*)malloc(sizeof(int) * (size + 1));
+    if (code == NULL || lines == NULL) {
+        exit(69);
+    }
+
+    bool valid = true;
+    for (int i = 0; i < optimizer->count; ++i) {
+        const Instruction *instruction = &optimizer->code[i];
+        if (instruction->dead) {
+            continue;
+        }
+
+        const int start = offsets[i];
+        memcpy(&code[start], &chunk->code[instruction->offset], instruction->length);
+        memcpy(&lines[start], &chunk->lines[instruction->offset], sizeof(int) * instruction->length);
+        code[start] = instruction->op;
+        if (instruction->target == -1) {
+            continue;
+        }
+
+        const int end = start + instruction->length;
+        const int target = offsets[landing(optimizer, i)];
+        if (instruction->op == OP_JUMP && target < end) {
+            code[start] = OP_LOOP;
+        } else if (instruction->op == OP_LOOP && target >= end) {
+            code[start] = OP_JUMP;
+        }
+
+        const int jump = jumpKind(code[start]) == JUMP_FORWARD ? target - end : end - target;
+        if (jump < 0 || jump > UINT16_MAX) {
+            valid = false;
+            break;
+        }
+        code[end - 2] = (uint8_t)(jump >> 8);
+        code[end - 1] = (uint8_t)jump;
+    }
+
+    if (valid) {
+        memcpy(chunk->code, code, size);
+        memcpy(chunk->lines, lines, sizeof(int) * size);
+        chunk->count = size;
+    }
+
+    free(code);
+    free(lines);
+    free(offsets);
+    return valid;
+}
+
+void optimizeChunk(Chunk *chunk) {
+    Optimizer optimizer;
+    optimizer.chunk = chunk;
+    optimizer.code = NULL;
+    optimizer.count = 0;
+    optimizer.incoming = NULL;
+    optimizer.slotCount = 0;
+    optimizer.captured = NULL;
+    optimizer.hasMatch = false;
+
+    if (decode(&optimizer)) {
+        bool changed = false;
+        for (int round = 0; round < ROUNDS_MAX; ++round) {
+            bool again = threadJumps(&optimizer);
+            again |= invertConditions(&optimizer);
+            again |= removeDeadStores(&optimizer);
+            again |= removePushPop(&optimizer);
+            again |= removeDeadCode(&optimizer);
+            if (!again) {
+                break;
+            }
+            changed = true;
+        }
+
+        if (changed) {
+            encode(&optimizer);
+        }
+    }
+
+    free(optimizer.code);
+    free(optimizer.incoming);
+    free(optimizer.captured);
+}
@@ -0,0 +1,14 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_OPTIMIZER_H__
+#define __C_OPTIMIZER_H__
+
+#include "chunk.h"
+
+// Rewrites the finished code of a function with fewer and cheaper instructions, see optimizer.c. Run by endCompiler()
+// when the VM was started with -O.
+void optimizeChunk(Chunk *chunk);
+
+#endif //__C_OPTIMIZER_H__
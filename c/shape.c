@@ -0,0 +1,162 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "shape.h"
+#include "vm.h"
+
+static Shape *newShape(VM *vm, ObjClass *objClass, const bool dictionary) {
+    Shape *shape = ALLOCATE(vm, Shape, 1);
+    shape->objClass = objClass;
+    initTable(&shape->fields, (Obj*)objClass);
+    initTable(&shape->privateFields, (Obj*)objClass);
+    initTable(&shape->transitions, (Obj*)objClass);
+    shape->slotCount = 0;
+    shape->defaults = NULL;
+    shape->dictionary = dictionary;
+
+    if (dictionary) {
+        return shape;
+    }
+
+    // Register the shape before filling it in so the class frees it and the collector can see it.
+    if (objClass->shapeCapacity < objClass->shapeCount + 1) {
+        const int oldCapacity = objClass->shapeCapacity;
+        objClass->shapeCapacity = GROW_CAPACITY(oldCapacity);
+        objClass->shapes = GROW_ARRAY(vm, Shape*, objClass->shapes, oldCapacity, objClass->shapeCapacity);
+    }
+    objClass->shapes[objClass->shapeCount++] = shape;
+
+    return shape;
+}
+
+// Gives every field in from a slot in the root shape, with the field's value as the slot's default.
+static void addSlots(VM *vm, Shape *shape, Table *slots, const Table *from) {
+    for (int i = 0; i < from->capacity; i++) {
+        const Entry *entry = &from->entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        const int slot = shape->slotCount++;
+        shape->defaults[slot] = entry->value;
+        tableSet(vm, slots, entry->key, NUMBER_VAL(slot), entry->readOnly);
+    }
+}
+
+// Copies the table entry for entry so the copy iterates in the same order as the original.
+static void copySlots(VM *vm, const Table *from, Table *to) {
+    if (from->count == 0) {
+        return;
+    }
+
+    to->entries = ALLOCATE(vm, Entry, from->capacity);
+    memcpy(to->entries, from->entries, sizeof(Entry) * from->capacity);
+    to->capacity = from->capacity;
+    to->count = from->count;
+}
+
+// The root shape has '_class' followed by the class's public and private fields, in the order the per instance tables
+// used to be filled in. It is rebuilt whenever the class's fields change.
+Shape *classRootShape(VM *vm, ObjClass *objClass) {
+    if (objClass->rootShape != NULL) {
+        return objClass->rootShape;
+    }
+
+    Shape *shape = newShape(vm, objClass, false);
+    shape->defaults = ALLOCATE(vm, Value, 1 + objClass->fields.count + objClass->privateFields.count);
+
+    ObjString *classStr = copyString(vm, "_class", 6);
+    push(vm, OBJ_VAL(classStr));
+    shape->defaults[shape->slotCount++] = OBJ_VAL(objClass);
+    tableSet(vm, &shape->fields, classStr, NUMBER_VAL(0), ILEX_READ_ONLY);
+    pop(vm);
+
+    addSlots(vm, shape, &shape->fields, &objClass->fields);
+    addSlots(vm, shape, &shape->privateFields, &objClass->privateFields);
+
+    objClass->rootShape = shape;
+    return shape;
+}
+
+// Returns the slot name is stored in, or -1 if slots has no such field.
+int shapeGetSlot(const Table *slots, ObjString *name) {
+    Value slot;
+    if (!tableGet(slots, name, &slot)) {
+        return -1;
+    }
+
+    return TO_INT(slot);
+}
+
+static Shape *copyShape(VM *vm, const Shape *from, const bool dictionary) {
+    Shape *shape = newShape(vm, from->objClass, dictionary);
+    copySlots(vm, &from->fields, &shape->fields);
+    copySlots(vm, &from->privateFields, &shape->privateFields);
+    shape->slotCount = from->slotCount;
+
+    return shape;
+}
+
+// Moves instance to the shape with name added to its private fields and stores value there. Both have to be reachable
+// by the collector, they are expected to be on the stack.
+void instanceAddPrivateField(VM *vm, ObjInstance *instance, ObjString *name, Value value) {
+    Shape *shape = instance->shape;
+    ObjClass *objClass = instance->objClass;
+
+    if (!shape->dictionary) {
+        Value next;
+        if (tableGet(&shape->transitions, name, &next)) {
+            shape = objClass->shapes[TO_INT(next)];
+        } else if (objClass->shapeCount < SHAPES_MAX) {
+            const int index = objClass->shapeCount;
+            Shape *from = shape;
+            shape = copyShape(vm, from, false);
+            tableSet(vm, &shape->privateFields, name, NUMBER_VAL(shape->slotCount++), ILEX_READ_WRITE);
+            tableSet(vm, &from->transitions, name, NUMBER_VAL(index), ILEX_READ_WRITE);
+        } else {
+            shape = copyShape(vm, shape, true);
+            tableSet(vm, &shape->privateFields, name, NUMBER_VAL(shape->slotCount++), ILEX_READ_WRITE);
+        }
+    } else {
+        tableSet(vm, &shape->privateFields, name, NUMBER_VAL(shape->slotCount++), ILEX_READ_WRITE);
+    }
+
+    if (instance->fieldCapacity < shape->slotCount) {
+        const int oldCapacity = instance->fieldCapacity;
+        instance->fieldCapacity = GROW_CAPACITY(oldCapacity);
+        instance->fields = GROW_POOLED_ARRAY(vm, Value, instance->fields, oldCapacity, instance->fieldCapacity);
+    }
+
+    // A dictionary shape belongs to the instance. Once it has one it keeps it and changes it in place.
+    instance->shape = shape;
+    instance->ownsShape = shape->dictionary;
+    instance->fields[shape->slotCount - 1] = value;
+    writeBarrier(vm, (Obj*)instance);
+}
+
+void markShape(VM *vm, const Shape *shape) {
+    markTable(vm, &shape->fields);
+    markTable(vm, &shape->privateFields);
+    markTable(vm, &shape->transitions);
+
+    if (shape->defaults != NULL) {
+        for (int i = 0; i < shape->slotCount; i++) {
+            markValue(vm, shape->defaults[i]);
+        }
+    }
+}
+
+void freeShape(VM *vm, Shape *shape) {
+    freeTable(vm, &shape->fields);
+    freeTable(vm, &shape->privateFields);
+    freeTable(vm, &shape->transitions);
+    if (shape->defaults != NULL) {
+        FREE_ARRAY(vm, Value, shape->defaults, shape->slotCount);
+    }
+    FREE(vm, Shape, shape);
+}
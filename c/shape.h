@@ -0,0 +1,22 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_SHAPE_H__
+#define __C_SHAPE_H__
+
+#include "ilex.h"
+#include "table.h"
+#include "value.h"
+
+// How many shapes a class can hand out. Instances that need a new layout after that get a dictionary shape of their own.
+#define SHAPES_MAX 64
+
+Shape *classRootShape(VM *vm, ObjClass *objClass);
+int shapeGetSlot(const Table *slots, ObjString *name);
+void instanceAddPrivateField(VM *vm, ObjInstance *instance, ObjString *name, Value value);
+
+void markShape(VM *vm, const Shape *shape);
+void freeShape(VM *vm, Shape *shape);
+
+#endif //__C_SHAPE_H__
@@ -11,19 +11,20 @@
 #include "table.h"
 #include "value.h"
 
-void initTable(Table *table) {
+void initTable(Table *table, Obj *owner) {
     table->count = 0;
     table->capacity = -1;
     table->entries = NULL;
+    table->owner = owner;
 }
 
 void freeTable(VM *vm, Table *table) {
     FREE_ARRAY(vm, Entry, table->entries, table->capacity);
-    initTable(table);
+    initTable(table, table->owner);
 }
 
-static Entry* findEntry(Entry *entries, int capacity, const ObjString* key) {
-    uint32_t index = key->hash & (capacity - 1);
+static Entry* findEntry(Entry *entries, int capacity, ObjString* key) {
+    uint32_t index = stringHash(key) & (capacity - 1);
     Entry *tombstone = NULL;
 
     for (;;) {
@@ -36,7 +37,7 @@ static Entry* findEntry(Entry *entries, int capacity, const ObjString* key) {
                     tombstone = entry;
                 }
             }
-        } else if (entry->key == key) {
+        } else if (entry->key == key || (key->len >= LONG_STRING_LENGTH && stringsEqual(entry->key, key))) {
             return entry;
         }
 
@@ -85,6 +86,20 @@ bool tableGet(const Table *table, ObjString *key, Value *value) {
     return true;
 }
 
+// Returns the index of key's entry, or -1 if the table doesn't contain it.
+int tableGetIndex(const Table *table, ObjString *key) {
+    if (table->count == 0) {
+        return -1;
+    }
+
+    const Entry *entry = findEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL) {
+        return -1;
+    }
+
+    return (int)(entry - table->entries);
+}
+
 int tableGetKeyValue(const Table *table, char **key, Value *value, int startIndex) {
     if (table->count == 0 || startIndex >= table->capacity) {
         return 0;
@@ -124,6 +139,8 @@ bool tableSet(VM *vm, Table *table, ObjString *key, Value value, bool readOnly)
     entry->key = key;
     entry->value = value;
     entry->readOnly = readOnly;
+    writeValueBarrier(vm, table->owner, OBJ_VAL(key));
+    writeValueBarrier(vm, table->owner, value);
     
     return isNewKey;
 }
@@ -175,13 +192,17 @@ ObjString *tableFindString(const Table *table, const char *str, int len, uint32_
     }
 }
 
-void tableRemoveWhite(Table *table) {
-    for (int i = 0; i < table->capacity; ++i) {
+// Removes the unmarked keys of the count entries from start on. Returns where the next call should start.
+int tableRemoveWhite(Table *table, const int start, const int count) {
+    const int end = count < table->capacity - start ? start + count : table->capacity;
+    for (int i = start; i < end; ++i) {
         Entry *entry = &table->entries[i];
         if (entry->key != NULL && !entry->key->obj.isMarked) {
             tableDelete(table, entry->key);
         }
     }
+
+    return end;
 }
 
 void markTable(VM *vm, const Table *table) {
@@ -30,7 +30,7 @@ static Value arrayMake(VM *vm, const int argc, const Value *args) {
 
     ObjArray *array = AS_ARRAY(args[0]);
     freeValueArray(vm, &array->data); // Should the array be freed or should the count be set to 0?
-    initValueArray(&array->data);
+    initValueArray(&array->data, (Obj*)array);
 
     if (!IS_NUMBER(args[1])) {
         char *str = valueType(args[1]);
@@ -125,6 +125,7 @@ static Value arrayInsert(VM *vm, int argc, const Value *args) {
     }
     
     array->data.values[idx] = value;
+    writeBarrier(vm, (Obj*)array);
     
     return ZERO_VAL;
 }
@@ -302,6 +303,7 @@ static Value arrayReverse(VM *vm, int argc, const Value *args) {
         array->data.values[i] = array->data.values[len - i - 1];
         array->data.values[len - i - 1] = tmp;
     }
+    writeBarrier(vm, (Obj*)array);
     
     return ZERO_VAL;
 }
@@ -502,7 +504,7 @@ static Value arrayJoin(VM *vm, int argc, const Value *args) {
 static Value arrayClear(VM *vm, int argc, const Value *args) {
     ObjArray *array = AS_ARRAY(args[0]);
     freeValueArray(vm, &array->data); // Should the array be freed or should the count be set to 0?
-    initValueArray(&array->data);
+    initValueArray(&array->data, (Obj*)array);
     
     return ZERO_VAL;
 }
@@ -714,17 +716,22 @@ static Value arrayMap(VM *vm, int argc, const Value *args) {
     ObjArray *array = AS_ARRAY(args[0]);
     ObjClosure *closure = AS_CLOSURE(args[1]);
     ObjArray *ret = newArray(vm);
+    push(vm, OBJ_VAL(ret));
 
     for (int i = 0; i < array->data.count; ++i) {
         Value value = callFromScript(vm, closure, 1, &array->data.values[i]);
         
         if (IS_ERR(value)) {
+            pop(vm);
             return ERROR_VAL;
         }
         
+        push(vm, value);
         writeValueArray(vm, &ret->data, value);
+        pop(vm);
     }
 
+    pop(vm);
     return OBJ_VAL(ret);
 }
 
@@ -744,11 +751,13 @@ static Value arrayFilter(VM *vm, int argc, const Value *args) {
     ObjArray *array = AS_ARRAY(args[0]);
     ObjClosure *closure = AS_CLOSURE(args[1]);
     ObjArray *ret = newArray(vm);
+    push(vm, OBJ_VAL(ret));
     
     for (int i = 0; i < array->data.count; ++i) {
         Value value = callFromScript(vm, closure, 1, &array->data.values[i]);
         
         if (IS_ERR(value)) {
+            pop(vm);
             return ERROR_VAL;
         }
         
@@ -756,6 +765,7 @@ static Value arrayFilter(VM *vm, int argc, const Value *args) {
             char *type = valueType(value);
             runtimeError(vm, "Function filter() expected return type 'bool' but got '%s'.", type);
             free(type);
+            pop(vm);
             return ERROR_VAL;
         }
         
@@ -764,6 +774,7 @@ static Value arrayFilter(VM *vm, int argc, const Value *args) {
         }
     }
     
+    pop(vm);
     return OBJ_VAL(ret);
 }
 
@@ -0,0 +1,44 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#include "type_fiber.h"
+
+#include <stdlib.h>
+
+static Value fiberNew(VM *vm, int argc, const Value *args) {
+    if (argc != 1) {
+        runtimeError(vm, "Function fiber() expected 1 argument but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    if (!IS_CLOSURE(args[0])) {
+        char *type = valueType(args[0]);
+        runtimeError(vm, "Function fiber() expected type 'function' for first argument but got '%s'.", type);
+        free(type);
+        return ERROR_VAL;
+    }
+
+    // The value the fiber is first resumed with is the only argument it can get.
+    ObjClosure *closure = AS_CLOSURE(args[0]);
+    if (closure->function->arity > 1 || closure->function->arityDefault != 0) {
+        runtimeError(vm, "A fiber's function can take at most 1 argument.");
+        return ERROR_VAL;
+    }
+
+    return OBJ_VAL(newFiber(vm, closure));
+}
+
+static Value fiberIsDone(VM *vm, int argc, const Value *args) {
+    if (argc != 0) {
+        runtimeError(vm, "Function isDone() expected 0 arguments but got '%d'.", argc);
+        return ERROR_VAL;
+    }
+
+    return BOOL_VAL(AS_FIBER(args[0])->state == FIBER_DONE);
+}
+
+void defineFiberFunctions(VM *vm) {
+    registerGlobalFunction(vm, "fiber", fiberNew);
+    defineNative(vm, "isDone", fiberIsDone, &vm->fiberFunctions);
+}
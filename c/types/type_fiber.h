@@ -0,0 +1,12 @@
+//
+// Created by Skyler on 10/17/26.
+//
+
+#ifndef __C_TYPE_FIBER_H__
+#define __C_TYPE_FIBER_H__
+
+#include "../vm.h"
+
+void defineFiberFunctions(VM *vm);
+
+#endif //__C_TYPE_FIBER_H__
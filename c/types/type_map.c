@@ -31,6 +31,7 @@ static Value mapKeysLib(VM *vm, int argc, const Value *args) {
     const ValueArray keysArr = mapKeys(vm, map);
     ObjArray *keys = newArray(vm);
     keys->data = keysArr;
+    keys->data.owner = (Obj*)keys;
 
     return OBJ_VAL(keys);
 }
@@ -40,6 +41,7 @@ static Value mapValuesLib(VM *vm, int argc, const Value *args) {
     const ValueArray valuesArr = mapValues(vm, map);
     ObjArray *values = newArray(vm);
     values->data = valuesArr;
+    values->data.owner = (Obj*)values;
 
     return OBJ_VAL(values);
 }
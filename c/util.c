@@ -6,6 +6,13 @@
 
 #include <stdlib.h>
 
+#ifndef I_WIN
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
 #ifdef I_WIN
 static void fseterr(FILE *fp) {
     struct file {
@@ -133,39 +140,85 @@ ObjString *getDir(VM *vm, const char *source) {
     return dirName(vm, res, strlen(res));
 }
 
-char* readFile(const char *path) {
-#ifdef I_WIN
-    FILE* file;
-    errno_t err = fopen_s(&file, path, "rb");
-#else
-    FILE* file = fopen(path, "rb");
-    errno_t err = file == NULL ? -1 : 0;
+// Sources are mapped when the byte after their end is already in the mapping, which zero fills the rest of its last
+// page. Everything else is read into a buffer.
+bool mapFile(const char *path, MappedFile *file, const bool terminated) {
+    file->bytes = NULL;
+    file->size = 0;
+    file->mapped = false;
+
+#ifndef I_WIN
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    file->size = (size_t)st.st_size;
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    if (file->size > 0 && (!terminated || file->size % pageSize != 0)) {
+        // Private and writable so code can be patched in place, pages are only copied once they are written.
+        void *bytes = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (bytes != MAP_FAILED) {
+            close(fd);
+            file->bytes = (char*)bytes;
+            file->mapped = true;
+            return true;
+        }
+    }
+    close(fd);
 #endif
-    if (err != 0) {
-        fprintf(stderr, "Could not open file '%s'.\n", path);
-        exit(74);
+
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return false;
     }
-    
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
-    
-    char *buffer = (char *)malloc(fileSize + 1);
-    if (buffer == NULL) {
+
+    fseek(stream, 0L, SEEK_END);
+    const long fileSize = ftell(stream);
+    rewind(stream);
+    if (fileSize < 0) {
+        fclose(stream);
+        return false;
+    }
+
+    file->size = (size_t)fileSize;
+    file->bytes = (char*)malloc(file->size + 1);
+    if (file->bytes == NULL) {
         fprintf(stderr, "Not enough memory to read '%s'.\n", path);
         exit(74);
     }
-    
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file '%s'.\n", path);
-        exit(74);
+
+    const size_t bytesRead = fread(file->bytes, sizeof(char), file->size, stream);
+    fclose(stream);
+    if (bytesRead < file->size) {
+        free(file->bytes);
+        file->bytes = NULL;
+        return false;
     }
-    
-    buffer[bytesRead] = '\0';
-    
-    fclose(file);
-    return buffer;
+
+    file->bytes[file->size] = '\0';
+    return true;
+}
+
+void unmapFile(MappedFile *file) {
+#ifndef I_WIN
+    if (file->mapped) {
+        munmap(file->bytes, file->size);
+    } else {
+        free(file->bytes);
+    }
+#else
+    free(file->bytes);
+#endif
+    file->bytes = NULL;
+    file->size = 0;
+    file->mapped = false;
 }
 
 bool isValidKey(Value value) {
@@ -15,10 +15,19 @@
 ssize_t getline(char **restrict line, size_t *restrict n, FILE *restrict file);
 #endif
 
+// The contents of a file, mapped into memory where possible.
+typedef struct {
+    char *bytes;
+    size_t size;
+    bool mapped;
+} MappedFile;
+
 bool resolvePath(const char *dir, const char *path, char *ret);
 ObjString *dirName(VM *vm, const char *path, size_t len);
 ObjString *getDir(VM *vm, const char *source);
-char* readFile(const char *path);
+// When terminated is true bytes[size] is '\0', so a source can be compiled in place.
+bool mapFile(const char *path, MappedFile *file, bool terminated);
+void unmapFile(MappedFile *file);
 bool isValidKey(Value value);
 
 #endif //__C_UTIL_H__
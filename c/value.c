@@ -94,6 +94,7 @@ bool valuesEqual(const Value a, const Value b) {
         }
         
         switch (aObj->type) {
+            case OBJ_STRING: return stringsEqual(AS_STRING(a), AS_STRING(b));
             case OBJ_ARRAY: return arraysEqual(AS_ARRAY(a), AS_ARRAY(b));
             case OBJ_MAP: return mapsEqual(AS_MAP(a), AS_MAP(b));
             case OBJ_SET: return setsEqual(AS_SET(a), AS_SET(b));
@@ -104,10 +105,11 @@ bool valuesEqual(const Value a, const Value b) {
     return a == b;
 }
 
-void initValueArray(ValueArray *array) {
+void initValueArray(ValueArray *array, Obj *owner) {
     array->values = NULL;
     array->capacity = 0;
     array->count = 0;
+    array->owner = owner;
 }
 
 void writeValueArray(VM *vm, ValueArray *array, const Value value) {
@@ -119,6 +121,7 @@ void writeValueArray(VM *vm, ValueArray *array, const Value value) {
 
     array->values[array->count] = value;
     array->count++;
+    writeValueBarrier(vm, array->owner, value);
 }
 
 void fillValueArray(VM *vm, const int count, ValueArray *array, const Value value) {
@@ -133,6 +136,7 @@ void fillValueArray(VM *vm, const int count, ValueArray *array, const Value valu
     }
 
     array->count = count;
+    writeValueBarrier(vm, array->owner, value);
 }
 
 void makeValueArray(VM *vm, const int count, ValueArray *array) {
@@ -145,7 +149,7 @@ void makeValueArray(VM *vm, const int count, ValueArray *array) {
 
 void freeValueArray(VM *vm, ValueArray *array) {
     FREE_ARRAY(vm, Value, array->values, array->capacity);
-    initValueArray(array);
+    initValueArray(array, array->owner);
 }
 
 static inline uint32_t hashBits(uint64_t hash) {
@@ -163,7 +167,7 @@ static inline uint32_t hashBits(uint64_t hash) {
 static uint32_t hashObject(Obj *obj) {
     switch (obj->type) {
         case OBJ_STRING: {
-            return ((ObjString *)obj)->hash;
+            return stringHash((ObjString *)obj);
         }
         default: {
 #ifdef DEBUG_PRINT_CODE
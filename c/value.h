@@ -10,7 +10,7 @@
 #include <string.h>
 
 bool valuesEqual(Value a, Value b);
-void initValueArray(ValueArray *array);
+void initValueArray(ValueArray *array, Obj *owner);
 void writeValueArray(VM *vm, ValueArray *array, Value value);
 void fillValueArray(VM *vm, int count, ValueArray *array, Value value);
 void makeValueArray(VM *vm, int count, ValueArray *array);
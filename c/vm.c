@@ -5,19 +5,24 @@
 #include "vm.h"
 
 #include "ilex.h"
+#include "bytecode.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
 #include "object.h"
 #include "memory.h"
+#include "shape.h"
 #include "util.h"
 
 #include "types/base_types.h"
 #include "types/type_array.h"
 #include "libs/lib_builtIn.h"
 #include "types/type_enum.h"
+#include "types/type_fiber.h"
 #include "types/type_file.h"
 #include "types/type_map.h"
 #include "libs/lib_natives.h"
+#include "libs/lib_random.h"
 #include "types/type_set.h"
 #include "types/type_string.h"
 
@@ -27,7 +32,62 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Parks the running fiber's stack and frames in it and hands the VM the ones of fiber.
+static void switchFiber(VM *vm, ObjFiber *fiber) {
+    ObjFiber *current = vm->fiber;
+    current->frames = vm->frames;
+    current->frameCount = vm->frameCount;
+    current->frameCapacity = vm->frameCapacity;
+    current->stack = vm->stack;
+    current->stackTop = vm->stackTop;
+    current->stackCapacity = vm->stackCapacity;
+    current->retiredCount = vm->retiredCount;
+    current->retiredStacks = vm->retiredStacks;
+    current->openUpvalues = vm->openUpvalues;
+
+    vm->frames = fiber->frames;
+    vm->frameCount = fiber->frameCount;
+    vm->frameCapacity = fiber->frameCapacity;
+    vm->stack = fiber->stack;
+    vm->stackTop = fiber->stackTop;
+    vm->stackCapacity = fiber->stackCapacity;
+    vm->retiredCount = fiber->retiredCount;
+    vm->retiredStacks = fiber->retiredStacks;
+    vm->openUpvalues = fiber->openUpvalues;
+#ifdef DEBUG_MODE
+    vm->stackHeight = (int)(vm->stackTop - vm->stack);
+#endif
+
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+    fiber->retiredCount = 0;
+    fiber->retiredStacks = NULL;
+    fiber->openUpvalues = NULL;
+    vm->fiber = fiber;
+
+    // The parked stack isn't a root any more, a collection that already traced the fiber has to trace it again.
+    writeBarrier(vm, (Obj*)current);
+}
+
+// Hands the VM back to whatever resumed the running fiber, which is left in state.
+static void leaveFiber(VM *vm, const FiberState state) {
+    ObjFiber *fiber = vm->fiber;
+    ObjFiber *caller = fiber->caller;
+    fiber->caller = NULL;
+    fiber->state = state;
+    switchFiber(vm, caller);
+}
+
 static void resetStack(VM *vm) {
+    // An error stops every fiber that was running, the main one takes over again.
+    while (vm->fiber != NULL && vm->fiber->caller != NULL) {
+        leaveFiber(vm, FIBER_DONE);
+    }
+
     vm->stackTop = vm->stack;
     vm->frameCount = 0;
 #ifdef DEBUG_MODE
@@ -61,6 +121,22 @@ void setPanicErrorCallback(VM *vm, const ErrorCallback panicCallback) {
     vm->panicCallback = panicCallback;
 }
 
+void setFrameLimit(VM *vm, const int frameLimit) {
+    vm->frameLimit = frameLimit;
+    // Frames past the new limit stay allocated but aren't used again.
+    if (vm->frameCapacity > frameLimit) {
+        vm->frameCapacity = frameLimit > vm->frameCount ? frameLimit : vm->frameCount;
+    }
+}
+
+void setOptimize(VM *vm, const bool optimize) {
+    vm->optimize = optimize;
+}
+
+void setJitThreshold(VM *vm, const int threshold) {
+    vm->jitThreshold = threshold < 0 ? 0 : threshold;
+}
+
 void runtimeError(VM *vm, const char *format, ...) {
     char *msg = (char*)malloc(sizeof(char) * I_ERR_MSG_SIZE);
     int len;
@@ -77,6 +153,11 @@ void runtimeError(VM *vm, const char *format, ...) {
     msg[len++] = '\n';
 
     for (int i = vm->frameCount - 1; i >= 0; --i) {
+        if (vm->frameCount - 1 - i == TRACE_FRAMES_MAX) {
+            len += snprintf(msg + len, I_ERR_MSG_SIZE, "[%d more]\n", i + 1);
+            break;
+        }
+
         const CallFrame *frame = &vm->frames[i];
         const ObjFunction *function = frame->closure->function;
         // TODO: Find a better way to store line numbers.
@@ -111,6 +192,11 @@ void assertError(VM *vm, const char *format, ...) {
     msg[len++] = '\n';
 
     for (int i = vm->frameCount - 1; i >= 0; i--) {
+        if (vm->frameCount - 1 - i == TRACE_FRAMES_MAX) {
+            len += snprintf(msg + len, I_ERR_MSG_SIZE, "[%d more]\n", i + 1);
+            break;
+        }
+
         const CallFrame *frame = &vm->frames[i];
         const ObjFunction *function = frame->closure->function;
         const size_t instruction = frame->ip - function->chunk.code - 1;
@@ -143,6 +229,11 @@ void panicError(VM *vm, const char *panicMsg) {
     }
 
     for (int i = vm->frameCount - 1; i >= 0; i--) {
+        if (vm->frameCount - 1 - i == TRACE_FRAMES_MAX) {
+            len += snprintf(msg + len, I_ERR_MSG_SIZE, "[%d more]\n", i + 1);
+            break;
+        }
+
         const CallFrame *frame = &vm->frames[i];
         const ObjFunction *function = frame->closure->function;
         const size_t instruction = frame->ip - function->chunk.code - 1;
@@ -176,14 +267,33 @@ void defineNative(VM *vm, const char *name, const NativeFn function, Table *tabl
     ++vm->fnCount;
 }
 
+static void defineGlobal(VM *vm, ObjString *name, const Value value) {
+    Value slot;
+    if (tableGet(&vm->globals, name, &slot)) {
+        vm->globalValues.values[TO_INT(slot)] = value;
+        return;
+    }
+
+    writeValueArray(vm, &vm->globalValues, value);
+    tableSet(vm, &vm->globals, name, NUMBER_VAL(vm->globalValues.count - 1), ILEX_READ_ONLY);
+}
+
 void registerGlobalFunction(VM *vm, const char *name, const NativeFn function) {
-    defineNative(vm, name, function, &vm->globals);
+    ObjString *nativeName = copyString(vm, name, (int)strlen(name));
+    push(vm, OBJ_VAL(nativeName));
+    ObjNative *nativeFunction = newNative(vm, function);
+    push(vm, OBJ_VAL(nativeFunction));
+    defineGlobal(vm, nativeName, OBJ_VAL(nativeFunction));
+    pop(vm);
+    pop(vm);
+    ++vm->fnCount;
 }
 
 void defineNativeValue(VM *vm, const char *name, const Value value, Table *table) {
+    // value is usually freshly allocated, so it has to be on the stack before the name is.
+    push(vm, value);
     ObjString *valueName = copyString(vm, name, (int)strlen(name));
     push(vm, OBJ_VAL(valueName));
-    push(vm, value);
     tableSet(vm, table, valueName, value, ILEX_READ_ONLY);
     pop(vm);
     pop(vm);
@@ -191,7 +301,13 @@ void defineNativeValue(VM *vm, const char *name, const Value value, Table *table
 }
 
 void registerGlobalValue(VM *vm, const char *name, const Value value) {
-    defineNativeValue(vm, name, value, &vm->globals);
+    push(vm, value);
+    ObjString *valueName = copyString(vm, name, (int)strlen(name));
+    push(vm, OBJ_VAL(valueName));
+    defineGlobal(vm, valueName, value);
+    pop(vm);
+    pop(vm);
+    ++vm->valCount;
 }
 
 void registerLibraryFunction(VM *vm, const char *name, const NativeFn function, Table *table) {
@@ -212,15 +328,53 @@ void registerLibrary(VM *vm, const char *name, const BuiltInLib lib) {
 VM *initVM(const char *path, const int argc, char **argv) {
     VM *vm = (VM*)calloc(1, sizeof(VM));
 
-    vm->stack = (Value*)malloc(sizeof(Value) * STACK_MAX);
+    vm->frames = (CallFrame*)malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm->frameCapacity = FRAMES_INITIAL;
+    vm->frameLimit = FRAMES_MAX;
+    vm->stack = (Value*)malloc(sizeof(Value) * STACK_INITIAL);
+    vm->stackCapacity = STACK_INITIAL;
+    vm->retiredCount = 0;
+    vm->retiredStacks = NULL;
+    if (vm->frames == NULL || vm->stack == NULL) {
+        exit(69);
+    }
     resetStack(vm);
-    vm->objects = NULL;
+    for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+        vm->arenas[i] = NULL;
+        vm->unswept[i] = NULL;
+        vm->freeBlocks[i] = NULL;
+    }
+    vm->youngCount = 0;
+    vm->youngCapacity = 0;
+    vm->youngObjects = NULL;
     vm->bytesAllocated = 0;
     vm->nextGC = 1024 * 1024;
+    vm->nextYoungGC = GC_NURSERY_SIZE;
     vm->gcRuns = 0;
+    vm->youngGcRuns = 0;
+    vm->collectingYoung = false;
+    vm->gcPhase = GC_IDLE;
+    vm->gcMaxPause = 0;
+    for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+        vm->pools[i] = NULL;
+    }
+    vm->slabs = NULL;
+    vm->slabNext = NULL;
+    vm->slabEnd = NULL;
+    vm->sweeper = NULL;
+    vm->deadCount = 0;
+    vm->deadCapacity = 0;
+    vm->deadBuffers = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    vm->remembered = NULL;
     vm->grayCount = 0;
     vm->grayCapacity = 0;
     vm->grayStack = NULL;
+    vm->sliced = NULL;
+    vm->sliceNext = 0;
+    vm->clearNext = 0;
+    vm->clearCapacity = 0;
     vm->lastScript = NULL;
     vm->runtimeCallback = NULL;
     vm->assertCallback = NULL;
@@ -232,28 +386,38 @@ VM *initVM(const char *path, const int argc, char **argv) {
     vm->argc = argc;
     vm->argv = argv;
 
-    initTable(&vm->globals);
-    initTable(&vm->consts);
-    initTable(&vm->strings);
-
-    initTable(&vm->scripts);
-    initTable(&vm->numberFunctions);
-    initTable(&vm->stringFunctions);
-    initTable(&vm->arrayFunctions);
-    initTable(&vm->fileFunctions);
-    initTable(&vm->mapFunctions);
-    initTable(&vm->setFunctions);
-    initTable(&vm->enumFunctions);
+    initTable(&vm->globals, NULL);
+    initValueArray(&vm->globalValues, NULL);
+    initTable(&vm->consts, NULL);
+    initTable(&vm->strings, NULL);
+
+    initTable(&vm->scripts, NULL);
+    vm->cacheFiles = NULL;
+    vm->worker = NULL;
+    vm->eventLoop = NULL;
+    initTable(&vm->numberFunctions, NULL);
+    initTable(&vm->stringFunctions, NULL);
+    initTable(&vm->arrayFunctions, NULL);
+    initTable(&vm->fileFunctions, NULL);
+    initTable(&vm->mapFunctions, NULL);
+    initTable(&vm->setFunctions, NULL);
+    initTable(&vm->enumFunctions, NULL);
+    initTable(&vm->fiberFunctions, NULL);
 
     vm->initString = NULL;
+    vm->toStringString = NULL;
     vm->scriptName = NULL;
     vm->initString = copyString(vm, "init", 4);
+    vm->toStringString = copyString(vm, "toString", 8);
     vm->scriptName = copyString(vm, path, (int)strlen(path));
+    vm->fiber = newFiber(vm, NULL);
     vm->envLoaded = false;
     vm->fallThrough = false;
+    vm->optimize = false;
+    vm->jitThreshold = 0;
 
     vm->window = nullptr;
-    vm->testMode = (strcmp("test", argv[1]) == 0);
+    vm->testMode = argc > 1 && strcmp("test", argv[1]) == 0;
 
     defineNatives(vm);
     defineNumberFunctions(vm);
@@ -263,16 +427,18 @@ VM *initVM(const char *path, const int argc, char **argv) {
     defineMapFunctions(vm);
     defineSetFunctions(vm);
     defineEnumFunctions(vm);
+    defineFiberFunctions(vm);
 
     initBuiltInLibs(vm);
 
-    srand(time(NULL));
+    seedRandom(vm, (unsigned int)time(NULL) ^ (unsigned int)((uintptr_t)vm >> 4));
 
     return vm;
 }
 
 void freeVM(VM *vm) {
     freeTable(vm, &vm->globals);
+    freeValueArray(vm, &vm->globalValues);
     freeTable(vm, &vm->consts);
     freeTable(vm, &vm->numberFunctions);
     freeTable(vm, &vm->strings);
@@ -282,17 +448,27 @@ void freeVM(VM *vm) {
     freeTable(vm, &vm->mapFunctions);
     freeTable(vm, &vm->setFunctions);
     freeTable(vm, &vm->enumFunctions);
+    freeTable(vm, &vm->fiberFunctions);
+    freeEventLoop(vm);
     for (int i = 0; i < vm->libCount; ++i) {
         FREE(vm, char, vm->libs[i].name);
     }
     FREE(vm, BuiltInLibs, vm->libs);
     vm->initString = NULL;
+    vm->toStringString = NULL;
     vm->scriptName = NULL;
+    vm->fiber = NULL;
     freeObjects(vm);
+    freeCacheFiles(vm);
+    for (int i = 0; i < vm->retiredCount; ++i) {
+        free(vm->retiredStacks[i]);
+    }
+    free(vm->retiredStacks);
     free(vm->stack);
+    free(vm->frames);
 }
 
-// TODO(Skyler): Grow the stack if needed.
+// call() makes sure there is room for everything a frame pushes, so push() doesn't have to check.
 void push(VM *vm, Value v) {
     *vm->stackTop = v;
     vm->stackTop++;
@@ -313,6 +489,119 @@ Value peek(const VM *vm, const int amount) {
     return vm->stackTop[-1 - amount];
 }
 
+// Natives only ever see flat strings, see concat().
+static void flattenArgs(VM *vm, const Value *args, const int count) {
+    for (int i = 0; i < count; ++i) {
+        if (IS_ROPE(args[i])) {
+            flattenString(vm, AS_STRING(args[i]));
+        }
+    }
+}
+
+// Moves the stack somewhere with at least needed slots above stackTop. The frames and open upvalues point into it so
+// they move along. The old stack is only freed with the VM or the fiber it belongs to, a native further up the C stack
+// might still read its arguments from there.
+static void growStack(VM *vm, const int needed) {
+    const int count = (int)(vm->stackTop - vm->stack);
+    int capacity = vm->stackCapacity;
+    while (count + needed > capacity) {
+        capacity *= 2;
+    }
+
+    Value *stack = (Value*)malloc(sizeof(Value) * capacity);
+    vm->retiredStacks = (Value**)realloc(vm->retiredStacks, sizeof(Value*) * (vm->retiredCount + 1));
+    if (stack == NULL || vm->retiredStacks == NULL) {
+        exit(69);
+    }
+    memcpy(stack, vm->stack, sizeof(Value) * count);
+
+    for (int i = 0; i < vm->frameCount; ++i) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    }
+    for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm->stack);
+    }
+
+    adoptBuffer(vm, sizeof(Value) * (capacity - vm->stackCapacity));
+    vm->retiredStacks[vm->retiredCount++] = vm->stack;
+    vm->stack = stack;
+    vm->stackTop = stack + count;
+    vm->stackCapacity = capacity;
+}
+
+// The frames never grow past the frame limit, so running out of them is a stack overflow.
+static bool growFrames(VM *vm) {
+    if (vm->frameCapacity >= vm->frameLimit) {
+        return false;
+    }
+
+    const int oldCapacity = vm->frameCapacity;
+    vm->frameCapacity = GROW_CAPACITY(vm->frameCapacity);
+    if (vm->frameCapacity > vm->frameLimit) {
+        vm->frameCapacity = vm->frameLimit;
+    }
+    adoptBuffer(vm, sizeof(CallFrame) * (vm->frameCapacity - oldCapacity));
+
+    vm->frames = (CallFrame*)realloc(vm->frames, sizeof(CallFrame) * vm->frameCapacity);
+    if (vm->frames == NULL) {
+        exit(69);
+    }
+
+    return true;
+}
+
+// Makes room for one more frame and enough stack for closure, false if that would go past the frame limit.
+static inline bool pushFrame(VM *vm, const ObjClosure *closure) {
+    if (vm->frameCount == vm->frameCapacity && !growFrames(vm)) {
+        return false;
+    }
+
+    const int needed = closure->function->maxSlots + UINT8_COUNT;
+    if (vm->stackTop + needed > vm->stack + vm->stackCapacity) {
+        growStack(vm, needed);
+    }
+
+    return true;
+}
+
+// Switches to fiber so it carries on from where it is. A suspended fiber gets value as the result of its yield, a new
+// one as the argument of its function.
+static bool startFiber(VM *vm, ObjFiber *fiber, const Value value, const bool resumedByNative) {
+    if (fiber->state == FIBER_RUNNING) {
+        runtimeError(vm, "Fiber is already running.");
+        return false;
+    }
+
+    if (fiber->state == FIBER_DONE) {
+        runtimeError(vm, "Cannot resume a fiber that has finished.");
+        return false;
+    }
+
+    fiber->caller = vm->fiber;
+    fiber->resumedByNative = resumedByNative;
+    switchFiber(vm, fiber);
+    if (fiber->state == FIBER_SUSPENDED || fiber->closure->function->arity == 1) {
+        push(vm, value);
+    }
+    fiber->state = FIBER_RUNNING;
+
+    return true;
+}
+
+// Resumes fiber from C, run() returns as soon as it yields or returns. The result is what it yielded or returned.
+Value resumeFiber(VM *vm, ObjFiber *fiber, const Value value) {
+    if (!startFiber(vm, fiber, value, true)) {
+        return ERROR_VAL;
+    }
+
+    Value result;
+    if (run(vm, -1, &result) != INTERPRET_GOOD) {
+        return ERROR_VAL;
+    }
+
+    return result;
+}
+
 Value callFromScript(VM *vm, ObjClosure *closure, const int argc, const Value *args) {
     if (argc < closure->function->arity ||
         argc > closure->function->arity + closure->function->arityDefault) {
@@ -321,7 +610,7 @@ Value callFromScript(VM *vm, ObjClosure *closure, const int argc, const Value *a
         return ERROR_VAL;
     }
 
-    if (vm->frameCount == FRAMES_MAX) {
+    if (!pushFrame(vm, closure)) {
         runtimeError(vm, "Stack overflow.");
         return ERROR_VAL;
     }
@@ -338,13 +627,22 @@ Value callFromScript(VM *vm, ObjClosure *closure, const int argc, const Value *a
 
     frame->slots = vm->stackTop - argc - 1;
     Value value;
-    run(vm, currentFrameIndex, &value);
+    // An error has already reset the stack.
+    if (run(vm, currentFrameIndex, &value) != INTERPRET_GOOD) {
+        return ERROR_VAL;
+    }
 
     // Pop args from the stack when done.
     for (int i = 0; i < argc; ++i) {
         pop(vm);
     }
 
+    if (IS_ROPE(value)) {
+        push(vm, value);
+        flattenString(vm, AS_STRING(value));
+        pop(vm);
+    }
+
     return value;
 }
 
@@ -357,8 +655,8 @@ static bool call(VM *vm, ObjClosure *closure, const int argc) {
         return ERROR_VAL;
     }
 
-    if (vm->frameCount == FRAMES_MAX) {
-        runtimeError(vm, "Stack overflow. (FRAMES_MAX)");
+    if (!pushFrame(vm, closure)) {
+        runtimeError(vm, "Stack overflow.");
         return false;
     }
 
@@ -411,6 +709,7 @@ static bool callValue(VM *vm, Value callee, int argc) {
             }
             case OBJ_NATIVE: {
                 const NativeFn native = AS_NATIVE(callee);
+                flattenArgs(vm, vm->stackTop - argc, argc);
                 const Value result = native(vm, argc, vm->stackTop - argc);
 
                 if (IS_ERR(result)) {
@@ -434,6 +733,7 @@ static bool callValue(VM *vm, Value callee, int argc) {
 }
 
 static bool callNativeFunction(VM *vm, const NativeFn native, int argc) {
+    flattenArgs(vm, vm->stackTop - argc - 1, argc + 1);
     const Value res = native(vm, argc, vm->stackTop - argc - 1);
     if (IS_ERR(res)) {
         return false;
@@ -447,6 +747,28 @@ static bool callNativeFunction(VM *vm, const NativeFn native, int argc) {
     return true;
 }
 
+// The caches belong to function, which marks what they point at.
+static void fillCache(VM *vm, ObjFunction *function, InlineCache *cache, const ObjInstance *instance, const int slot, const Value method) {
+    // Dictionary shapes change in place, so what is true of them now might not be next time.
+    if (instance->shape->dictionary) {
+        return;
+    }
+
+    cache->shape = instance->shape;
+    cache->slot = slot;
+    cache->method = method;
+    writeBarrier(vm, (Obj*)function);
+}
+
+// Instances with the same shape have the same fields in the same slots.
+static inline int cachedSlot(const InlineCache *cache, const ObjInstance *instance) {
+    return cache->shape == instance->shape ? cache->slot : -1;
+}
+
+static inline bool cachedMethod(const InlineCache *cache, const ObjInstance *instance) {
+    return cache->shape == instance->shape && cache->slot == -1;
+}
+
 static bool invokeFromClass(VM *vm, ObjClass *objClass, ObjString *name, const int argc) {
     Value method;
     if (!tableGet(&objClass->methods, name, &method)) {
@@ -530,7 +852,7 @@ static bool invokeFromThis(VM *vm, ObjString *name, const int argc) {
     return false;
 }
 
-static bool invoke(VM *vm, ObjString *name, const int argc) {
+static bool invoke(VM *vm, ObjString *name, const int argc, InlineCache *cache) {
     const Value receiver = peek(vm, argc);
 
     if (IS_NUMBER(receiver)) {
@@ -553,16 +875,37 @@ static bool invoke(VM *vm, ObjString *name, const int argc) {
     switch (getObjType(receiver)) {
         case OBJ_INSTANCE: {
             ObjInstance *instance = AS_INSTANCE(receiver);
+            if (cachedMethod(cache, instance)) {
+                return call(vm, AS_CLOSURE(cache->method), argc);
+            }
 
-            Value value;
-            if (tableGet(&instance->fields, name, &value)) {
+            int slot = cachedSlot(cache, instance);
+            if (slot == -1) {
+                slot = shapeGetSlot(&instance->shape->fields, name);
+                if (slot != -1) {
+                    fillCache(vm, vm->frames[vm->frameCount - 1].closure->function, cache, instance, slot, NULL_VAL);
+                }
+            }
+
+            if (slot != -1) {
+                const Value value = instance->fields[slot];
                 vm->stackTop[-argc - 1] = value;
                 return callValue(vm, value, argc);
             }
 
+            Value method;
+            if (tableGet(&instance->objClass->methods, name, &method)) {
+                fillCache(vm, vm->frames[vm->frameCount - 1].closure->function, cache, instance, -1, method);
+            }
+
             return invokeFromClass(vm, instance->objClass, name, argc);
         }
         case OBJ_STRING: {
+            // String interpolation calls toString() on everything, a string is returned as is so a rope stays one.
+            if (name == vm->toStringString && argc == 0) {
+                return true;
+            }
+
             Value value;
             if (tableGet(&vm->stringFunctions, name, &value)) {
                 return callNativeFunction(vm, AS_NATIVE(value), argc);
@@ -590,7 +933,7 @@ static bool invoke(VM *vm, ObjString *name, const int argc) {
             ObjScript *script = AS_SCRIPT(receiver);
 
             Value value;
-            if (!tableGet(&script->values, name, &value)) {
+            if (!scriptGet(script, name, &value)) {
                 runtimeError(vm, "Undefined property '%s' on '%s'.", name->str, script->name->str);
                 return false;
             }
@@ -633,6 +976,15 @@ static bool invoke(VM *vm, ObjString *name, const int argc) {
             runtimeError(vm, "Set has no function %s().", name->str);
             return false;
         }
+        case OBJ_FIBER: {
+            Value value;
+            if (tableGet(&vm->fiberFunctions, name, &value)) {
+                return callNativeFunction(vm, AS_NATIVE(value), argc);
+            }
+
+            runtimeError(vm, "Fiber has no function %s().", name->str);
+            return false;
+        }
         case OBJ_ABSTRACT: {
             ObjAbstract *abstract = AS_ABSTRACT(receiver);
             Value value;
@@ -694,6 +1046,7 @@ static void closeUpvalues(VM *vm, const Value *last) {
         ObjUpvalue *upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        writeValueBarrier(vm, (Obj*)upvalue, upvalue->closed);
         vm->openUpvalues = upvalue->next;
     }
 }
@@ -726,6 +1079,7 @@ static void createClass(VM *vm, ObjString *name, ObjClass *superClass, const Cla
     
         tableAddAll(vm, &superClass->fields, &objClass->fields);
         tableAddAll(vm, &superClass->privateFields, &objClass->privateFields);
+        objClass->rootShape = NULL;
     }
 }
 
@@ -739,99 +1093,400 @@ void registerClassFunction(VM *vm, ObjClass *objClass, const char *name, NativeF
 void registerClassVariable(VM *vm, ObjClass *objClass, const char *name, NativeFn function, bool isPrivate);
 void registerClassStaticVariable(VM *vm, ObjClass *objClass, const char *name, NativeFn function, bool isConst);
 
+// Long results are ropes, so building a string in a loop doesn't copy everything built so far each time. Short ones
+// are flat and interned as usual, a rope is never shorter than LONG_STRING_LENGTH so both halves are flat then.
 static void concat(VM *vm) {
     ObjString* b = AS_STRING(peek(vm, 0));
     ObjString* a = AS_STRING(peek(vm, 1));
 
     int len = a->len + b->len;
-    char* str = ALLOCATE(vm, char, len + 1);
-    memcpy(str, a->str, a->len);
-    memcpy(str + a->len, b->str, b->len);
-    str[len] = '\0';
+    ObjString *res;
+    if (a->len == 0 || b->len == 0) {
+        res = a->len == 0 ? b : a;
+    } else if (len >= LONG_STRING_LENGTH) {
+        res = newRope(vm, a, b);
+    } else {
+        // Short results are built on the stack, copyString() only allocates if the string isn't interned yet.
+        char str[LONG_STRING_LENGTH];
+        memcpy(str, a->str, a->len);
+        memcpy(str + a->len, b->str, b->len);
+        res = copyString(vm, str, len);
+    }
 
-    ObjString *res = takeString(vm, str, len);
     pop(vm);
     pop(vm);
     push(vm, OBJ_VAL(res));
 }
 
+#if defined(__GNUC__) || defined(__clang__)
+#   define LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#   define LIKELY(x) (x)
+#endif
+// Integers are checked first, so the arithmetic after these goes straight to its integer path for them.
+#define INTS(a, b) LIKELY(IS_INT(a) && IS_INT(b))
+#define NUMBER(a) (LIKELY(IS_INT(a)) || IS_NUMBER(a))
+#define NUMBERS(a, b) (INTS(a, b) || (IS_NUMBER(a) && IS_NUMBER(b)))
+
+// Two integers are added, subtracted and multiplied as 64 bit integers, which can't overflow for 32 bit operands, and
+// the result only turns into a double when it doesn't fit in 32 bits. That is the double the arithmetic on doubles would
+// have given too.
+static inline Value intResult(const int64_t result) {
+    return LIKELY(result >= INT32_MIN && result <= INT32_MAX) ? INT_VAL(result) : NUMBER_VAL((double)result);
+}
+
+static inline Value addNumbers(const Value a, const Value b) {
+    if (INTS(a, b)) {
+        return intResult((int64_t)AS_INT(a) + AS_INT(b));
+    }
+
+    return NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+static inline Value subtractNumbers(const Value a, const Value b) {
+    if (INTS(a, b)) {
+        return intResult((int64_t)AS_INT(a) - AS_INT(b));
+    }
+
+    return NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+static inline Value multiplyNumbers(const Value a, const Value b) {
+    // 0 times a negative number is -0, which only a double holds.
+    if (INTS(a, b)) {
+        const int64_t result = (int64_t)AS_INT(a) * AS_INT(b);
+        if (LIKELY(result != 0 || (AS_INT(a) | AS_INT(b)) >= 0)) {
+            return intResult(result);
+        }
+    }
+
+    return NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+static inline Value moduloNumbers(const Value a, const Value b) {
+    // Like fmod(), the result has the sign of a, -0 included.
+    if (INTS(a, b) && AS_INT(b) != 0) {
+        const int64_t result = (int64_t)AS_INT(a) % AS_INT(b);
+        if (LIKELY(result != 0 || AS_INT(a) >= 0)) {
+            return INT_VAL(result);
+        }
+    }
+
+    return NUMBER_VAL(fmod(AS_NUMBER(a), AS_NUMBER(b)));
+}
+
 InterpretResult run(VM *vm, int frameIndex, Value *val) {
     CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    // Ilex code called from C runs on the fiber that called it, frameIndex is one of that fiber's frames.
+    const ObjFiber *runFiber = vm->fiber;
     // printf("frameCount %d\n", vm->frameCount);
     register uint8_t *ip = frame->ip;
 
+    // The stack top, the current frame's slots, constant pool and inline caches live in locals while run() is executing. Anything
+    // outside of run() only sees vm->stackTop so it has to be stored before calls, allocations (which can collect),
+    // and errors, and loaded again after anything that can move it.
+    register Value *sp = vm->stackTop;
+    Value *slots = frame->slots;
+    Value *constants = frame->closure->function->chunk.constants.values;
+    InlineCache *caches = frame->closure->function->chunk.caches;
+
 #define READ_BYTE() (*ip++)
 #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_SHORT()])
+#define READ_CONSTANT() (constants[READ_SHORT()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() (&caches[READ_SHORT()])
+
+#ifdef DEBUG_MODE
+#   define PUSH(value) (vm->stackHeight++, *sp++ = (value))
+#   define POP() (vm->stackHeight--, *--sp)
+#   define DROP() (vm->stackHeight--, --sp)
+#else
+#   define PUSH(value) (*sp++ = (value))
+#   define POP() (*--sp)
+#   define DROP() (--sp) // POP() for values nobody reads.
+#endif
+#define PEEK(distance) (sp[-1 - (distance)])
+#define STORE_SP() (vm->stackTop = sp)
+#define LOAD_SP() (sp = vm->stackTop)
+#define STORE_FRAME() do { frame->ip = ip; STORE_SP(); } while (false)
+#define LOAD_FRAME() \
+    do { \
+        frame = &vm->frames[vm->frameCount - 1]; \
+        ip = frame->ip; \
+        slots = frame->slots; \
+        constants = frame->closure->function->chunk.constants.values; \
+        caches = frame->closure->function->chunk.caches; \
+    } while (false)
+// Ropes are flattened before an instruction looks at their characters or puts them where natives can see them.
+#define FLATTEN(value) \
+    do { \
+        if (IS_ROPE(value)) { \
+            STORE_SP(); \
+            flattenString(vm, AS_STRING(value)); \
+        } \
+    } while (false)
 #define BINARY_OP(valueTypeArg, op, opStr, type) \
     do { \
-      if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
-        frame->ip = ip; \
-        runtimeError(vm, "'%s' operands must be numbers. Got '%s', '%s' (%s, %s).", opStr, valueType(peek(vm, 0)), valueType(peek(vm, 1)), valueToString(peek(vm, 0)), valueToString(peek(vm, 1))); \
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+        STORE_FRAME(); \
+        runtimeError(vm, "'%s' operands must be numbers. Got '%s', '%s' (%s, %s).", opStr, valueType(PEEK(0)), valueType(PEEK(1)), valueToString(PEEK(0)), valueToString(PEEK(1))); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
-      type b = AS_NUMBER(pop(vm)); \
-      type a = AS_NUMBER(pop(vm)); \
-      push(vm, valueTypeArg(a op b)); \
+      type b = AS_NUMBER(POP()); \
+      type a = AS_NUMBER(POP()); \
+      PUSH(valueTypeArg(a op b)); \
+    } while (false)
+// Two integers are compared or combined as integers, without going through doubles.
+#define INT_BINARY_OP(valueTypeArg, op, opStr, type) \
+    do { \
+      if (INTS(PEEK(1), PEEK(0))) { \
+        const int32_t b = AS_INT(POP()); \
+        sp[-1] = valueTypeArg(AS_INT(sp[-1]) op b); \
+      } else { \
+        BINARY_OP(valueTypeArg, op, opStr, type); \
+      } \
+    } while (false)
+// Arithmetic where fn() knows what to do about integers. BINARY_OP only reports the error.
+#define NUMBER_OP(fn, op, opStr) \
+    do { \
+      if (NUMBERS(PEEK(1), PEEK(0))) { \
+        const Value b = POP(); \
+        sp[-1] = fn(sp[-1], b); \
+      } else { \
+        BINARY_OP(NUMBER_VAL, op, opStr, double); \
+      } \
+    } while (false)
+#ifdef ILEX_JIT
+// Carries on in the machine code of the current function if it has some for ip. Where 'counts', the function got
+// hotter and is compiled once it is hot enough.
+#   define JIT_ENTER(counts) \
+    do { \
+        ObjFunction *hot = frame->closure->function; \
+        if ((counts) && hot->hotness < vm->jitThreshold && ++hot->hotness == vm->jitThreshold) { \
+            compileJit(vm, hot); \
+        } \
+        if (hot->jit != NULL) { \
+            STORE_SP(); \
+            ip = runJit(hot->jit, ip, slots, constants, &vm->stackTop); \
+            LOAD_SP(); \
+        } \
+    } while (false)
+#else
+#   define JIT_ENTER(counts) do { } while (false)
+#endif
+// The instruction being run turns into its quickened form, or back into the generic one when the quickened one's guard
+// fails. A generic instruction runs in its place on the same operands. Code other VMs run too is left generic, so
+// quickened instructions are only ever found in code that can be written.
+#define QUICKEN(op) \
+    do { \
+        if (!frame->closure->function->chunk.readOnlyCode) { \
+            ip[-1] = (op); \
+        } \
+    } while (false)
+#define DEOPTIMIZE(op) do { *--ip = (op); DISPATCH(); } while (false)
+// Compare a local against 'rhs' and jump when the comparison is false, leaving false on the stack for the pop at the
+// jump target. Non numbers are pushed and handed to BINARY_OP so the error matches the unfused instructions.
+#define LOCAL_CMP_JMP(op, opStr, rhs) \
+    do { \
+      Value a = slots[READ_SHORT()]; \
+      Value b = rhs; \
+      uint16_t offset = READ_SHORT(); \
+      if (!NUMBERS(a, b)) { \
+        PUSH(a); \
+        PUSH(b); \
+        BINARY_OP(BOOL_VAL, op, opStr, double); \
+      } \
+      if (INTS(a, b) ? !(AS_INT(a) op AS_INT(b)) : !(AS_NUMBER(a) op AS_NUMBER(b))) { \
+        PUSH(BOOL_VAL(false)); \
+        ip += offset; \
+      } \
     } while (false)
 
-    for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        disassembleInstruction(&frame->closure->function->chunk, (int)(ip - frame->closure->function->chunk.code));
+#   define TRACE_INSTRUCTION() \
+    do { \
+        printf("          "); \
+        for (Value* slot = vm->stack; slot < sp; slot++) { \
+            printf("[ "); \
+            printValue(*slot); \
+            printf(" ]"); \
+        } \
+        printf("\n"); \
+        disassembleInstruction(&frame->closure->function->chunk, (int)(ip - frame->closure->function->chunk.code)); \
+    } while (false)
+#else
+#   define TRACE_INSTRUCTION() do { } while (false)
 #endif
+
+#ifdef ILEX_COMPUTED_GOTO
+    // Direct threaded dispatch. Every handler jumps straight to the next one through this table so each opcode
+    // gets its own indirect branch instead of all of them sharing the one at the top of the switch.
+    static void *dispatchTable[] = {
+        [OP_CONSTANT] = &&op_OP_CONSTANT,
+        [OP_NULL] = &&op_OP_NULL,
+        [OP_TRUE] = &&op_OP_TRUE,
+        [OP_FALSE] = &&op_OP_FALSE,
+        [OP_POP] = &&op_OP_POP,
+        [OP_GET_LOCAL] = &&op_OP_GET_LOCAL,
+        [OP_GET_GLOBAL] = &&op_OP_GET_GLOBAL,
+        [OP_GET_UPVALUE] = &&op_OP_GET_UPVALUE,
+        [OP_GET_PROPERTY] = &&op_OP_GET_PROPERTY,
+        [OP_GET_PROPERTY_NO_POP] = &&op_OP_GET_PROPERTY_NO_POP,
+        [OP_GET_PRIVATE_PROPERTY] = &&op_OP_GET_PRIVATE_PROPERTY,
+        [OP_GET_PRIVATE_PROPERTY_NO_POP] = &&op_OP_GET_PRIVATE_PROPERTY_NO_POP,
+        [OP_GET_SUPER] = &&op_OP_GET_SUPER,
+        [OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL,
+        [OP_SET_LOCAL] = &&op_OP_SET_LOCAL,
+        [OP_SET_GLOBAL] = &&op_OP_SET_GLOBAL,
+        [OP_SET_UPVALUE] = &&op_OP_SET_UPVALUE,
+        [OP_SET_PROPERTY] = &&op_OP_SET_PROPERTY,
+        [OP_SET_PRIVATE_PROPERTY] = &&op_OP_SET_PRIVATE_PROPERTY,
+        [OP_SET_CLASS_STATIC_VAR] = &&op_OP_SET_CLASS_STATIC_VAR,
+        [OP_EQ] = &&op_OP_EQ,
+        [OP_NOTEQ] = &&op_OP_NOTEQ,
+        [OP_GR] = &&op_OP_GR,
+        [OP_GREQ] = &&op_OP_GREQ,
+        [OP_LT] = &&op_OP_LT,
+        [OP_LTEQ] = &&op_OP_LTEQ,
+        [OP_ADD] = &&op_OP_ADD,
+        [OP_CONCAT] = &&op_OP_CONCAT,
+        [OP_INC] = &&op_OP_INC,
+        [OP_SUB] = &&op_OP_SUB,
+        [OP_DEC] = &&op_OP_DEC,
+        [OP_MUL] = &&op_OP_MUL,
+        [OP_DIV] = &&op_OP_DIV,
+        [OP_POW] = &&op_OP_POW,
+        [OP_MOD] = &&op_OP_MOD,
+        [OP_NOT] = &&op_OP_NOT,
+        [OP_BIT_AND] = &&op_OP_BIT_AND,
+        [OP_BIT_OR] = &&op_OP_BIT_OR,
+        [OP_BIT_XOR] = &&op_OP_BIT_XOR,
+        [OP_BIT_NOT] = &&op_OP_BIT_NOT,
+        [OP_BIT_LS] = &&op_OP_BIT_LS,
+        [OP_BIT_RS] = &&op_OP_BIT_RS,
+        [OP_NEG] = &&op_OP_NEG,
+        [OP_JUMP] = &&op_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&op_OP_JUMP_IF_TRUE,
+        [OP_JUMP_DO_WHILE] = &&op_OP_JUMP_DO_WHILE,
+        [OP_LOOP] = &&op_OP_LOOP,
+        [OP_CALL] = &&op_OP_CALL,
+        [OP_INVOKE] = &&op_OP_INVOKE,
+        [OP_INVOKE_SUPER] = &&op_OP_INVOKE_SUPER,
+        [OP_INVOKE_THIS] = &&op_OP_INVOKE_THIS,
+        [OP_CLOSURE] = &&op_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE] = &&op_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&op_OP_RETURN,
+        [OP_CLASS] = &&op_OP_CLASS,
+        [OP_INHERIT] = &&op_OP_INHERIT,
+        [OP_CHECK_ABSTRACT] = &&op_OP_CHECK_ABSTRACT,
+        [OP_METHOD] = &&op_OP_METHOD,
+        [OP_ASSERT] = &&op_OP_ASSERT,
+        [OP_TYPEOF] = &&op_OP_TYPEOF,
+        [OP_PANIC] = &&op_OP_PANIC,
+        [OP_NULL_COALESCE] = &&op_OP_NULL_COALESCE,
+        [OP_OR] = &&op_OP_OR,
+        [OP_MULTI_CASE] = &&op_OP_MULTI_CASE,
+        [OP_CMP_JMP] = &&op_OP_CMP_JMP,
+        [OP_CMP_JMP_FALL] = &&op_OP_CMP_JMP_FALL,
+        [OP_ENUM] = &&op_OP_ENUM,
+        [OP_ENUM_SET_VALUE] = &&op_OP_ENUM_SET_VALUE,
+        [OP_USE] = &&op_OP_USE,
+        [OP_USE_VAR] = &&op_OP_USE_VAR,
+        [OP_USE_VAR_FROM] = &&op_OP_USE_VAR_FROM,
+        [OP_USE_BUILTIN] = &&op_OP_USE_BUILTIN,
+        [OP_USE_BUILTIN_VAR] = &&op_OP_USE_BUILTIN_VAR,
+        [OP_USE_END] = &&op_OP_USE_END,
+        [OP_BREAK] = &&op_OP_BREAK,
+        [OP_NEW_ARRAY] = &&op_OP_NEW_ARRAY,
+        [OP_EMPTY] = &&op_OP_EMPTY,
+        [OP_SLICE] = &&op_OP_SLICE,
+        [OP_INDEX] = &&op_OP_INDEX,
+        [OP_INDEX_ASSIGN] = &&op_OP_INDEX_ASSIGN,
+        [OP_INDEX_PUSH] = &&op_OP_INDEX_PUSH,
+        [OP_OPEN_FILE] = &&op_OP_OPEN_FILE,
+        [OP_CLOSE_FILE] = &&op_OP_CLOSE_FILE,
+        [OP_GET_SCRIPT] = &&op_OP_GET_SCRIPT,
+        [OP_SET_SCRIPT] = &&op_OP_SET_SCRIPT,
+        [OP_DEFINE_SCRIPT] = &&op_OP_DEFINE_SCRIPT,
+        [OP_NEW_MAP] = &&op_OP_NEW_MAP,
+        [OP_NEW_SET] = &&op_OP_NEW_SET,
+        [OP_DEFINE_DEFAULT] = &&op_OP_DEFINE_DEFAULT,
+        [OP_YIELD] = &&op_OP_YIELD,
+        [OP_RESUME] = &&op_OP_RESUME,
+        [OP_INC_LOCAL] = &&op_OP_INC_LOCAL,
+        [OP_DEC_LOCAL] = &&op_OP_DEC_LOCAL,
+        [OP_ADD_LOCAL_CONST] = &&op_OP_ADD_LOCAL_CONST,
+        [OP_SUB_LOCAL_CONST] = &&op_OP_SUB_LOCAL_CONST,
+        [OP_LT_LOCALS_JMP] = &&op_OP_LT_LOCALS_JMP,
+        [OP_LTEQ_LOCALS_JMP] = &&op_OP_LTEQ_LOCALS_JMP,
+        [OP_GR_LOCALS_JMP] = &&op_OP_GR_LOCALS_JMP,
+        [OP_GREQ_LOCALS_JMP] = &&op_OP_GREQ_LOCALS_JMP,
+        [OP_LT_LOCAL_CONST_JMP] = &&op_OP_LT_LOCAL_CONST_JMP,
+        [OP_LTEQ_LOCAL_CONST_JMP] = &&op_OP_LTEQ_LOCAL_CONST_JMP,
+        [OP_GR_LOCAL_CONST_JMP] = &&op_OP_GR_LOCAL_CONST_JMP,
+        [OP_GREQ_LOCAL_CONST_JMP] = &&op_OP_GREQ_LOCAL_CONST_JMP,
+        [OP_ADD_NUM] = &&op_OP_ADD_NUM,
+        [OP_EQ_NUM] = &&op_OP_EQ_NUM,
+        [OP_NOTEQ_NUM] = &&op_OP_NOTEQ_NUM,
+        [OP_INDEX_ARRAY] = &&op_OP_INDEX_ARRAY,
+    };
+
+#   define CASE(op) op_##op
+#   define DISPATCH() do { TRACE_INSTRUCTION(); goto *dispatchTable[READ_BYTE()]; } while (false)
+#else
+#   define CASE(op) case op
+#   define DISPATCH() goto loop
+#endif
+
+    for (;;) {
+#ifdef ILEX_COMPUTED_GOTO
+        DISPATCH();
+        {
+#else
+    loop:
+        TRACE_INSTRUCTION();
         switch (READ_BYTE()) {
-            case OP_CONSTANT: {
+#endif
+            CASE(OP_CONSTANT): {
                 Value constant = READ_CONSTANT();
-                push(vm, constant);
-            } break;
-            case OP_NULL:  push(vm, NULL_VAL); break;
-            case OP_EMPTY: push(vm, ERROR_VAL); break; // Does nothing.
-            case OP_TRUE:  push(vm, BOOL_VAL(true)); break;
-            case OP_FALSE: push(vm, BOOL_VAL(false)); break;
-            case OP_POP: pop(vm); break;
-            case OP_GET_LOCAL: {
+                PUSH(constant);
+            } DISPATCH();
+            CASE(OP_NULL):  PUSH(NULL_VAL); DISPATCH();
+            CASE(OP_EMPTY): PUSH(ERROR_VAL); DISPATCH(); // Does nothing.
+            CASE(OP_TRUE):  PUSH(BOOL_VAL(true)); DISPATCH();
+            CASE(OP_FALSE): PUSH(BOOL_VAL(false)); DISPATCH();
+            CASE(OP_POP): DROP(); DISPATCH();
+            CASE(OP_GET_LOCAL): {
                 uint16_t slot = READ_SHORT();
-                push(vm, frame->slots[slot]);
-            } break;
-            case OP_GET_GLOBAL: {
-                ObjString *name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm->globals, name, &value)) {
-                    frame->ip = ip;
-                    runtimeError(vm, "GET_GLOBAL: Undefined variable '%s'.", name->str);
-
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(vm, value);
-            } break;
-            case OP_GET_SCRIPT: {
-                ObjString *name = READ_STRING();
-                Value value;
-                if (!tableGet(&frame->closure->function->script->values, name, &value)) {
-                    frame->ip = ip;
-                    runtimeError(vm, "GET_SCRIPT: Undefined variable '%s'.", name->str);
+                PUSH(slots[slot]);
+            } DISPATCH();
+            CASE(OP_GET_GLOBAL): {
+                uint16_t slot = READ_SHORT();
+                PUSH(vm->globalValues.values[slot]);
+            } DISPATCH();
+            CASE(OP_GET_SCRIPT): {
+                uint16_t slot = READ_SHORT();
+                const ObjScript *script = frame->closure->function->script;
+                Value value = script->variableValues.values[slot];
+                if (IS_UNDEFINED(value)) {
+                    STORE_FRAME();
+                    runtimeError(vm, "GET_SCRIPT: Undefined variable '%s'.", scriptVariableName(script, slot)->str);
     
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(vm, value);
-            } break;
-            case OP_GET_UPVALUE: {
+                PUSH(value);
+            } DISPATCH();
+            CASE(OP_GET_UPVALUE): {
                 uint16_t slot = READ_SHORT();
-                push(vm, *frame->closure->upvalues[slot]->location);
-            } break;
-            case OP_GET_PROPERTY: {
-                Value receiver = peek(vm, 0);
+                PUSH(*frame->closure->upvalues[slot]->location);
+            } DISPATCH();
+            CASE(OP_GET_PROPERTY): {
+                InlineCache *cache = READ_CACHE();
+                Value receiver = PEEK(0);
                 if (!IS_OBJ(receiver)) {
                     char *type = valueType(receiver);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Type '%s' has no properties.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
@@ -842,23 +1497,39 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         ObjInstance *instance = AS_INSTANCE(receiver);
                         ObjString *name = READ_STRING();
 
-                        Value value;
-                        if (tableGet(&instance->fields, name, &value)) {
-                            pop(vm); // Instance.
-                            push(vm, value);
+                        int slot = cachedSlot(cache, instance);
+                        if (slot != -1) {
+                            sp[-1] = instance->fields[slot];
+                            break;
+                        }
+                        if (cachedMethod(cache, instance)) {
+                            STORE_SP();
+                            ObjBoundMethod *bound = newBoundMethod(vm, receiver, AS_CLOSURE(cache->method));
+                            sp[-1] = OBJ_VAL(bound);
                             break;
                         }
-                        if (tableGet(&instance->privateFields, name, &value)) {
-                            frame->ip = ip;
+
+                        slot = shapeGetSlot(&instance->shape->fields, name);
+                        if (slot != -1) {
+                            fillCache(vm, frame->closure->function, cache, instance, slot, NULL_VAL);
+                            DROP(); // Instance.
+                            PUSH(instance->fields[slot]);
+                            break;
+                        }
+
+                        if (shapeGetSlot(&instance->shape->privateFields, name) != -1) {
+                            STORE_FRAME();
                             runtimeError(vm, "Can't access private property '%s' on '%s' instance.", name->str, instance->objClass->name->str);
                             return INTERPRET_RUNTIME_ERROR;
                         }
                         
+                        STORE_SP();
                         if (bindMethod(vm, instance->objClass, name)) {
+                            fillCache(vm, frame->closure->function, cache, instance, -1, OBJ_VAL(AS_BOUND_METHOD(PEEK(0))->method));
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "'%s' instance does not have property: '%s'.", instance->objClass->name->str, name->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -868,12 +1539,12 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         Value value;
 
                         if (tableGet(&enumObj->values, name, &value)) {
-                            pop(vm); // Enum.
-                            push(vm, value);
+                            DROP(); // Enum.
+                            PUSH(value);
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "'%s' enum does not have property: '%s'.", enumObj->name->str, name->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -881,13 +1552,13 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         ObjScript *script  = AS_SCRIPT(receiver);
                         ObjString *name = READ_STRING();
                         Value value;
-                        if (tableGet(&script->values, name, &value)) {
-                            pop(vm); // Script.
-                            push(vm, value);
+                        if (scriptGet(script, name, &value)) {
+                            DROP(); // Script.
+                            PUSH(value);
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "'%s' does not have property: '%s'.", script->name->str, name->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -900,15 +1571,15 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         Value value;
                         while (objClass != NULL) {
                             if (tableGet(&objClass->staticConsts, name, &value)) {
-                                pop(vm); // Class.
-                                push(vm, value);
+                                DROP(); // Class.
+                                PUSH(value);
                                 found = true;
                                 break;
                             }
                             
                             if (tableGet(&objClass->staticVars, name, &value)) {
-                                pop(vm);
-                                push(vm, value);
+                                DROP();
+                                PUSH(value);
                                 found = true;
                                 break;
                             }
@@ -917,7 +1588,7 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         }
     
                         if (!found) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "'%s' does not have property '%s'.", checkingClass->name->str, name->str);
                             return INTERPRET_RUNTIME_ERROR;
                         }
@@ -926,211 +1597,227 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         ObjMap *map = AS_MAP(receiver);
                         Value name = READ_CONSTANT();
 
-                        pop(vm); // map
+                        DROP(); // map
 
                         Value v;
                         if (mapGet(map, name, &v)) {
-                            push(vm, v);
+                            PUSH(v);
                         } else {
                             ObjString *str = AS_STRING(name);
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Map does not have property '%s'.", str->str);
                             return INTERPRET_RUNTIME_ERROR;
                         }
                     } break;
                     default: {
                         char *type = valueType(receiver);
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Type '%s' has no properties.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                 }
-            } break;
-            case OP_GET_PROPERTY_NO_POP: {
-                if (!IS_INSTANCE(peek(vm, 0))) {
-                    frame->ip = ip;
+            } DISPATCH();
+            CASE(OP_GET_PROPERTY_NO_POP): {
+                if (!IS_INSTANCE(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
     
-                ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
+                ObjInstance *instance = AS_INSTANCE(PEEK(0));
                 ObjString *name = READ_STRING();
-                Value value;
     
-                if (tableGet(&instance->fields, name, &value)) {
-                    push(vm, value);
-                    break;
+                const int slot = shapeGetSlot(&instance->shape->fields, name);
+                if (slot != -1) {
+                    PUSH(instance->fields[slot]);
+                    DISPATCH();
                 }
     
+                STORE_SP();
                 if (bindMethod(vm, instance->objClass, name)) {
-                    break;
+                    DISPATCH();
                 }
 
-                if (tableGet(&instance->privateFields, name, &value)) {
-                    frame->ip = ip;
+                if (shapeGetSlot(&instance->shape->privateFields, name) != -1) {
+                    STORE_FRAME();
                     runtimeError(vm, "Can't access private property '%s' on '%s' instance.", name->str, instance->objClass->name->str);
                     return INTERPRET_RUNTIME_ERROR;
                 }
     
-                frame->ip = ip;
+                STORE_FRAME();
                 runtimeError(vm, "'%s' instance does not have property: '%s'.", instance->objClass->name->str, name->str);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_GET_PRIVATE_PROPERTY: {
-                if (!IS_INSTANCE(peek(vm, 0))) {
-                    frame->ip = ip;
+            CASE(OP_GET_PRIVATE_PROPERTY): {
+                if (!IS_INSTANCE(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
+                ObjInstance *instance = AS_INSTANCE(PEEK(0));
                 ObjString *name = READ_STRING();
-                Value value;
 
-                if (tableGet(&instance->privateFields, name, &value)) {
-                    pop(vm); // Instance.
-                    push(vm, value);
-                    break;
+                int slot = shapeGetSlot(&instance->shape->privateFields, name);
+                if (slot == -1) {
+                    slot = shapeGetSlot(&instance->shape->fields, name);
                 }
-
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop(vm); // Instance.
-                    push(vm, value);
-                    break;
+                if (slot != -1) {
+                    DROP(); // Instance.
+                    PUSH(instance->fields[slot]);
+                    DISPATCH();
                 }
 
+                STORE_SP();
                 if (bindMethod(vm, instance->objClass, name)) {
-                    break;
+                    DISPATCH();
                 }
     
-                frame->ip = ip;
+                STORE_FRAME();
                 runtimeError(vm, "'%s' instance does not have property: '%s'.", instance->objClass->name->str, name->str);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_GET_PRIVATE_PROPERTY_NO_POP: {
-                if (!IS_INSTANCE(peek(vm, 0))) {
-                    frame->ip = ip;
+            CASE(OP_GET_PRIVATE_PROPERTY_NO_POP): {
+                if (!IS_INSTANCE(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
+                ObjInstance *instance = AS_INSTANCE(PEEK(0));
                 ObjString *name = READ_STRING();
-                Value value;
 
-                if (tableGet(&instance->privateFields, name, &value)) {
-                    push(vm, value);
-                    break;
+                int slot = shapeGetSlot(&instance->shape->privateFields, name);
+                if (slot == -1) {
+                    slot = shapeGetSlot(&instance->shape->fields, name);
                 }
-
-                if (tableGet(&instance->fields, name, &value)) {
-                    push(vm, value);
-                    break;
+                if (slot != -1) {
+                    PUSH(instance->fields[slot]);
+                    DISPATCH();
                 }
 
+                STORE_SP();
                 if (bindMethod(vm, instance->objClass, name)) {
-                    break;
+                    DISPATCH();
                 }
     
-                frame->ip = ip;
+                STORE_FRAME();
                 runtimeError(vm, "'%s' instance does not have property: '%s'.", instance->objClass->name->str, name->str);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_GET_SUPER: {
+            CASE(OP_GET_SUPER): {
                 ObjString *name = READ_STRING();
-                ObjClass *superclass = AS_CLASS(pop(vm));
+                ObjClass *superclass = AS_CLASS(POP());
 
+                STORE_SP();
                 if (!bindMethod(vm, superclass, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-            } break;
-            case OP_DEFINE_GLOBAL: {
-                ObjString *name = READ_STRING();
-                tableSet(vm, &vm->globals, name, peek(vm, 0), ILEX_READ_WRITE);
-                pop(vm);
-            } break;
-            case OP_DEFINE_SCRIPT: {
-                ObjString *name = READ_STRING();
-                tableSet(vm, &frame->closure->function->script->values, name, peek(vm, 0), ILEX_READ_WRITE);
-                pop(vm);
-            } break;
-            case OP_SET_LOCAL: {
+            } DISPATCH();
+            CASE(OP_DEFINE_GLOBAL): {
                 uint16_t slot = READ_SHORT();
-                frame->slots[slot] = peek(vm, 0);
-            } break;
-            case OP_SET_GLOBAL: {
-                ObjString *name = READ_STRING();
-                if (tableSet(vm, &vm->globals, name, peek(vm, 0), ILEX_READ_WRITE)) {
-                    tableDelete(&vm->globals, name);
-                    frame->ip = ip;
-                    runtimeError(vm, "SET_GLOBAL: Undefined variable '%s'.", name->str);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-            } break;
-            case OP_SET_SCRIPT: {
-                ObjString *name = READ_STRING();
-                if (tableSet(vm, &frame->closure->function->script->values, name, peek(vm, 0), ILEX_READ_WRITE)) {
-                    tableDelete(&frame->closure->function->script->values, name);
-                    frame->ip = ip;
-                    runtimeError(vm, "SET_SCRIPT: Undefined variable '%s'.", name->str);
+                vm->globalValues.values[slot] = POP();
+            } DISPATCH();
+            CASE(OP_DEFINE_SCRIPT): {
+                uint16_t slot = READ_SHORT();
+                ObjScript *script = frame->closure->function->script;
+                script->variableValues.values[slot] = POP();
+                writeValueBarrier(vm, (Obj*)script, script->variableValues.values[slot]);
+            } DISPATCH();
+            CASE(OP_SET_LOCAL): {
+                uint16_t slot = READ_SHORT();
+                slots[slot] = PEEK(0);
+            } DISPATCH();
+            CASE(OP_SET_GLOBAL): {
+                uint16_t slot = READ_SHORT();
+                vm->globalValues.values[slot] = PEEK(0);
+            } DISPATCH();
+            CASE(OP_SET_SCRIPT): {
+                uint16_t slot = READ_SHORT();
+                ObjScript *script = frame->closure->function->script;
+                if (IS_UNDEFINED(script->variableValues.values[slot])) {
+                    STORE_FRAME();
+                    runtimeError(vm, "SET_SCRIPT: Undefined variable '%s'.", scriptVariableName(script, slot)->str);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-            } break;
-            case OP_SET_UPVALUE: {
+                script->variableValues.values[slot] = PEEK(0);
+                writeValueBarrier(vm, (Obj*)script, PEEK(0));
+            } DISPATCH();
+            CASE(OP_SET_UPVALUE): {
                 uint16_t slot = READ_SHORT();
-                *frame->closure->upvalues[slot]->location = peek(vm, 0);
-            } break;
-            case OP_SET_PROPERTY: {
-                if (IS_SCRIPT(peek(vm, 1))) {
-                    ObjScript *script = AS_SCRIPT(peek(vm, 1));
+                ObjUpvalue *upvalue = frame->closure->upvalues[slot];
+                *upvalue->location = PEEK(0);
+                writeValueBarrier(vm, (Obj*)upvalue, PEEK(0));
+            } DISPATCH();
+            CASE(OP_SET_PROPERTY): {
+                InlineCache *cache = READ_CACHE();
+                if (IS_SCRIPT(PEEK(1))) {
+                    ObjScript *script = AS_SCRIPT(PEEK(1));
                     ObjString *name = READ_STRING();
                     Value unused;
                     
                     if (tableGet(&vm->consts, name, &unused)) {
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Cannot assign to const variable '%s'.", name->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                     
-                    tableSet(vm, &script->values, name, peek(vm, 0), ILEX_READ_WRITE);
-                    Value value = pop(vm);
-                    pop(vm); // Script.
-                    push(vm, value);
-                } else if (IS_INSTANCE(peek(vm, 1))) {
-                    ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
+                    STORE_SP();
+                    scriptSet(vm, script, name, PEEK(0));
+                    Value value = POP();
+                    DROP(); // Script.
+                    PUSH(value);
+                } else if (IS_INSTANCE(PEEK(1))) {
+                    ObjInstance *instance = AS_INSTANCE(PEEK(1));
                     ObjString *var = READ_STRING();
-                    
-                    // TODO: Move these checks to the compiler. Have an instance map.
-                    Value unused;
-                    if (tableGet(&instance->privateFields, var, &unused)) {
-                        frame->ip = ip;
-                        runtimeError(vm, "Cannot assign to private variable '%s'.", var->str);
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
 
-                    if (!tableGet(&instance->fields, var, &unused)) {
-                        frame->ip = ip;
-                        runtimeError(vm, "Instance of '%s' contains no variable '%s'.", instance->objClass->name->str, var->str);
-                        return INTERPRET_RUNTIME_ERROR;
+                    int slot = cachedSlot(cache, instance);
+                    if (slot == -1) {
+                        // TODO: Move these checks to the compiler. Have an instance map.
+                        if (shapeGetSlot(&instance->shape->privateFields, var) != -1) {
+                            STORE_FRAME();
+                            runtimeError(vm, "Cannot assign to private variable '%s'.", var->str);
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+
+                        const int index = tableGetIndex(&instance->shape->fields, var);
+                        if (index == -1) {
+                            STORE_FRAME();
+                            runtimeError(vm, "Instance of '%s' contains no variable '%s'.", instance->objClass->name->str, var->str);
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+
+                        // Read only fields are shared by every instance with the shape, so they stay read only.
+                        const Entry *entry = &instance->shape->fields.entries[index];
+                        if (entry->readOnly) {
+                            STORE_FRAME();
+                            runtimeError(vm, "%s is marked as readonly.", var->str);
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+
+                        slot = TO_INT(entry->value);
+                        fillCache(vm, frame->closure->function, cache, instance, slot, NULL_VAL);
                     }
+
+                    instance->fields[slot] = PEEK(0);
+                    writeValueBarrier(vm, (Obj*)instance, PEEK(0));
                     
-                    tableSet(vm, &instance->fields, var, peek(vm, 0), ILEX_READ_WRITE);
-                    Value value = pop(vm);
-                    pop(vm); // Instance.
-                    push(vm, value);
-                } else if (IS_CLASS(peek(vm, 1))) {
-                    ObjClass *objClass = AS_CLASS(peek(vm, 1));
+                    Value value = POP();
+                    DROP(); // Instance.
+                    PUSH(value);
+                } else if (IS_CLASS(PEEK(1))) {
+                    ObjClass *objClass = AS_CLASS(PEEK(1));
                     ObjString *var = READ_STRING();
                     
                     // TODO: Move these check to the compiler.
                     Value unused;
                     if (tableGet(&objClass->staticConsts, var, &unused)) {
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Cannot assign to a class constant '%s'.", var->str);
                         return INTERPRET_RUNTIME_ERROR;
                     } /*else if (!tableGet(&objClass->fields, var, &unused)) {
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Class '%s' contains no static variable '%s'.", objClass->name->str, var->str);
                         return INTERPRET_RUNTIME_ERROR;
                     } */
@@ -1138,313 +1825,393 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                     // If it is static set that.
                     // TODO: Have the compiler generate OP_SET_CLASS_STATIC_VAR for Class.staticVar = thing
                     
+                    STORE_SP();
                     if (tableGet(&objClass->staticVars, var, &unused)) {
-                        tableSet(vm, &objClass->staticVars, var, peek(vm, 0), ILEX_READ_WRITE);
+                        tableSet(vm, &objClass->staticVars, var, PEEK(0), ILEX_READ_WRITE);
                     } else {
-                        tableSet(vm, &objClass->fields, var, peek(vm, 0), ILEX_READ_WRITE);
+                        tableSet(vm, &objClass->fields, var, PEEK(0), ILEX_READ_WRITE);
+                        objClass->rootShape = NULL;
                     }
-                    pop(vm); // Value.
-                    // pop(vm); // Class.
-                } else if (IS_MAP(peek(vm, 1))) {
-                    ObjMap *map = AS_MAP(peek(vm, 1));
+                    DROP(); // Value.
+                    // POP(); // Class.
+                } else if (IS_MAP(PEEK(1))) {
+                    ObjMap *map = AS_MAP(PEEK(1));
                     Value key = READ_CONSTANT();
 
                     Value unused;
                     if (!mapGet(map, key, &unused)) {
                         ObjString *str = AS_STRING(key);
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Key '%s' not found, cannot add keys to map via the dot operator.", str->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
-                    mapSet(vm, map, key, peek(vm, 0));
+                    FLATTEN(PEEK(0));
+                    STORE_SP();
+                    mapSet(vm, map, key, PEEK(0));
 
-                    pop(vm); // map
+                    DROP(); // map
                 } else {
-                    char *type = valueType(peek(vm, 1));
-                    frame->ip = ip;
+                    char *type = valueType(PEEK(1));
+                    STORE_FRAME();
                     runtimeError(vm, "Can't set property on type '%s'.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-            } break;
-            case OP_SET_PRIVATE_PROPERTY: {
-                if (IS_INSTANCE(peek(vm, 1))) {
-                    ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
-                    tableSet(vm, &instance->privateFields, READ_STRING(), peek(vm, 0), ILEX_READ_WRITE);
-                    pop(vm);
-                    pop(vm);
-                    push(vm, NULL_VAL);
-                } else if (IS_CLASS(peek(vm, 1))) {
-                    ObjClass *objClass = AS_CLASS(peek(vm, 1));
-                    tableSet(vm, &objClass->privateFields, READ_STRING(), peek(vm, 0), ILEX_READ_WRITE);
-                    pop(vm); // Value.
-//                    pop(vm); // Class.
-                }
-            } break;
-            case OP_SET_CLASS_STATIC_VAR: {
-                ObjClass *objClass = AS_CLASS(peek(vm, 1));
+            } DISPATCH();
+            CASE(OP_SET_PRIVATE_PROPERTY): {
+                if (IS_INSTANCE(PEEK(1))) {
+                    ObjInstance *instance = AS_INSTANCE(PEEK(1));
+                    ObjString *name = READ_STRING();
+
+                    const int slot = shapeGetSlot(&instance->shape->privateFields, name);
+                    if (slot != -1) {
+                        instance->fields[slot] = PEEK(0);
+                        writeValueBarrier(vm, (Obj*)instance, PEEK(0));
+                    } else {
+                        STORE_SP();
+                        instanceAddPrivateField(vm, instance, name, PEEK(0));
+                    }
+                    DROP();
+                    DROP();
+                    PUSH(NULL_VAL);
+                } else if (IS_CLASS(PEEK(1))) {
+                    ObjClass *objClass = AS_CLASS(PEEK(1));
+                    STORE_SP();
+                    tableSet(vm, &objClass->privateFields, READ_STRING(), PEEK(0), ILEX_READ_WRITE);
+                    objClass->rootShape = NULL;
+                    DROP(); // Value.
+//                    POP(); // Class.
+                }
+            } DISPATCH();
+            CASE(OP_SET_CLASS_STATIC_VAR): {
+                ObjClass *objClass = AS_CLASS(PEEK(1));
                 ObjString *key = READ_STRING();
                 bool isConst = READ_BYTE();
 
+                STORE_SP();
                 if (isConst) {
-                    tableSet(vm, &objClass->staticConsts, key, peek(vm, 0), ILEX_READ_ONLY);
+                    tableSet(vm, &objClass->staticConsts, key, PEEK(0), ILEX_READ_ONLY);
                 } else {
-                    tableSet(vm, &objClass->staticVars, key, peek(vm, 0), ILEX_READ_WRITE);
-                }
-
-                pop(vm);
-            } break;
-            case OP_EQ: {
-                Value a = pop(vm);
-                Value b = pop(vm);
-                push(vm, BOOL_VAL(valuesEqual(a, b)));
-            } break;
-            case OP_NOTEQ: {
-                Value a = pop(vm);
-                Value b = pop(vm);
-                push(vm, BOOL_VAL(!valuesEqual(a, b)));
-            } break;
-            case OP_GR: BINARY_OP(BOOL_VAL, >, ">", double); break;
-            case OP_GREQ: BINARY_OP(BOOL_VAL, >=, ">=", double); break;
-            case OP_LT: BINARY_OP(BOOL_VAL, <, "<", double); break;
-            case OP_LTEQ: BINARY_OP(BOOL_VAL, <=, "<=", double); break;
-            case OP_ADD: {
-                if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
-                    double b = AS_NUMBER(pop(vm));
-                    double a = AS_NUMBER(pop(vm));
-                    push(vm, NUMBER_VAL(a + b));
-                } else if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    tableSet(vm, &objClass->staticVars, key, PEEK(0), ILEX_READ_WRITE);
+                }
+
+                DROP();
+            } DISPATCH();
+            CASE(OP_EQ): {
+                if (NUMBERS(PEEK(1), PEEK(0))) {
+                    QUICKEN(OP_EQ_NUM);
+                }
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                Value a = POP();
+                Value b = POP();
+                PUSH(BOOL_VAL(valuesEqual(a, b)));
+            } DISPATCH();
+            CASE(OP_EQ_NUM): {
+                if (!NUMBERS(PEEK(1), PEEK(0))) {
+                    DEOPTIMIZE(OP_EQ);
+                }
+                Value b = POP();
+                sp[-1] = BOOL_VAL(sp[-1] == b);
+            } DISPATCH();
+            CASE(OP_NOTEQ): {
+                if (NUMBERS(PEEK(1), PEEK(0))) {
+                    QUICKEN(OP_NOTEQ_NUM);
+                }
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                Value a = POP();
+                Value b = POP();
+                PUSH(BOOL_VAL(!valuesEqual(a, b)));
+            } DISPATCH();
+            CASE(OP_NOTEQ_NUM): {
+                if (!NUMBERS(PEEK(1), PEEK(0))) {
+                    DEOPTIMIZE(OP_NOTEQ);
+                }
+                Value b = POP();
+                sp[-1] = BOOL_VAL(sp[-1] != b);
+            } DISPATCH();
+            CASE(OP_GR): INT_BINARY_OP(BOOL_VAL, >, ">", double); DISPATCH();
+            CASE(OP_GREQ): INT_BINARY_OP(BOOL_VAL, >=, ">=", double); DISPATCH();
+            CASE(OP_LT): INT_BINARY_OP(BOOL_VAL, <, "<", double); DISPATCH();
+            CASE(OP_LTEQ): INT_BINARY_OP(BOOL_VAL, <=, "<=", double); DISPATCH();
+            CASE(OP_ADD): {
+                if (NUMBERS(PEEK(1), PEEK(0))) {
+                    QUICKEN(OP_ADD_NUM);
+                    Value b = POP();
+                    sp[-1] = addNumbers(sp[-1], b);
+                } else if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+                    STORE_SP();
                     concat(vm);
+                    LOAD_SP();
                 } else {
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-            } break;
-            case OP_CONCAT: {
-                if (!IS_STRING(peek(vm, 0)) || !IS_STRING(peek(vm, 1))) {
-                    frame->ip = ip;
+            } DISPATCH();
+            CASE(OP_ADD_NUM): {
+                if (!NUMBERS(PEEK(1), PEEK(0))) {
+                    DEOPTIMIZE(OP_ADD);
+                }
+                Value b = POP();
+                sp[-1] = addNumbers(sp[-1], b);
+            } DISPATCH();
+            CASE(OP_CONCAT): {
+                if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Concat operands must be two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                STORE_SP();
                 concat(vm);
-            } break;
-            case OP_INC: {
-                if (!IS_NUMBER(peek(vm, 0))) {
-                    frame->ip = ip;
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_INC): {
+                if (!NUMBER(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
-                push(vm, NUMBER_VAL(AS_NUMBER(pop(vm)) + 1));
-            } break;
-            case OP_SUB: BINARY_OP(NUMBER_VAL, -, "-", double); break;
-            case OP_DEC: {
-                if (!IS_NUMBER(peek(vm, 0))) {
-                    frame->ip = ip;
+                sp[-1] = addNumbers(sp[-1], INT_VAL(1));
+            } DISPATCH();
+            CASE(OP_SUB): NUMBER_OP(subtractNumbers, -, "-"); DISPATCH();
+            CASE(OP_DEC): {
+                if (!NUMBER(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
         
-                push(vm, NUMBER_VAL(AS_NUMBER(pop(vm)) - 1));
-            } break;
-            case OP_MUL: BINARY_OP(NUMBER_VAL, *, "*", double); break;
-            case OP_DIV: BINARY_OP(NUMBER_VAL, /, "/", double); break;
-            case OP_POW: {
-                if (!IS_NUMBER(peek(vm, 0) || !IS_NUMBER(peek(vm, 1)))) {
-                    frame->ip = ip;
+                sp[-1] = subtractNumbers(sp[-1], INT_VAL(1));
+            } DISPATCH();
+            CASE(OP_MUL): NUMBER_OP(multiplyNumbers, *, "*"); DISPATCH();
+            CASE(OP_DIV): BINARY_OP(NUMBER_VAL, /, "/", double); DISPATCH();
+            CASE(OP_POW): {
+                if (!IS_NUMBER(PEEK(0) || !IS_NUMBER(PEEK(1)))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Operands must be two numbers.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                double b = AS_NUMBER(pop(vm));
-                double a = AS_NUMBER(pop(vm));
-                push(vm, NUMBER_VAL(powf(a, b)));
-            } break;
-            case OP_MOD: {
-                if (!IS_NUMBER(peek(vm, 0) || !IS_NUMBER(peek(vm, 1)))) {
-                    frame->ip = ip;
+                double b = AS_NUMBER(POP());
+                double a = AS_NUMBER(POP());
+                PUSH(NUMBER_VAL(powf(a, b)));
+            } DISPATCH();
+            CASE(OP_MOD): {
+                if (!IS_NUMBER(PEEK(0) || !IS_NUMBER(PEEK(1)))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Operands must be two numbers.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                double b = AS_NUMBER(pop(vm));
-                double a = AS_NUMBER(pop(vm));
-                push(vm, NUMBER_VAL(fmod(a, b)));
-            } break;
-            case OP_BIT_AND: BINARY_OP(NUMBER_VAL, &, "&",  int); break;
-            case OP_BIT_OR:  BINARY_OP(NUMBER_VAL, |, "|",  int); break;
-            case OP_BIT_XOR: BINARY_OP(NUMBER_VAL, ^, "^",  int); break;
-            case OP_BIT_LS:  BINARY_OP(NUMBER_VAL, <<, "<<", int); break;
-            case OP_BIT_RS:  BINARY_OP(NUMBER_VAL, >>, ">>", int); break;
-            case OP_NULL_COALESCE: {
-                if (IS_NULL(peek(vm, 1))) {
-                    Value rhs = pop(vm); // rhs
-                    pop(vm); // lhs
-                    push(vm, rhs);
+                Value b = POP();
+                sp[-1] = moduloNumbers(sp[-1], b);
+            } DISPATCH();
+            CASE(OP_BIT_AND): INT_BINARY_OP(INT_VAL, &, "&",  int); DISPATCH();
+            CASE(OP_BIT_OR):  INT_BINARY_OP(INT_VAL, |, "|",  int); DISPATCH();
+            CASE(OP_BIT_XOR): INT_BINARY_OP(INT_VAL, ^, "^",  int); DISPATCH();
+            CASE(OP_BIT_LS):  INT_BINARY_OP(INT_VAL, <<, "<<", int); DISPATCH();
+            CASE(OP_BIT_RS):  INT_BINARY_OP(INT_VAL, >>, ">>", int); DISPATCH();
+            CASE(OP_NULL_COALESCE): {
+                if (IS_NULL(PEEK(1))) {
+                    Value rhs = POP(); // rhs
+                    DROP(); // lhs
+                    PUSH(rhs);
                 } else {
-                    pop(vm); // rhs
-                    push(vm, pop(vm)); // lhs
-                }
-            } break;
-            case OP_OR: {
-                if (isFalsy(peek(vm, 1))) {
-                    Value rhs = pop(vm); // rhs
-                    pop(vm); // lhs
-                    push(vm, rhs);
+                    DROP(); // rhs, lhs stays.
+                }
+            } DISPATCH();
+            CASE(OP_OR): {
+                if (isFalsy(PEEK(1))) {
+                    Value rhs = POP(); // rhs
+                    DROP(); // lhs
+                    PUSH(rhs);
                 } else {
-                    pop(vm); // rhs
-                    push(vm, pop(vm)); // lhs
-                }
-            } break;
-            case OP_NOT: push(vm, BOOL_VAL(isFalsy(pop(vm)))); break;
-            case OP_BIT_NOT: {
-                if (!IS_NUMBER(peek(vm, 0))) {
-                    frame->ip = ip;
+                    DROP(); // rhs, lhs stays.
+                }
+            } DISPATCH();
+            CASE(OP_NOT): sp[-1] = BOOL_VAL(isFalsy(sp[-1])); DISPATCH();
+            CASE(OP_BIT_NOT): {
+                if (!IS_NUMBER(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(vm, NUMBER_VAL(~(int)AS_NUMBER(pop(vm))));
-            } break;
-            case OP_NEG: {
-                if (!IS_NUMBER(peek(vm, 0))) {
-                    frame->ip = ip;
+                sp[-1] = INT_VAL(~TO_INT(sp[-1]));
+            } DISPATCH();
+            CASE(OP_NEG): {
+                if (!IS_NUMBER(PEEK(0))) {
+                    STORE_FRAME();
                     runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-            } break;
-            case OP_JUMP: {
+                sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+            } DISPATCH();
+            CASE(OP_JUMP): {
                 uint16_t offset = READ_SHORT();
                 ip += offset;
-            } break;
-            case OP_JUMP_IF_FALSE: {
+            } DISPATCH();
+            CASE(OP_JUMP_IF_FALSE): {
                 uint16_t offset = READ_SHORT();
-                if (isFalsy(peek(vm, 0))) {
+                if (isFalsy(PEEK(0))) {
                     ip += offset;
                 }
-            } break;
-            case OP_JUMP_IF_TRUE: {
+            } DISPATCH();
+            CASE(OP_JUMP_IF_TRUE): {
                 uint16_t offset = READ_SHORT();
-                if (!isFalsy(peek(vm, 0))) {
+                if (!isFalsy(PEEK(0))) {
                     ip += offset;
                 }
-            } break;
-            case OP_JUMP_DO_WHILE: {
+            } DISPATCH();
+            CASE(OP_JUMP_DO_WHILE): {
                 uint16_t offset = READ_SHORT();
-                if (!isFalsy(peek(vm, 0))) {
+                if (!isFalsy(PEEK(0))) {
                     ip -= offset;
                 }
-            } break;
-            case OP_LOOP: {
+            } DISPATCH();
+            CASE(OP_LOOP): {
                 uint16_t offset = READ_SHORT();
                 ip -= offset;
-            } break;
-            case OP_CALL: {
+                JIT_ENTER(true);
+            } DISPATCH();
+            CASE(OP_CALL): {
                 int argc = READ_BYTE();
-                frame->ip = ip;
-                if (!callValue(vm, peek(vm, argc), argc)) {
+                const int frameCount = vm->frameCount;
+                STORE_FRAME();
+                if (!callValue(vm, PEEK(argc), argc)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                ip = frame->ip;
-            } break;
-            case OP_INVOKE: {
+                LOAD_FRAME();
+                LOAD_SP();
+                // Natives return straight to the caller, only a call that started a frame makes its function hotter.
+                JIT_ENTER(vm->frameCount != frameCount);
+            } DISPATCH();
+            CASE(OP_INVOKE): {
+                InlineCache *cache = READ_CACHE();
                 ObjString *method = READ_STRING();
                 int argc = READ_BYTE();
-                frame->ip = ip;
-                if (!invoke(vm, method, argc)) {
+                STORE_FRAME();
+                if (!invoke(vm, method, argc, cache)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                ip = frame->ip;
-            } break;
-            case OP_INVOKE_SUPER: {
+                LOAD_FRAME();
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_INVOKE_SUPER): {
                 ObjString *method = READ_STRING();
                 int argc = READ_BYTE();
-                frame->ip = ip;
-                ObjClass *superclass = AS_CLASS(pop(vm));
+                ObjClass *superclass = AS_CLASS(POP());
+                STORE_FRAME();
                 if (!invokeFromClass(vm, superclass, method, argc)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                ip = frame->ip;
-            } break;
-            case OP_INVOKE_THIS: {
+                LOAD_FRAME();
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_INVOKE_THIS): {
                 ObjString *method = READ_STRING();
                 int argc = READ_BYTE();
-                frame->ip = ip;
+                STORE_FRAME();
                 if (!invokeFromThis(vm, method, argc)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                ip = frame->ip;
-            } break;
-            case OP_CLOSURE: {
+                LOAD_FRAME();
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_CLOSURE): {
                 ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+                STORE_SP();
                 ObjClosure *closure = newClosure(vm, function);
-                push(vm, OBJ_VAL(closure));
+                PUSH(OBJ_VAL(closure));
+                STORE_SP();
 
                 for (int i = 0; i < closure->upvalueCount; ++i) {
                     uint8_t isLocal = READ_BYTE();
                     uint16_t index = READ_SHORT();
                     if (isLocal) {
-                        closure->upvalues[i] = captureUpvalue(vm, frame->slots + index);
+                        closure->upvalues[i] = captureUpvalue(vm, slots + index);
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
-                }
-            } break;
-            case OP_CLOSE_UPVALUE: {
-                closeUpvalues(vm, vm->stackTop - 1);
-                pop(vm);
-            } break;
-            case OP_RETURN: {
-                Value result = pop(vm);
+                    writeValueBarrier(vm, (Obj*)closure, OBJ_VAL(closure->upvalues[i]));
+                }
+            } DISPATCH();
+            CASE(OP_CLOSE_UPVALUE): {
+                closeUpvalues(vm, sp - 1);
+                DROP();
+            } DISPATCH();
+            CASE(OP_RETURN): {
+                Value result = POP();
                 vm->frameCount--;
-                closeUpvalues(vm, frame->slots);
+                closeUpvalues(vm, slots);
+
+                // A fiber returning from its function is done, whatever resumed it gets the result.
+                if (vm->frameCount == 0 && vm->fiber->caller != NULL) {
+                    ObjFiber *fiber = vm->fiber;
+                    sp = slots;
+                    STORE_SP();
+                    leaveFiber(vm, FIBER_DONE);
+                    freeFiberBuffers(vm, fiber);
+                    if (fiber->resumedByNative) {
+                        *val = result;
+                        return INTERPRET_GOOD;
+                    }
+
+                    LOAD_SP();
+                    PUSH(result);
+                    LOAD_FRAME();
+                    DISPATCH();
+                }
 
                 // If we are at the frameIndex frame that means we are returning from Ilex code called from c.
                 // A frameIndex of -1 indicates that this is running in a normal state.
-                if (vm->frameCount == 0 || (frameIndex != -1 && &vm->frames[vm->frameCount - 1] == &vm->frames[frameIndex])) {
+                if (vm->frameCount == 0 || (frameIndex != -1 && vm->fiber == runFiber && vm->frameCount - 1 == frameIndex)) {
                     if (frameIndex != -1) {
                         *val = result;
-                        // pop(vm); // TODO: Sometimes this pop is needed, sometimes it causes crashes.
-                        // printValueNl(peek(vm, 0));
+                        // POP(); // TODO: Sometimes this pop is needed, sometimes it causes crashes.
+                        // printValueNl(PEEK(0));
+                        STORE_SP();
                         return INTERPRET_GOOD;
                     }
 
-                    pop(vm);
+                    DROP();
+                    STORE_SP();
                     return INTERPRET_GOOD;
                 }
 
-                vm->stackTop = frame->slots;
-                push(vm, result);
-                frame = &vm->frames[vm->frameCount - 1];
-                ip = frame->ip;
-            } break;
-            case OP_CLASS: {
+                sp = slots;
+                PUSH(result);
+                LOAD_FRAME();
+                JIT_ENTER(false);
+            } DISPATCH();
+            CASE(OP_CLASS): {
                 ClassType type = READ_BYTE();
+                STORE_SP();
                 createClass(vm, READ_STRING(), NULL, type);
-            } break;
-            case OP_INHERIT: {
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_INHERIT): {
                 ClassType type = READ_BYTE();
-                Value superClass = peek(vm, 0);
+                Value superClass = PEEK(0);
                 if (!IS_CLASS(superClass)) {
                     char *vt = valueType(superClass);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Superclass must be a class, got a '%s' instead.", vt);
                     free(vt);
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                STORE_SP();
                 createClass(vm, READ_STRING(), AS_CLASS(superClass), type);
-            } break;
+                LOAD_SP();
+            } DISPATCH();
             // TODO: Can this be moved to the compiler?
-            case OP_CHECK_ABSTRACT: {
-                ObjClass *objClass = AS_CLASS(peek(vm, 0));
+            CASE(OP_CHECK_ABSTRACT): {
+                ObjClass *objClass = AS_CLASS(PEEK(0));
 
                 for ( int i = 0; i < objClass->abstractMethods.capacity; ++i) {
                     ObjString *key = objClass->abstractMethods.entries[i].key;
@@ -1454,17 +2221,19 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
 
                     Value unused;
                     if (!tableGet(&objClass->methods, key, &unused)) {
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Class '%s' doesn't implement abstract method '%s'.", objClass->name->str, objClass->abstractMethods.entries[i].key->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                 }
-            } break;
-            case OP_METHOD: {
+            } DISPATCH();
+            CASE(OP_METHOD): {
+                STORE_SP();
                 defineMethod(vm, READ_STRING());
-            }break;
-            case OP_ASSERT: {
-                Value condition = pop(vm);
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_ASSERT): {
+                Value condition = POP();
                 ObjString *error = READ_STRING();
 
                 if (isFalsy(condition)) {
@@ -1476,147 +2245,168 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                     
                     return INTERPRET_ASSERT_ERROR;
                 }
-            } break;
-            case OP_TYPEOF: {
-                Value value = pop(vm);
+            } DISPATCH();
+            CASE(OP_TYPEOF): {
+                Value value = POP();
                 char* type = valueType(value);
+                STORE_SP();
                 ObjString *typeStr = takeString(vm, type, (int)strlen(type));
-                push(vm, OBJ_VAL(typeStr));
-            } break;
-            case OP_PANIC: {
+                PUSH(OBJ_VAL(typeStr));
+            } DISPATCH();
+            CASE(OP_PANIC): {
                 ObjString *error = READ_STRING();
                 panicError(vm, error->str);
                 return INTERPRET_PANIC_ERROR;
-            } break;
-            case OP_MULTI_CASE: {
+            } DISPATCH();
+            CASE(OP_MULTI_CASE): {
                 int count = READ_BYTE();
-                Value switchValue = peek(vm, count + 1);
-                Value caseValue = pop(vm);
+                for (int i = 0; i <= count + 1; ++i) {
+                    FLATTEN(PEEK(i));
+                }
+                Value switchValue = PEEK(count + 1);
+                Value caseValue = POP();
                 for (int i = 0; i < count; ++i) {
                     if (valuesEqual(switchValue, caseValue)) {
                         i++;
                         while(i <= count) {
-                            pop(vm);
+                            DROP();
                             i++;
                         } break;
                     }
-                    caseValue = pop(vm);
+                    caseValue = POP();
                 }
-                push(vm,caseValue);
-            } break;
-            case OP_CMP_JMP: {
+                PUSH(caseValue);
+            } DISPATCH();
+            CASE(OP_CMP_JMP): {
                 uint16_t offset = READ_SHORT();
-                Value a = pop(vm);
-                if (!vm->fallThrough && !valuesEqual(peek(vm,0), a)) {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                Value a = POP();
+                if (!vm->fallThrough && !valuesEqual(PEEK(0), a)) {
                     ip += offset;
                 } else {
-                    pop(vm); // switch expression.
+                    DROP(); // switch expression.
                     vm->fallThrough = false;
                 }
-            } break;
-            case OP_CMP_JMP_FALL: {
+            } DISPATCH();
+            CASE(OP_CMP_JMP_FALL): {
                 uint16_t offset = READ_SHORT();
-                Value a = pop(vm);
-                if (!vm->fallThrough && !valuesEqual(peek(vm,0), a)) {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                Value a = POP();
+                if (!vm->fallThrough && !valuesEqual(PEEK(0), a)) {
                     ip += offset;
                 } else {
-                    pop(vm); // switch expression.
+                    DROP(); // switch expression.
                     vm->fallThrough = true;
                 }
-            } break;
-            case OP_ENUM: {
+            } DISPATCH();
+            CASE(OP_ENUM): {
+                STORE_SP();
                 ObjEnum *enumObj = newEnum(vm, READ_STRING());
-                push(vm, OBJ_VAL(enumObj));
-            } break;
-            case OP_ENUM_SET_VALUE: {
-                Value value = peek(vm, 0);
-                ObjEnum *enumObj = AS_ENUM(peek(vm, 1));
-
+                PUSH(OBJ_VAL(enumObj));
+            } DISPATCH();
+            CASE(OP_ENUM_SET_VALUE): {
+                FLATTEN(PEEK(0));
+                Value value = PEEK(0);
+                ObjEnum *enumObj = AS_ENUM(PEEK(1));
+
+                STORE_SP();
                 tableSet(vm, &enumObj->values, READ_STRING(), value, ILEX_READ_ONLY);
-                pop(vm);
-            } break;
-            case OP_USE: {
+                DROP();
+            } DISPATCH();
+            CASE(OP_USE): {
                 ObjString *filename = READ_STRING();
                 Value scriptVal;
                 
                 if (tableGet(&vm->scripts, filename, &scriptVal)) {
                     vm->lastScript = AS_SCRIPT(scriptVal);
-                    push(vm, NULL_VAL);
-                    break;
+                    PUSH(NULL_VAL);
+                    DISPATCH();
                 }
 
                 char filenameStr[1024];
+                if (filename->len + 6 > (int)sizeof(filenameStr)) {
+                    STORE_FRAME();
+                    runtimeError(vm, "Could not open file '%s'.", filename->str);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 memcpy(filenameStr, filename->str, filename->len);
                 filenameStr[filename->len] = '\0';
                 size_t len = strlen(filenameStr);
 
-                if (strcmp(filenameStr + len - 5, ".ilex") != 0) {
+                if (len < 5 || strcmp(filenameStr + len - 5, ".ilex") != 0) {
                     strncat(filenameStr, ".ilex", 5);
                     len += 5;
                 }
 
                 char path[I_MAX_PATH];
                 if (!resolvePath(frame->closure->function->script->path->str, filenameStr, path)) {
-                    frame->ip = ip;
-                    runtimeError(vm, "Coule not open file '%s'.", filenameStr);
+                    STORE_FRAME();
+                    runtimeError(vm, "Could not open file '%s'.", filenameStr);
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 const size_t pathLen = strlen(path);
                 
-                char *src = readFile(path);
-                if (src == NULL) {
-                    frame->ip = ip;
+                MappedFile src;
+                if (!mapFile(path, &src, true)) {
+                    STORE_FRAME();
                     runtimeError(vm, "Could not open file '%s'.", filenameStr);
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
+                STORE_SP();
                 ObjString *nameStr = copyString(vm, filenameStr, (int)len);
-                push(vm, OBJ_VAL(nameStr));
+                PUSH(OBJ_VAL(nameStr));
+                STORE_SP();
                 ObjScript *script = newScript(vm, nameStr);
                 script->path = dirName(vm, path, pathLen);
+                writeBarrier(vm, (Obj*)script);
                 vm->lastScript = script;
-                pop(vm);
+                DROP();
                 
-                push(vm, OBJ_VAL(script));
-                ObjFunction *function = compile(vm, script, src);
-                pop(vm);
+                PUSH(OBJ_VAL(script));
+                STORE_SP();
+                ObjFunction *function = compileCached(vm, script, path, src.bytes);
+                DROP();
     
-                FREE_ARRAY(vm, char, src, strlen(src));
+                unmapFile(&src);
                 
                 if (function == NULL) {
                     return INTERPRET_COMPILE_ERROR;
                 }
                 
-                push(vm, OBJ_VAL(function));
+                PUSH(OBJ_VAL(function));
+                STORE_SP();
                 ObjClosure *closure = newClosure(vm, function);
-                pop(vm);
-                push (vm, OBJ_VAL(closure));
+                DROP();
+                PUSH(OBJ_VAL(closure));
                 
-                frame->ip = ip;
+                STORE_FRAME();
                 call(vm, closure, 0);
-                frame = &vm->frames[vm->frameCount - 1];
-                ip = frame->ip;
-            } break;
-            case OP_USE_VAR: {
-                push(vm, OBJ_VAL(vm->lastScript));
-            } break;
-            case OP_USE_VAR_FROM: {
+                LOAD_FRAME();
+                LOAD_SP();
+            } DISPATCH();
+            CASE(OP_USE_VAR): {
+                PUSH(OBJ_VAL(vm->lastScript));
+            } DISPATCH();
+            CASE(OP_USE_VAR_FROM): {
                 const int varCount = READ_BYTE();
 
                 for (int i = 0; i < varCount; ++i) {
                     Value libVar;
                     ObjString *variable = READ_STRING();
 
-                    if (!tableGet(&vm->lastScript->values, variable, &libVar)) {
+                    if (!scriptGet(vm->lastScript, variable, &libVar)) {
                         runtimeError(vm, "OP_USE_VAR_FROM: Undefined variable '%s'.", variable->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
-                    push(vm, libVar);
+                    PUSH(libVar);
                 }
-            } break;
-            case OP_USE_BUILTIN: {
+            } DISPATCH();
+            CASE(OP_USE_BUILTIN): {
                 int idx = READ_BYTE();
                 ObjString *fileName = READ_STRING();
                 Value libVal;
@@ -1624,19 +2414,20 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 // Skip if used already.
                 if (tableGet(&vm->scripts, fileName, &libVal)) {
                     // vm->lastScript = AS_SCRIPT(libVal);
-                    push(vm, libVal);
-                    break;
+                    PUSH(libVal);
+                    DISPATCH();
                 }
 
+                STORE_SP();
                 Value lib = useBuiltInLib(vm, idx);
 
                 if (IS_ERR(lib)) {
                     return INTERPRET_COMPILE_ERROR;
                 }
 
-                push(vm, lib);
-            } break;
-            case OP_USE_BUILTIN_VAR: {
+                PUSH(lib);
+            } DISPATCH();
+            CASE(OP_USE_BUILTIN_VAR): {
                 ObjString *fileName = READ_STRING();
                 int varCount = READ_BYTE();
 
@@ -1646,7 +2437,7 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 if (tableGet(&vm->scripts, fileName, &libVal)) {
                     script = AS_SCRIPT(libVal);
                 } else {
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Unknown error.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -1655,41 +2446,46 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                     Value libVar;
                     ObjString *variable = READ_STRING();
 
-                    if (!tableGet(&script->values, variable, &libVar)) {
-                        frame->ip = ip;
+                    if (!scriptGet(script, variable, &libVar)) {
+                        STORE_FRAME();
                         runtimeError(vm, "'%s' can't be found in library '%s'.", variable->str, script->name->str);
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
-                    push(vm, libVar);
+                    PUSH(libVar);
                 }
-            } break;
-            case OP_USE_END:
+            } DISPATCH();
+            CASE(OP_USE_END):
                 vm->lastScript = frame->closure->function->script;
-                break;
-            case OP_BREAK: break; // lol
-            case OP_NEW_ARRAY: {
+                DISPATCH();
+            CASE(OP_BREAK): DISPATCH(); // lol
+            CASE(OP_NEW_ARRAY): {
                 int count = READ_BYTE();
+                STORE_SP();
                 ObjArray *array = newArray(vm);
-                push(vm, OBJ_VAL(array));
+                PUSH(OBJ_VAL(array));
+                STORE_SP();
                 
                 for (int i = count; i > 0; --i) {
-                    writeValueArray(vm, &array->data, peek(vm, i));
+                    FLATTEN(PEEK(i));
+                    writeValueArray(vm, &array->data, PEEK(i));
                 }
 
 #ifdef DEBUG_MODE
                 vm->stackHeight -= count + 1;
 #endif
-                vm->stackTop -= count + 1;
-                push(vm, OBJ_VAL(array));
-            } break;
-            case OP_INDEX: {
-                Value indexValue = peek(vm, 0);
-                Value receiver = peek(vm, 1);
+                sp -= count + 1;
+                PUSH(OBJ_VAL(array));
+            } DISPATCH();
+            CASE(OP_INDEX): {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                Value indexValue = PEEK(0);
+                Value receiver = PEEK(1);
     
                 if (!IS_OBJ(receiver)) {
                     char *type = valueType(receiver);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Type '%s' is not indexable.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
@@ -1698,13 +2494,13 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 switch (getObjType(receiver)) {
                     case OBJ_ARRAY: {
                         if (!IS_NUMBER(indexValue)) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Array index must be a number.");
                             return INTERPRET_RUNTIME_ERROR;
                         }
         
                         ObjArray *array = AS_ARRAY(receiver);
-                        int idx = AS_NUMBER(indexValue);
+                        int idx = TO_INT(indexValue);
                         int oIdx = idx;
         
                         if (idx < 0) {
@@ -1712,25 +2508,28 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         }
         
                         if (idx >= 0 && idx < array->data.count) {
-                            pop(vm);
-                            pop(vm);
-                            push(vm, array->data.values[idx]);
+                            if (IS_INT(indexValue)) {
+                                QUICKEN(OP_INDEX_ARRAY);
+                            }
+                            DROP();
+                            DROP();
+                            PUSH(array->data.values[idx]);
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Array index '%d' out of bounds.", oIdx);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                     case OBJ_STRING: {
                         if (!IS_NUMBER(indexValue)) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Array index must be a number.");
                             return INTERPRET_RUNTIME_ERROR;
                         }
         
                         ObjString *str = AS_STRING(receiver);
-                        int idx = AS_NUMBER(indexValue);
+                        int idx = TO_INT(indexValue);
                         int oIdx = idx;
         
                         if (idx < 0) {
@@ -1738,13 +2537,14 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         }
         
                         if (idx >= 0 && idx < str->len) {
-                            pop(vm);
-                            pop(vm);
-                            push(vm, OBJ_VAL(copyString(vm, &str->str[idx], 1)));
+                            STORE_SP();
+                            DROP();
+                            DROP();
+                            PUSH(OBJ_VAL(copyString(vm, &str->str[idx], 1)));
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "String index '%d' out of bounds.", oIdx);
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -1752,39 +2552,42 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         ObjMap *map = AS_MAP(receiver);
                         if (!isValidKey(indexValue)) {
                             char *type = valueType(indexValue);
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Expect string or number for key but got '%s'.", type);
                             free(type);
                             return INTERPRET_RUNTIME_ERROR;
                         }
                         
                         Value v;
-                        pop(vm);
-                        pop(vm);
+                        DROP();
+                        DROP();
                         
                         if (mapGet(map, indexValue, &v)) {
-                            push(vm, v);
+                            PUSH(v);
                         } else {
-                            push(vm, NULL_VAL); // Return null if the key doesn't exist.
+                            PUSH(NULL_VAL); // Return null if the key doesn't exist.
                         }
                     } break;
                     default: {
                         char *type = valueType(receiver);
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Type '%s' is not indexable.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                 }
-            } break;
-            case OP_INDEX_ASSIGN: {
-                Value assignValue = peek(vm, 0);
-                Value indexValue = peek(vm, 1);
-                Value receiver = peek(vm, 2);
+            } DISPATCH();
+            CASE(OP_INDEX_ASSIGN): {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                FLATTEN(PEEK(2));
+                Value assignValue = PEEK(0);
+                Value indexValue = PEEK(1);
+                Value receiver = PEEK(2);
     
                 if (!IS_OBJ(receiver)) {
                     char *type = valueType(receiver);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Type '%s' is not indexable.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
@@ -1793,13 +2596,13 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 switch (getObjType(receiver)) {
                     case OBJ_ARRAY: {
                         if (!IS_NUMBER(indexValue)) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Array index must be a number.");
                             return INTERPRET_RUNTIME_ERROR;
                         }
     
                         ObjArray *array = AS_ARRAY(receiver);
-                        int idx = AS_NUMBER(indexValue);
+                        int idx = TO_INT(indexValue);
                         int oIdx = idx;
     
                         if (idx < 0) {
@@ -1808,33 +2611,34 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
     
                         if (idx >= 0 && idx < array->data.count) {
                             array->data.values[idx] = assignValue;
-                            pop(vm);
-                            pop(vm);
-                            pop(vm);
-                            push(vm, NULL_VAL);
+                            writeValueBarrier(vm, (Obj*)array, assignValue);
+                            DROP();
+                            DROP();
+                            DROP();
+                            PUSH(NULL_VAL);
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Array index '%d' out of bounds.", oIdx);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                     case OBJ_STRING: {
                         if (!IS_NUMBER(indexValue)) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Array index must be a number.");
                             return INTERPRET_RUNTIME_ERROR;
                         }
                         
                         if (!IS_STRING(assignValue)) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Assign value must be a string.");
                             return INTERPRET_RUNTIME_ERROR;
                         }
         
                         ObjString *str = AS_STRING(receiver);
                         ObjString *assignStr = AS_STRING(assignValue);
-                        int idx = AS_NUMBER(indexValue);
+                        int idx = TO_INT(indexValue);
                         int oIdx = idx;
         
                         if (idx < 0) {
@@ -1843,14 +2647,14 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
         
                         if (idx >= 0 && idx < str->len) {
                             str->str[idx] = assignStr->str[0];
-                            pop(vm);
-                            pop(vm);
-                            pop(vm);
-                            push(vm, NULL_VAL);
+                            DROP();
+                            DROP();
+                            DROP();
+                            PUSH(NULL_VAL);
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "String index '%d' out of bounds.", oIdx);
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -1858,35 +2662,39 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         ObjMap *map = AS_MAP(receiver);
                         if (!isValidKey(indexValue)) {
                             char *type = valueType(indexValue);
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Expect string or number for key but got '%s'.", type);
                             free(type);
                             return INTERPRET_RUNTIME_ERROR;
                         }
     
+                        STORE_SP();
                         mapSet(vm, map, indexValue, assignValue);
-                        pop(vm);
-                        pop(vm);
-                        pop(vm);
-                        push(vm, NULL_VAL);
+                        DROP();
+                        DROP();
+                        DROP();
+                        PUSH(NULL_VAL);
                     } break;
                     default: {
                         char *type = valueType(receiver);
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Type '%s' is not indexable.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                 }
-            } break;
-            case OP_INDEX_PUSH: {
-                Value pushValue = peek(vm, 0);
-                Value indexValue = peek(vm, 1);
-                Value receiver = peek(vm, 2);
+            } DISPATCH();
+            CASE(OP_INDEX_PUSH): {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                FLATTEN(PEEK(2));
+                Value pushValue = PEEK(0);
+                Value indexValue = PEEK(1);
+                Value receiver = PEEK(2);
     
                 if (!IS_OBJ(receiver)) {
                     char *type = valueType(receiver);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Type '%s' is not indexable.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
@@ -1895,13 +2703,13 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 switch (getObjType(receiver)) {
                     case OBJ_ARRAY: {
                         if (!IS_NUMBER(indexValue)) {
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Array index must be a number.");
                             return INTERPRET_RUNTIME_ERROR;
                         }
             
                         ObjArray *array = AS_ARRAY(receiver);
-                        int idx = AS_NUMBER(indexValue);
+                        int idx = TO_INT(indexValue);
                         int oIdx = idx;
             
                         if (idx < 0) {
@@ -1909,12 +2717,12 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         }
             
                         if (idx >= 0 && idx < array->data.count) {
-                            vm->stackTop[-1] = array->data.values[idx];
-                            push(vm, pushValue);
+                            sp[-1] = array->data.values[idx];
+                            PUSH(pushValue);
                             break;
                         }
     
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Array index '%d' out of bounds.", oIdx);
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -1922,7 +2730,7 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                         ObjMap *map = AS_MAP(receiver);
                         if (!isValidKey(indexValue)) {
                             char *type = valueType(indexValue);
-                            frame->ip = ip;
+                            STORE_FRAME();
                             runtimeError(vm, "Expect string or number for key but got '%s'.", type);
                             free(type);
                             return INTERPRET_RUNTIME_ERROR;
@@ -1933,39 +2741,42 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                             mapValue = NULL_VAL;
                         }
                         
-                        vm->stackTop[-1] = mapValue;
-                        push(vm, pushValue);
+                        sp[-1] = mapValue;
+                        PUSH(pushValue);
                     } break;
                     default: {
                         char *type = valueType(receiver);
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Type '%s' is not indexable.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                 }
-            } break;
-            case OP_SLICE: {
-                Value sliceEndIndex = peek(vm, 0);
-                Value sliceStartIndex = peek(vm, 1);
-                Value receiver = peek(vm, 2);
+            } DISPATCH();
+            CASE(OP_SLICE): {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                FLATTEN(PEEK(2));
+                Value sliceEndIndex = PEEK(0);
+                Value sliceStartIndex = PEEK(1);
+                Value receiver = PEEK(2);
     
                 if (!IS_OBJ(receiver)) {
                     char *type = valueType(receiver);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Type '%s' is not sliceable.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
                 if (!IS_NUMBER(sliceStartIndex) && !IS_ERR(sliceStartIndex)) {
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Slice start index must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 
                 if (!IS_NUMBER(sliceEndIndex) && !IS_ERR(sliceEndIndex)) {
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Slice end index must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -1986,8 +2797,9 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 
                 switch (getObjType(receiver)) {
                     case OBJ_ARRAY: {
+                        STORE_SP();
                         ObjArray *retArray = newArray(vm);
-                        push(vm, OBJ_VAL(retArray));
+                        PUSH(OBJ_VAL(retArray));
                         ObjArray *array = AS_ARRAY(receiver);
                         
                         if (IS_ERR(sliceEndIndex)) {
@@ -2002,11 +2814,12 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                             }
                         }
                         
+                        STORE_SP();
                         for (int i = indexStart; i < indexEnd; ++i) {
                             writeValueArray(vm, &retArray->data, array->data.values[i]);
                         }
                         
-                        pop(vm);
+                        DROP();
                         returnVal = OBJ_VAL(retArray);
                     } break;
                     case OBJ_STRING: {
@@ -2024,6 +2837,7 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                             }
                         }
                         
+                        STORE_SP();
                         if (indexStart > indexEnd) {
                             returnVal = OBJ_VAL(copyString(vm, "", 0));
                         } else {
@@ -2032,26 +2846,28 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                     } break;
                     default: {
                         char *type = valueType(receiver);
-                        frame->ip = ip;
+                        STORE_FRAME();
                         runtimeError(vm, "Type '%s' is not sliceable.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
                 }
     
-                pop(vm);
-                pop(vm);
-                pop(vm);
+                DROP();
+                DROP();
+                DROP();
     
-                push(vm, returnVal);
-            } break;
-            case OP_OPEN_FILE: {
-                Value flag = peek(vm, 0);
-                Value name = peek(vm, 1);
+                PUSH(returnVal);
+            } DISPATCH();
+            CASE(OP_OPEN_FILE): {
+                FLATTEN(PEEK(0));
+                FLATTEN(PEEK(1));
+                Value flag = PEEK(0);
+                Value name = PEEK(1);
                 
                 if (!IS_STRING(flag)) {
                     char *type = valueType(flag);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "File flag must be a string got '%s'.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
@@ -2059,7 +2875,7 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
     
                 if (!IS_STRING(name)) {
                     char *type = valueType(name);
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "File name must be a string got '%s'.", type);
                     free(type);
                     return INTERPRET_RUNTIME_ERROR;
@@ -2068,6 +2884,7 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 ObjString *flagStr = AS_STRING(flag);
                 ObjString *nameStr = AS_STRING(name);
                 
+                STORE_SP();
                 ObjFile *file = newFile(vm);
 #ifdef I_WIN
                 errno_t err = fopen_s(&file->file, nameStr->str, flagStr->str);
@@ -2079,84 +2896,91 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 file->flags = flagStr->str;
                 
                 if (err != 0) {
-                    frame->ip = ip;
+                    STORE_FRAME();
                     runtimeError(vm, "Unable to open file '%s'.", file->path);
                     return INTERPRET_RUNTIME_ERROR;
                 }
     
-                pop(vm);
-                pop(vm);
-                push(vm, OBJ_VAL(file));
-            } break;
-            case OP_CLOSE_FILE: {
+                DROP();
+                DROP();
+                PUSH(OBJ_VAL(file));
+            } DISPATCH();
+            CASE(OP_CLOSE_FILE): {
                 uint16_t slot = READ_SHORT();
-                Value value = frame->slots[slot];
+                Value value = slots[slot];
                 ObjFile *file = AS_FILE(value);
                 fclose(file->file);
                 file->file = NULL;
-            } break;
-            case OP_NEW_MAP: {
+            } DISPATCH();
+            CASE(OP_NEW_MAP): {
                 int count = READ_BYTE();
+                STORE_SP();
                 ObjMap *map = newMap(vm);
-                push(vm, OBJ_VAL(map));
+                PUSH(OBJ_VAL(map));
+                STORE_SP();
                 
                 for (int i = count * 2; i > 0; i -= 2) {
-                    if (!isValidKey(peek(vm, i))) {
-                        char *type = valueType(peek(vm, i));
-                        frame->ip = ip;
+                    if (!isValidKey(PEEK(i))) {
+                        char *type = valueType(PEEK(i));
+                        STORE_FRAME();
                         runtimeError(vm, "Expect string or number for key but got '%s'.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
     
-                    mapSet(vm, map, peek(vm, i), peek(vm, i - 1));
+                    FLATTEN(PEEK(i));
+                    FLATTEN(PEEK(i - 1));
+                    mapSet(vm, map, PEEK(i), PEEK(i - 1));
                 }
 
 #ifdef DEBUG_MODE
                 vm->stackHeight -= count * 2 + 1;
 #endif
-                vm->stackTop -= count * 2 + 1;
-                push(vm, OBJ_VAL(map));
-            } break;
-            case OP_NEW_SET: {
+                sp -= count * 2 + 1;
+                PUSH(OBJ_VAL(map));
+            } DISPATCH();
+            CASE(OP_NEW_SET): {
                 int count = READ_BYTE();
+                STORE_SP();
                 ObjSet *set = newSet(vm);
-                push(vm, OBJ_VAL(set));
+                PUSH(OBJ_VAL(set));
+                STORE_SP();
                 
                 for (int i = count; i > 0; --i) {
-                    if (!isValidKey(peek(vm, i))) {
-                        char *type = valueType(peek(vm, i));
-                        frame->ip = ip;
+                    if (!isValidKey(PEEK(i))) {
+                        char *type = valueType(PEEK(i));
+                        STORE_FRAME();
                         runtimeError(vm, "Expect string or number for value but got '%s'.", type);
                         free(type);
                         return INTERPRET_RUNTIME_ERROR;
                     }
     
-                    setAdd(vm, set, peek(vm, i));
+                    FLATTEN(PEEK(i));
+                    setAdd(vm, set, PEEK(i));
                 }
 
 #ifdef DEBUG_MODE
                 vm->stackHeight -= count + 1;
 #endif
-                vm->stackTop -= count + 1;
-                push(vm, OBJ_VAL(set));
-            } break;
-            case OP_DEFINE_DEFAULT: {
+                sp -= count + 1;
+                PUSH(OBJ_VAL(set));
+            } DISPATCH();
+            CASE(OP_DEFINE_DEFAULT): {
                 int arity = READ_BYTE();
                 int arityDefault = READ_BYTE();
-                int argc = (int)(vm->stackTop - frame->slots - arityDefault - 1);
+                int argc = (int)(sp - slots - arityDefault - 1);
                 
                 Value values[255];
                 int index;
                 
                 for (index = 0; index < arityDefault + argc; ++index) {
-                    values[index] = pop(vm);
+                    values[index] = POP();
                 }
                 
                 --index;
                 
                 for (int i = 0; i < argc; ++i) {
-                    push(vm, values[index - i]);
+                    PUSH(values[index - i]);
                 }
                 
                 // How many default values are required.
@@ -2164,14 +2988,137 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
                 
                 // Push any default values back on to the stack.
                 for (int i = remaining; i > 0; --i) {
-                    push(vm, values[i - 1]);
+                    PUSH(values[i - 1]);
+                }
+            } DISPATCH();
+            CASE(OP_YIELD): {
+                Value value = POP();
+                ObjFiber *fiber = vm->fiber;
+                if (fiber->caller == NULL) {
+                    STORE_FRAME();
+                    runtimeError(vm, "Cannot yield from the main fiber.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // The C code that called into this fiber is still on the C stack and expects it to return.
+                if (frameIndex != -1 && fiber == runFiber) {
+                    STORE_FRAME();
+                    runtimeError(vm, "Cannot yield from a function called by a native function.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                STORE_FRAME();
+                leaveFiber(vm, FIBER_SUSPENDED);
+                if (fiber->resumedByNative) {
+                    *val = value;
+                    return INTERPRET_GOOD;
+                }
+
+                LOAD_SP();
+                PUSH(value);
+                LOAD_FRAME();
+            } DISPATCH();
+            CASE(OP_RESUME): {
+                Value value = POP();
+                Value target = POP();
+                STORE_FRAME();
+                if (!IS_FIBER(target)) {
+                    char *type = valueType(target);
+                    runtimeError(vm, "Can only resume fibers, got '%s'.", type);
+                    free(type);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (!startFiber(vm, AS_FIBER(target), value, false)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                LOAD_SP();
+                LOAD_FRAME();
+            } DISPATCH();
+            CASE(OP_INC_LOCAL): {
+                uint16_t slot = READ_SHORT();
+                if (!NUMBER(slots[slot])) {
+                    STORE_FRAME();
+                    runtimeError(vm, "Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
                 }
-            } break;
+
+                slots[slot] = addNumbers(slots[slot], INT_VAL(1));
+                PUSH(slots[slot]);
+            } DISPATCH();
+            CASE(OP_DEC_LOCAL): {
+                uint16_t slot = READ_SHORT();
+                if (!NUMBER(slots[slot])) {
+                    STORE_FRAME();
+                    runtimeError(vm, "Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                slots[slot] = subtractNumbers(slots[slot], INT_VAL(1));
+                PUSH(slots[slot]);
+            } DISPATCH();
+            CASE(OP_ADD_LOCAL_CONST): {
+                Value a = slots[READ_SHORT()];
+                Value b = READ_CONSTANT();
+                if (NUMBERS(a, b)) {
+                    PUSH(addNumbers(a, b));
+                } else if (IS_STRING(a) && IS_STRING(b)) {
+                    PUSH(a);
+                    PUSH(b);
+                    STORE_SP();
+                    concat(vm);
+                    LOAD_SP();
+                } else {
+                    STORE_FRAME();
+                    runtimeError(vm, "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+            } DISPATCH();
+            CASE(OP_SUB_LOCAL_CONST): {
+                Value a = slots[READ_SHORT()];
+                Value b = READ_CONSTANT();
+                if (NUMBERS(a, b)) {
+                    PUSH(subtractNumbers(a, b));
+                } else {
+                    PUSH(a);
+                    PUSH(b);
+                    BINARY_OP(NUMBER_VAL, -, "-", double);
+                }
+            } DISPATCH();
+            CASE(OP_LT_LOCALS_JMP): LOCAL_CMP_JMP(<, "<", slots[READ_SHORT()]); DISPATCH();
+            CASE(OP_LTEQ_LOCALS_JMP): LOCAL_CMP_JMP(<=, "<=", slots[READ_SHORT()]); DISPATCH();
+            CASE(OP_GR_LOCALS_JMP): LOCAL_CMP_JMP(>, ">", slots[READ_SHORT()]); DISPATCH();
+            CASE(OP_GREQ_LOCALS_JMP): LOCAL_CMP_JMP(>=, ">=", slots[READ_SHORT()]); DISPATCH();
+            CASE(OP_LT_LOCAL_CONST_JMP): LOCAL_CMP_JMP(<, "<", READ_CONSTANT()); DISPATCH();
+            CASE(OP_LTEQ_LOCAL_CONST_JMP): LOCAL_CMP_JMP(<=, "<=", READ_CONSTANT()); DISPATCH();
+            CASE(OP_GR_LOCAL_CONST_JMP): LOCAL_CMP_JMP(>, ">", READ_CONSTANT()); DISPATCH();
+            CASE(OP_GREQ_LOCAL_CONST_JMP): LOCAL_CMP_JMP(>=, ">=", READ_CONSTANT()); DISPATCH();
+            CASE(OP_INDEX_ARRAY): {
+                // Anything the generic instruction would do more than read an element, errors included, is left to it.
+                if (!IS_ARRAY(PEEK(1)) || !IS_INT(PEEK(0))) {
+                    DEOPTIMIZE(OP_INDEX);
+                }
+
+                const ObjArray *array = AS_ARRAY(PEEK(1));
+                int idx = AS_INT(PEEK(0));
+                if (idx < 0) {
+                    idx = array->data.count + idx;
+                }
+
+                if (idx < 0 || idx >= array->data.count) {
+                    DEOPTIMIZE(OP_INDEX);
+                }
+                DROP();
+                sp[-1] = array->data.values[idx];
+            } DISPATCH();
+#ifndef ILEX_COMPUTED_GOTO
             default: {
-                frame->ip = ip;
+                STORE_FRAME();
                 runtimeError(vm, "Unknown OP.");
                 return INTERPRET_RUNTIME_ERROR;
             }
+#endif
         }
     }
 
@@ -2179,10 +3126,33 @@ InterpretResult run(VM *vm, int frameIndex, Value *val) {
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
+#undef PUSH
+#undef POP
+#undef DROP
+#undef PEEK
+#undef STORE_SP
+#undef LOAD_SP
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef FLATTEN
 #undef BINARY_OP
+#undef INT_BINARY_OP
+#undef NUMBER_OP
+#undef NUMBER
+#undef NUMBERS
+#undef INTS
+#undef LIKELY
+#undef JIT_ENTER
+#undef QUICKEN
+#undef DEOPTIMIZE
+#undef LOCAL_CMP_JMP
+#undef TRACE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
 }
 
-InterpretResult interpret(VM *vm, const char *scriptName, const char *source) {
+static ObjScript *newMainScript(VM *vm, const char *scriptName) {
     ObjString *name = copyString(vm, scriptName, (int)strlen(scriptName));
     push(vm, OBJ_VAL(name));
     ObjScript *script = newScript(vm, name);
@@ -2190,13 +3160,13 @@ InterpretResult interpret(VM *vm, const char *scriptName, const char *source) {
     
     push(vm, OBJ_VAL(script));
     script->path = getDir(vm, scriptName);
+    writeBarrier(vm, (Obj*)script);
     pop(vm);
-    
-    ObjFunction *function = compile(vm, script, source);
-    if (function == NULL) {
-        return INTERPRET_COMPILE_ERROR;
-    }
 
+    return script;
+}
+
+static InterpretResult runMain(VM *vm, ObjFunction *function) {
     push(vm, OBJ_VAL(function));
     ObjClosure *closure = newClosure(vm, function);
     pop(vm);
@@ -2206,10 +3176,46 @@ InterpretResult interpret(VM *vm, const char *scriptName, const char *source) {
     return run(vm, -1, NULL);
 }
 
+InterpretResult interpret(VM *vm, const char *scriptName, const char *source) {
+    ObjScript *script = newMainScript(vm, scriptName);
+    ObjFunction *function = compileCached(vm, script, scriptName, source);
+    if (function == NULL) {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return runMain(vm, function);
+}
+
+IlexProgram *compileProgram(VM *vm, const char *scriptName, const char *source) {
+    ObjScript *script = newMainScript(vm, scriptName);
+    push(vm, OBJ_VAL(script));
+    IlexProgram *program = newProgram(vm, script, source);
+    pop(vm);
+
+    return program;
+}
+
+InterpretResult runProgram(VM *vm, const IlexProgram *program) {
+    ObjScript *script = newMainScript(vm, program->name);
+    push(vm, OBJ_VAL(script));
+    ObjFunction *function = loadProgram(vm, script, program);
+    pop(vm);
+    if (function == NULL) {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return runMain(vm, function);
+}
+
 void runFile(VM *vm, const char *path) {
-    char *source = readFile(path);
-    const InterpretResult res = interpret(vm, path, source);
-    free(source);
+    MappedFile source;
+    if (!mapFile(path, &source, true)) {
+        fprintf(stderr, "Could not open file '%s'.\n", path);
+        exit(74);
+    }
+    
+    const InterpretResult res = interpret(vm, path, source.bytes);
+    unmapFile(&source);
     
     switch (res) {
         case INTERPRET_COMPILE_ERROR: exit(99);
@@ -10,9 +10,25 @@
 #include "table.h"
 #include "value.h"
 #include "compiler.h"
+#include "memory.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// The frames and the value stack start out small and grow as calls get deeper, up to the VM's frame limit, see
+// setFrameLimit(). Define FRAMES_MAX to change the default limit.
+#ifndef FRAMES_MAX
+#   define FRAMES_MAX 65536
+#endif
+#define FRAMES_INITIAL 64
+#define STACK_INITIAL (4 * UINT8_COUNT)
+#define FIBER_FRAMES_INITIAL 8
+
+// Frames shown in an error's stack trace, the outer ones are only counted.
+#define TRACE_FRAMES_MAX 32
+
+// Use labels as values for the dispatch loop in run() when the compiler supports them. Define
+// ILEX_NO_COMPUTED_GOTO to force the portable switch based loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(ILEX_NO_COMPUTED_GOTO)
+#   define ILEX_COMPUTED_GOTO
+#endif
 
 typedef struct {
     ObjClosure *closure;
@@ -20,27 +36,80 @@ typedef struct {
     Value *slots;
 } CallFrame;
 
+typedef enum {
+    FIBER_NEW,
+    FIBER_SUSPENDED,
+    FIBER_RUNNING, // The running fiber and the fibers that resumed it.
+    FIBER_DONE,
+} FiberState;
+
+// A fiber is a value stack and call frames of its own that can be suspended with yield and picked up again with resume.
+// The running fiber's stack and frames are the VM's, a fiber only holds them while it isn't running. The main fiber has
+// no closure and runs the scripts.
+struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    ObjClosure *closure;
+    ObjFiber *caller; // The fiber that resumed this one and gets control back when it yields or returns.
+    bool resumedByNative; // By resumeFiber(), run() returns to it instead of carrying on with the caller.
+    CallFrame *frames;
+    int frameCount;
+    int frameCapacity;
+    Value *stack;
+    Value *stackTop;
+    int stackCapacity;
+    int retiredCount;
+    Value **retiredStacks;
+    ObjUpvalue *openUpvalues;
+};
+
 typedef struct {
     char *name;
     BuiltInLib lib;
 } BuiltInLibs;
 
+typedef enum {
+    GC_IDLE,
+    GC_MARKING,
+    GC_CLEARING, // Removing the strings that weren't marked from the string table.
+    GC_SWEEPING,
+} GcPhase;
+
+typedef struct Arena Arena;
+typedef struct Sweeper Sweeper;
+typedef struct CacheFile CacheFile;
+typedef struct Worker Worker;
+typedef struct EventLoop EventLoop;
+
 struct VM_ {
     Compiler *compiler;
-    CallFrame frames[FRAMES_MAX];
+    CallFrame *frames;
     int frameCount;
+    int frameCapacity;
+    int frameLimit;
     Value *stack;
     Value *stackTop;
+    int stackCapacity;
+    int retiredCount;
+    Value **retiredStacks; // Stacks that were outgrown, see growStack().
+    ObjFiber *fiber;       // The fiber the frames and the stack above belong to.
 #ifdef DEBUG_MODE
     int stackHeight;
 #endif
-    Table globals;
+    Table globals; // Global name -> slot in globalValues, resolved by the compiler.
+    ValueArray globalValues;
     Table consts;
     Table strings;
     ObjString *initString;
+    ObjString *toStringString;
     ObjUpvalue *openUpvalues;
 
     Table scripts;
+    uint64_t randomState;
+    unsigned int randomSeed; // See lib_random.c.
+    Worker *worker;          // The thread this VM was spawned for, see lib_thread.c.
+    EventLoop *eventLoop;    // Tasks waiting on timers and descriptors, see lib_async.c.
+    CacheFile *cacheFiles; // Mapped cache files whose code runs in place, see bytecode.c.
     ObjScript *lastScript; // Used for 'from'.
     Table stringFunctions;
     Table arrayFunctions;
@@ -48,15 +117,41 @@ struct VM_ {
     Table mapFunctions;
     Table setFunctions;
     Table enumFunctions;
+    Table fiberFunctions;
     Table numberFunctions;
 
     size_t bytesAllocated;
     size_t nextGC;
+    size_t nextYoungGC;
     size_t gcRuns;
-    Obj *objects;
+    size_t youngGcRuns;
+    Arena *arenas[POOL_CLASS_COUNT];  // Every object arena of each size class, newest first.
+    Arena *unswept[POOL_CLASS_COUNT]; // Arenas a full collection still has to sweep.
+    Obj *freeBlocks[POOL_CLASS_COUNT];
+    int youngCount;
+    int youngCapacity;
+    Obj **youngObjects; // Objects allocated since the last collection.
+    bool collectingYoung;
+    GcPhase gcPhase;
+    double gcMaxPause; // Longest single collection or collection step, in seconds.
+    int rememberedCount;
+    int rememberedCapacity;
+    Obj **remembered; // Old objects that might point to young ones.
+    void *pools[POOL_CLASS_COUNT]; // Free list for each size class, see reallocatePooled().
+    void *slabs;                   // Every slab, linked through their first word.
+    char *slabNext;
+    char *slabEnd;
+    Sweeper *sweeper; // Background threads freeing dead buffers, see ILEX_BACKGROUND_SWEEP.
+    int deadCount;
+    int deadCapacity;
+    void **deadBuffers;
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
+    Obj *sliced;       // Array, map or set being traced a step at a time, see traceSlice().
+    int sliceNext;     // Its slots below this are still to be traced.
+    int clearNext;     // Next string table entry to look at while clearing.
+    int clearCapacity; // The string table's capacity when clearing started.
     ObjString *scriptName;
 
     int fnCount;
@@ -64,6 +159,8 @@ struct VM_ {
 
     bool envLoaded;
     bool fallThrough;
+    bool optimize;    // Set with -O, functions go through optimizeChunk() as they are compiled.
+    int jitThreshold; // Set with -J, see jit.c. 0 when the JIT is off.
 
     BuiltInLibs *libs;
     int libCount;
@@ -93,6 +190,7 @@ void push(VM *vm, Value v);
 Value pop(VM *vm);
 
 Value callFromScript(VM *vm, ObjClosure *closure, int argc, const Value *args);
+Value resumeFiber(VM *vm, ObjFiber *fiber, Value value);
 
 InterpretResult run(VM *vm, int frameIndex, Value *value);
 